@@ -7,13 +7,20 @@
 #include <vector>
 #include <thread>
 #include <functional>
+#include <algorithm>
 
 #include "blackwidow/blackwidow.h"
+#include "rocksdb/comparator.h"
+#include "src/custom_comparator.h"
+#include "src/base_filter.h"
+#include "src/zsets_data_key_format.h"
+#include "src/lru_cache.h"
 
 const int KEYLENGTH = 1024 * 10;
 const int VALUELENGTH = 1024 * 10;
 const int THREADNUM = 20;
 const int HASH_TABLE_FIELD_SIZE = 10000000;
+const int ZSET_MEMBER_SIZE = 1000000;
 
 using namespace blackwidow;
 using namespace std::chrono;
@@ -23,10 +30,10 @@ static const std::string value(VALUELENGTH, 'a');
 
 void BenchSet() {
   printf("====== Set ======\n");
-  blackwidow::Options options;
-  options.create_if_missing = true;
+  blackwidow::BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
   blackwidow::BlackWidow db;
-  blackwidow::Status s = db.Open(options, "./db");
+  blackwidow::Status s = db.Open(bw_options, "./db");
 
   if (!s.ok()) {
     printf("Open db failed, error: %s\n", s.ToString().c_str());
@@ -77,10 +84,10 @@ void BenchSet() {
 
 void BenchHGetall() {
   printf("====== HGetall ======\n");
-  blackwidow::Options options;
-  options.create_if_missing = true;
+  blackwidow::BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
   blackwidow::BlackWidow db;
-  blackwidow::Status s = db.Open(options, "./db");
+  blackwidow::Status s = db.Open(bw_options, "./db");
 
   if (!s.ok()) {
     printf("Open db failed, error: %s\n", s.ToString().c_str());
@@ -88,10 +95,10 @@ void BenchHGetall() {
   }
 
   int32_t ret = 0;
-  BlackWidow::FieldValue fv;
+  FieldValue fv;
   std::vector<std::string> fields;
-  std::vector<BlackWidow::FieldValue> fvs_in;
-  std::vector<BlackWidow::FieldValue> fvs_out;
+  std::vector<FieldValue> fvs_in;
+  std::vector<FieldValue> fvs_out;
 
   // 1. Create the hash table then insert hash table 10000 field
   // 2. HGetall the hash table 10000 field (statistics cost time)
@@ -124,8 +131,8 @@ void BenchHGetall() {
     fvs_in.push_back(fv);
   }
   db.HMSet("HGETALL_KEY2", fvs_in);
-  std::vector<Slice> del_keys({"HGETALL_KEY2"});
-  std::map<BlackWidow::DataType, Status> type_status;
+  std::vector<std::string> del_keys({"HGETALL_KEY2"});
+  std::map<DataType, Status> type_status;
   db.Del(del_keys, &type_status);
   fvs_in.clear();
   for (size_t i = 0; i < 10000; ++i) {
@@ -172,10 +179,10 @@ void BenchHGetall() {
 
 void BenchScan() {
   printf("====== Scan ======\n");
-  blackwidow::Options options;
-  options.create_if_missing = true;
+  blackwidow::BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
   blackwidow::BlackWidow db;
-  blackwidow::Status s = db.Open(options, "./db");
+  blackwidow::Status s = db.Open(bw_options, "./db");
 
   if (!s.ok()) {
     printf("Open db failed, error: %s\n", s.ToString().c_str());
@@ -207,7 +214,7 @@ void BenchScan() {
   // Scan 100000
   std::vector<std::string> keys;
   start = system_clock::now();
-  db.Scan(0, "*", 100000, &keys);
+  db.Scan(DataType::kStrings, 0, "*", 100000, &keys);
   end = system_clock::now();
   elapsed_seconds = end - start;
   cost = duration_cast<seconds>(elapsed_seconds).count();
@@ -217,7 +224,7 @@ void BenchScan() {
   // Scan 10000000
   keys.clear();
   start = system_clock::now();
-  db.Scan(0, "*", kv_num, &keys);
+  db.Scan(DataType::kStrings, 0, "*", kv_num, &keys);
   end = system_clock::now();
   elapsed_seconds = end - start;
   cost = duration_cast<seconds>(elapsed_seconds).count();
@@ -226,13 +233,420 @@ void BenchScan() {
 }
 
 
+void BenchZAdd() {
+  printf("====== ZAdd ======\n");
+  blackwidow::BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  blackwidow::BlackWidow db;
+  blackwidow::Status s = db.Open(bw_options, "./db");
+
+  if (!s.ok()) {
+    printf("Open db failed, error: %s\n", s.ToString().c_str());
+    return;
+  }
+
+  // Every thread adds members with random scores one by one into its own
+  // zset, so each insert lands somewhere in the middle of the score cf
+  std::vector<std::thread> jobs;
+  size_t member_num = 100000;
+  auto start = system_clock::now();
+  for (size_t i = 0; i < THREADNUM; ++i) {
+    jobs.emplace_back([&db](size_t thread_id, size_t member_num) {
+      int32_t ret = 0;
+      std::string zset_key = "ZADD_KEY_" + std::to_string(thread_id);
+      std::vector<ScoreMember> score_members(1);
+      for (size_t j = 0; j < member_num; ++j) {
+        score_members[0].score = static_cast<double>(rand() % 2000000) - 1000000;
+        score_members[0].member = "member_" + std::to_string(j);
+        db.ZAdd(zset_key, score_members, &ret);
+      }
+    }, i, member_num);
+  }
+
+  for (auto& job : jobs) {
+    job.join();
+  }
+  auto end = system_clock::now();
+  duration<double> elapsed_seconds = end - start;
+  auto cost = duration_cast<milliseconds>(elapsed_seconds).count();
+  std::cout << "Test case 1, ZAdd " << THREADNUM * member_num << " Cost: "
+    << cost << "ms QPS: " << (THREADNUM * member_num) * 1000 / (cost + 1)
+    << std::endl;
+}
+
+void BenchZRangebyscore() {
+  printf("====== ZRangebyscore ======\n");
+  blackwidow::BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  blackwidow::BlackWidow db;
+  blackwidow::Status s = db.Open(bw_options, "./db");
+
+  if (!s.ok()) {
+    printf("Open db failed, error: %s\n", s.ToString().c_str());
+    return;
+  }
+
+  int32_t ret = 0;
+  std::vector<ScoreMember> score_members;
+  for (size_t i = 0; i < ZSET_MEMBER_SIZE; ++i) {
+    score_members.push_back({static_cast<double>(i),
+                             "member_" + std::to_string(i)});
+  }
+  db.ZAdd("ZRANGEBYSCORE_KEY", score_members, &ret);
+  db.Compact(DataType::kZSets);
+
+  // 10000 windows of 100 members at random positions
+  size_t query_num = 10000;
+  std::vector<ScoreMember> score_members_out;
+  auto start = system_clock::now();
+  for (size_t i = 0; i < query_num; ++i) {
+    double min = rand() % (ZSET_MEMBER_SIZE - 100);
+    score_members_out.clear();
+    db.ZRangebyscore("ZRANGEBYSCORE_KEY", min, min + 99,
+                     true, true, &score_members_out);
+  }
+  auto end = system_clock::now();
+  duration<double> elapsed_seconds = end - start;
+  auto cost = duration_cast<microseconds>(elapsed_seconds).count();
+  std::cout << "Test case 1, ZRangebyscore " << query_num
+    << " queries over " << ZSET_MEMBER_SIZE << " members, avg latency: "
+    << cost / query_num << "us" << std::endl;
+}
+
+// Sort the same score keys with the format 1 comparator and with the
+// bytewise comparator format 2 keys rely on
+void BenchZSetsScoreComparator() {
+  printf("====== ZSets Score Comparator ======\n");
+  ZSetsScoreKeyComparatorImpl v1_comparator;
+  const rocksdb::Comparator* bytewise = rocksdb::BytewiseComparator();
+
+  std::vector<std::string> v1_keys;
+  std::vector<std::string> v2_keys;
+  for (size_t i = 0; i < ZSET_MEMBER_SIZE; ++i) {
+    double score = static_cast<double>(rand() % 2000000) - 1000000;
+    std::string member = "member_" + std::to_string(i);
+    ZSetsScoreKey score_key("ZSET_COMPARATOR_KEY", 1, score, member);
+    v2_keys.push_back(score_key.Encode().ToString());
+
+    // Format 1 stores the raw double bits instead
+    std::string v1_key = v2_keys.back();
+    size_t score_pos = DecodeFixed32(v1_key.data()) + 2 * sizeof(int32_t);
+    const void* ptr_score = reinterpret_cast<const void*>(&score);
+    EncodeFixed64(&v1_key[score_pos],
+                  *reinterpret_cast<const uint64_t*>(ptr_score));
+    v1_keys.push_back(v1_key);
+  }
+
+  auto start = system_clock::now();
+  std::sort(v1_keys.begin(), v1_keys.end(),
+            [&v1_comparator](const std::string& a, const std::string& b) {
+              return v1_comparator.Compare(a, b) < 0;
+            });
+  auto end = system_clock::now();
+  duration<double> elapsed_seconds = end - start;
+  auto cost = duration_cast<milliseconds>(elapsed_seconds).count();
+  std::cout << "Test case 1, ZSetsScoreKeyComparator sort "
+    << ZSET_MEMBER_SIZE << " keys Cost: " << cost << "ms" << std::endl;
+
+  start = system_clock::now();
+  std::sort(v2_keys.begin(), v2_keys.end(),
+            [bytewise](const std::string& a, const std::string& b) {
+              return bytewise->Compare(a, b) < 0;
+            });
+  end = system_clock::now();
+  elapsed_seconds = end - start;
+  cost = duration_cast<milliseconds>(elapsed_seconds).count();
+  std::cout << "Test case 2, BytewiseComparator sort "
+    << ZSET_MEMBER_SIZE << " keys Cost: " << cost << "ms" << std::endl;
+}
+
+// PFCOUNT over 10 dense HyperLogLogs, which merges all their registers
+void BenchPfCount() {
+  printf("====== PfCount ======\n");
+  blackwidow::BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  blackwidow::BlackWidow db;
+  blackwidow::Status s = db.Open(bw_options, "./db");
+
+  if (!s.ok()) {
+    printf("Open db failed, error: %s\n", s.ToString().c_str());
+    return;
+  }
+
+  bool update;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < 10; ++i) {
+    keys.push_back("PFCOUNT_KEY_" + std::to_string(i));
+    std::vector<std::string> values;
+    for (size_t j = 0; j < 100000; ++j) {
+      values.push_back("element_" + std::to_string(i) + "_" + std::to_string(j));
+      if (values.size() == 200) {
+        db.PfAdd(keys.back(), values, &update);
+        values.clear();
+      }
+    }
+  }
+
+  size_t query_num = 10000;
+  int64_t result = 0;
+  auto start = system_clock::now();
+  for (size_t i = 0; i < query_num; ++i) {
+    db.PfCount(keys, &result);
+  }
+  auto end = system_clock::now();
+  duration<double> elapsed_seconds = end - start;
+  auto cost = duration_cast<microseconds>(elapsed_seconds).count();
+  std::cout << "Test case 1, PfCount " << query_num << " queries over "
+    << keys.size() << " keys, result: " << result << ", avg latency: "
+    << cost / query_num << "us" << std::endl;
+}
+
+
+// EXISTS and DEL of string keys, which probe every type without the key
+// type directory and only the strings with it
+void BenchDelExists() {
+  printf("====== Del/Exists ======\n");
+  for (bool directory : {false, true}) {
+    blackwidow::BlackwidowOptions bw_options;
+    bw_options.options.create_if_missing = true;
+    bw_options.enable_key_type_directory = directory;
+    blackwidow::BlackWidow db;
+    blackwidow::Status s = db.Open(bw_options, "./db");
+
+    if (!s.ok()) {
+      printf("Open db failed, error: %s\n", s.ToString().c_str());
+      return;
+    }
+
+    size_t kv_num = 100000;
+    std::vector<std::string> keys;
+    for (size_t i = 0; i < kv_num; ++i) {
+      keys.push_back("DEL_EXISTS_KEY_" + std::to_string(i));
+      db.Set(keys.back(), "VALUE");
+    }
+
+    std::map<DataType, Status> type_status;
+    auto start = system_clock::now();
+    for (const auto& key : keys) {
+      db.Exists({key}, &type_status);
+    }
+    auto end = system_clock::now();
+    auto exists_cost = duration_cast<microseconds>(end - start).count();
+
+    start = system_clock::now();
+    for (const auto& key : keys) {
+      db.Del({key}, &type_status);
+    }
+    end = system_clock::now();
+    auto del_cost = duration_cast<microseconds>(end - start).count();
+
+    std::cout << "Test case " << (directory ? 2 : 1) << ", "
+      << (directory ? "with" : "without") << " key type directory, "
+      << "Exists avg latency: " << static_cast<double>(exists_cost) / kv_num
+      << "us, Del avg latency: " << static_cast<double>(del_cost) / kv_num
+      << "us" << std::endl;
+  }
+}
+
+void BenchShards() {
+  printf("====== Shards ======\n");
+  for (size_t shards : {1, 4}) {
+    blackwidow::BlackwidowOptions bw_options;
+    bw_options.options.create_if_missing = true;
+    bw_options.shards = shards;
+    blackwidow::BlackWidow db;
+    blackwidow::Status s = db.Open(bw_options,
+        "./db_shards_" + std::to_string(shards));
+
+    if (!s.ok()) {
+      printf("Open db failed, error: %s\n", s.ToString().c_str());
+      return;
+    }
+
+    size_t kv_num = 100000;
+    for (size_t thread_num : {1, 2, 4, 8, 16}) {
+      std::vector<std::thread> jobs;
+      auto start = system_clock::now();
+      for (size_t i = 0; i < thread_num; ++i) {
+        jobs.emplace_back([&db, i](size_t kv_num) {
+          std::string prefix = "SHARDS_KEY_" + std::to_string(i) + "_";
+          for (size_t j = 0; j < kv_num; ++j) {
+            db.Set(prefix + std::to_string(j), "VALUE");
+          }
+        }, kv_num / thread_num);
+      }
+
+      for (auto& job : jobs) {
+        job.join();
+      }
+      auto end = system_clock::now();
+      auto cost = duration_cast<microseconds>(end - start).count();
+      std::cout << "Test case " << (shards == 1 ? 1 : 2) << ", " << shards
+        << " shards, " << thread_num << " threads, Set " << kv_num
+        << " QPS: " << kv_num * 1000000 / std::max<int64_t>(cost, 1)
+        << std::endl;
+    }
+  }
+}
+
+void BenchDataFilter() {
+  printf("====== Data Filter ======\n");
+  rocksdb::Options options;
+  options.create_if_missing = true;
+  std::string db_path = "./db_data_filter";
+  rocksdb::DB* db;
+  rocksdb::Status s = rocksdb::DB::Open(options, db_path, &db);
+  if (s.ok()) {
+    rocksdb::ColumnFamilyHandle* cf;
+    s = db->CreateColumnFamily(rocksdb::ColumnFamilyOptions(),
+        "data_cf", &cf);
+    delete cf;
+    delete db;
+  }
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+      "data_cf", rocksdb::ColumnFamilyOptions()));
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  s = rocksdb::DB::Open(options, db_path, column_families, &handles, &db);
+  if (!s.ok()) {
+    printf("Open db failed, error: %s\n", s.ToString().c_str());
+    return;
+  }
+
+  // Many small hashes, one in every two of them deleted
+  size_t key_num = 1000000;
+  size_t field_num = 4;
+  char buf[32];
+  std::vector<std::string> keys;
+  HashesMetaValue meta_value(std::string(4, '\0'));
+  int32_t version = meta_value.UpdateVersion();
+  for (size_t i = 0; i < key_num; ++i) {
+    snprintf(buf, sizeof(buf), "DATA_FILTER_KEY_%08zu", i);
+    keys.push_back(buf);
+    if (i % 2 == 0) {
+      db->Put(rocksdb::WriteOptions(), handles[0], buf, meta_value.Encode());
+    }
+  }
+  db->Flush(rocksdb::FlushOptions(), handles[0]);
+
+  // Test case 1 looks up the meta value of every key with a Get, as the
+  // data filters did before, test case 2 runs the data filter
+  for (int32_t test_case : {1, 2}) {
+    std::string meta;
+    std::string new_value;
+    bool value_changed;
+    bool found = false;
+    size_t dropped = 0;
+    auto start = system_clock::now();
+    HashesDataFilter filter(db, &handles);
+    for (const auto& key : keys) {
+      for (size_t j = 0; j < field_num; ++j) {
+        HashesDataKey data_key(key, version, "field_" + std::to_string(j));
+        if (test_case == 1) {
+          if (j == 0) {
+            found = db->Get(rocksdb::ReadOptions(), handles[0],
+                            key, &meta).ok();
+          }
+          if (!found) {
+            dropped++;
+          }
+        } else if (filter.Filter(0, data_key.Encode(), "value",
+              &new_value, &value_changed)) {
+          dropped++;
+        }
+      }
+    }
+    auto end = system_clock::now();
+    auto cost = duration_cast<microseconds>(end - start).count();
+    std::cout << "Test case " << test_case << ", "
+      << (test_case == 1 ? "Get per key" : "data filter") << ", "
+      << key_num * field_num << " records, dropped " << dropped
+      << ", records per second: "
+      << key_num * field_num * 1000000 / std::max<int64_t>(cost, 1)
+      << std::endl;
+  }
+
+  for (auto handle : handles) {
+    delete handle;
+  }
+  delete db;
+}
+
+// The statistics store pattern: look a key up, then insert the new count
+template <typename Cache>
+static double RunLRUCache(Cache* cache, size_t thread_num,
+                          const std::vector<std::string>& keys,
+                          size_t ops_per_thread) {
+  std::vector<std::thread> threads;
+  auto start = system_clock::now();
+  for (size_t t = 0; t < thread_num; ++t) {
+    threads.push_back(std::thread([&, t]() {
+      size_t total = 0;
+      size_t idx = t * 7919;
+      for (size_t i = 0; i < ops_per_thread; ++i) {
+        idx = (idx * 1103515245 + 12345) % keys.size();
+        cache->Lookup(keys[idx], &total);
+        cache->Insert(keys[idx], total + 1);
+      }
+    }));
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  auto end = system_clock::now();
+  auto cost = duration_cast<microseconds>(end - start).count();
+  return static_cast<double>(thread_num * ops_per_thread) * 1000000
+    / (cost ? cost : 1);
+}
+
+void BenchLRUCache() {
+  printf("====== LRUCache ======\n");
+  size_t key_num = 100000;
+  size_t ops_per_thread = 1000000;
+  std::vector<std::string> keys;
+  for (size_t i = 0; i < key_num; ++i) {
+    keys.push_back("LRU_CACHE_KEY_" + std::to_string(i));
+  }
+
+  for (size_t thread_num : {1, 4, 16}) {
+    LRUCache<std::string, size_t> single;
+    single.SetCapacity(key_num / 2);
+    ShardedLRUCache<std::string, size_t> sharded(16, false);
+    sharded.SetCapacity(key_num / 2);
+    ShardedLRUCache<std::string, size_t> clock(16, true);
+    clock.SetCapacity(key_num / 2);
+
+    std::cout << thread_num << " threads, ops/s: LRUCache "
+      << RunLRUCache(&single, thread_num, keys, ops_per_thread)
+      << ", ShardedLRUCache "
+      << RunLRUCache(&sharded, thread_num, keys, ops_per_thread)
+      << ", ShardedLRUCache approximate "
+      << RunLRUCache(&clock, thread_num, keys, ops_per_thread)
+      << std::endl;
+  }
+}
+
 int main(int argc, char** argv) {
   // keys
   BenchSet();
+  BenchDelExists();
+  BenchShards();
+  BenchLRUCache();
 
   // hashes
   BenchHGetall();
+  BenchDataFilter();
 
   // Iterator
   BenchScan();
+
+  // zsets
+  BenchZAdd();
+  BenchZRangebyscore();
+  BenchZSetsScoreComparator();
+
+  // hyperloglog
+  BenchPfCount();
 }
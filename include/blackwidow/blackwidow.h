@@ -11,6 +11,7 @@
 #include <list>
 #include <queue>
 #include <vector>
+#include <functional>
 #include <unistd.h>
 
 #include "rocksdb/status.h"
@@ -53,6 +54,11 @@ class RedisSets;
 class RedisLists;
 class RedisZSets;
 class HyperLogLog;
+class KeyTypeDirectory;
+class FanoutPool;
+class Redis;
+struct ScanCursor;
+class BGTaskQueue;
 
 template <typename T1, typename T2>
 class LRUCache;
@@ -65,11 +71,107 @@ struct BlackwidowOptions {
   size_t statistics_max_size;
   size_t small_compaction_threshold;
 
+  // Sample one in this many reads that iterate the members of a key, and
+  // compact the key once a sampled read had to skip at least
+  // read_skip_compaction_threshold deleted or overwritten entries to get
+  // to the live ones. 0 disables the sampling.
+  size_t read_skip_sample_interval;
+  size_t read_skip_compaction_threshold;
+
+  // Mark an SST file of the member data for compaction once some
+  // deletion_compaction_window consecutive entries of it hold at least
+  // deletion_compaction_trigger deletes, so that RocksDB drops the
+  // tombstones of drained keys before reads have to skip them.
+  // 0 disables it.
+  size_t deletion_compaction_window;
+  size_t deletion_compaction_trigger;
+
+  // Del, Expire/Expireat into the past and the writes that replace an
+  // expired hash, set, zset or list drop the members of its old version
+  // with one range tombstone per member CF, instead of leaving them to the
+  // compaction filters, once it held at least this many members.
+  // 0 disables it.
+  size_t reclaim_range_delete_threshold;
+
+  // Memory budget in bytes of the zsets window cache, which keeps the
+  // zsets_window_size lowest and highest ranked members of hot zsets
+  // for ZRange/ZRevrange. 0 disables it.
+  size_t zsets_window_cache_size;
+  int32_t zsets_window_size;
+
+  // ZRemrangebyscore/ZRemrangebyrank/ZRemrangebylex drop the contiguous
+  // part of a removed range with one range tombstone instead of a delete
+  // per member once it holds at least this many members. 0 disables it.
+  size_t zsets_range_delete_threshold;
+
+  // Keep a directory of the types every key holds, in its own db next to
+  // the type dbs, so that Del/Exists/Expire/Expireat/Persist/TTL/Type only
+  // visit the types a key lives in. It is built from all the keys the
+  // first time the db is opened with it, and dropped when opened without.
+  bool enable_key_type_directory;
+
+  // Workers that Del/Exists/Expire/TTL use to probe the types of their keys
+  // concurrently instead of one after another. 0 probes them serially.
+  size_t keys_fanout_threads;
+
+  // Threads that run the background compactions. At most all but one of
+  // them run full compactions, so with two or more a CompactKey task never
+  // waits for a full compaction to end.
+  size_t bg_task_workers;
+
+  // Split the db into this many shards by key hash, each a complete db
+  // with its own type dbs, WALs and write queues, in the shard<N> sub
+  // directories. A key containing a {hash tag} goes to the shard of the
+  // tag. MGet, MSet, Del, Exists, SUnion/SInter/SDiff, PfCount, the scans
+  // and Keys gather over the shards, without atomicity across them; the
+  // other multi-key writes need all their keys in one shard. The number of
+  // shards can not be changed once a db was created.
+  size_t shards;
+
+  // Keys the SipHash check of the string scan cursors, so that clients
+  // can not forge a cursor that resumes the scan at a key of their choice.
+  // Left empty, the check only catches corrupted or mismatched cursors.
+  // Cursors stay valid across restarts as long as it does not change.
+  std::string scan_cursor_secret;
+
+  // GetKeyNum adds up the key numbers every SST file records when it is
+  // written instead of scanning all the keys, see EstimateKeyNum. They
+  // leave out unflushed writes and count keys rewritten since the last
+  // compaction more than once. Type dbs with files written before the
+  // numbers were recorded still get scanned, until they are compacted.
+  bool estimate_key_num;
+
+  // Record how long writes wait for the locks of their keys, and keep the
+  // lock_stats_top_n most contended keys and longest current holders of
+  // every type, for GetLockStats. 0 disables it, which leaves the path of
+  // an uncontended lock untouched.
+  size_t lock_stats_top_n;
+
+  // HSet/HIncrby and LPush/RPush to the same key coalesce: the first of
+  // them to get the key lock applies all the ones queued on the key by
+  // then with one meta read and commits them with one WriteBatch.
+  bool coalesce_key_writes;
+
   explicit BlackwidowOptions()
       : block_cache_size(0),
         share_block_cache(false),
         statistics_max_size(0),
-        small_compaction_threshold(5000) {}
+        small_compaction_threshold(5000),
+        read_skip_sample_interval(0),
+        read_skip_compaction_threshold(5000),
+        deletion_compaction_window(0),
+        deletion_compaction_trigger(5000),
+        reclaim_range_delete_threshold(0),
+        zsets_window_cache_size(0),
+        zsets_window_size(128),
+        zsets_range_delete_threshold(0),
+        enable_key_type_directory(false),
+        keys_fanout_threads(0),
+        bg_task_workers(1),
+        shards(1),
+        estimate_key_num(false),
+        lock_stats_top_n(0),
+        coalesce_key_writes(false) {}
 };
 
 struct KeyValue {
@@ -83,6 +185,14 @@ struct KeyValue {
   }
 };
 
+struct ZSetsCacheInfo {
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t windows;
+  uint64_t usage;
+  uint64_t capacity;
+};
+
 struct KeyInfo {
   uint64_t keys;
   uint64_t expires;
@@ -160,6 +270,17 @@ enum BitOpType {
   kBitOpDefault
 };
 
+// ZADD options, combined as a bit mask
+enum ZAddFlags {
+  kZAddNone = 0,
+  kZAddNX = 1 << 0,
+  kZAddXX = 1 << 1,
+  kZAddGT = 1 << 2,
+  kZAddLT = 1 << 3,
+  kZAddCH = 1 << 4,
+  kZAddINCR = 1 << 5
+};
+
 enum Operation {
   kNone = 0,
   kCleanAll,
@@ -181,6 +302,55 @@ struct BGTask {
          const std::string& _argv = "") : type(_type), operation(_opeation), argv(_argv) {}
 };
 
+struct BGTaskStats {
+  uint64_t queued_key_tasks;   // CompactKey tasks waiting to run
+  uint64_t queued_full_tasks;  // full compactions waiting to run
+  uint64_t running_tasks;
+  uint64_t finished_tasks;
+  // dropped as the same task, or a full compaction covering it, was queued
+  uint64_t deduped_tasks;
+  // removed from the queue by a full compaction covering them
+  uint64_t cancelled_tasks;
+  // from queued to started, and from started to done
+  uint64_t avg_wait_micros;
+  uint64_t max_wait_micros;
+  uint64_t avg_run_micros;
+  uint64_t max_run_micros;
+};
+
+// Buckets of LockStats::wait_histogram
+static const size_t kLockWaitBuckets = 24;
+
+struct LockKeyStat {
+  DataType type;
+  std::string key;
+  // contended acquisitions, or micros held so far
+  uint64_t count;
+};
+
+struct LockSlotStat {
+  DataType type;
+  size_t slot;
+  uint64_t contended;
+};
+
+struct LockStats {
+  // acquisitions that had to wait for another holder
+  uint64_t contended;
+  uint64_t total_wait_micros;
+  uint64_t max_wait_micros;
+  // wait_histogram[i] counts the waits shorter than 2^i micros and not
+  // counted before, the last bucket all the longer ones
+  std::vector<uint64_t> wait_histogram;
+  // the most contended lock slots, keys sharing a slot share its lock
+  std::vector<LockSlotStat> hot_slots;
+  // the most contended keys, estimated with a space saving sketch, so a
+  // count may be too high by up to the smallest count kept
+  std::vector<LockKeyStat> hot_keys;
+  // the keys held exclusively the longest right now
+  std::vector<LockKeyStat> longest_holders;
+};
+
 class BlackWidow {
  public:
   BlackWidow();
@@ -403,6 +573,10 @@ class BlackWidow {
   Status HScan(const Slice& key, int64_t cursor, const std::string& pattern,
                int64_t count, std::vector<FieldValue>* field_values, int64_t* next_cursor);
 
+  // See the string cursor SCAN for HSCAN documentation.
+  Status HScan(const Slice& key, const std::string& cursor, const std::string& pattern,
+               int64_t count, std::vector<FieldValue>* field_values, std::string* next_cursor);
+
   // Iterate over a Hash table of fields
   // return next_field that the user need to use as the start_field argument
   // in the next call
@@ -555,6 +729,10 @@ class BlackWidow {
   Status SScan(const Slice& key, int64_t cursor, const std::string& pattern,
                int64_t count, std::vector<std::string>* members, int64_t* next_cursor);
 
+  // See the string cursor SCAN for SSCAN documentation.
+  Status SScan(const Slice& key, const std::string& cursor, const std::string& pattern,
+               int64_t count, std::vector<std::string>* members, std::string* next_cursor);
+
   // Lists Commands
 
   // Insert all the specified values at the head of the list stored at key. If
@@ -688,6 +866,29 @@ class BlackWidow {
               const std::vector<ScoreMember>& score_members,
               int32_t* ret);
 
+  // ZADD with options, flags is a mask of ZAddFlags, all members are checked
+  // and written under one lock and one write batch.
+  //
+  // NX: Only add new elements. Don't update already existing elements.
+  // XX: Only update elements that already exist. Don't add new elements.
+  // GT: Only update existing elements if the new score is greater than the
+  //     current score. This flag doesn't prevent adding new elements.
+  // LT: Only update existing elements if the new score is less than the
+  //     current score. This flag doesn't prevent adding new elements.
+  // CH: ret counts the elements changed (new elements added and elements
+  //     whose score was updated) instead of only the new elements.
+  // INCR: Act like ZINCRBY, only one score-element pair can be specified, the
+  //       new score is stored in incr_score. NotFound is returned when the
+  //       operation was aborted because of a NX/XX/GT/LT condition.
+  //
+  // NX together with XX, GT or LT, and GT together with LT, are rejected with
+  // InvalidArgument.
+  Status ZAdd(const Slice& key,
+              const std::vector<ScoreMember>& score_members,
+              int32_t flags,
+              int32_t* ret,
+              double* incr_score = nullptr);
+
   // Returns the sorted set cardinality (number of elements) of the sorted set
   // stored at key.
   Status ZCard(const Slice& key, int32_t* ret);
@@ -798,6 +999,19 @@ class BlackWidow {
                        bool right_close,
                        std::vector<ScoreMember>* score_members);
 
+  // Same as above but only returns the matching elements selected by the
+  // LIMIT offset count clause, the iteration over the score column family
+  // stops as soon as count elements have been collected. A negative count
+  // returns all the elements from offset, a negative offset returns nothing.
+  Status ZRangebyscore(const Slice& key,
+                       double min,
+                       double max,
+                       bool left_close,
+                       bool right_close,
+                       int64_t offset,
+                       int64_t count,
+                       std::vector<ScoreMember>* score_members);
+
   // Returns the rank of member in the sorted set stored at key, with the scores
   // ordered from low to high. The rank (or index) is 0-based, which means that
   // the member with the lowest score has rank 0.
@@ -865,6 +1079,16 @@ class BlackWidow {
                           bool right_close,
                           std::vector<ScoreMember>* score_members);
 
+  // ZREVRANGEBYSCORE with the LIMIT offset count clause, see ZRANGEBYSCORE.
+  Status ZRevrangebyscore(const Slice& key,
+                          double min,
+                          double max,
+                          bool left_close,
+                          bool right_close,
+                          int64_t offset,
+                          int64_t count,
+                          std::vector<ScoreMember>* score_members);
+
   // Returns the rank of member in the sorted set stored at key, with the scores
   // ordered from high to low. The rank (or index) is 0-based, which means that
   // the member with the highest score has rank 0.
@@ -948,6 +1172,16 @@ class BlackWidow {
                      bool right_close,
                      std::vector<std::string>* members);
 
+  // ZRANGEBYLEX with the LIMIT offset count clause, see ZRANGEBYSCORE.
+  Status ZRangebylex(const Slice& key,
+                     const Slice& min,
+                     const Slice& max,
+                     bool left_close,
+                     bool right_close,
+                     int64_t offset,
+                     int64_t count,
+                     std::vector<std::string>* members);
+
   // When all the elements in a sorted set are inserted with the same score, in
   // order to force lexicographical ordering, this command returns the number of
   // elements in the sorted set at key with a value between min and max.
@@ -984,6 +1218,10 @@ class BlackWidow {
   Status ZScan(const Slice& key, int64_t cursor, const std::string& pattern,
                int64_t count, std::vector<ScoreMember>* score_members, int64_t* next_cursor);
 
+  // See the string cursor SCAN for ZSCAN documentation.
+  Status ZScan(const Slice& key, const std::string& cursor, const std::string& pattern,
+               int64_t count, std::vector<ScoreMember>* score_members, std::string* next_cursor);
+
   // Keys Commands
 
   // Note:
@@ -1015,6 +1253,16 @@ class BlackWidow {
                const std::string& pattern, int64_t count,
                std::vector<std::string>* keys);
 
+  // Like Scan, with a cursor that encodes where the scan resumes instead
+  // of an index into a cursor cache, so it never restarts from the
+  // beginning because the cache evicted it, and still works after a
+  // restart. Start with "0", next_cursor is "0" once the scan is done.
+  // return InvalidArgument if the cursor was not returned by a scan with
+  // the same pattern
+  Status Scan(const DataType& dtype, const std::string& cursor,
+              const std::string& pattern, int64_t count,
+              std::vector<std::string>* keys, std::string* next_cursor);
+
   // Iterate over a collection of elements, obtaining the item which timeout
   // conforms to the inequality (min_ttl < item_ttl < max_ttl)
   // return an updated cursor that the user need to use as the cursor argument
@@ -1103,7 +1351,7 @@ class BlackWidow {
   // HyperLogLog
   enum {
     kMaxKeys = 255,
-    kPrecision = 17,
+    kPrecision = 14,
   };
   // Adds all the element arguments to the HyperLogLog data structure stored
   // at the variable name specified as first argument.
@@ -1121,9 +1369,10 @@ class BlackWidow {
   Status PfMerge(const std::vector<std::string>& keys);
 
   // Admin Commands
-  Status StartBGThread();
+  Status StartBGThread(size_t workers = 1);
   Status RunBGTask();
   Status AddBGTask(const BGTask& bg_task);
+  Status GetBGTaskStats(BGTaskStats* stats);
 
   Status Compact(const DataType& type, bool sync = false);
   Status DoCompact(const DataType& type);
@@ -1139,8 +1388,12 @@ class BlackWidow {
   uint64_t GetProperty(const std::string& db_type, const std::string& property);
 
   Status GetKeyNum(std::vector<KeyInfo>* key_infos);
+  Status GetZSetsCacheInfo(ZSetsCacheInfo* info);
+  // Empty unless opened with lock_stats_top_n
+  Status GetLockStats(LockStats* stats);
   Status StopScanKeyNum();
 
+  // NULL for a sharded db, which has one db of each type per shard
   rocksdb::DB* GetDBByType(const std::string& type);
 
  private:
@@ -1150,21 +1403,40 @@ class BlackWidow {
   RedisZSets* zsets_db_;
   RedisLists* lists_db_;
   std::atomic<bool> is_opened_;
+  KeyTypeDirectory* key_type_directory_;
+  FanoutPool* fanout_pool_;
+  std::vector<BlackWidow*> shards_;
 
   LRUCache<std::string, std::string>* cursors_store_;
+  std::string scan_cursor_secret_;
+  bool estimate_key_num_;
+  size_t lock_stats_top_n_;
 
-  // Blackwidow start the background thread for compaction task
-  pthread_t bg_tasks_thread_id_;
-  slash::Mutex bg_tasks_mutex_;
-  slash::CondVar bg_tasks_cond_var_;
-  std::queue<BGTask> bg_tasks_queue_;
+  // Blackwidow start the background threads for compaction tasks
+  std::vector<pthread_t> bg_tasks_threads_;
+  BGTaskQueue* bg_tasks_queue_;
 
-  std::atomic<int> current_task_type_;
-  std::atomic<bool> bg_tasks_should_exit_;
+  // Full compactions running per Operation, several run at once with
+  // bg_task_workers above two
+  std::atomic<int> running_full_tasks_[kCompactKey];
+  void CountRunningFullTasks(std::vector<int>* running);
 
   // For scan keys in data base
   std::atomic<bool> scan_keynum_exit_;
 
+  Status BuildKeyTypeDirectory();
+  Redis* TypeDB(const DataType& type);
+  bool ScanTypes(const DataType& dtype, const std::string& pattern,
+                 int64_t* leftover_visits, std::vector<std::string>* keys,
+                 ScanCursor* position);
+
+  size_t ShardIndex(const Slice& key);
+  BlackWidow* Shard(const Slice& key);
+  bool InOneShard(const std::vector<std::string>& keys, size_t* index);
+  int64_t ScanShards(const DataType& dtype, int64_t cursor, int64_t count,
+                     std::vector<std::string>* keys,
+                     const std::function<int64_t(BlackWidow*, int64_t,
+                         int64_t, std::vector<std::string>*)>& scan);
 };
 
 }  //  namespace blackwidow
@@ -17,15 +17,92 @@
 
 namespace blackwidow {
 
+// A filter is created for each compaction job, which uses the time it
+// started at for all its records
+static inline int32_t CompactionTime() {
+  int64_t unix_time;
+  rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+  return static_cast<int32_t>(unix_time);
+}
+
+/*
+ * Finds the meta values of the keys a data compaction visits. The data
+ * keys of one key length come in the order of their keys, so instead of a
+ * random Get per key an iterator over the meta CF steps forward along
+ * with them, and only seeks when the next key is too far ahead or the
+ * length changes.
+ *
+ * The iterator reads the meta CF as it was at the first lookup, which is
+ * after the compaction time was taken. A meta value written since then
+ * is not seen, which can only keep data that could have been dropped:
+ * the data in the compaction was written with its meta value before, and
+ * a key that had expired at the compaction time can not be revived.
+ */
+class CompactionMetaCursor {
+ public:
+  CompactionMetaCursor(rocksdb::DB* db,
+                       std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr)
+      : db_(db), cf_handles_ptr_(handles_ptr), iter_(nullptr) {
+    read_options_.fill_cache = false;
+    read_options_.readahead_size = kReadaheadSize;
+  }
+
+  ~CompactionMetaCursor() {
+    delete iter_;
+  }
+
+  Status Get(const Slice& key, std::string* meta_value) {
+    if (iter_ == nullptr) {
+      iter_ = db_->NewIterator(read_options_, (*cf_handles_ptr_)[0]);
+      iter_->Seek(key);
+    } else if (key.compare(last_key_) < 0) {
+      iter_->Seek(key);
+    } else {
+      for (int32_t step = 0; iter_->Valid()
+        && iter_->key().compare(key) < 0; ++step) {
+        if (step == kMaxSteps) {
+          iter_->Seek(key);
+          break;
+        }
+        iter_->Next();
+      }
+    }
+    last_key_.assign(key.data(), key.size());
+
+    if (!iter_->status().ok()) {
+      Status s = iter_->status();
+      delete iter_;
+      iter_ = nullptr;
+      return s;
+    }
+    if (!iter_->Valid() || iter_->key() != key) {
+      return Status::NotFound();
+    }
+    meta_value->assign(iter_->value().data(), iter_->value().size());
+    return Status::OK();
+  }
+
+ private:
+  static const int32_t kMaxSteps = 8;
+  static const size_t kReadaheadSize = 2 * 1024 * 1024;
+
+  rocksdb::DB* db_;
+  std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
+  rocksdb::ReadOptions read_options_;
+  rocksdb::Iterator* iter_;
+  std::string last_key_;
+
+  CompactionMetaCursor(const CompactionMetaCursor&);
+  void operator=(const CompactionMetaCursor&);
+};
+
 class BaseMetaFilter : public rocksdb::CompactionFilter {
  public:
-  BaseMetaFilter() = default;
+  BaseMetaFilter() : cur_time_(CompactionTime()) {}
   bool Filter(int level, const rocksdb::Slice& key,
               const rocksdb::Slice& value,
               std::string* new_value, bool* value_changed) const override {
-    int64_t unix_time;
-    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
-    int32_t cur_time = static_cast<int32_t>(unix_time);
+    int32_t cur_time = cur_time_;
     ParsedBaseMetaValue parsed_base_meta_value(value);
     Trace("==========================START==========================");
     Trace("[MetaFilter], key: %s, count = %d, timestamp: %d, cur_time: %d, version: %d",
@@ -51,6 +128,9 @@ class BaseMetaFilter : public rocksdb::CompactionFilter {
   }
 
   const char* Name() const override { return "BaseMetaFilter"; }
+
+ private:
+  const int32_t cur_time_;
 };
 
 class BaseMetaFilterFactory : public rocksdb::CompactionFilterFactory {
@@ -69,12 +149,13 @@ class BaseDataFilter : public rocksdb::CompactionFilter {
  public:
   BaseDataFilter(rocksdb::DB* db,
                  std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr) :
-    db_(db),
     cf_handles_ptr_(cf_handles_ptr),
+    meta_cursor_(db, cf_handles_ptr),
     cur_key_(""),
     meta_not_found_(false),
     cur_meta_version_(0),
-    cur_meta_timestamp_(0) {}
+    cur_meta_timestamp_(0),
+    cur_time_(CompactionTime()) {}
 
   bool Filter(int level, const Slice& key,
               const rocksdb::Slice& value,
@@ -93,8 +174,7 @@ class BaseDataFilter : public rocksdb::CompactionFilter {
       if (cf_handles_ptr_->size() == 0) {
         return false;
       }
-      Status s = db_->Get(default_read_options_,
-              (*cf_handles_ptr_)[0], cur_key_, &meta_value);
+      Status s = meta_cursor_.Get(cur_key_, &meta_value);
       if (s.ok()) {
         meta_not_found_ = false;
         ParsedBaseMetaValue parsed_base_meta_value(&meta_value);
@@ -114,10 +194,8 @@ class BaseDataFilter : public rocksdb::CompactionFilter {
       return true;
     }
 
-    int64_t unix_time;
-    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
     if (cur_meta_timestamp_ != 0
-      && cur_meta_timestamp_ < static_cast<int32_t>(unix_time)) {
+      && cur_meta_timestamp_ < cur_time_) {
       Trace("Drop[Timeout]");
       return true;
     }
@@ -134,13 +212,13 @@ class BaseDataFilter : public rocksdb::CompactionFilter {
   const char* Name() const override { return "BaseDataFilter"; }
 
  private:
-  rocksdb::DB* db_;
   std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
-  rocksdb::ReadOptions default_read_options_;
+  mutable CompactionMetaCursor meta_cursor_;
   mutable std::string cur_key_;
   mutable bool meta_not_found_;
   mutable int32_t cur_meta_version_;
   mutable int32_t cur_meta_timestamp_;
+  const int32_t cur_time_;
 };
 
 class BaseDataFilterFactory : public rocksdb::CompactionFilterFactory {
@@ -0,0 +1,145 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/bg_task_queue.h"
+
+#include <algorithm>
+
+#include "rocksdb/env.h"
+
+namespace blackwidow {
+
+BGTaskQueue::BGTaskQueue(size_t max_full_running)
+    : cv_(&mu_),
+      closed_(false),
+      max_full_running_(std::max<size_t>(max_full_running, 1)),
+      full_running_(0),
+      stats_(),
+      total_wait_micros_(0),
+      total_run_micros_(0) {
+}
+
+bool BGTaskQueue::IsFull(const BGTask& task) {
+  return task.operation == kCleanAll;
+}
+
+bool BGTaskQueue::Covers(const BGTask& full, const BGTask& task) {
+  return IsFull(full)
+    && (IsFull(task) || task.operation == kCompactKey)
+    && (full.type == kAll || full.type == task.type);
+}
+
+BGTaskQueue::TaskKey BGTaskQueue::KeyOf(const BGTask& task) {
+  return TaskKey(task.type, task.operation, task.argv);
+}
+
+bool BGTaskQueue::IsCovered(const BGTask& task) {
+  if (queued_.count(KeyOf(task))) {
+    return true;
+  }
+  for (const auto& entry : full_tasks_) {
+    if (Covers(entry.task, task)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BGTaskQueue::CancelCovered(const BGTask& full) {
+  for (auto tasks : {&key_tasks_, &full_tasks_}) {
+    for (auto iter = tasks->begin(); iter != tasks->end();) {
+      if (Covers(full, iter->task)) {
+        queued_.erase(KeyOf(iter->task));
+        iter = tasks->erase(iter);
+        stats_.cancelled_tasks++;
+      } else {
+        ++iter;
+      }
+    }
+  }
+}
+
+bool BGTaskQueue::Push(const BGTask& task) {
+  slash::MutexLock l(&mu_);
+  if (closed_) {
+    return false;
+  }
+  if (IsCovered(task)) {
+    stats_.deduped_tasks++;
+    return false;
+  }
+  if (IsFull(task)) {
+    CancelCovered(task);
+  }
+
+  Entry entry = {task, rocksdb::Env::Default()->NowMicros()};
+  (IsFull(task) ? full_tasks_ : key_tasks_).push_back(entry);
+  queued_.insert(KeyOf(task));
+  cv_.Signal();
+  return true;
+}
+
+bool BGTaskQueue::Pop(BGTask* task) {
+  slash::MutexLock l(&mu_);
+  while (!closed_ && key_tasks_.empty()
+    && (full_tasks_.empty() || full_running_ >= max_full_running_)) {
+    cv_.Wait();
+  }
+  if (closed_) {
+    return false;
+  }
+
+  std::deque<Entry>* tasks = key_tasks_.empty() ? &full_tasks_ : &key_tasks_;
+  Entry entry = tasks->front();
+  tasks->pop_front();
+  queued_.erase(KeyOf(entry.task));
+  if (IsFull(entry.task)) {
+    full_running_++;
+  }
+  stats_.running_tasks++;
+
+  uint64_t wait_micros = rocksdb::Env::Default()->NowMicros()
+    - entry.queued_micros;
+  total_wait_micros_ += wait_micros;
+  stats_.max_wait_micros = std::max(stats_.max_wait_micros, wait_micros);
+  *task = entry.task;
+  return true;
+}
+
+void BGTaskQueue::Finish(const BGTask& task, uint64_t run_micros) {
+  slash::MutexLock l(&mu_);
+  if (IsFull(task)) {
+    full_running_--;
+    // a worker may be waiting for a full compaction to run
+    cv_.Signal();
+  }
+  stats_.running_tasks--;
+  stats_.finished_tasks++;
+  total_run_micros_ += run_micros;
+  stats_.max_run_micros = std::max(stats_.max_run_micros, run_micros);
+}
+
+void BGTaskQueue::Close() {
+  slash::MutexLock l(&mu_);
+  closed_ = true;
+  key_tasks_.clear();
+  full_tasks_.clear();
+  queued_.clear();
+  cv_.SignalAll();
+}
+
+void BGTaskQueue::GetStats(BGTaskStats* stats) {
+  slash::MutexLock l(&mu_);
+  *stats = stats_;
+  stats->queued_key_tasks = key_tasks_.size();
+  stats->queued_full_tasks = full_tasks_.size();
+  // waits are counted as tasks start, runs as they finish
+  uint64_t started = stats_.finished_tasks + stats_.running_tasks;
+  stats->avg_wait_micros = started ? total_wait_micros_ / started : 0;
+  stats->avg_run_micros = stats_.finished_tasks
+    ? total_run_micros_ / stats_.finished_tasks : 0;
+}
+
+}  //  namespace blackwidow
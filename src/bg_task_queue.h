@@ -0,0 +1,78 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_BG_TASK_QUEUE_H_
+#define SRC_BG_TASK_QUEUE_H_
+
+#include <set>
+#include <deque>
+#include <tuple>
+#include <string>
+
+#include "slash/include/slash_mutex.h"
+
+#include "blackwidow/blackwidow.h"
+
+namespace blackwidow {
+
+/*
+ * The queue the background workers take their tasks from.
+ *
+ * CompactKey tasks are small and run before any queued full compaction.
+ * As a full compaction can not be interrupted once it runs, at most
+ * max_full_running of them run at a time, so with more workers than that
+ * the others stay free for the CompactKey tasks.
+ *
+ * A task is dropped if the same task, or a full compaction covering it,
+ * is already queued, and queuing a full compaction removes the queued
+ * tasks it covers. A full compaction of kAll covers every task, one of a
+ * single type covers the tasks of that type.
+ */
+class BGTaskQueue {
+ public:
+  explicit BGTaskQueue(size_t max_full_running);
+
+  // false if the task was dropped, or the queue is closed
+  bool Push(const BGTask& task);
+  // Blocks until a task may run, false once the queue is closed
+  bool Pop(BGTask* task);
+  // Called when a task returned by Pop is done
+  void Finish(const BGTask& task, uint64_t run_micros);
+  // Wakes up the workers blocked in Pop, queued tasks are discarded
+  void Close();
+
+  void GetStats(BGTaskStats* stats);
+
+ private:
+  typedef std::tuple<DataType, Operation, std::string> TaskKey;
+  struct Entry {
+    BGTask task;
+    uint64_t queued_micros;
+  };
+
+  static bool IsFull(const BGTask& task);
+  static bool Covers(const BGTask& full, const BGTask& task);
+  static TaskKey KeyOf(const BGTask& task);
+  bool IsCovered(const BGTask& task);
+  void CancelCovered(const BGTask& full);
+
+  slash::Mutex mu_;
+  slash::CondVar cv_;
+  bool closed_;
+  const size_t max_full_running_;
+  size_t full_running_;
+  std::deque<Entry> key_tasks_;
+  std::deque<Entry> full_tasks_;
+  std::set<TaskKey> queued_;
+  BGTaskStats stats_;
+  uint64_t total_wait_micros_;
+  uint64_t total_run_micros_;
+
+  BGTaskQueue(const BGTaskQueue&);
+  void operator=(const BGTaskQueue&);
+};
+
+}  //  namespace blackwidow
+#endif  //  SRC_BG_TASK_QUEUE_H_
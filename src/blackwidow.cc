@@ -3,6 +3,12 @@
 //  LICENSE file in the root directory of this source tree. An additional grant
 //  of patent rights can be found in the PATENTS file in the same directory.
 
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <unordered_set>
+
 #include "blackwidow/blackwidow.h"
 #include "blackwidow/util.h"
 
@@ -13,10 +19,19 @@
 #include "src/redis_lists.h"
 #include "src/redis_zsets.h"
 #include "src/redis_hyperloglog.h"
+#include "src/key_type_directory.h"
+#include "src/fanout_pool.h"
+#include "src/scan_cursor.h"
+#include "src/key_num_collector.h"
+#include "src/bg_task_queue.h"
 #include "src/lru_cache.h"
+#include "src/murmurhash.h"
 
 namespace blackwidow {
 
+static const char kCrossShardKeys[] =
+  "keys of a multi-key write must be in one shard, use a {hash tag}";
+
 BlackWidow::BlackWidow() :
   strings_db_(nullptr),
   hashes_db_(nullptr),
@@ -24,24 +39,24 @@ BlackWidow::BlackWidow() :
   zsets_db_(nullptr),
   lists_db_(nullptr),
   is_opened_(false),
-  bg_tasks_cond_var_(&bg_tasks_mutex_),
-  current_task_type_(kNone),
-  bg_tasks_should_exit_(false),
+  key_type_directory_(nullptr),
+  fanout_pool_(nullptr),
+  estimate_key_num_(false),
+  lock_stats_top_n_(0),
+  bg_tasks_queue_(nullptr),
   scan_keynum_exit_(false) {
+  for (int op = kNone; op < kCompactKey; ++op) {
+    running_full_tasks_[op] = 0;
+  }
   cursors_store_ = new LRUCache<std::string, std::string>();
   cursors_store_->SetCapacity(5000);
-
-  Status s = StartBGThread();
-  if (!s.ok()) {
-    fprintf(stderr,
-        "[FATAL] start bg thread failed, %s\n", s.ToString().c_str());
-    exit(-1);
-  }
 }
 
 BlackWidow::~BlackWidow() {
-  bg_tasks_should_exit_ = true;
-  bg_tasks_cond_var_.Signal();
+  if (bg_tasks_queue_ != nullptr) {
+    bg_tasks_queue_->Close();
+  }
+  delete fanout_pool_;
 
   if (is_opened_) {
     rocksdb::CancelAllBackgroundWork(strings_db_->GetDB(), true);
@@ -52,16 +67,24 @@ BlackWidow::~BlackWidow() {
   }
 
   int ret = 0;
-  if ((ret = pthread_join(bg_tasks_thread_id_, NULL)) != 0) {
-    fprintf(stderr, "pthread_join failed with bgtask thread error %d\n", ret);
+  for (auto thread_id : bg_tasks_threads_) {
+    if ((ret = pthread_join(thread_id, NULL)) != 0) {
+      fprintf(stderr, "pthread_join failed with bgtask thread error %d\n", ret);
+    }
   }
+  delete bg_tasks_queue_;
 
+  // Its compactions read the type dbs
+  delete key_type_directory_;
   delete strings_db_;
   delete hashes_db_;
   delete sets_db_;
   delete lists_db_;
   delete zsets_db_;
   delete cursors_store_;
+  for (auto shard : shards_) {
+    delete shard;
+  }
 }
 
 static std::string AppendSubDirectory(const std::string& db_path,
@@ -76,6 +99,40 @@ static std::string AppendSubDirectory(const std::string& db_path,
 Status BlackWidow::Open(const BlackwidowOptions& bw_options,
                         const std::string& db_path) {
   mkpath(db_path.c_str(), 0755);
+  scan_cursor_secret_ = bw_options.scan_cursor_secret;
+  estimate_key_num_ = bw_options.estimate_key_num;
+  lock_stats_top_n_ = bw_options.lock_stats_top_n;
+
+  // A db keeps the number of shards it was created with
+  size_t existing_shards = 0;
+  while (!access(AppendSubDirectory(db_path,
+          "shard" + std::to_string(existing_shards)).c_str(), F_OK)) {
+    ++existing_shards;
+  }
+  size_t shards = std::max<size_t>(bw_options.shards, 1);
+  if (shards == 1 && existing_shards != 0) {
+    return Status::InvalidArgument("db was created with "
+        + std::to_string(existing_shards) + " shards");
+  } else if (shards > 1 && ((existing_shards != 0 && existing_shards != shards)
+      || !access(AppendSubDirectory(db_path, "strings").c_str(), F_OK))) {
+    return Status::InvalidArgument("db was created with "
+        + std::to_string(std::max<size_t>(existing_shards, 1)) + " shards");
+  }
+
+  if (shards > 1) {
+    BlackwidowOptions shard_options(bw_options);
+    shard_options.shards = 1;
+    for (size_t i = 0; i < shards; ++i) {
+      BlackWidow* shard = new BlackWidow();
+      shards_.push_back(shard);
+      Status s = shard->Open(shard_options,
+          AppendSubDirectory(db_path, "shard" + std::to_string(i)));
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return Status::OK();
+  }
 
   strings_db_ = new RedisStrings(this, kStrings);
   Status s = strings_db_->Open(
@@ -117,10 +174,97 @@ Status BlackWidow::Open(const BlackwidowOptions& bw_options,
         "[FATAL] open zset db failed, %s\n", s.ToString().c_str());
     exit(-1);
   }
+
+  std::vector<Redis*> dbs = {strings_db_, hashes_db_,
+    lists_db_, zsets_db_, sets_db_};
+  for (auto db : dbs) {
+    db->EnableLockStats(bw_options.lock_stats_top_n);
+  }
+
+  std::string directory_path = AppendSubDirectory(db_path, "directory");
+  if (bw_options.enable_key_type_directory) {
+    key_type_directory_ = new KeyTypeDirectory();
+    s = key_type_directory_->Open(bw_options, directory_path,
+        [this](const Slice& key, const DataType& type) {
+          int32_t ret;
+          uint64_t llen;
+          std::string value;
+          Status s;
+          switch (type) {
+            case kStrings:
+              s = strings_db_->Get(key, &value);
+              break;
+            case kHashes:
+              s = hashes_db_->HLen(key, &ret);
+              break;
+            case kSets:
+              s = sets_db_->SCard(key, &ret);
+              break;
+            case kLists:
+              s = lists_db_->LLen(key, &llen);
+              break;
+            case kZSets:
+              s = zsets_db_->ZCard(key, &ret);
+              break;
+            default:
+              break;
+          }
+          return !s.IsNotFound();
+        });
+    if (s.ok()) {
+      s = BuildKeyTypeDirectory();
+    }
+  } else {
+    s = KeyTypeDirectory::Destroy(bw_options, directory_path);
+  }
+  if (!s.ok()) {
+    fprintf(stderr,
+        "[FATAL] open key type directory failed, %s\n", s.ToString().c_str());
+    exit(-1);
+  }
+
+  fanout_pool_ = new FanoutPool(bw_options.keys_fanout_threads);
+
+  s = StartBGThread(bw_options.bg_task_workers);
+  if (!s.ok()) {
+    fprintf(stderr,
+        "[FATAL] start bg thread failed, %s\n", s.ToString().c_str());
+    exit(-1);
+  }
   is_opened_.store(true);
   return Status::OK();
 }
 
+// Record the keys written while the db was used without a directory
+Status BlackWidow::BuildKeyTypeDirectory() {
+  if (key_type_directory_->IsBuilt()) {
+    return Status::OK();
+  }
+
+  std::vector<std::pair<DataType, Redis*>> dbs = {
+    {kStrings, strings_db_}, {kHashes, hashes_db_}, {kSets, sets_db_},
+    {kLists, lists_db_}, {kZSets, zsets_db_}};
+  std::vector<std::string> keys;
+  std::string start_key, next_key;
+  for (const auto& db : dbs) {
+    bool is_finish = false;
+    start_key.clear();
+    while (!is_finish) {
+      int64_t count = 1000;
+      keys.clear();
+      is_finish = db.second->Scan(start_key, "*", &keys, &count, &next_key);
+      for (const auto& key : keys) {
+        Status s = key_type_directory_->Mark(key, db.first);
+        if (!s.ok()) {
+          return s;
+        }
+      }
+      start_key = next_key;
+    }
+  }
+  return key_type_directory_->SetBuilt();
+}
+
 Status BlackWidow::GetStartKey(const DataType& dtype, int64_t cursor, std::string* start_key) {
   std::string index_key = DataTypeTag[dtype] + std::to_string(cursor);
   return cursors_store_->Lookup(index_key, start_key);
@@ -132,9 +276,256 @@ Status BlackWidow::StoreCursorStartKey(const DataType& dtype, int64_t cursor,
   return cursors_store_->Insert(index_key, next_key);
 }
 
+// A key goes to the shard of its {hash tag}, if it has a non-empty one
+size_t BlackWidow::ShardIndex(const Slice& key) {
+  Slice hashed = key;
+  const char* begin = static_cast<const char*>(
+      memchr(key.data(), '{', key.size()));
+  if (begin != NULL) {
+    size_t offset = begin - key.data() + 1;
+    const char* end = static_cast<const char*>(
+        memchr(begin + 1, '}', key.size() - offset));
+    if (end != NULL && end != begin + 1) {
+      hashed = Slice(begin + 1, end - begin - 1);
+    }
+  }
+  return MurmurHash(hashed.data(), static_cast<int>(hashed.size()), 0)
+    % shards_.size();
+}
+
+BlackWidow* BlackWidow::Shard(const Slice& key) {
+  return shards_[ShardIndex(key)];
+}
+
+bool BlackWidow::InOneShard(const std::vector<std::string>& keys,
+                            size_t* index) {
+  *index = keys.empty() ? 0 : ShardIndex(keys[0]);
+  for (size_t i = 1; i < keys.size(); ++i) {
+    if (ShardIndex(keys[i]) != *index) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// The cursor of a sharded scan maps to "<shard>:<cursor of the shard>",
+// once a shard is done the scan goes on with the next one
+int64_t BlackWidow::ScanShards(const DataType& dtype, int64_t cursor,
+    int64_t count, std::vector<std::string>* keys,
+    const std::function<int64_t(BlackWidow*, int64_t, int64_t,
+                                std::vector<std::string>*)>& scan) {
+  keys->clear();
+  if (cursor < 0) {
+    return 0;
+  }
+
+  size_t shard = 0;
+  int64_t shard_cursor = 0;
+  std::string position;
+  if (GetStartKey(dtype, cursor, &position).ok()) {
+    unsigned long index = 0;                      // NOLINT
+    long long start = 0;                          // NOLINT
+    if (sscanf(position.c_str(), "%lu:%lld", &index, &start) == 2) {
+      shard = index;
+      shard_cursor = start;
+    }
+  } else {
+    cursor = 0;
+  }
+
+  std::vector<std::string> shard_keys;
+  while (shard < shards_.size()
+    && static_cast<int64_t>(keys->size()) < count) {
+    shard_keys.clear();
+    shard_cursor = scan(shards_[shard], shard_cursor,
+                        count - keys->size(), &shard_keys);
+    keys->insert(keys->end(), shard_keys.begin(), shard_keys.end());
+    if (shard_cursor != 0) {
+      break;
+    }
+    ++shard;
+  }
+
+  if (shard >= shards_.size()) {
+    return 0;
+  }
+  int64_t cursor_ret = cursor + count;
+  StoreCursorStartKey(dtype, cursor_ret,
+      std::to_string(shard) + ":" + std::to_string(shard_cursor));
+  return cursor_ret;
+}
+
+// Every shard returns its part of the range up to its own next key, which
+// are only complete below the smallest of them (the largest for a reverse
+// scan). Keep what lies before it, in key order, up to limit.
+template <typename T, typename KeyOf>
+static void MergeShardRanges(const std::vector<std::vector<T>>& shard_items,
+                             const std::vector<std::string>& next_keys,
+                             int64_t limit, bool reverse, KeyOf key_of,
+                             std::vector<T>* items, std::string* next_key) {
+  std::string bound;
+  bool bounded = false;
+  for (const auto& key : next_keys) {
+    if (!key.empty() && (!bounded || (reverse ? key > bound : key < bound))) {
+      bound = key;
+      bounded = true;
+    }
+  }
+
+  std::vector<T> merged;
+  for (const auto& part : shard_items) {
+    for (const auto& item : part) {
+      const std::string& key = key_of(item);
+      if (!bounded || (reverse ? key > bound : key < bound)) {
+        merged.push_back(item);
+      }
+    }
+  }
+  std::sort(merged.begin(), merged.end(),
+      [&](const T& a, const T& b) {
+        return reverse ? key_of(a) > key_of(b) : key_of(a) < key_of(b);
+      });
+
+  *next_key = bound;
+  if (limit > 0 && static_cast<int64_t>(merged.size()) > limit) {
+    *next_key = key_of(merged[limit]);
+    merged.resize(limit);
+  }
+  items->insert(items->end(), merged.begin(), merged.end());
+}
+
+// The set commands over keys of several shards, on the members read from
+// each of them
+static Status SUnionAcrossShards(BlackWidow* bw,
+                                 const std::vector<std::string>& keys,
+                                 std::vector<std::string>* members) {
+  std::unordered_set<std::string> seen;
+  std::vector<std::string> key_members;
+  for (const auto& key : keys) {
+    key_members.clear();
+    Status s = bw->SMembers(key, &key_members);
+    if (!s.ok() && !s.IsNotFound()) {
+      return s;
+    }
+    for (const auto& member : key_members) {
+      if (seen.insert(member).second) {
+        members->push_back(member);
+      }
+    }
+  }
+  return Status::OK();
+}
+
+static Status SInterAcrossShards(BlackWidow* bw,
+                                 const std::vector<std::string>& keys,
+                                 std::vector<std::string>* members) {
+  std::vector<std::string> first_members;
+  Status s = bw->SMembers(keys[0], &first_members);
+  if (s.IsNotFound()) {
+    return Status::OK();
+  } else if (!s.ok()) {
+    return s;
+  }
+
+  std::vector<std::unordered_set<std::string>> others;
+  std::vector<std::string> key_members;
+  for (size_t i = 1; i < keys.size(); ++i) {
+    key_members.clear();
+    s = bw->SMembers(keys[i], &key_members);
+    if (s.IsNotFound()) {
+      return Status::OK();
+    } else if (!s.ok()) {
+      return s;
+    }
+    others.emplace_back(key_members.begin(), key_members.end());
+  }
+
+  for (const auto& member : first_members) {
+    bool in_all = true;
+    for (const auto& other : others) {
+      if (!other.count(member)) {
+        in_all = false;
+        break;
+      }
+    }
+    if (in_all) {
+      members->push_back(member);
+    }
+  }
+  return Status::OK();
+}
+
+static Status SDiffAcrossShards(BlackWidow* bw,
+                                const std::vector<std::string>& keys,
+                                std::vector<std::string>* members) {
+  std::vector<std::string> first_members;
+  Status s = bw->SMembers(keys[0], &first_members);
+  if (s.IsNotFound()) {
+    return Status::OK();
+  } else if (!s.ok()) {
+    return s;
+  }
+
+  std::unordered_set<std::string> others;
+  std::vector<std::string> key_members;
+  for (size_t i = 1; i < keys.size(); ++i) {
+    key_members.clear();
+    s = bw->SMembers(keys[i], &key_members);
+    if (!s.ok() && !s.IsNotFound()) {
+      return s;
+    }
+    others.insert(key_members.begin(), key_members.end());
+  }
+
+  for (const auto& member : first_members) {
+    if (!others.count(member)) {
+      members->push_back(member);
+    }
+  }
+  return Status::OK();
+}
+
+// The cursors of HScan/SScan/ZScan carry the member the scan resumes at
+static Status DecodeMemberCursor(const std::string& cursor, char tag,
+                                 const Slice& key, const std::string& pattern,
+                                 const std::string& secret,
+                                 std::string* start_point) {
+  start_point->clear();
+  if (cursor == kScanCursorStart) {
+    return Status::OK();
+  }
+  ScanCursor position;
+  if (!DecodeScanCursor(cursor, key, pattern, secret, &position)
+    || position.tag != tag) {
+    return Status::InvalidArgument("invalid cursor");
+  }
+  *start_point = position.start_point;
+  return Status::OK();
+}
+
+static std::string EncodeMemberCursor(char tag, const Slice& key,
+                                      const std::string& pattern,
+                                      const std::string& secret,
+                                      const std::string& next_point) {
+  if (next_point.empty()) {
+    return kScanCursorStart;
+  }
+  ScanCursor position;
+  position.tag = tag;
+  position.start_point = next_point;
+  return EncodeScanCursor(position, key, pattern, secret);
+}
+
 // Strings Commands
 Status BlackWidow::Set(const Slice& key,
                        const Slice& value) {
+  if (!shards_.empty()) {
+    return Shard(key)->Set(key, value);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Set(key, value);
 }
 
@@ -142,191 +533,436 @@ Status BlackWidow::Setxx(const Slice& key,
                          const Slice& value,
                          int32_t* ret,
                          const int32_t ttl) {
+  if (!shards_.empty()) {
+    return Shard(key)->Setxx(key, value, ret, ttl);
+  }
   return strings_db_->Setxx(key, value, ret, ttl);
 }
 
 Status BlackWidow::Get(const Slice& key, std::string* value) {
+  if (!shards_.empty()) {
+    return Shard(key)->Get(key, value);
+  }
   return strings_db_->Get(key, value);
 }
 
 Status BlackWidow::GetSet(const Slice& key, const Slice& value,
                           std::string* old_value) {
+  if (!shards_.empty()) {
+    return Shard(key)->GetSet(key, value, old_value);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->GetSet(key, value, old_value);
 }
 
 Status BlackWidow::SetBit(const Slice& key, int64_t offset,
                           int32_t value, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->SetBit(key, offset, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->SetBit(key, offset, value, ret);
 }
 
 Status BlackWidow::GetBit(const Slice& key, int64_t offset, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->GetBit(key, offset, ret);
+  }
   return strings_db_->GetBit(key, offset, ret);
 }
 
 Status BlackWidow::MSet(const std::vector<KeyValue>& kvs) {
+  if (!shards_.empty()) {
+    std::vector<std::vector<KeyValue>> shard_kvs(shards_.size());
+    for (const auto& kv : kvs) {
+      shard_kvs[ShardIndex(kv.key)].push_back(kv);
+    }
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (!shard_kvs[i].empty()) {
+        Status s = shards_[i]->MSet(shard_kvs[i]);
+        if (!s.ok()) {
+          return s;
+        }
+      }
+    }
+    return Status::OK();
+  }
+  std::vector<std::string> keys;
+  for (const auto& kv : kvs) {
+    keys.push_back(kv.key);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, keys, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->MSet(kvs);
 }
 
 Status BlackWidow::MGet(const std::vector<std::string>& keys,
                         std::vector<ValueStatus>* vss) {
+  if (!shards_.empty()) {
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    std::vector<std::vector<size_t>> positions(shards_.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      size_t index = ShardIndex(keys[i]);
+      shard_keys[index].push_back(keys[i]);
+      positions[index].push_back(i);
+    }
+    vss->assign(keys.size(), ValueStatus());
+    std::vector<ValueStatus> shard_vss;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (shard_keys[i].empty()) {
+        continue;
+      }
+      Status s = shards_[i]->MGet(shard_keys[i], &shard_vss);
+      if (!s.ok()) {
+        vss->clear();
+        return s;
+      }
+      for (size_t j = 0; j < shard_vss.size(); ++j) {
+        (*vss)[positions[i][j]] = shard_vss[j];
+      }
+    }
+    return Status::OK();
+  }
   return strings_db_->MGet(keys, vss);
 }
 
 Status BlackWidow::Setnx(const Slice& key, const Slice& value,
                          int32_t* ret, const int32_t ttl) {
+  if (!shards_.empty()) {
+    return Shard(key)->Setnx(key, value, ret, ttl);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Setnx(key, value, ret, ttl);
 }
 
 Status BlackWidow::MSetnx(const std::vector<KeyValue>& kvs,
                           int32_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> keys;
+    for (const auto& kv : kvs) {
+      keys.push_back(kv.key);
+    }
+    size_t index;
+    if (!InOneShard(keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->MSetnx(kvs, ret);
+  }
+  std::vector<std::string> keys;
+  for (const auto& kv : kvs) {
+    keys.push_back(kv.key);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, keys, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->MSetnx(kvs, ret);
 }
 
 Status BlackWidow::Setvx(const Slice& key, const Slice& value,
                          const Slice& new_value, int32_t* ret,
                          const int32_t ttl) {
+  if (!shards_.empty()) {
+    return Shard(key)->Setvx(key, value, new_value, ret, ttl);
+  }
   return strings_db_->Setvx(key, value, new_value, ret, ttl);
 }
 
 Status BlackWidow::Delvx(const Slice& key, const Slice& value, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Delvx(key, value, ret);
+  }
   return strings_db_->Delvx(key, value, ret);
 }
 
 Status BlackWidow::Setrange(const Slice& key, int64_t start_offset,
                             const Slice& value, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Setrange(key, start_offset, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Setrange(key, start_offset, value, ret);
 }
 
 Status BlackWidow::Getrange(const Slice& key, int64_t start_offset,
                             int64_t end_offset, std::string* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Getrange(key, start_offset, end_offset, ret);
+  }
   return strings_db_->Getrange(key, start_offset, end_offset, ret);
 }
 
 Status BlackWidow::Append(const Slice& key, const Slice& value, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Append(key, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Append(key, value, ret);
 }
 
 Status BlackWidow::BitCount(const Slice& key, int64_t start_offset,
                             int64_t end_offset, int32_t *ret, bool have_range) {
+  if (!shards_.empty()) {
+    return Shard(key)->BitCount(key, start_offset, end_offset, ret, have_range);
+  }
   return strings_db_->BitCount(key, start_offset, end_offset, ret, have_range);
 }
 
 Status BlackWidow::BitOp(BitOpType op, const std::string& dest_key,
                          const std::vector<std::string>& src_keys,
                          int64_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> keys(src_keys);
+    keys.push_back(dest_key);
+    size_t index;
+    if (!InOneShard(keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->BitOp(op, dest_key, src_keys, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, dest_key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->BitOp(op, dest_key, src_keys, ret);
 }
 
 Status BlackWidow::BitPos(const Slice& key, int32_t bit,
                           int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->BitPos(key, bit, ret);
+  }
   return strings_db_->BitPos(key, bit, ret);
 }
 
 Status BlackWidow::BitPos(const Slice& key, int32_t bit,
                           int64_t start_offset, int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->BitPos(key, bit, start_offset, ret);
+  }
   return strings_db_->BitPos(key, bit, start_offset, ret);
 }
 
 Status BlackWidow::BitPos(const Slice& key, int32_t bit,
                           int64_t start_offset, int64_t end_offset,
                           int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->BitPos(key, bit, start_offset, end_offset, ret);
+  }
   return strings_db_->BitPos(key, bit, start_offset, end_offset, ret);
 }
 
 Status BlackWidow::Decrby(const Slice& key, int64_t value, int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Decrby(key, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Decrby(key, value, ret);
 }
 
 Status BlackWidow::Incrby(const Slice& key, int64_t value, int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Incrby(key, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Incrby(key, value, ret);
 }
 
 Status BlackWidow::Incrbyfloat(const Slice& key, const Slice& value,
                                std::string* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->Incrbyfloat(key, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Incrbyfloat(key, value, ret);
 }
 
 Status BlackWidow::Setex(const Slice& key, const Slice& value, int32_t ttl) {
+  if (!shards_.empty()) {
+    return Shard(key)->Setex(key, value, ttl);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->Setex(key, value, ttl);
 }
 
 Status BlackWidow::Strlen(const Slice& key, int32_t* len) {
+  if (!shards_.empty()) {
+    return Shard(key)->Strlen(key, len);
+  }
   return strings_db_->Strlen(key, len);
 }
 
 Status BlackWidow::PKSetexAt(const Slice& key,
                              const Slice& value,
                              int32_t timestamp) {
+  if (!shards_.empty()) {
+    return Shard(key)->PKSetexAt(key, value, timestamp);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return strings_db_->PKSetexAt(key, value, timestamp);
 }
 
 // Hashes Commands
 Status BlackWidow::HSet(const Slice& key, const Slice& field,
     const Slice& value, int32_t* res) {
+  if (!shards_.empty()) {
+    return Shard(key)->HSet(key, field, value, res);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kHashes);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return hashes_db_->HSet(key, field, value, res);
 }
 
 Status BlackWidow::HGet(const Slice& key, const Slice& field,
     std::string* value) {
+  if (!shards_.empty()) {
+    return Shard(key)->HGet(key, field, value);
+  }
   return hashes_db_->HGet(key, field, value);
 }
 
 Status BlackWidow::HMSet(const Slice& key,
                          const std::vector<FieldValue>& fvs) {
+  if (!shards_.empty()) {
+    return Shard(key)->HMSet(key, fvs);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kHashes);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return hashes_db_->HMSet(key, fvs);
 }
 
 Status BlackWidow::HMGet(const Slice& key,
                          const std::vector<std::string>& fields,
                          std::vector<ValueStatus>* vss) {
+  if (!shards_.empty()) {
+    return Shard(key)->HMGet(key, fields, vss);
+  }
   return hashes_db_->HMGet(key, fields, vss);
 }
 
 Status BlackWidow::HGetall(const Slice& key,
                            std::vector<FieldValue>* fvs) {
+  if (!shards_.empty()) {
+    return Shard(key)->HGetall(key, fvs);
+  }
   return hashes_db_->HGetall(key, fvs);
 }
 
 Status BlackWidow::HKeys(const Slice& key,
                          std::vector<std::string>* fields) {
+  if (!shards_.empty()) {
+    return Shard(key)->HKeys(key, fields);
+  }
   return hashes_db_->HKeys(key, fields);
 }
 
 Status BlackWidow::HVals(const Slice& key,
                          std::vector<std::string>* values) {
+  if (!shards_.empty()) {
+    return Shard(key)->HVals(key, values);
+  }
   return hashes_db_->HVals(key, values);
 }
 
 Status BlackWidow::HSetnx(const Slice& key, const Slice& field,
                           const Slice& value, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->HSetnx(key, field, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kHashes);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return hashes_db_->HSetnx(key, field, value, ret);
 }
 
 Status BlackWidow::HLen(const Slice& key, int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->HLen(key, ret);
+  }
   return hashes_db_->HLen(key, ret);
 }
 
 Status BlackWidow::HStrlen(const Slice& key, const Slice& field, int32_t* len) {
+  if (!shards_.empty()) {
+    return Shard(key)->HStrlen(key, field, len);
+  }
   return hashes_db_->HStrlen(key, field, len);
 }
 
 Status BlackWidow::HExists(const Slice& key, const Slice& field) {
+  if (!shards_.empty()) {
+    return Shard(key)->HExists(key, field);
+  }
   return hashes_db_->HExists(key, field);
 }
 
 Status BlackWidow::HIncrby(const Slice& key, const Slice& field, int64_t value,
                            int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->HIncrby(key, field, value, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kHashes);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return hashes_db_->HIncrby(key, field, value, ret);
 }
 
 Status BlackWidow::HIncrbyfloat(const Slice& key, const Slice& field,
                                 const Slice& by, std::string* new_value) {
+  if (!shards_.empty()) {
+    return Shard(key)->HIncrbyfloat(key, field, by, new_value);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kHashes);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return hashes_db_->HIncrbyfloat(key, field, by, new_value);
 }
 
 Status BlackWidow::HDel(const Slice& key,
                         const std::vector<std::string>& fields,
                         int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->HDel(key, fields, ret);
+  }
   return hashes_db_->HDel(key, fields, ret);
 }
 
@@ -334,14 +970,44 @@ Status BlackWidow::HScan(const Slice& key, int64_t cursor,
                          const std::string& pattern, int64_t count,
                          std::vector<FieldValue>* field_values,
                          int64_t* next_cursor) {
+  if (!shards_.empty()) {
+    return Shard(key)->HScan(key, cursor, pattern, count, field_values,
+        next_cursor);
+  }
   return hashes_db_->HScan(key, cursor,
       pattern, count, field_values, next_cursor);
 }
 
+Status BlackWidow::HScan(const Slice& key, const std::string& cursor,
+                         const std::string& pattern, int64_t count,
+                         std::vector<FieldValue>* field_values,
+                         std::string* next_cursor) {
+  if (!shards_.empty()) {
+    return Shard(key)->HScan(key, cursor, pattern, count, field_values,
+        next_cursor);
+  }
+  std::string start_point, next_point;
+  *next_cursor = kScanCursorStart;
+  Status s = DecodeMemberCursor(cursor, DataTypeTag[kHashes], key, pattern,
+                                scan_cursor_secret_, &start_point);
+  if (!s.ok()) {
+    field_values->clear();
+    return s;
+  }
+  s = hashes_db_->HScan(key, start_point, pattern, count, field_values, &next_point);
+  *next_cursor = EncodeMemberCursor(DataTypeTag[kHashes], key, pattern,
+                                    scan_cursor_secret_, next_point);
+  return s;
+}
+
 Status BlackWidow::HScanx(const Slice& key, const std::string start_field,
                           const std::string& pattern, int64_t count,
                           std::vector<FieldValue>* field_values,
                           std::string* next_field) {
+  if (!shards_.empty()) {
+    return Shard(key)->HScanx(key, start_field, pattern, count, field_values,
+        next_field);
+  }
   return hashes_db_->HScanx(key, start_field,
       pattern, count, field_values, next_field);
 }
@@ -351,6 +1017,10 @@ Status BlackWidow::PKHScanRange(const Slice& key, const Slice& field_start,
                                 const Slice& pattern, int32_t limit,
                                 std::vector<FieldValue>* field_values,
                                 std::string* next_field) {
+  if (!shards_.empty()) {
+    return Shard(key)->PKHScanRange(key, field_start, field_end, pattern,
+        limit, field_values, next_field);
+  }
   return hashes_db_->PKHScanRange(key, field_start,
       field_end, pattern, limit, field_values, next_field);
 }
@@ -360,6 +1030,10 @@ Status BlackWidow::PKHRScanRange(const Slice& key, const Slice& field_start,
                                  const Slice& pattern, int32_t limit,
                                  std::vector<FieldValue>* field_values,
                                  std::string* next_field) {
+  if (!shards_.empty()) {
+    return Shard(key)->PKHRScanRange(key, field_start, field_end, pattern,
+        limit, field_values, next_field);
+  }
   return hashes_db_->PKHRScanRange(key, field_start,
       field_end, pattern, limit, field_values, next_field);
 }
@@ -368,52 +1042,122 @@ Status BlackWidow::PKHRScanRange(const Slice& key, const Slice& field_start,
 Status BlackWidow::SAdd(const Slice& key,
                         const std::vector<std::string>& members,
                         int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->SAdd(key, members, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return sets_db_->SAdd(key, members, ret);
 }
 
 Status BlackWidow::SCard(const Slice& key,
                          int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->SCard(key, ret);
+  }
   return sets_db_->SCard(key, ret);
 }
 
 Status BlackWidow::SDiff(const std::vector<std::string>& keys,
                          std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    size_t index;
+    if (InOneShard(keys, &index)) {
+      return shards_[index]->SDiff(keys, members);
+    }
+    return SDiffAcrossShards(this, keys, members);
+  }
   return sets_db_->SDiff(keys, members);
 }
 
 Status BlackWidow::SDiffstore(const Slice& destination,
                               const std::vector<std::string>& keys,
                               int32_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> all_keys(keys);
+    all_keys.push_back(destination.ToString());
+    size_t index;
+    if (!InOneShard(all_keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->SDiffstore(destination, keys, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return sets_db_->SDiffstore(destination, keys, ret);
 }
 
 Status BlackWidow::SInter(const std::vector<std::string>& keys,
                           std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    size_t index;
+    if (InOneShard(keys, &index)) {
+      return shards_[index]->SInter(keys, members);
+    }
+    return SInterAcrossShards(this, keys, members);
+  }
   return sets_db_->SInter(keys, members);
 }
 
 Status BlackWidow::SInterstore(const Slice& destination,
                                const std::vector<std::string>& keys,
                                int32_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> all_keys(keys);
+    all_keys.push_back(destination.ToString());
+    size_t index;
+    if (!InOneShard(all_keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->SInterstore(destination, keys, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return sets_db_->SInterstore(destination, keys, ret);
 }
 
 Status BlackWidow::SIsmember(const Slice& key, const Slice& member,
                              int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->SIsmember(key, member, ret);
+  }
   return sets_db_->SIsmember(key, member, ret);
 }
 
 Status BlackWidow::SMembers(const Slice& key,
                             std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    return Shard(key)->SMembers(key, members);
+  }
   return sets_db_->SMembers(key, members);
 }
 
 Status BlackWidow::SMove(const Slice& source, const Slice& destination,
                          const Slice& member, int32_t* ret) {
+  if (!shards_.empty()) {
+    size_t index;
+    if (!InOneShard({source.ToString(), destination.ToString()}, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->SMove(source, destination, member, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return sets_db_->SMove(source, destination, member, ret);
 }
 
 Status BlackWidow::SPop(const Slice& key, std::string* member) {
+  if (!shards_.empty()) {
+    return Shard(key)->SPop(key, member);
+  }
   bool need_compact = false;
   Status status = sets_db_->SPop(key, member, &need_compact);
   if (need_compact) {
@@ -424,23 +1168,49 @@ Status BlackWidow::SPop(const Slice& key, std::string* member) {
 
 Status BlackWidow::SRandmember(const Slice& key, int32_t count,
                                std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    return Shard(key)->SRandmember(key, count, members);
+  }
   return sets_db_->SRandmember(key, count, members);
 }
 
 Status BlackWidow::SRem(const Slice& key,
                         const std::vector<std::string>& members,
                         int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->SRem(key, members, ret);
+  }
   return sets_db_->SRem(key, members, ret);
 }
 
 Status BlackWidow::SUnion(const std::vector<std::string>& keys,
                           std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    size_t index;
+    if (InOneShard(keys, &index)) {
+      return shards_[index]->SUnion(keys, members);
+    }
+    return SUnionAcrossShards(this, keys, members);
+  }
   return sets_db_->SUnion(keys, members);
 }
 
 Status BlackWidow::SUnionstore(const Slice& destination,
                                const std::vector<std::string>& keys,
                                int32_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> all_keys(keys);
+    all_keys.push_back(destination.ToString());
+    size_t index;
+    if (!InOneShard(all_keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->SUnionstore(destination, keys, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return sets_db_->SUnionstore(destination, keys, ret);
 }
 
@@ -448,45 +1218,102 @@ Status BlackWidow::SScan(const Slice& key, int64_t cursor,
                          const std::string& pattern, int64_t count,
                          std::vector<std::string>* members,
                          int64_t* next_cursor) {
+  if (!shards_.empty()) {
+    return Shard(key)->SScan(key, cursor, pattern, count, members, next_cursor);
+  }
   return sets_db_->SScan(key, cursor, pattern, count, members, next_cursor);
 }
 
+Status BlackWidow::SScan(const Slice& key, const std::string& cursor,
+                         const std::string& pattern, int64_t count,
+                         std::vector<std::string>* members,
+                         std::string* next_cursor) {
+  if (!shards_.empty()) {
+    return Shard(key)->SScan(key, cursor, pattern, count, members,
+        next_cursor);
+  }
+  std::string start_point, next_point;
+  *next_cursor = kScanCursorStart;
+  Status s = DecodeMemberCursor(cursor, DataTypeTag[kSets], key, pattern,
+                                scan_cursor_secret_, &start_point);
+  if (!s.ok()) {
+    members->clear();
+    return s;
+  }
+  s = sets_db_->SScan(key, start_point, pattern, count, members, &next_point);
+  *next_cursor = EncodeMemberCursor(DataTypeTag[kSets], key, pattern,
+                                    scan_cursor_secret_, next_point);
+  return s;
+}
+
 Status BlackWidow::LPush(const Slice& key,
                          const std::vector<std::string>& values,
                          uint64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->LPush(key, values, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kLists);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return lists_db_->LPush(key, values, ret);
 }
 
 Status BlackWidow::RPush(const Slice& key,
                          const std::vector<std::string>& values,
                          uint64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->RPush(key, values, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kLists);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return lists_db_->RPush(key, values, ret);
 }
 
 Status BlackWidow::LRange(const Slice& key, int64_t start, int64_t stop,
                           std::vector<std::string>* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->LRange(key, start, stop, ret);
+  }
   return lists_db_->LRange(key, start, stop, ret);
 }
 
 Status BlackWidow::LTrim(const Slice& key, int64_t start, int64_t stop) {
+  if (!shards_.empty()) {
+    return Shard(key)->LTrim(key, start, stop);
+  }
   return lists_db_->LTrim(key, start, stop);
 }
 
 Status BlackWidow::LLen(const Slice& key, uint64_t* len) {
+  if (!shards_.empty()) {
+    return Shard(key)->LLen(key, len);
+  }
   return lists_db_->LLen(key, len);
 }
 
 Status BlackWidow::LPop(const Slice& key, std::string* element) {
+  if (!shards_.empty()) {
+    return Shard(key)->LPop(key, element);
+  }
   return lists_db_->LPop(key, element);
 }
 
 Status BlackWidow::RPop(const Slice& key, std::string* element) {
+  if (!shards_.empty()) {
+    return Shard(key)->RPop(key, element);
+  }
   return lists_db_->RPop(key, element);
 }
 
 Status BlackWidow::LIndex(const Slice& key,
                           int64_t index,
                           std::string* element) {
+  if (!shards_.empty()) {
+    return Shard(key)->LIndex(key, index, element);
+  }
   return lists_db_->LIndex(key, index, element);
 }
 
@@ -495,52 +1322,109 @@ Status BlackWidow::LInsert(const Slice& key,
                            const std::string& pivot,
                            const std::string& value,
                            int64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->LInsert(key, before_or_after, pivot, value, ret);
+  }
   return lists_db_->LInsert(key, before_or_after, pivot, value, ret);
 }
 
 Status BlackWidow::LPushx(const Slice& key, const Slice& value, uint64_t* len) {
+  if (!shards_.empty()) {
+    return Shard(key)->LPushx(key, value, len);
+  }
   return lists_db_->LPushx(key, value, len);
 }
 
 Status BlackWidow::RPushx(const Slice& key, const Slice& value, uint64_t* len) {
+  if (!shards_.empty()) {
+    return Shard(key)->RPushx(key, value, len);
+  }
   return lists_db_->RPushx(key, value, len);
 }
 
 Status BlackWidow::LRem(const Slice& key, int64_t count,
                         const Slice& value, uint64_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->LRem(key, count, value, ret);
+  }
   return lists_db_->LRem(key, count, value, ret);
 }
 
 Status BlackWidow::LSet(const Slice& key, int64_t index, const Slice& value) {
+  if (!shards_.empty()) {
+    return Shard(key)->LSet(key, index, value);
+  }
   return lists_db_->LSet(key, index, value);
 }
 
 Status BlackWidow::RPoplpush(const Slice& source,
                              const Slice& destination,
                              std::string* element) {
+  if (!shards_.empty()) {
+    size_t index;
+    if (!InOneShard({source.ToString(), destination.ToString()}, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->RPoplpush(source, destination, element);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kLists);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return lists_db_->RPoplpush(source, destination, element);
 }
 
 Status BlackWidow::ZPopMax(const Slice& key,
 			   const int64_t count,
 			   std::vector<ScoreMember>* score_members){
+  if (!shards_.empty()) {
+    return Shard(key)->ZPopMax(key, count, score_members);
+  }
   return zsets_db_->ZPopMax(key, count, score_members);
 }
 
 Status BlackWidow::ZPopMin(const Slice& key,
 			   const int64_t count,
                            std::vector<ScoreMember>* score_members){
+  if (!shards_.empty()) {
+    return Shard(key)->ZPopMin(key, count, score_members);
+  }
   return zsets_db_->ZPopMin(key, count, score_members);
 }
 
 Status BlackWidow::ZAdd(const Slice& key,
                         const std::vector<ScoreMember>& score_members,
                         int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZAdd(key, score_members, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kZSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return zsets_db_->ZAdd(key, score_members, ret);
 }
 
+Status BlackWidow::ZAdd(const Slice& key,
+                        const std::vector<ScoreMember>& score_members,
+                        int32_t flags,
+                        int32_t* ret,
+                        double* incr_score) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZAdd(key, score_members, flags, ret, incr_score);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kZSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
+  return zsets_db_->ZAdd(key, score_members, flags, ret, incr_score);
+}
+
 Status BlackWidow::ZCard(const Slice& key,
                          int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZCard(key, ret);
+  }
   return zsets_db_->ZCard(key, ret);
 }
 
@@ -550,6 +1434,9 @@ Status BlackWidow::ZCount(const Slice& key,
                           bool left_close,
                           bool right_close,
                           int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZCount(key, min, max, left_close, right_close, ret);
+  }
   return zsets_db_->ZCount(key, min, max, left_close, right_close, ret);
 }
 
@@ -557,6 +1444,13 @@ Status BlackWidow::ZIncrby(const Slice& key,
                            const Slice& member,
                            double increment,
                            double* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZIncrby(key, member, increment, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kZSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return zsets_db_->ZIncrby(key, member, increment, ret);
 }
 
@@ -564,6 +1458,9 @@ Status BlackWidow::ZRange(const Slice& key,
                           int32_t start,
                           int32_t stop,
                           std::vector<ScoreMember>* score_members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRange(key, start, stop, score_members);
+  }
   return zsets_db_->ZRange(key, start, stop, score_members);
 }
 
@@ -573,19 +1470,45 @@ Status BlackWidow::ZRangebyscore(const Slice& key,
                                  bool left_close,
                                  bool right_close,
                                  std::vector<ScoreMember>* score_members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRangebyscore(key, min, max, left_close, right_close,
+        score_members);
+  }
+  return zsets_db_->ZRangebyscore(key, min, max,
+      left_close, right_close, 0, -1, score_members);
+}
+
+Status BlackWidow::ZRangebyscore(const Slice& key,
+                                 double min,
+                                 double max,
+                                 bool left_close,
+                                 bool right_close,
+                                 int64_t offset,
+                                 int64_t count,
+                                 std::vector<ScoreMember>* score_members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRangebyscore(key, min, max, left_close, right_close,
+        offset, count, score_members);
+  }
   return zsets_db_->ZRangebyscore(key, min, max,
-      left_close, right_close, score_members);
+      left_close, right_close, offset, count, score_members);
 }
 
 Status BlackWidow::ZRank(const Slice& key,
                          const Slice& member,
                          int32_t* rank) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRank(key, member, rank);
+  }
   return zsets_db_->ZRank(key, member, rank);
 }
 
 Status BlackWidow::ZRem(const Slice& key,
                         std::vector<std::string> members,
                         int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRem(key, members, ret);
+  }
   return zsets_db_->ZRem(key, members, ret);
 }
 
@@ -593,6 +1516,9 @@ Status BlackWidow::ZRemrangebyrank(const Slice& key,
                                    int32_t start,
                                    int32_t stop,
                                    int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRemrangebyrank(key, start, stop, ret);
+  }
   return zsets_db_->ZRemrangebyrank(key, start, stop, ret);
 }
 
@@ -602,6 +1528,10 @@ Status BlackWidow::ZRemrangebyscore(const Slice& key,
                                     bool left_close,
                                     bool right_close,
                                     int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRemrangebyscore(key, min, max, left_close, right_close,
+        ret);
+  }
   return zsets_db_->ZRemrangebyscore(key, min, max,
       left_close, right_close, ret);
 }
@@ -610,6 +1540,9 @@ Status BlackWidow::ZRevrange(const Slice& key,
                              int32_t start,
                              int32_t stop,
                              std::vector<ScoreMember>* score_members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRevrange(key, start, stop, score_members);
+  }
   return zsets_db_->ZRevrange(key, start, stop, score_members);
 }
 
@@ -619,19 +1552,45 @@ Status BlackWidow::ZRevrangebyscore(const Slice& key,
                                     bool left_close,
                                     bool right_close,
                                     std::vector<ScoreMember>* score_members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRevrangebyscore(key, min, max, left_close, right_close,
+        score_members);
+  }
+  return zsets_db_->ZRevrangebyscore(key, min, max,
+      left_close, right_close, 0, -1, score_members);
+}
+
+Status BlackWidow::ZRevrangebyscore(const Slice& key,
+                                    double min,
+                                    double max,
+                                    bool left_close,
+                                    bool right_close,
+                                    int64_t offset,
+                                    int64_t count,
+                                    std::vector<ScoreMember>* score_members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRevrangebyscore(key, min, max, left_close, right_close,
+        offset, count, score_members);
+  }
   return zsets_db_->ZRevrangebyscore(key, min, max,
-      left_close, right_close, score_members);
+      left_close, right_close, offset, count, score_members);
 }
 
 Status BlackWidow::ZRevrank(const Slice& key,
                             const Slice& member,
                             int32_t* rank) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRevrank(key, member, rank);
+  }
   return zsets_db_->ZRevrank(key, member, rank);
 }
 
 Status BlackWidow::ZScore(const Slice& key,
                           const Slice& member,
                           double* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZScore(key, member, ret);
+  }
   return zsets_db_->ZScore(key, member, ret);
 }
 
@@ -640,6 +1599,19 @@ Status BlackWidow::ZUnionstore(const Slice& destination,
                                const std::vector<double>& weights,
                                const AGGREGATE agg,
                                int32_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> all_keys(keys);
+    all_keys.push_back(destination.ToString());
+    size_t index;
+    if (!InOneShard(all_keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->ZUnionstore(destination, keys, weights, agg, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kZSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return zsets_db_->ZUnionstore(destination, keys, weights, agg, ret);
 }
 
@@ -648,6 +1620,19 @@ Status BlackWidow::ZInterstore(const Slice& destination,
                                const std::vector<double>& weights,
                                const AGGREGATE agg,
                                int32_t* ret) {
+  if (!shards_.empty()) {
+    std::vector<std::string> all_keys(keys);
+    all_keys.push_back(destination.ToString());
+    size_t index;
+    if (!InOneShard(all_keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->ZInterstore(destination, keys, weights, agg, ret);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, destination, kZSets);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
   return zsets_db_->ZInterstore(destination, keys, weights, agg, ret);
 }
 
@@ -657,8 +1642,28 @@ Status BlackWidow::ZRangebylex(const Slice& key,
                                bool left_close,
                                bool right_close,
                                std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRangebylex(key, min, max, left_close, right_close,
+        members);
+  }
+  return zsets_db_->ZRangebylex(key, min, max,
+      left_close, right_close, 0, -1, members);
+}
+
+Status BlackWidow::ZRangebylex(const Slice& key,
+                               const Slice& min,
+                               const Slice& max,
+                               bool left_close,
+                               bool right_close,
+                               int64_t offset,
+                               int64_t count,
+                               std::vector<std::string>* members) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRangebylex(key, min, max, left_close, right_close,
+        offset, count, members);
+  }
   return zsets_db_->ZRangebylex(key, min, max,
-      left_close, right_close, members);
+      left_close, right_close, offset, count, members);
 }
 
 Status BlackWidow::ZLexcount(const Slice& key,
@@ -667,6 +1672,9 @@ Status BlackWidow::ZLexcount(const Slice& key,
                              bool left_close,
                              bool right_close,
                              int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZLexcount(key, min, max, left_close, right_close, ret);
+  }
   return zsets_db_->ZLexcount(key, min, max, left_close, right_close, ret);
 }
 
@@ -676,6 +1684,10 @@ Status BlackWidow::ZRemrangebylex(const Slice& key,
                                   bool left_close,
                                   bool right_close,
                                   int32_t* ret) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZRemrangebylex(key, min, max, left_close, right_close,
+        ret);
+  }
   return zsets_db_->ZRemrangebylex(key, min, max, left_close, right_close, ret);
 }
 
@@ -683,60 +1695,164 @@ Status BlackWidow::ZScan(const Slice& key, int64_t cursor,
                          const std::string& pattern, int64_t count,
                          std::vector<ScoreMember>* score_members,
                          int64_t* next_cursor) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZScan(key, cursor, pattern, count, score_members,
+        next_cursor);
+  }
   return zsets_db_->ZScan(key, cursor,
       pattern, count, score_members, next_cursor);
 }
 
+Status BlackWidow::ZScan(const Slice& key, const std::string& cursor,
+                         const std::string& pattern, int64_t count,
+                         std::vector<ScoreMember>* score_members,
+                         std::string* next_cursor) {
+  if (!shards_.empty()) {
+    return Shard(key)->ZScan(key, cursor, pattern, count, score_members,
+        next_cursor);
+  }
+  std::string start_point, next_point;
+  *next_cursor = kScanCursorStart;
+  Status s = DecodeMemberCursor(cursor, DataTypeTag[kZSets], key, pattern,
+                                scan_cursor_secret_, &start_point);
+  if (!s.ok()) {
+    score_members->clear();
+    return s;
+  }
+  s = zsets_db_->ZScan(key, start_point, pattern, count, score_members, &next_point);
+  *next_cursor = EncodeMemberCursor(DataTypeTag[kZSets], key, pattern,
+                                    scan_cursor_secret_, next_point);
+  return s;
+}
 
-// Keys Commands
-int32_t BlackWidow::Expire(const Slice& key, int32_t ttl,
-                           std::map<DataType, Status>* type_status) {
-  int32_t ret = 0;
-  bool is_corruption = false;
 
-  // Strings
-  Status s = strings_db_->Expire(key, ttl);
-  if (s.ok()) {
-    ret++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kStrings] = s;
+// The types that may hold key, all of them without a key type directory
+static Status LookupKeyTypes(KeyTypeDirectory* directory,
+                             const Slice& key, uint8_t* types) {
+  if (directory == nullptr) {
+    *types = 0xff;
+    return Status::OK();
+  }
+  return directory->Lookup(key, types);
+}
+
+static bool HasType(uint8_t types, const DataType& type) {
+  return types & (1 << type);
+}
+
+static const size_t kTypeSlots = kSets + 1;
+static const DataType kProbedTypes[] = {
+  kStrings, kHashes, kSets, kLists, kZSets
+};
+
+// Probe the types that may hold each key, one task per type going over all
+// the keys, so that the fan-out pool probes the types concurrently. The
+// status of key i in type lands in results[i * kTypeSlots + type], which
+// stays NotFound for the types that were not probed.
+static void ProbeTypes(
+    FanoutPool* pool, const std::vector<uint8_t>& key_types,
+    const std::function<Status(const DataType&, size_t)>& probe,
+    std::vector<Status>* results) {
+  results->assign(key_types.size() * kTypeSlots, Status::NotFound());
+  std::vector<std::function<void()>> tasks;
+  for (const auto& type : kProbedTypes) {
+    if (std::none_of(key_types.begin(), key_types.end(),
+          [type](uint8_t types) { return HasType(types, type); })) {
+      continue;
+    }
+    tasks.push_back([&key_types, &probe, results, type]() {
+      for (size_t i = 0; i < key_types.size(); ++i) {
+        if (HasType(key_types[i], type)) {
+          (*results)[i * kTypeSlots + type] = probe(type, i);
+        }
+      }
+    });
   }
+  pool->Run(tasks);
+}
 
-  // Hash
-  s = hashes_db_->Expire(key, ttl);
-  if (s.ok()) {
-    ret++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kHashes] = s;
+Redis* BlackWidow::TypeDB(const DataType& type) {
+  switch (type) {
+    case kStrings:
+      return strings_db_;
+    case kHashes:
+      return hashes_db_;
+    case kSets:
+      return sets_db_;
+    case kLists:
+      return lists_db_;
+    case kZSets:
+      return zsets_db_;
+    default:
+      return nullptr;
   }
+}
+
+// Scans the types of dtype in the order of the integer cursor Scan, from
+// position on, until leftover_visits runs out. Leaves position where the
+// scan resumes, and returns true once all the types are done.
+bool BlackWidow::ScanTypes(const DataType& dtype, const std::string& pattern,
+                           int64_t* leftover_visits,
+                           std::vector<std::string>* keys,
+                           ScanCursor* position) {
+  static const DataType kScanOrder[] = {kStrings, kHashes, kSets, kLists,
+                                        kZSets};
+  static const size_t kScanTypes = sizeof(kScanOrder) / sizeof(kScanOrder[0]);
+  std::string prefix = isTailWildcard(pattern) ?
+    pattern.substr(0, pattern.size() - 1) : "";
 
-  // Sets
-  s = sets_db_->Expire(key, ttl);
-  if (s.ok()) {
-    ret++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kSets] = s;
+  size_t idx = 0;
+  while (idx < kScanTypes && DataTypeTag[kScanOrder[idx]] != position->tag) {
+    ++idx;
+  }
+  std::string next_key;
+  for (; idx < kScanTypes; ++idx) {
+    if (dtype != kAll && dtype != kScanOrder[idx]) {
+      continue;
+    }
+    position->tag = DataTypeTag[kScanOrder[idx]];
+    if (*leftover_visits <= 0) {
+      return false;
+    }
+    bool is_finish = TypeDB(kScanOrder[idx])->Scan(position->start_point,
+        pattern, keys, leftover_visits, &next_key);
+    if (!is_finish) {
+      position->start_point = next_key;
+      return false;
+    }
+    position->start_point = prefix;
   }
+  return true;
+}
 
-  // Lists
-  s = lists_db_->Expire(key, ttl);
-  if (s.ok()) {
-    ret++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kLists] = s;
+// Keys Commands
+int32_t BlackWidow::Expire(const Slice& key, int32_t ttl,
+                           std::map<DataType, Status>* type_status) {
+  if (!shards_.empty()) {
+    return Shard(key)->Expire(key, ttl, type_status);
+  }
+  int32_t ret = 0;
+  bool is_corruption = false;
+  std::vector<uint8_t> key_types(1);
+  Status s = LookupKeyTypes(key_type_directory_, key, &key_types[0]);
+  if (!s.ok()) {
+    (*type_status)[DataType::kAll] = s;
+    return -1;
   }
 
-  // Zsets
-  s = zsets_db_->Expire(key, ttl);
-  if (s.ok()) {
-    ret++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kZSets] = s;
+  std::vector<Status> results;
+  ProbeTypes(fanout_pool_, key_types,
+      [&](const DataType& type, size_t i) {
+        return TypeDB(type)->Expire(key, ttl);
+      }, &results);
+  for (const auto& type : kProbedTypes) {
+    s = results[type];
+    if (s.ok()) {
+      ret++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[type] = s;
+    }
   }
 
   if (is_corruption) {
@@ -748,54 +1864,67 @@ int32_t BlackWidow::Expire(const Slice& key, int32_t ttl,
 
 int64_t BlackWidow::Del(const std::vector<std::string>& keys,
                         std::map<DataType, Status>* type_status) {
+  if (!shards_.empty()) {
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    for (const auto& key : keys) {
+      shard_keys[ShardIndex(key)].push_back(key);
+    }
+    int64_t count = 0;
+    bool is_corruption = false;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (shard_keys[i].empty()) {
+        continue;
+      }
+      int64_t ret = shards_[i]->Del(shard_keys[i], type_status);
+      if (ret < 0) {
+        is_corruption = true;
+      } else {
+        count += ret;
+      }
+    }
+    return is_corruption ? -1 : count;
+  }
   Status s;
   int64_t count = 0;
   bool is_corruption = false;
 
-  for (const auto& key : keys) {
-    // Strings
-    Status s = strings_db_->Del(key);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kStrings] = s;
-    }
-
-    // Hashes
-    s = hashes_db_->Del(key);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kHashes] = s;
-    }
-
-    // Sets
-    s = sets_db_->Del(key);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
+  ScopeKeyTypeDelete l(key_type_directory_, keys);
+  std::vector<uint8_t> key_types(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    s = LookupKeyTypes(key_type_directory_, keys[i], &key_types[i]);
+    if (!s.ok()) {
       is_corruption = true;
-      (*type_status)[DataType::kSets] = s;
+      (*type_status)[DataType::kAll] = s;
+      key_types[i] = 0;
     }
+  }
 
-    // Lists
-    s = lists_db_->Del(key);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kLists] = s;
+  std::vector<Status> results;
+  ProbeTypes(fanout_pool_, key_types,
+      [&](const DataType& type, size_t i) {
+        return TypeDB(type)->Del(keys[i]);
+      }, &results);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    bool key_corruption = false;
+    for (const auto& type : kProbedTypes) {
+      s = results[i * kTypeSlots + type];
+      if (s.ok()) {
+        count++;
+      } else if (!s.IsNotFound()) {
+        key_corruption = true;
+        (*type_status)[type] = s;
+      }
     }
 
-    // ZSets
-    s = zsets_db_->Del(key);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
+    // The entry may only go once the key is gone from all its types
+    if (key_corruption) {
       is_corruption = true;
-      (*type_status)[DataType::kZSets] = s;
+    } else if (key_type_directory_ != nullptr && key_types[i] != 0) {
+      s = key_type_directory_->Remove(keys[i]);
+      if (!s.ok()) {
+        is_corruption = true;
+        (*type_status)[DataType::kAll] = s;
+      }
     }
   }
 
@@ -808,6 +1937,26 @@ int64_t BlackWidow::Del(const std::vector<std::string>& keys,
 
 int64_t BlackWidow::DelByType(const std::vector<std::string>& keys,
                               const DataType& type) {
+  if (!shards_.empty()) {
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    for (const auto& key : keys) {
+      shard_keys[ShardIndex(key)].push_back(key);
+    }
+    int64_t count = 0;
+    bool is_corruption = false;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (shard_keys[i].empty()) {
+        continue;
+      }
+      int64_t ret = shards_[i]->DelByType(shard_keys[i], type);
+      if (ret < 0) {
+        is_corruption = true;
+      } else {
+        count += ret;
+      }
+    }
+    return is_corruption ? -1 : count;
+  }
   Status s;
   int64_t count = 0;
   bool is_corruption = false;
@@ -886,52 +2035,70 @@ int64_t BlackWidow::DelByType(const std::vector<std::string>& keys,
 
 int64_t BlackWidow::Exists(const std::vector<std::string>& keys,
                        std::map<DataType, Status>* type_status) {
-  int64_t count = 0;
-  int32_t ret;
-  uint64_t llen;
-  std::string value;
-  Status s;
-  bool is_corruption = false;
-
-  for (const auto& key : keys) {
-    s = strings_db_->Get(key, &value);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kStrings] = s;
-    }
-
-    s = hashes_db_->HLen(key, &ret);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kHashes] = s;
+  if (!shards_.empty()) {
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    for (const auto& key : keys) {
+      shard_keys[ShardIndex(key)].push_back(key);
     }
-
-    s = sets_db_->SCard(key, &ret);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kSets] = s;
+    int64_t count = 0;
+    bool is_corruption = false;
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      if (shard_keys[i].empty()) {
+        continue;
+      }
+      int64_t ret = shards_[i]->Exists(shard_keys[i], type_status);
+      if (ret < 0) {
+        is_corruption = true;
+      } else {
+        count += ret;
+      }
     }
+    return is_corruption ? -1 : count;
+  }
+  int64_t count = 0;
+  Status s;
+  bool is_corruption = false;
 
-    s = lists_db_->LLen(key, &llen);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
+  std::vector<uint8_t> key_types(keys.size());
+  for (size_t i = 0; i < keys.size(); ++i) {
+    s = LookupKeyTypes(key_type_directory_, keys[i], &key_types[i]);
+    if (!s.ok()) {
       is_corruption = true;
-      (*type_status)[DataType::kLists] = s;
+      (*type_status)[DataType::kAll] = s;
+      key_types[i] = 0;
     }
+  }
 
-    s = zsets_db_->ZCard(key, &ret);
-    if (s.ok()) {
-      count++;
-    } else if (!s.IsNotFound()) {
-      is_corruption = true;
-      (*type_status)[DataType::kZSets] = s;
+  std::vector<Status> results;
+  ProbeTypes(fanout_pool_, key_types,
+      [&](const DataType& type, size_t i) {
+        int32_t ret;
+        uint64_t llen;
+        std::string value;
+        switch (type) {
+          case kStrings:
+            return strings_db_->Get(keys[i], &value);
+          case kHashes:
+            return hashes_db_->HLen(keys[i], &ret);
+          case kSets:
+            return sets_db_->SCard(keys[i], &ret);
+          case kLists:
+            return lists_db_->LLen(keys[i], &llen);
+          case kZSets:
+            return zsets_db_->ZCard(keys[i], &ret);
+          default:
+            return Status::NotFound();
+        }
+      }, &results);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    for (const auto& type : kProbedTypes) {
+      s = results[i * kTypeSlots + type];
+      if (s.ok()) {
+        count++;
+      } else if (!s.IsNotFound()) {
+        is_corruption = true;
+        (*type_status)[type] = s;
+      }
     }
   }
 
@@ -945,6 +2112,14 @@ int64_t BlackWidow::Exists(const std::vector<std::string>& keys,
 int64_t BlackWidow::Scan(const DataType& dtype, int64_t cursor,
                          const std::string& pattern, int64_t count,
                          std::vector<std::string>* keys) {
+  if (!shards_.empty()) {
+    return ScanShards(dtype, cursor, count, keys,
+        [&](BlackWidow* shard, int64_t shard_cursor, int64_t shard_count,
+            std::vector<std::string>* shard_keys) {
+          return shard->Scan(dtype, shard_cursor, pattern, shard_count,
+                             shard_keys);
+        });
+  }
   keys->clear();
   bool is_finish;
   int64_t leftover_visits = count;
@@ -1056,9 +2231,60 @@ int64_t BlackWidow::Scan(const DataType& dtype, int64_t cursor,
   return cursor_ret;
 }
 
+Status BlackWidow::Scan(const DataType& dtype, const std::string& cursor,
+                        const std::string& pattern, int64_t count,
+                        std::vector<std::string>* keys,
+                        std::string* next_cursor) {
+  keys->clear();
+  *next_cursor = kScanCursorStart;
+  std::string prefix = isTailWildcard(pattern) ?
+    pattern.substr(0, pattern.size() - 1) : "";
+  char first_tag = DataTypeTag[dtype == kAll ? kStrings : dtype];
+
+  // A sharded db scans the shards one after another, the cursor keeps the
+  // shard it stopped in
+  ScanCursor position;
+  if (cursor == kScanCursorStart) {
+    position.tag = first_tag;
+    position.start_point = prefix;
+  } else if (!DecodeScanCursor(cursor, Slice(), pattern,
+                               scan_cursor_secret_, &position)
+    || (dtype != kAll && position.tag != first_tag)
+    || position.shard >= std::max<size_t>(shards_.size(), 1)) {
+    return Status::InvalidArgument("invalid cursor");
+  }
+
+  int64_t leftover_visits = count;
+  if (shards_.empty()) {
+    if (ScanTypes(dtype, pattern, &leftover_visits, keys, &position)) {
+      return Status::OK();
+    }
+  } else {
+    while (shards_[position.shard]->ScanTypes(dtype, pattern,
+          &leftover_visits, keys, &position)) {
+      if (++position.shard == shards_.size()) {
+        return Status::OK();
+      }
+      position.tag = first_tag;
+      position.start_point = prefix;
+    }
+  }
+  *next_cursor = EncodeScanCursor(position, Slice(), pattern,
+                                  scan_cursor_secret_);
+  return Status::OK();
+}
+
 int64_t BlackWidow::PKExpireScan(const DataType& dtype, int64_t cursor,
                                  int32_t min_ttl, int32_t max_ttl,
                                  int64_t count, std::vector<std::string>* keys) {
+  if (!shards_.empty()) {
+    return ScanShards(dtype, cursor, count, keys,
+        [&](BlackWidow* shard, int64_t shard_cursor, int64_t shard_count,
+            std::vector<std::string>* shard_keys) {
+          return shard->PKExpireScan(dtype, shard_cursor, min_ttl, max_ttl,
+                                     shard_count, shard_keys);
+        });
+  }
   keys->clear();
   bool is_finish;
   int64_t leftover_visits = count;
@@ -1178,6 +2404,29 @@ Status BlackWidow::PKScanRange(const DataType& data_type,
                                std::vector<std::string>* keys,
                                std::vector<KeyValue>* kvs,
                                std::string* next_key) {
+  if (!shards_.empty()) {
+    keys->clear();
+    kvs->clear();
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    std::vector<std::vector<KeyValue>> shard_kvs(shards_.size());
+    std::vector<std::string> next_keys(shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      Status s = shards_[i]->PKScanRange(data_type, key_start, key_end, pattern,
+          limit, &shard_keys[i], &shard_kvs[i], &next_keys[i]);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    MergeShardRanges(shard_keys, next_keys, limit, false,
+        [](const std::string& key) -> const std::string& { return key; },
+        keys, next_key);
+    if (data_type == DataType::kStrings) {
+      MergeShardRanges(shard_kvs, next_keys, limit, false,
+          [](const KeyValue& kv) -> const std::string& { return kv.key; },
+          kvs, next_key);
+    }
+    return Status::OK();
+  }
   Status s;
   keys->clear();
   next_key->clear();
@@ -1215,6 +2464,29 @@ Status BlackWidow::PKRScanRange(const DataType& data_type,
                                 std::vector<std::string>* keys,
                                 std::vector<KeyValue>* kvs,
                                 std::string* next_key) {
+  if (!shards_.empty()) {
+    keys->clear();
+    kvs->clear();
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    std::vector<std::vector<KeyValue>> shard_kvs(shards_.size());
+    std::vector<std::string> next_keys(shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      Status s = shards_[i]->PKRScanRange(data_type, key_start, key_end, pattern,
+          limit, &shard_keys[i], &shard_kvs[i], &next_keys[i]);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    MergeShardRanges(shard_keys, next_keys, limit, true,
+        [](const std::string& key) -> const std::string& { return key; },
+        keys, next_key);
+    if (data_type == DataType::kStrings) {
+      MergeShardRanges(shard_kvs, next_keys, limit, true,
+          [](const KeyValue& kv) -> const std::string& { return kv.key; },
+          kvs, next_key);
+    }
+    return Status::OK();
+  }
   Status s;
   keys->clear();
   next_key->clear();
@@ -1249,6 +2521,18 @@ Status BlackWidow::PKRScanRange(const DataType& data_type,
 Status BlackWidow::PKPatternMatchDel(const DataType& data_type,
                                      const std::string& pattern,
                                      int32_t* ret) {
+  if (!shards_.empty()) {
+    *ret = 0;
+    for (auto shard : shards_) {
+      int32_t shard_ret = 0;
+      Status s = shard->PKPatternMatchDel(data_type, pattern, &shard_ret);
+      *ret += shard_ret;
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return Status::OK();
+  }
   Status s;
   switch (data_type) {
     case DataType::kStrings:
@@ -1279,6 +2563,22 @@ Status BlackWidow::Scanx(const DataType& data_type,
                          int64_t count,
                          std::vector<std::string>* keys,
                          std::string* next_key) {
+  if (!shards_.empty()) {
+    keys->clear();
+    std::vector<std::vector<std::string>> shard_keys(shards_.size());
+    std::vector<std::string> next_keys(shards_.size());
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      Status s = shards_[i]->Scanx(data_type, start_key, pattern, count,
+                                   &shard_keys[i], &next_keys[i]);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    MergeShardRanges(shard_keys, next_keys, count, false,
+        [](const std::string& key) -> const std::string& { return key; },
+        keys, next_key);
+    return Status::OK();
+  }
   Status s;
   keys->clear();
   next_key->clear();
@@ -1307,48 +2607,66 @@ Status BlackWidow::Scanx(const DataType& data_type,
 
 int32_t BlackWidow::Expireat(const Slice& key, int32_t timestamp,
                              std::map<DataType, Status>* type_status) {
-  Status s;
+  if (!shards_.empty()) {
+    return Shard(key)->Expireat(key, timestamp, type_status);
+  }
   int32_t count = 0;
   bool is_corruption = false;
+  uint8_t types;
+  Status s = LookupKeyTypes(key_type_directory_, key, &types);
+  if (!s.ok()) {
+    (*type_status)[DataType::kAll] = s;
+    return -1;
+  }
 
-  s = strings_db_->Expireat(key, timestamp);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kStrings] = s;
+  if (HasType(types, DataType::kStrings)) {
+    s = strings_db_->Expireat(key, timestamp);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kStrings] = s;
+    }
   }
 
-  s = hashes_db_->Expireat(key, timestamp);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kHashes] = s;
+  if (HasType(types, DataType::kHashes)) {
+    s = hashes_db_->Expireat(key, timestamp);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kHashes] = s;
+    }
   }
 
-  s = sets_db_->Expireat(key, timestamp);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kSets] = s;
+  if (HasType(types, DataType::kSets)) {
+    s = sets_db_->Expireat(key, timestamp);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kSets] = s;
+    }
   }
 
-  s = lists_db_->Expireat(key, timestamp);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kLists] = s;
+  if (HasType(types, DataType::kLists)) {
+    s = lists_db_->Expireat(key, timestamp);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kLists] = s;
+    }
   }
 
-  s = zsets_db_->Expireat(key, timestamp);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kLists] = s;
+  if (HasType(types, DataType::kZSets)) {
+    s = zsets_db_->Expireat(key, timestamp);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kLists] = s;
+    }
   }
 
   if (is_corruption) {
@@ -1360,48 +2678,66 @@ int32_t BlackWidow::Expireat(const Slice& key, int32_t timestamp,
 
 int32_t BlackWidow::Persist(const Slice& key,
                             std::map<DataType, Status>* type_status) {
-  Status s;
+  if (!shards_.empty()) {
+    return Shard(key)->Persist(key, type_status);
+  }
   int32_t count = 0;
   bool is_corruption = false;
+  uint8_t types;
+  Status s = LookupKeyTypes(key_type_directory_, key, &types);
+  if (!s.ok()) {
+    (*type_status)[DataType::kAll] = s;
+    return -1;
+  }
 
-  s = strings_db_->Persist(key);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kStrings] = s;
+  if (HasType(types, DataType::kStrings)) {
+    s = strings_db_->Persist(key);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kStrings] = s;
+    }
   }
 
-  s = hashes_db_->Persist(key);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kHashes] = s;
+  if (HasType(types, DataType::kHashes)) {
+    s = hashes_db_->Persist(key);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kHashes] = s;
+    }
   }
 
-  s = sets_db_->Persist(key);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kSets] = s;
+  if (HasType(types, DataType::kSets)) {
+    s = sets_db_->Persist(key);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kSets] = s;
+    }
   }
 
-  s = lists_db_->Persist(key);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kLists] = s;
+  if (HasType(types, DataType::kLists)) {
+    s = lists_db_->Persist(key);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kLists] = s;
+    }
   }
 
-  s = zsets_db_->Persist(key);
-  if (s.ok()) {
-    count++;
-  } else if (!s.IsNotFound()) {
-    is_corruption = true;
-    (*type_status)[DataType::kLists] = s;
+  if (HasType(types, DataType::kZSets)) {
+    s = zsets_db_->Persist(key);
+    if (s.ok()) {
+      count++;
+    } else if (!s.IsNotFound()) {
+      is_corruption = true;
+      (*type_status)[DataType::kLists] = s;
+    }
   }
 
   if (is_corruption) {
@@ -1413,100 +2749,105 @@ int32_t BlackWidow::Persist(const Slice& key,
 
 std::map<DataType, int64_t> BlackWidow::TTL(const Slice& key,
                         std::map<DataType, Status>* type_status) {
-  Status s;
-  std::map<DataType, int64_t> ret;
-  int64_t timestamp = 0;
-
-  s = strings_db_->TTL(key, &timestamp);
-  if (s.ok() || s.IsNotFound()) {
-    ret[DataType::kStrings] = timestamp;
-  } else if (!s.IsNotFound()) {
-    ret[DataType::kStrings] = -3;
-    (*type_status)[DataType::kStrings] = s;
-  }
-
-  s = hashes_db_->TTL(key, &timestamp);
-  if (s.ok() || s.IsNotFound()) {
-    ret[DataType::kHashes] = timestamp;
-  } else if (!s.IsNotFound()) {
-    ret[DataType::kHashes] = -3;
-    (*type_status)[DataType::kHashes] = s;
-  }
-
-  s = lists_db_->TTL(key, &timestamp);
-  if (s.ok() || s.IsNotFound()) {
-    ret[DataType::kLists] = timestamp;
-  } else if (!s.IsNotFound()) {
-    ret[DataType::kLists] = -3;
-    (*type_status)[DataType::kLists] = s;
+  if (!shards_.empty()) {
+    return Shard(key)->TTL(key, type_status);
   }
-
-  s = sets_db_->TTL(key, &timestamp);
-  if (s.ok() || s.IsNotFound()) {
-    ret[DataType::kSets] = timestamp;
-  } else if (!s.IsNotFound()) {
-    ret[DataType::kSets] = -3;
-    (*type_status)[DataType::kSets] = s;
+  std::map<DataType, int64_t> ret;
+  std::vector<uint8_t> key_types(1);
+  Status s = LookupKeyTypes(key_type_directory_, key, &key_types[0]);
+  if (!s.ok()) {
+    (*type_status)[DataType::kAll] = s;
+    for (const auto& type : kProbedTypes) {
+      ret[type] = -3;
+    }
+    return ret;
   }
 
-  s = zsets_db_->TTL(key, &timestamp);
-  if (s.ok() || s.IsNotFound()) {
-    ret[DataType::kZSets] = timestamp;
-  } else if (!s.IsNotFound()) {
-    ret[DataType::kZSets] = -3;
-    (*type_status)[DataType::kZSets] = s;
+  // -2 for the types that do not hold key
+  std::vector<int64_t> timestamps(kTypeSlots, -2);
+  std::vector<Status> results;
+  ProbeTypes(fanout_pool_, key_types,
+      [&](const DataType& type, size_t i) {
+        return TypeDB(type)->TTL(key, &timestamps[type]);
+      }, &results);
+  for (const auto& type : kProbedTypes) {
+    s = results[type];
+    if (s.ok() || s.IsNotFound()) {
+      ret[type] = timestamps[type];
+    } else {
+      ret[type] = -3;
+      (*type_status)[type] = s;
+    }
   }
   return ret;
 }
 
 // the sequence is kv, hash, list, zset, set
 Status BlackWidow::Type(const std::string &key, std::string* type) {
+  if (!shards_.empty()) {
+    return Shard(key)->Type(key, type);
+  }
   type->clear();
 
-  Status s;
-  std::string value;
-  s = strings_db_->Get(key, &value);
-  if (s.ok()) {
-    *type = "string";
-    return s;
-  } else if (!s.IsNotFound()) {
+  uint8_t types;
+  Status s = LookupKeyTypes(key_type_directory_, key, &types);
+  if (!s.ok()) {
     return s;
   }
 
-  int32_t hashes_len = 0;
-  s = hashes_db_->HLen(key, &hashes_len);
-  if (s.ok() && hashes_len != 0) {
-    *type = "hash";
-    return s;
-  } else if (!s.IsNotFound()) {
-    return s;
+  std::string value;
+  if (HasType(types, DataType::kStrings)) {
+    s = strings_db_->Get(key, &value);
+    if (s.ok()) {
+      *type = "string";
+      return s;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
   }
 
-  uint64_t lists_len = 0;
-  s = lists_db_->LLen(key, &lists_len);
-  if (s.ok() && lists_len != 0) {
-    *type = "list";
-    return s;
-  } else if (!s.IsNotFound()) {
-    return s;
+  if (HasType(types, DataType::kHashes)) {
+    int32_t hashes_len = 0;
+    s = hashes_db_->HLen(key, &hashes_len);
+    if (s.ok() && hashes_len != 0) {
+      *type = "hash";
+      return s;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
   }
 
-  int32_t zsets_size = 0;
-  s = zsets_db_->ZCard(key, &zsets_size);
-  if (s.ok() && zsets_size != 0) {
-    *type = "zset";
-    return s;
-  } else if (!s.IsNotFound()) {
-    return s;
+  if (HasType(types, DataType::kLists)) {
+    uint64_t lists_len = 0;
+    s = lists_db_->LLen(key, &lists_len);
+    if (s.ok() && lists_len != 0) {
+      *type = "list";
+      return s;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
   }
 
-  int32_t sets_size = 0;
-  s = sets_db_->SCard(key, &sets_size);
-  if (s.ok() && sets_size != 0) {
-    *type = "set";
-    return s;
-  } else if (!s.IsNotFound()) {
-    return s;
+  if (HasType(types, DataType::kZSets)) {
+    int32_t zsets_size = 0;
+    s = zsets_db_->ZCard(key, &zsets_size);
+    if (s.ok() && zsets_size != 0) {
+      *type = "zset";
+      return s;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
+  }
+
+  if (HasType(types, DataType::kSets)) {
+    int32_t sets_size = 0;
+    s = sets_db_->SCard(key, &sets_size);
+    if (s.ok() && sets_size != 0) {
+      *type = "set";
+      return s;
+    } else if (!s.IsNotFound()) {
+      return s;
+    }
   }
 
   *type = "none";
@@ -1516,6 +2857,15 @@ Status BlackWidow::Type(const std::string &key, std::string* type) {
 Status BlackWidow::Keys(const DataType& data_type,
                         const std::string& pattern,
                         std::vector<std::string>* keys) {
+  if (!shards_.empty()) {
+    for (auto shard : shards_) {
+      Status s = shard->Keys(data_type, pattern, keys);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return Status::OK();
+  }
   Status s;
   if (data_type == DataType::kStrings) {
     s = strings_db_->ScanKeys(pattern, keys);
@@ -1548,6 +2898,12 @@ Status BlackWidow::Keys(const DataType& data_type,
 }
 
 void BlackWidow::ScanDatabase(const DataType& type) {
+  if (!shards_.empty()) {
+    for (auto shard : shards_) {
+      shard->ScanDatabase(type);
+    }
+    return;
+  }
   switch (type) {
     case kStrings:
         strings_db_->ScanDatabase();
@@ -1575,35 +2931,53 @@ void BlackWidow::ScanDatabase(const DataType& type) {
 }
 
 // HyperLogLog
+static const char kIncompatibleHllValue[] =
+  "Legacy HyperLogLog values can only be merged with each other";
+
 Status BlackWidow::PfAdd(const Slice& key,
                          const std::vector<std::string>& values,
                          bool* update) {
+  if (!shards_.empty()) {
+    return Shard(key)->PfAdd(key, values, update);
+  }
   *update = false;
   if (values.size() >= kMaxKeys) {
     return Status::InvalidArgument("Invalid the number of key");
   }
+  ScopeKeyTypeMark mark(key_type_directory_, key, kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
 
-  std::string value, registers, result = "";
-  Status s = strings_db_->Get(key, &value);
-  if (s.ok()) {
-    registers = value;
-  } else if (s.IsNotFound()) {
-    registers = "";
-  } else {
+  std::string registers;
+  Status s = strings_db_->Get(key, &registers);
+  if (!s.ok() && !s.IsNotFound()) {
     return s;
   }
   HyperLogLog log(kPrecision, registers);
-  int32_t previous = static_cast<int32_t>(log.Estimate());
+  if (!log.IsValid()) {
+    return Status::InvalidArgument(kInvalidHllValue);
+  }
+  if (log.IsLegacy()) {
+    return strings_db_->PfAddLegacy(key, values, update);
+  }
+
+  // Only the registers raised here are written, as a merge operand, so
+  // concurrent PfAdds on a key never overwrite each other. The read above
+  // stays, it rejects plain strings, finds legacy values and tells whether
+  // a register changed. The merge stays under the record lock, as the
+  // other writes of strings keys (Expire, Append, the cardinality cache of
+  // PfCount...) put whole values under it, and would drop an operand
+  // merged between their read and their write.
+  std::string operand;
   for (size_t i = 0; i < values.size(); ++i) {
-    result = log.Add(values[i].data(), values[i].size());
+    log.Add(values[i].data(), values[i].size(), &operand);
   }
-  HyperLogLog update_log(kPrecision, result);
-  int32_t now = static_cast<int32_t>(update_log.Estimate());
-  if (previous != now || (s.IsNotFound() && values.size() == 0)) {
-    *update = true;
+  if (operand.empty() && !s.IsNotFound()) {
+    return Status::OK();
   }
-  s = strings_db_->Set(key, result);
-  return s;
+  *update = true;
+  return strings_db_->MergeHyperLogLog(key, operand);
 }
 
 Status BlackWidow::PfCount(const std::vector<std::string>& keys,
@@ -1612,26 +2986,39 @@ Status BlackWidow::PfCount(const std::vector<std::string>& keys,
     return Status::InvalidArgument("Invalid the number of key");
   }
 
-  std::string value, first_registers;
-  Status s = strings_db_->Get(keys[0], &value);
-  if (s.ok()) {
-    first_registers = std::string(value.data(), value.size());
-  } else if (s.IsNotFound()) {
-    first_registers = "";
+  if (keys.size() == 1) {
+    if (!shards_.empty()) {
+      return Shard(keys[0])->PfCount(keys, result);
+    }
+    return strings_db_->HyperLogLogCount(keys[0], result);
+  }
+
+  // Get reads each key from its own shard
+  std::string first_registers;
+  Status s = Get(keys[0], &first_registers);
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
   }
 
   HyperLogLog first_log(kPrecision, first_registers);
+  if (!first_log.IsValid()) {
+    return Status::InvalidArgument(kInvalidHllValue);
+  }
+  std::string registers;
   for (size_t i = 1; i < keys.size(); ++i) {
-    std::string value, registers;
-    s = strings_db_->Get(keys[i], &value);
-    if (s.ok()) {
-      registers = value;
-    } else if (s.IsNotFound()) {
+    s = Get(keys[i], &registers);
+    if (s.IsNotFound()) {
       continue;
-    } else {
+    } else if (!s.ok()) {
       return s;
     }
     HyperLogLog log(kPrecision, registers);
+    if (!log.IsValid()) {
+      return Status::InvalidArgument(kInvalidHllValue);
+    }
+    if (!first_log.Compatible(log)) {
+      return Status::InvalidArgument(kIncompatibleHllValue);
+    }
     first_log.Merge(log);
   }
   *result = static_cast<int32_t>(first_log.Estimate());
@@ -1642,33 +3029,46 @@ Status BlackWidow::PfMerge(const std::vector<std::string>& keys) {
   if (keys.size() >= kMaxKeys || keys.size() <= 0) {
     return Status::InvalidArgument("Invalid the number of key");
   }
+  if (!shards_.empty()) {
+    size_t index;
+    if (!InOneShard(keys, &index)) {
+      return Status::NotSupported(kCrossShardKeys);
+    }
+    return shards_[index]->PfMerge(keys);
+  }
+  ScopeKeyTypeMark mark(key_type_directory_, keys[0], kStrings);
+  if (!mark.status().ok()) {
+    return mark.status();
+  }
 
-  Status s;
-  std::string value, first_registers, result;
-  s = strings_db_->Get(keys[0], &value);
-  if (s.ok()) {
-    first_registers = std::string(value.data(), value.size());
-  } else if (s.IsNotFound()) {
-    first_registers = "";
+  std::string first_registers;
+  Status s = strings_db_->Get(keys[0], &first_registers);
+  if (!s.ok() && !s.IsNotFound()) {
+    return s;
   }
 
-  result = first_registers;
   HyperLogLog first_log(kPrecision, first_registers);
+  if (!first_log.IsValid()) {
+    return Status::InvalidArgument(kInvalidHllValue);
+  }
+  std::string registers;
   for (size_t i = 1; i < keys.size(); ++i) {
-    std::string value, registers;
-    s = strings_db_->Get(keys[i], &value);
-    if (s.ok()) {
-      registers = std::string(value.data(), value.size());
-    } else if (s.IsNotFound()) {
+    s = strings_db_->Get(keys[i], &registers);
+    if (s.IsNotFound()) {
       continue;
-    } else {
+    } else if (!s.ok()) {
       return s;
     }
     HyperLogLog log(kPrecision, registers);
-    result = first_log.Merge(log);
+    if (!log.IsValid()) {
+      return Status::InvalidArgument(kInvalidHllValue);
+    }
+    if (!first_log.Compatible(log)) {
+      return Status::InvalidArgument(kIncompatibleHllValue);
+    }
+    first_log.Merge(log);
   }
-  s = strings_db_->Set(keys[0], result);
-  return s;
+  return strings_db_->Set(keys[0], first_log.Serialize());
 }
 
 static void* StartBGThreadWrapper(void* arg) {
@@ -1677,59 +3077,101 @@ static void* StartBGThreadWrapper(void* arg) {
   return NULL;
 }
 
-Status BlackWidow::StartBGThread() {
-  int result = pthread_create(&bg_tasks_thread_id_,
-      NULL, StartBGThreadWrapper, this);
-  if (result != 0) {
-    char msg[128];
-    snprintf(msg, sizeof(msg), "pthread create: %s", strerror(result));
-    return Status::Corruption(msg);
+// One worker is kept for the CompactKey tasks, if there is more than one
+Status BlackWidow::StartBGThread(size_t workers) {
+  workers = std::max<size_t>(workers, 1);
+  bg_tasks_queue_ = new BGTaskQueue(workers > 1 ? workers - 1 : 1);
+  for (size_t i = 0; i < workers; ++i) {
+    pthread_t thread_id;
+    int result = pthread_create(&thread_id, NULL, StartBGThreadWrapper, this);
+    if (result != 0) {
+      char msg[128];
+      snprintf(msg, sizeof(msg), "pthread create: %s", strerror(result));
+      return Status::Corruption(msg);
+    }
+    bg_tasks_threads_.push_back(thread_id);
   }
   return Status::OK();
 }
 
 Status BlackWidow::AddBGTask(const BGTask& bg_task) {
-  bg_tasks_mutex_.Lock();
-  if (bg_task.type == kAll) {
-    // if current task it is global compact,
-    // clear the bg_tasks_queue_;
-    std::queue<BGTask> empty_queue;
-    bg_tasks_queue_.swap(empty_queue);
-  }
-  bg_tasks_queue_.push(bg_task);
-  bg_tasks_cond_var_.Signal();
-  bg_tasks_mutex_.Unlock();
+  if (!shards_.empty()) {
+    if (bg_task.operation == kCompactKey) {
+      return Shard(bg_task.argv)->AddBGTask(bg_task);
+    }
+    for (auto shard : shards_) {
+      shard->AddBGTask(bg_task);
+    }
+    return Status::OK();
+  }
+  if (bg_tasks_queue_ == nullptr) {
+    return Status::Incomplete("db is not opened");
+  }
+  bg_tasks_queue_->Push(bg_task);
   return Status::OK();
 }
 
 Status BlackWidow::RunBGTask() {
   BGTask task;
-  while (!bg_tasks_should_exit_) {
-    bg_tasks_mutex_.Lock();
-    while (bg_tasks_queue_.empty() && !bg_tasks_should_exit_) {
-      bg_tasks_cond_var_.Wait();
-    }
-
-    if (!bg_tasks_queue_.empty()) {
-      task = bg_tasks_queue_.front();
-      bg_tasks_queue_.pop();
-    }
-    bg_tasks_mutex_.Unlock();
-
-    if (bg_tasks_should_exit_) {
-      return Status::Incomplete("bgtask return with bg_tasks_should_exit true");
-    }
-
+  while (bg_tasks_queue_->Pop(&task)) {
+    uint64_t start_micros = rocksdb::Env::Default()->NowMicros();
     if (task.operation == kCleanAll) {
       DoCompact(task.type);
     } else if (task.operation == kCompactKey) {
       CompactKey(task.type, task.argv);
     }
+    bg_tasks_queue_->Finish(task,
+        rocksdb::Env::Default()->NowMicros() - start_micros);
+  }
+  return Status::Incomplete("bgtask return with the bg task queue closed");
+}
+
+Status BlackWidow::GetBGTaskStats(BGTaskStats* stats) {
+  if (!shards_.empty()) {
+    *stats = BGTaskStats();
+    uint64_t total_wait_micros = 0, total_run_micros = 0;
+    BGTaskStats shard_stats;
+    for (auto shard : shards_) {
+      shard->GetBGTaskStats(&shard_stats);
+      stats->queued_key_tasks += shard_stats.queued_key_tasks;
+      stats->queued_full_tasks += shard_stats.queued_full_tasks;
+      stats->running_tasks += shard_stats.running_tasks;
+      stats->finished_tasks += shard_stats.finished_tasks;
+      stats->deduped_tasks += shard_stats.deduped_tasks;
+      stats->cancelled_tasks += shard_stats.cancelled_tasks;
+      total_wait_micros += shard_stats.avg_wait_micros
+        * (shard_stats.finished_tasks + shard_stats.running_tasks);
+      total_run_micros += shard_stats.avg_run_micros
+        * shard_stats.finished_tasks;
+      stats->max_wait_micros = std::max(stats->max_wait_micros,
+                                        shard_stats.max_wait_micros);
+      stats->max_run_micros = std::max(stats->max_run_micros,
+                                       shard_stats.max_run_micros);
+    }
+    uint64_t started = stats->finished_tasks + stats->running_tasks;
+    stats->avg_wait_micros = started ? total_wait_micros / started : 0;
+    stats->avg_run_micros = stats->finished_tasks
+      ? total_run_micros / stats->finished_tasks : 0;
+    return Status::OK();
+  }
+  if (bg_tasks_queue_ == nullptr) {
+    *stats = BGTaskStats();
+    return Status::OK();
   }
+  bg_tasks_queue_->GetStats(stats);
   return Status::OK();
 }
 
 Status BlackWidow::Compact(const DataType& type, bool sync) {
+  if (!shards_.empty()) {
+    for (auto shard : shards_) {
+      Status s = shard->Compact(type, sync);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return Status::OK();
+  }
   if (sync) {
     return DoCompact(type);
   } else {
@@ -1739,6 +3181,15 @@ Status BlackWidow::Compact(const DataType& type, bool sync) {
 }
 
 Status BlackWidow::DoCompact(const DataType& type) {
+  if (!shards_.empty()) {
+    for (auto shard : shards_) {
+      Status s = shard->DoCompact(type);
+      if (!s.ok()) {
+        return s;
+      }
+    }
+    return Status::OK();
+  }
   if (type != kAll
     && type != kStrings
     && type != kHashes
@@ -1748,35 +3199,41 @@ Status BlackWidow::DoCompact(const DataType& type) {
     return Status::InvalidArgument("");
   }
 
+  Operation operation = type == kStrings ? kCleanStrings
+    : type == kHashes ? kCleanHashes
+    : type == kSets ? kCleanSets
+    : type == kZSets ? kCleanZSets
+    : type == kLists ? kCleanLists : kCleanAll;
+  running_full_tasks_[operation]++;
   Status s;
   if (type == kStrings) {
-    current_task_type_ = Operation::kCleanStrings;
     s = strings_db_->CompactRange(NULL, NULL);
   } else if (type == kHashes) {
-    current_task_type_ = Operation::kCleanHashes;
     s = hashes_db_->CompactRange(NULL, NULL);
   } else if (type == kSets) {
-    current_task_type_ = Operation::kCleanSets;
     s = sets_db_->CompactRange(NULL, NULL);
   } else if (type == kZSets) {
-    current_task_type_ = Operation::kCleanZSets;
     s = zsets_db_->CompactRange(NULL, NULL);
   } else if (type == kLists) {
-    current_task_type_ = Operation::kCleanLists;
     s = lists_db_->CompactRange(NULL, NULL);
   } else {
-    current_task_type_ = Operation::kCleanAll;
     s = strings_db_->CompactRange(NULL, NULL);
     s = hashes_db_->CompactRange(NULL, NULL);
     s = sets_db_->CompactRange(NULL, NULL);
     s = zsets_db_->CompactRange(NULL, NULL);
     s = lists_db_->CompactRange(NULL, NULL);
+    if (key_type_directory_ != nullptr) {
+      s = key_type_directory_->CompactRange();
+    }
   }
-  current_task_type_ = Operation::kNone;
+  running_full_tasks_[operation]--;
   return s;
 }
 
 Status BlackWidow::CompactKey(const DataType& type, const std::string& key) {
+  if (!shards_.empty()) {
+    return Shard(key)->CompactKey(type, key);
+  }
   std::string meta_start_key, meta_end_key;
   std::string data_start_key, data_end_key;
   CalculateMetaStartAndEndKey(key, &meta_start_key, &meta_end_key);
@@ -1802,6 +3259,12 @@ Status BlackWidow::CompactKey(const DataType& type, const std::string& key) {
 }
 
 Status BlackWidow::SetMaxCacheStatisticKeys(uint32_t max_cache_statistic_keys) {
+  if (!shards_.empty()) {
+    for (auto shard : shards_) {
+      shard->SetMaxCacheStatisticKeys(max_cache_statistic_keys);
+    }
+    return Status::OK();
+  }
   std::vector<Redis*> dbs = {sets_db_, zsets_db_, hashes_db_, lists_db_};
   for (const auto& db : dbs) {
     db->SetMaxCacheStatisticKeys(max_cache_statistic_keys);
@@ -1810,6 +3273,12 @@ Status BlackWidow::SetMaxCacheStatisticKeys(uint32_t max_cache_statistic_keys) {
 }
 
 Status BlackWidow::SetSmallCompactionThreshold(uint32_t small_compaction_threshold) {
+  if (!shards_.empty()) {
+    for (auto shard : shards_) {
+      shard->SetSmallCompactionThreshold(small_compaction_threshold);
+    }
+    return Status::OK();
+  }
   std::vector<Redis*> dbs = {sets_db_, zsets_db_, hashes_db_, lists_db_};
   for (const auto& db : dbs) {
     db->SetSmallCompactionThreshold(small_compaction_threshold);
@@ -1817,25 +3286,29 @@ Status BlackWidow::SetSmallCompactionThreshold(uint32_t small_compaction_thresho
   return Status::OK();
 }
 
+void BlackWidow::CountRunningFullTasks(std::vector<int>* running) {
+  for (auto shard : shards_) {
+    shard->CountRunningFullTasks(running);
+  }
+  for (int op = kNone; op < kCompactKey; ++op) {
+    (*running)[op] += running_full_tasks_[op];
+  }
+}
+
+// The types of all the full compactions running, comma separated
 std::string BlackWidow::GetCurrentTaskType() {
-  int type = current_task_type_;
-  switch (type) {
-    case kCleanAll:
-      return "All";
-    case kCleanStrings:
-      return "String";
-    case kCleanHashes:
-      return "Hash";
-    case kCleanZSets:
-      return "ZSet";
-    case kCleanSets:
-      return "Set";
-    case kCleanLists:
-      return "List";
-    case kNone:
-    default:
-      return "No";
+  static const char* const kTaskTypeNames[kCompactKey] = {
+    "No", "All", "String", "Hash", "ZSet", "Set", "List"};
+  std::vector<int> running(kCompactKey, 0);
+  CountRunningFullTasks(&running);
+  std::string task_type;
+  for (int op = kCleanAll; op < kCompactKey; ++op) {
+    if (running[op] > 0) {
+      task_type += (task_type.empty() ? "" : ",");
+      task_type += kTaskTypeNames[op];
+    }
   }
+  return task_type.empty() ? kTaskTypeNames[kNone] : task_type;
 }
 
 Status BlackWidow::GetUsage(const std::string& property, uint64_t* const result) {
@@ -1856,6 +3329,13 @@ Status BlackWidow::GetUsage(const std::string& property,
 
 uint64_t BlackWidow::GetProperty(const std::string& db_type,
                                  const std::string& property) {
+  if (!shards_.empty()) {
+    uint64_t result = 0;
+    for (auto shard : shards_) {
+      result += shard->GetProperty(db_type, property);
+    }
+    return result;
+  }
   uint64_t out = 0, result = 0;
   if (db_type == ALL_DB || db_type == STRINGS_DB) {
     strings_db_->GetProperty(property, &out);
@@ -1881,6 +3361,31 @@ uint64_t BlackWidow::GetProperty(const std::string& db_type,
 }
 
 Status BlackWidow::GetKeyNum(std::vector<KeyInfo>* key_infos) {
+  if (!shards_.empty()) {
+    // the avg_ttl of the shards weighted by their expires
+    std::vector<KeyInfo> shard_infos;
+    std::vector<uint64_t> ttl_sums;
+    for (auto shard : shards_) {
+      shard_infos.clear();
+      Status s = shard->GetKeyNum(&shard_infos);
+      if (!s.ok()) {
+        return s;
+      }
+      key_infos->resize(shard_infos.size(), KeyInfo());
+      ttl_sums.resize(shard_infos.size(), 0);
+      for (size_t i = 0; i < shard_infos.size(); ++i) {
+        (*key_infos)[i].keys += shard_infos[i].keys;
+        (*key_infos)[i].expires += shard_infos[i].expires;
+        (*key_infos)[i].invaild_keys += shard_infos[i].invaild_keys;
+        ttl_sums[i] += shard_infos[i].avg_ttl * shard_infos[i].expires;
+      }
+    }
+    for (size_t i = 0; i < key_infos->size(); ++i) {
+      (*key_infos)[i].avg_ttl = (*key_infos)[i].expires == 0 ? 0
+        : ttl_sums[i] / (*key_infos)[i].expires;
+    }
+    return Status::OK();
+  }
   KeyInfo key_info;
   // NOTE: keep the db order with string, hash, list, zset, set
   std::vector<Redis*> dbs = {strings_db_, hashes_db_,
@@ -1890,7 +3395,9 @@ Status BlackWidow::GetKeyNum(std::vector<KeyInfo>* key_infos) {
     if (scan_keynum_exit_) {
       break;
     }
-    db->ScanKeyNum(&key_info);
+    if (!estimate_key_num_ || !EstimateKeyNum(db->GetDB(), &key_info).ok()) {
+      db->ScanKeyNum(&key_info);
+    }
     key_infos->push_back(key_info);
   }
   if (scan_keynum_exit_) {
@@ -1900,12 +3407,88 @@ Status BlackWidow::GetKeyNum(std::vector<KeyInfo>* key_infos) {
   return Status::OK();
 }
 
+Status BlackWidow::GetZSetsCacheInfo(ZSetsCacheInfo* info) {
+  if (!shards_.empty()) {
+    *info = ZSetsCacheInfo();
+    ZSetsCacheInfo shard_info;
+    for (auto shard : shards_) {
+      shard->GetZSetsCacheInfo(&shard_info);
+      info->hits += shard_info.hits;
+      info->misses += shard_info.misses;
+      info->windows += shard_info.windows;
+      info->usage += shard_info.usage;
+      info->capacity += shard_info.capacity;
+    }
+    return Status::OK();
+  }
+  zsets_db_->GetWindowCacheInfo(info);
+  return Status::OK();
+}
+
+// Keeps the top_n largest entries of list
+template <typename Stat, typename Count>
+static void TrimLockStatList(size_t top_n, Count count,
+                             std::vector<Stat>* list) {
+  std::sort(list->begin(), list->end(),
+            [&](const Stat& a, const Stat& b) {
+              return count(a) > count(b);
+            });
+  list->resize(std::min(list->size(), top_n));
+}
+
+Status BlackWidow::GetLockStats(LockStats* stats) {
+  *stats = LockStats();
+  stats->wait_histogram.resize(kLockWaitBuckets, 0);
+  if (!shards_.empty()) {
+    LockStats shard_stats;
+    for (auto shard : shards_) {
+      shard->GetLockStats(&shard_stats);
+      stats->contended += shard_stats.contended;
+      stats->total_wait_micros += shard_stats.total_wait_micros;
+      stats->max_wait_micros = std::max(stats->max_wait_micros,
+                                        shard_stats.max_wait_micros);
+      for (size_t i = 0; i < kLockWaitBuckets; ++i) {
+        stats->wait_histogram[i] += shard_stats.wait_histogram[i];
+      }
+      stats->hot_slots.insert(stats->hot_slots.end(),
+          shard_stats.hot_slots.begin(), shard_stats.hot_slots.end());
+      stats->hot_keys.insert(stats->hot_keys.end(),
+          shard_stats.hot_keys.begin(), shard_stats.hot_keys.end());
+      stats->longest_holders.insert(stats->longest_holders.end(),
+          shard_stats.longest_holders.begin(),
+          shard_stats.longest_holders.end());
+    }
+  } else if (is_opened_) {
+    std::vector<Redis*> dbs = {strings_db_, hashes_db_,
+      lists_db_, zsets_db_, sets_db_};
+    for (auto db : dbs) {
+      db->GetLockStats(stats);
+    }
+  }
+  TrimLockStatList(lock_stats_top_n_,
+                   [](const LockSlotStat& s) { return s.contended; },
+                   &stats->hot_slots);
+  TrimLockStatList(lock_stats_top_n_,
+                   [](const LockKeyStat& s) { return s.count; },
+                   &stats->hot_keys);
+  TrimLockStatList(lock_stats_top_n_,
+                   [](const LockKeyStat& s) { return s.count; },
+                   &stats->longest_holders);
+  return Status::OK();
+}
+
 Status BlackWidow::StopScanKeyNum() {
+  for (auto shard : shards_) {
+    shard->StopScanKeyNum();
+  }
   scan_keynum_exit_ = true;
   return Status::OK();
 }
 
 rocksdb::DB* BlackWidow::GetDBByType(const std::string& type) {
+  if (!shards_.empty()) {
+    return NULL;
+  }
   if (type == STRINGS_DB) {
     return strings_db_->GetDB();
   } else if (type == HASHES_DB) {
@@ -69,5 +69,41 @@ inline uint64_t DecodeFixed64(const char* ptr) {
   }
 }
 
+// Order-preserving double: the IEEE 754 bits stored big-endian, with the
+// sign bit flipped for non-negative values and every bit flipped for
+// negative ones, so that memcmp order matches numeric order. -0.0 is
+// folded into 0.0 because the two compare equal as doubles.
+inline void EncodeOrderedDouble(char* buf, double value) {
+  if (value == 0) {
+    value = 0;
+  }
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  if (bits & (1ULL << 63)) {
+    bits = ~bits;
+  } else {
+    bits |= (1ULL << 63);
+  }
+  for (int i = 7; i >= 0; --i) {
+    buf[i] = static_cast<char>(bits & 0xff);
+    bits >>= 8;
+  }
+}
+
+inline double DecodeOrderedDouble(const char* ptr) {
+  uint64_t bits = 0;
+  for (int i = 0; i < 8; ++i) {
+    bits = (bits << 8) | static_cast<unsigned char>(ptr[i]);
+  }
+  if (bits & (1ULL << 63)) {
+    bits &= ~(1ULL << 63);
+  } else {
+    bits = ~bits;
+  }
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
+}
+
 }  // namespace blackwidow
 #endif  // SRC_CODING_H_
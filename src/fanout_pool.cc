@@ -0,0 +1,112 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/fanout_pool.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace blackwidow {
+
+FanoutPool::FanoutPool(size_t threads)
+    : cv_(&mu_),
+      should_exit_(false) {
+  for (size_t i = 0; i < threads; ++i) {
+    pthread_t thread_id;
+    int result = pthread_create(&thread_id, NULL, StartWorker, this);
+    if (result != 0) {
+      fprintf(stderr, "pthread create fanout worker: %s\n", strerror(result));
+      break;
+    }
+    workers_.push_back(thread_id);
+  }
+}
+
+FanoutPool::~FanoutPool() {
+  mu_.Lock();
+  should_exit_ = true;
+  cv_.SignalAll();
+  mu_.Unlock();
+
+  int ret = 0;
+  for (auto thread_id : workers_) {
+    if ((ret = pthread_join(thread_id, NULL)) != 0) {
+      fprintf(stderr, "pthread_join failed with fanout worker error %d\n", ret);
+    }
+  }
+}
+
+void* FanoutPool::StartWorker(void* arg) {
+  reinterpret_cast<FanoutPool*>(arg)->RunWorker();
+  return NULL;
+}
+
+void FanoutPool::RunWorker() {
+  mu_.Lock();
+  while (true) {
+    while (queue_.empty() && !should_exit_) {
+      cv_.Wait();
+    }
+    if (should_exit_) {
+      break;
+    }
+    Task task = queue_.front();
+    queue_.pop_front();
+    mu_.Unlock();
+
+    (*task.fn)();
+
+    mu_.Lock();
+    if (--task.batch->pending == 0) {
+      task.batch->done.Signal();
+    }
+  }
+  mu_.Unlock();
+}
+
+void FanoutPool::Run(const std::vector<std::function<void()>>& tasks) {
+  if (workers_.empty() || tasks.size() <= 1) {
+    for (const auto& task : tasks) {
+      task();
+    }
+    return;
+  }
+
+  Batch batch(&mu_);
+  mu_.Lock();
+  for (size_t i = 1; i < tasks.size(); ++i) {
+    queue_.push_back({&tasks[i], &batch});
+  }
+  batch.pending = tasks.size() - 1;
+  cv_.SignalAll();
+  mu_.Unlock();
+
+  tasks[0]();
+
+  std::vector<const std::function<void()>*> taken;
+  mu_.Lock();
+  for (auto iter = queue_.begin(); iter != queue_.end();) {
+    if (iter->batch == &batch) {
+      taken.push_back(iter->fn);
+      iter = queue_.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+  batch.pending -= taken.size();
+  mu_.Unlock();
+
+  for (auto fn : taken) {
+    (*fn)();
+  }
+
+  mu_.Lock();
+  while (batch.pending > 0) {
+    batch.done.Wait();
+  }
+  mu_.Unlock();
+}
+
+}  //  namespace blackwidow
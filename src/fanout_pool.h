@@ -0,0 +1,57 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_FANOUT_POOL_H_
+#define SRC_FANOUT_POOL_H_
+
+#include <pthread.h>
+
+#include <deque>
+#include <vector>
+#include <functional>
+
+#include "slash/include/slash_mutex.h"
+
+namespace blackwidow {
+
+// Runs the tasks of one call concurrently on a fixed set of workers. The
+// calling thread runs the first task itself, then takes back the tasks no
+// worker has started yet, so a busy pool never makes a call much slower
+// than running its tasks one after another. Without workers every task
+// runs on the calling thread.
+class FanoutPool {
+ public:
+  explicit FanoutPool(size_t threads);
+  ~FanoutPool();
+
+  // Returns once all the tasks are done
+  void Run(const std::vector<std::function<void()>>& tasks);
+
+ private:
+  struct Batch {
+    explicit Batch(slash::Mutex* mu) : pending(0), done(mu) {}
+    size_t pending;
+    slash::CondVar done;
+  };
+  struct Task {
+    const std::function<void()>* fn;
+    Batch* batch;
+  };
+
+  static void* StartWorker(void* arg);
+  void RunWorker();
+
+  slash::Mutex mu_;
+  slash::CondVar cv_;
+  std::deque<Task> queue_;
+  bool should_exit_;
+  std::vector<pthread_t> workers_;
+
+  FanoutPool(const FanoutPool&);
+  void operator=(const FanoutPool&);
+};
+
+}  //  namespace blackwidow
+#endif  //  SRC_FANOUT_POOL_H_
@@ -0,0 +1,76 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_HYPERLOGLOG_MERGE_OPERATOR_H_
+#define SRC_HYPERLOGLOG_MERGE_OPERATOR_H_
+
+#include <string>
+#include <deque>
+#include <vector>
+
+#include "rocksdb/merge_operator.h"
+#include "blackwidow/blackwidow.h"
+#include "src/redis_hyperloglog.h"
+#include "src/strings_value_format.h"
+
+namespace blackwidow {
+
+// Folds the register updates PfAdd writes as merge operands into the
+// HyperLogLog value of a strings key. The value keeps its timestamp, a
+// missing or stale value starts as an empty HyperLogLog, and a value that
+// is no longer a HyperLogLog, because it was overwritten by a plain SET,
+// is left as it is.
+class HyperLogLogMergeOperator : public rocksdb::MergeOperator {
+ public:
+  HyperLogLogMergeOperator() = default;
+
+  bool FullMergeV2(const MergeOperationInput& merge_in,
+                   MergeOperationOutput* merge_out) const override {
+    std::string registers;
+    int32_t timestamp = 0;
+    if (merge_in.existing_value != nullptr) {
+      ParsedStringsValue parsed_strings_value(*merge_in.existing_value);
+      if (!parsed_strings_value.IsStale()) {
+        registers = parsed_strings_value.value().ToString();
+        timestamp = parsed_strings_value.timestamp();
+      }
+    }
+
+    HyperLogLog log(BlackWidow::kPrecision, registers);
+    if (!log.IsValid() || log.IsLegacy()) {
+      merge_out->new_value.assign(merge_in.existing_value->data(),
+                                  merge_in.existing_value->size());
+      return true;
+    }
+    for (const auto& operand : merge_in.operand_list) {
+      log.MergeOperand(operand.data(), operand.size());
+    }
+
+    std::string result = log.Serialize();
+    StringsValue strings_value(result);
+    strings_value.set_timestamp(timestamp);
+    merge_out->new_value = strings_value.Encode().ToString();
+    return true;
+  }
+
+  // Operands are lists of registers, joining them loses nothing
+  bool PartialMergeMulti(const rocksdb::Slice& key,
+                         const std::deque<rocksdb::Slice>& operand_list,
+                         std::string* new_value,
+                         rocksdb::Logger* logger) const override {
+    new_value->clear();
+    for (const auto& operand : operand_list) {
+      new_value->append(operand.data(), operand.size());
+    }
+    return true;
+  }
+
+  const char* Name() const override {
+    return "HyperLogLogMergeOperator";
+  }
+};
+
+}  //  namespace blackwidow
+#endif  // SRC_HYPERLOGLOG_MERGE_OPERATOR_H_
@@ -0,0 +1,179 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/key_num_collector.h"
+
+#include <algorithm>
+
+#include "rocksdb/env.h"
+
+#include "src/coding.h"
+#include "src/strings_value_format.h"
+#include "src/base_meta_value_format.h"
+#include "src/lists_meta_value_format.h"
+
+namespace blackwidow {
+
+static const char kKeyNumKeys[] = "blackwidow.key_num.keys";
+static const char kKeyNumDeletions[] = "blackwidow.key_num.deletions";
+static const char kKeyNumExpires[] = "blackwidow.key_num.expires";
+static const char kKeyNumTimestampSum[] = "blackwidow.key_num.timestamp_sum";
+static const char kKeyNumMaxTimestamp[] = "blackwidow.key_num.max_timestamp";
+static const char kKeyNumInvalidKeys[] = "blackwidow.key_num.invalid_keys";
+
+class KeyNumCollector : public rocksdb::TablePropertiesCollector {
+ public:
+  explicit KeyNumCollector(const DataType& type)
+      : type_(type), keys_(0), deletions_(0), expires_(0),
+        timestamp_sum_(0), max_timestamp_(0), invalid_keys_(0) {
+    int64_t unix_time;
+    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+    cur_time_ = static_cast<int32_t>(unix_time);
+  }
+
+  Status AddUserKey(const rocksdb::Slice& key, const rocksdb::Slice& value,
+                    rocksdb::EntryType type, rocksdb::SequenceNumber seq,
+                    uint64_t file_size) override {
+    if (type == rocksdb::kEntryDelete || type == rocksdb::kEntrySingleDelete) {
+      // the key counted in an older file
+      deletions_++;
+      return Status::OK();
+    } else if (type != rocksdb::kEntryPut) {
+      return Status::OK();
+    }
+
+    int32_t timestamp;
+    bool is_empty = false;
+    if (type_ == kStrings) {
+      ParsedStringsValue parsed_strings_value(value);
+      timestamp = parsed_strings_value.timestamp();
+    } else if (type_ == kLists) {
+      ParsedListsMetaValue parsed_lists_meta_value(value);
+      timestamp = parsed_lists_meta_value.timestamp();
+      is_empty = parsed_lists_meta_value.count() == 0;
+    } else {
+      ParsedBaseMetaValue parsed_base_meta_value(value);
+      timestamp = parsed_base_meta_value.timestamp();
+      is_empty = parsed_base_meta_value.count() == 0;
+    }
+
+    if (is_empty || (timestamp != 0 && timestamp < cur_time_)) {
+      invalid_keys_++;
+    } else {
+      keys_++;
+      if (timestamp != 0) {
+        expires_++;
+        timestamp_sum_ += timestamp;
+        max_timestamp_ = std::max<uint64_t>(max_timestamp_, timestamp);
+      }
+    }
+    return Status::OK();
+  }
+
+  Status Finish(rocksdb::UserCollectedProperties* properties) override {
+    Add(properties, kKeyNumKeys, keys_);
+    Add(properties, kKeyNumDeletions, deletions_);
+    Add(properties, kKeyNumExpires, expires_);
+    Add(properties, kKeyNumTimestampSum, timestamp_sum_);
+    Add(properties, kKeyNumMaxTimestamp, max_timestamp_);
+    Add(properties, kKeyNumInvalidKeys, invalid_keys_);
+    return Status::OK();
+  }
+
+  rocksdb::UserCollectedProperties GetReadableProperties() const override {
+    return {{kKeyNumKeys, std::to_string(keys_)},
+            {kKeyNumDeletions, std::to_string(deletions_)},
+            {kKeyNumExpires, std::to_string(expires_)},
+            {kKeyNumTimestampSum, std::to_string(timestamp_sum_)},
+            {kKeyNumMaxTimestamp, std::to_string(max_timestamp_)},
+            {kKeyNumInvalidKeys, std::to_string(invalid_keys_)}};
+  }
+
+  const char* Name() const override {
+    return "KeyNumCollector";
+  }
+
+ private:
+  DataType type_;
+  int32_t cur_time_;
+  uint64_t keys_;
+  uint64_t deletions_;
+  uint64_t expires_;
+  uint64_t timestamp_sum_;
+  uint64_t max_timestamp_;
+  uint64_t invalid_keys_;
+
+  static void Add(rocksdb::UserCollectedProperties* properties,
+                  const char* name, uint64_t value) {
+    char buf[sizeof(uint64_t)];
+    EncodeFixed64(buf, value);
+    (*properties)[name] = std::string(buf, sizeof(buf));
+  }
+};
+
+rocksdb::TablePropertiesCollector*
+KeyNumCollectorFactory::CreateTablePropertiesCollector(
+    rocksdb::TablePropertiesCollectorFactory::Context context) {
+  return new KeyNumCollector(type_);
+}
+
+static bool GetProperty(const rocksdb::UserCollectedProperties& properties,
+                        const char* name, uint64_t* value) {
+  auto iter = properties.find(name);
+  if (iter == properties.end() || iter->second.size() != sizeof(uint64_t)) {
+    return false;
+  }
+  *value = DecodeFixed64(iter->second.data());
+  return true;
+}
+
+Status EstimateKeyNum(rocksdb::DB* db, KeyInfo* key_info) {
+  rocksdb::TablePropertiesCollection collection;
+  Status s = db->GetPropertiesOfAllTables(&collection);
+  if (!s.ok()) {
+    return s;
+  }
+
+  int64_t unix_time;
+  rocksdb::Env::Default()->GetCurrentTime(&unix_time);
+  uint64_t cur_time = static_cast<uint64_t>(unix_time);
+
+  uint64_t keys = 0, deletions = 0, expires = 0;
+  uint64_t timestamp_sum = 0, invalid_keys = 0;
+  for (const auto& table : collection) {
+    const auto& properties = table.second->user_collected_properties;
+    uint64_t file_keys, file_deletions, file_expires;
+    uint64_t file_timestamp_sum, file_max_timestamp, file_invalid_keys;
+    if (!GetProperty(properties, kKeyNumKeys, &file_keys)
+      || !GetProperty(properties, kKeyNumDeletions, &file_deletions)
+      || !GetProperty(properties, kKeyNumExpires, &file_expires)
+      || !GetProperty(properties, kKeyNumTimestampSum, &file_timestamp_sum)
+      || !GetProperty(properties, kKeyNumMaxTimestamp, &file_max_timestamp)
+      || !GetProperty(properties, kKeyNumInvalidKeys, &file_invalid_keys)) {
+      return Status::Incomplete("table written without key num properties");
+    }
+
+    keys += file_keys;
+    deletions += file_deletions;
+    invalid_keys += file_invalid_keys;
+    if (file_expires != 0 && file_max_timestamp < cur_time) {
+      keys -= file_expires;
+      invalid_keys += file_expires;
+    } else {
+      expires += file_expires;
+      timestamp_sum += file_timestamp_sum;
+    }
+  }
+
+  keys = keys > deletions ? keys - deletions : 0;
+  key_info->keys = keys;
+  key_info->expires = std::min(expires, keys);
+  key_info->avg_ttl = (expires != 0 && timestamp_sum / expires > cur_time)
+    ? timestamp_sum / expires - cur_time : 0;
+  key_info->invaild_keys = invalid_keys;
+  return Status::OK();
+}
+
+}  //  namespace blackwidow
@@ -0,0 +1,49 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_KEY_NUM_COLLECTOR_H_
+#define SRC_KEY_NUM_COLLECTOR_H_
+
+#include <string>
+
+#include "rocksdb/db.h"
+#include "rocksdb/table_properties.h"
+
+#include "blackwidow/blackwidow.h"
+
+namespace blackwidow {
+
+/*
+ * Records in the properties of every SST file of a meta column family how
+ * many keys it holds, how many of them have a ttl and the sum of their
+ * expire timestamps. The numbers are taken as the file is written by a
+ * flush or a compaction, so they follow the writes, drop what compaction
+ * filters dropped, and are persisted with the file itself.
+ */
+class KeyNumCollectorFactory
+    : public rocksdb::TablePropertiesCollectorFactory {
+ public:
+  explicit KeyNumCollectorFactory(const DataType& type) : type_(type) {}
+
+  rocksdb::TablePropertiesCollector* CreateTablePropertiesCollector(
+      rocksdb::TablePropertiesCollectorFactory::Context context) override;
+
+  const char* Name() const override {
+    return "KeyNumCollectorFactory";
+  }
+
+ private:
+  DataType type_;
+};
+
+// Adds up the properties of all the SST files of the meta column family
+// of db, as of now: keys whose files show they all expired since are
+// counted as invalid. Unflushed writes are not counted, and a key written
+// to several files counts once per file until compaction merges them.
+// return Incomplete if a file was written before the properties existed
+Status EstimateKeyNum(rocksdb::DB* db, KeyInfo* key_info);
+
+}  //  namespace blackwidow
+#endif  //  SRC_KEY_NUM_COLLECTOR_H_
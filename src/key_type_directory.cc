@@ -0,0 +1,344 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/key_type_directory.h"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <memory>
+
+#include "rocksdb/merge_operator.h"
+#include "rocksdb/compaction_filter.h"
+#include "rocksdb/filter_policy.h"
+#include "rocksdb/table.h"
+#include "rocksdb/convenience.h"
+
+#include "src/murmurhash.h"
+
+namespace blackwidow {
+
+static const char kBuiltKey[] = "built";
+static const size_t kMarkedKeysCapacity = 1 << 16;
+static const size_t kMarkedKeysShards = 16;
+static const DataType kDirectoryTypes[] = {
+  kStrings, kHashes, kSets, kLists, kZSets};
+
+// Entries are the OR of all the type bits merged into them
+class KeyTypeMergeOperator : public rocksdb::AssociativeMergeOperator {
+ public:
+  bool Merge(const rocksdb::Slice& key,
+             const rocksdb::Slice* existing_value,
+             const rocksdb::Slice& value,
+             std::string* new_value,
+             rocksdb::Logger* logger) const override {
+    char types = 0;
+    if (existing_value != nullptr && !existing_value->empty()) {
+      types = (*existing_value)[0];
+    }
+    if (!value.empty()) {
+      types |= value[0];
+    }
+    new_value->assign(1, types);
+    return true;
+  }
+
+  const char* Name() const override {
+    return "blackwidow.KeyTypeMergeOperator";
+  }
+};
+
+class KeyTypeCompactionFilter : public rocksdb::CompactionFilter {
+ public:
+  explicit KeyTypeCompactionFilter(KeyTypeDirectory* directory)
+      : directory_(directory) {}
+
+  bool Filter(int level, const Slice& key,
+              const rocksdb::Slice& value,
+              std::string* new_value, bool* value_changed) const override {
+    return directory_->Reclaim(key, value, new_value, value_changed);
+  }
+
+  // Entries still made of the operands of Mark are reclaimed the same way,
+  // an operand can only be dropped as a whole
+  bool FilterMergeOperand(int level, const Slice& key,
+                          const rocksdb::Slice& operand) const override {
+    std::string new_value;
+    bool value_changed = false;
+    return directory_->Reclaim(key, operand, &new_value, &value_changed);
+  }
+
+  const char* Name() const override {
+    return "blackwidow.KeyTypeCompactionFilter";
+  }
+
+ private:
+  KeyTypeDirectory* const directory_;
+};
+
+class KeyTypeCompactionFilterFactory
+    : public rocksdb::CompactionFilterFactory {
+ public:
+  explicit KeyTypeCompactionFilterFactory(KeyTypeDirectory* directory)
+      : directory_(directory) {}
+
+  std::unique_ptr<rocksdb::CompactionFilter> CreateCompactionFilter(
+      const rocksdb::CompactionFilter::Context& context) override {
+    return std::unique_ptr<rocksdb::CompactionFilter>(
+        new KeyTypeCompactionFilter(directory_));
+  }
+
+  const char* Name() const override {
+    return "blackwidow.KeyTypeCompactionFilterFactory";
+  }
+
+ private:
+  KeyTypeDirectory* const directory_;
+};
+
+KeyTypeDirectory::KeyTypeDirectory()
+    : db_(nullptr),
+      marked_(kMarkedKeysShards, true) {
+  marked_.SetCapacity(kMarkedKeysCapacity);
+  for (size_t i = 0; i < kKeyTypeDirectoryStripes; ++i) {
+    pthread_rwlock_init(&stripes_[i], NULL);
+  }
+}
+
+KeyTypeDirectory::~KeyTypeDirectory() {
+  if (db_ != nullptr) {
+    rocksdb::CancelAllBackgroundWork(db_, true);
+    for (auto handle : handles_) {
+      delete handle;
+    }
+    delete db_;
+  }
+  for (size_t i = 0; i < kKeyTypeDirectoryStripes; ++i) {
+    pthread_rwlock_destroy(&stripes_[i]);
+  }
+}
+
+Status KeyTypeDirectory::Open(const BlackwidowOptions& bw_options,
+                              const std::string& db_path,
+                              const HoldsKeyFunc& holds_key) {
+  holds_key_ = holds_key;
+  rocksdb::Options ops(bw_options.options);
+  Status s = rocksdb::DB::Open(ops, db_path, &db_);
+  if (s.ok()) {
+    // create column family
+    rocksdb::ColumnFamilyHandle* cf;
+    s = db_->CreateColumnFamily(rocksdb::ColumnFamilyOptions(),
+        "meta_cf", &cf);
+    if (!s.ok()) {
+      return s;
+    }
+    // close DB
+    delete cf;
+    delete db_;
+  }
+
+  // Open
+  rocksdb::DBOptions db_ops(bw_options.options);
+  rocksdb::ColumnFamilyOptions types_cf_ops(bw_options.options);
+  rocksdb::ColumnFamilyOptions meta_cf_ops(bw_options.options);
+  types_cf_ops.merge_operator = std::make_shared<KeyTypeMergeOperator>();
+  types_cf_ops.compaction_filter_factory =
+    std::make_shared<KeyTypeCompactionFilterFactory>(this);
+
+  // use the bloom filter policy to reduce disk reads
+  rocksdb::BlockBasedTableOptions table_ops(bw_options.table_options);
+  table_ops.filter_policy.reset(rocksdb::NewBloomFilterPolicy(10, true));
+  types_cf_ops.table_factory.reset(
+      rocksdb::NewBlockBasedTableFactory(table_ops));
+
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  // Types CF
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+      rocksdb::kDefaultColumnFamilyName, types_cf_ops));
+  // Meta CF
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+      "meta_cf", meta_cf_ops));
+  return rocksdb::DB::Open(db_ops, db_path, column_families, &handles_, &db_);
+}
+
+Status KeyTypeDirectory::Destroy(const BlackwidowOptions& bw_options,
+                                 const std::string& db_path) {
+  if (access(db_path.c_str(), F_OK)) {
+    return Status::OK();
+  }
+  return rocksdb::DestroyDB(db_path, bw_options.options);
+}
+
+bool KeyTypeDirectory::IsBuilt() {
+  std::string value;
+  return db_->Get(default_read_options_, handles_[1], kBuiltKey, &value).ok();
+}
+
+Status KeyTypeDirectory::SetBuilt() {
+  return db_->Put(default_write_options_, handles_[1], kBuiltKey, "");
+}
+
+Status KeyTypeDirectory::Mark(const Slice& key, const DataType& type) {
+  char bit = static_cast<char>(1 << type);
+  uint8_t types = 0;
+  std::string key_str = key.ToString();
+  if (marked_.Lookup(key_str, &types).ok() && (types & bit)) {
+    return Status::OK();
+  }
+  Status s = db_->Merge(default_write_options_, handles_[0],
+                        key, Slice(&bit, 1));
+  if (s.ok()) {
+    marked_.Insert(key_str, static_cast<uint8_t>(types | bit));
+  }
+  return s;
+}
+
+Status KeyTypeDirectory::Lookup(const Slice& key, uint8_t* types) {
+  std::string value;
+  Status s = db_->Get(default_read_options_, handles_[0], key, &value);
+  if (s.IsNotFound()) {
+    *types = 0;
+    return Status::OK();
+  } else if (!s.ok()) {
+    return s;
+  }
+  *types = value.empty() ? 0 : static_cast<uint8_t>(value[0]);
+  return Status::OK();
+}
+
+Status KeyTypeDirectory::Remove(const Slice& key) {
+  marked_.Remove(key.ToString());
+  return db_->Delete(default_write_options_, handles_[0], key);
+}
+
+Status KeyTypeDirectory::CompactRange() {
+  return db_->CompactRange(rocksdb::CompactRangeOptions(), handles_[0],
+                           nullptr, nullptr);
+}
+
+bool KeyTypeDirectory::Reclaim(const Slice& key, const Slice& value,
+                               std::string* new_value, bool* value_changed) {
+  if (!holds_key_) {
+    return false;
+  }
+  // A write of the key is under way, leave it to a later compaction
+  size_t stripe = Stripe(key);
+  if (!TryLockExclusive(stripe)) {
+    return false;
+  }
+  uint8_t types = value.empty() ? 0 : static_cast<uint8_t>(value[0]);
+  uint8_t live_types = 0;
+  for (auto type : kDirectoryTypes) {
+    uint8_t bit = static_cast<uint8_t>(1 << type);
+    if ((types & bit) && holds_key_(key, type)) {
+      live_types |= bit;
+    }
+  }
+  // The next write of the key must merge its bit again
+  if (live_types != types) {
+    marked_.Remove(key.ToString());
+  }
+  Unlock(stripe);
+
+  if (live_types == 0) {
+    return true;
+  } else if (live_types != types) {
+    new_value->assign(1, static_cast<char>(live_types));
+    *value_changed = true;
+  }
+  return false;
+}
+
+size_t KeyTypeDirectory::Stripe(const Slice& key) {
+  return MurmurHash(key.data(), static_cast<int>(key.size()), 0)
+    % kKeyTypeDirectoryStripes;
+}
+
+void KeyTypeDirectory::LockShared(size_t stripe) {
+  pthread_rwlock_rdlock(&stripes_[stripe]);
+}
+
+void KeyTypeDirectory::LockExclusive(size_t stripe) {
+  pthread_rwlock_wrlock(&stripes_[stripe]);
+}
+
+bool KeyTypeDirectory::TryLockExclusive(size_t stripe) {
+  return pthread_rwlock_trywrlock(&stripes_[stripe]) == 0;
+}
+
+void KeyTypeDirectory::Unlock(size_t stripe) {
+  pthread_rwlock_unlock(&stripes_[stripe]);
+}
+
+ScopeKeyTypeMark::ScopeKeyTypeMark(KeyTypeDirectory* directory,
+                                   const Slice& key, const DataType& type)
+    : directory_(directory) {
+  if (directory_ != nullptr) {
+    LockAndMark({key}, type);
+  }
+}
+
+ScopeKeyTypeMark::ScopeKeyTypeMark(KeyTypeDirectory* directory,
+                                   const std::vector<std::string>& keys,
+                                   const DataType& type)
+    : directory_(directory) {
+  if (directory_ != nullptr) {
+    LockAndMark(std::vector<Slice>(keys.begin(), keys.end()), type);
+  }
+}
+
+ScopeKeyTypeMark::~ScopeKeyTypeMark() {
+  for (auto stripe : stripes_) {
+    directory_->Unlock(stripe);
+  }
+}
+
+// Each stripe is locked once and in order, so that calls on several keys
+// can not deadlock with each other
+template <typename Key>
+static void SortedStripes(KeyTypeDirectory* directory,
+                          const std::vector<Key>& keys,
+                          std::vector<size_t>* stripes) {
+  for (const auto& key : keys) {
+    stripes->push_back(directory->Stripe(key));
+  }
+  std::sort(stripes->begin(), stripes->end());
+  stripes->erase(std::unique(stripes->begin(), stripes->end()),
+                 stripes->end());
+}
+
+void ScopeKeyTypeMark::LockAndMark(const std::vector<Slice>& keys,
+                                   const DataType& type) {
+  SortedStripes(directory_, keys, &stripes_);
+  for (auto stripe : stripes_) {
+    directory_->LockShared(stripe);
+  }
+
+  for (const auto& key : keys) {
+    status_ = directory_->Mark(key, type);
+    if (!status_.ok()) {
+      return;
+    }
+  }
+}
+
+ScopeKeyTypeDelete::ScopeKeyTypeDelete(KeyTypeDirectory* directory,
+                                       const std::vector<std::string>& keys)
+    : directory_(directory) {
+  if (directory_ != nullptr) {
+    SortedStripes(directory_, keys, &stripes_);
+    for (auto stripe : stripes_) {
+      directory_->LockExclusive(stripe);
+    }
+  }
+}
+
+ScopeKeyTypeDelete::~ScopeKeyTypeDelete() {
+  for (auto stripe : stripes_) {
+    directory_->Unlock(stripe);
+  }
+}
+
+}  //  namespace blackwidow
@@ -0,0 +1,148 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_KEY_TYPE_DIRECTORY_H_
+#define SRC_KEY_TYPE_DIRECTORY_H_
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "rocksdb/db.h"
+#include "rocksdb/status.h"
+#include "rocksdb/slice.h"
+
+#include "blackwidow/blackwidow.h"
+#include "src/lru_cache.h"
+
+namespace blackwidow {
+using Status = rocksdb::Status;
+using Slice = rocksdb::Slice;
+
+static const size_t kKeyTypeDirectoryStripes = 1024;
+
+/*
+ * Records which types every key holds, so that the keys commands only
+ * visit the type dbs a key lives in instead of all five of them.
+ *
+ * An entry maps a key to one byte with the bit (1 << DataType) set for each
+ * type that may hold it. Bits are only ever added by merges while a key is
+ * written, and the entry is removed once Del dropped the key from all its
+ * types, so it may name a type that no longer holds the key (expired, or
+ * emptied by SREM/HDEL...), but never misses one that does.
+ *
+ * A write holds the stripe of its key shared from the mark until the
+ * write is done, Del holds it exclusively, so Del never removes the entry
+ * of a key that is being created.
+ *
+ * Keys that expire, or are emptied member by member, are never deleted,
+ * so the compaction of the directory asks the type dbs whether they still
+ * hold the key of every entry it rewrites. The bits of the types that do
+ * not are cleared, and the entry is dropped once no type is left. This is
+ * done with the stripe held exclusively and skipped while a write of the
+ * key is under way.
+ */
+class KeyTypeDirectory {
+ public:
+  // Whether the db of type still holds a live key, true on errors so that
+  // entries are only dropped for sure
+  typedef std::function<bool(const Slice& key, const DataType& type)>
+    HoldsKeyFunc;
+
+  KeyTypeDirectory();
+  ~KeyTypeDirectory();
+
+  Status Open(const BlackwidowOptions& bw_options,
+              const std::string& db_path, const HoldsKeyFunc& holds_key);
+  // Drop the directory of an earlier run, it went stale as soon as keys
+  // were written without it
+  static Status Destroy(const BlackwidowOptions& bw_options,
+                        const std::string& db_path);
+
+  // Whether all the keys that existed when the directory was created have
+  // been recorded
+  bool IsBuilt();
+  Status SetBuilt();
+
+  // Record that key may hold a value of type
+  Status Mark(const Slice& key, const DataType& type);
+  // The type bits of key, 0 if it holds no type
+  Status Lookup(const Slice& key, uint8_t* types);
+  // Forget key, once it was deleted from all the types it held
+  Status Remove(const Slice& key);
+  // Compact the whole directory, reclaiming the entries of gone keys
+  Status CompactRange();
+  // Called by the compaction of the directory for every entry, true if
+  // the entry is dropped
+  bool Reclaim(const Slice& key, const Slice& value,
+               std::string* new_value, bool* value_changed);
+
+  size_t Stripe(const Slice& key);
+  void LockShared(size_t stripe);
+  void LockExclusive(size_t stripe);
+  bool TryLockExclusive(size_t stripe);
+  void Unlock(size_t stripe);
+
+ private:
+  rocksdb::DB* db_;
+  std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+  rocksdb::WriteOptions default_write_options_;
+  rocksdb::ReadOptions default_read_options_;
+  HoldsKeyFunc holds_key_;
+
+  // Type bits known to be in the entry of recently written keys, so that
+  // rewriting a key does not merge the same bits again. Looked up by every
+  // write, hence sharded.
+  ShardedLRUCache<std::string, uint8_t> marked_;
+  pthread_rwlock_t stripes_[kKeyTypeDirectoryStripes];
+
+  KeyTypeDirectory(const KeyTypeDirectory&);
+  void operator=(const KeyTypeDirectory&);
+};
+
+// Marks keys as holding type, and keeps their stripes locked shared until
+// the write that may create them is done. Does nothing without a directory.
+class ScopeKeyTypeMark {
+ public:
+  ScopeKeyTypeMark(KeyTypeDirectory* directory,
+                   const Slice& key, const DataType& type);
+  ScopeKeyTypeMark(KeyTypeDirectory* directory,
+                   const std::vector<std::string>& keys,
+                   const DataType& type);
+  ~ScopeKeyTypeMark();
+
+  Status status() const {
+    return status_;
+  }
+
+ private:
+  KeyTypeDirectory* const directory_;
+  std::vector<size_t> stripes_;
+  Status status_;
+
+  void LockAndMark(const std::vector<Slice>& keys, const DataType& type);
+  ScopeKeyTypeMark(const ScopeKeyTypeMark&);
+  void operator=(const ScopeKeyTypeMark&);
+};
+
+// Holds the stripes of keys exclusively while Del removes them. Does
+// nothing without a directory.
+class ScopeKeyTypeDelete {
+ public:
+  ScopeKeyTypeDelete(KeyTypeDirectory* directory,
+                     const std::vector<std::string>& keys);
+  ~ScopeKeyTypeDelete();
+
+ private:
+  KeyTypeDirectory* const directory_;
+  std::vector<size_t> stripes_;
+  ScopeKeyTypeDelete(const ScopeKeyTypeDelete&);
+  void operator=(const ScopeKeyTypeDelete&);
+};
+
+}  //  namespace blackwidow
+#endif  //  SRC_KEY_TYPE_DIRECTORY_H_
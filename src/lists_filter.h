@@ -11,6 +11,7 @@
 #include <vector>
 
 #include "src/debug.h"
+#include "src/base_filter.h"
 #include "src/lists_meta_value_format.h"
 #include "src/lists_data_key_format.h"
 #include "rocksdb/compaction_filter.h"
@@ -19,13 +20,11 @@ namespace blackwidow {
 
 class ListsMetaFilter : public rocksdb::CompactionFilter {
  public:
-  ListsMetaFilter() = default;
+  ListsMetaFilter() : cur_time_(CompactionTime()) {}
   bool Filter(int level, const rocksdb::Slice& key,
               const rocksdb::Slice& value,
               std::string* new_value, bool* value_changed) const override {
-    int64_t unix_time;
-    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
-    int32_t cur_time = static_cast<int32_t>(unix_time);
+    int32_t cur_time = cur_time_;
     ParsedListsMetaValue parsed_lists_meta_value(value);
     Trace("==========================START==========================");
     Trace("[ListMetaFilter], key: %s, count = %lu, timestamp: %d, cur_time: %d, version: %d",
@@ -51,6 +50,9 @@ class ListsMetaFilter : public rocksdb::CompactionFilter {
   }
 
   const char* Name() const override { return "ListsMetaFilter"; }
+
+ private:
+  const int32_t cur_time_;
 };
 
 class ListsMetaFilterFactory : public rocksdb::CompactionFilterFactory {
@@ -69,7 +71,10 @@ class ListsDataFilter : public rocksdb::CompactionFilter {
  public:
   ListsDataFilter(rocksdb::DB* db,
                   std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr) :
-    db_(db), cf_handles_ptr_(cf_handles_ptr), meta_not_found_(false) {}
+    cf_handles_ptr_(cf_handles_ptr),
+    meta_cursor_(db, cf_handles_ptr),
+    meta_not_found_(false),
+    cur_time_(CompactionTime()) {}
 
   bool Filter(int level, const rocksdb::Slice& key,
               const rocksdb::Slice& value,
@@ -89,8 +94,7 @@ class ListsDataFilter : public rocksdb::CompactionFilter {
       if (cf_handles_ptr_->size() == 0) {
         return false;
       }
-      Status s = db_->Get(default_read_options_,
-              (*cf_handles_ptr_)[0], cur_key_, &meta_value);
+      Status s = meta_cursor_.Get(cur_key_, &meta_value);
       if (s.ok()) {
         meta_not_found_ = false;
         ParsedListsMetaValue parsed_lists_meta_value(&meta_value);
@@ -110,10 +114,8 @@ class ListsDataFilter : public rocksdb::CompactionFilter {
       return true;
     }
 
-    int64_t unix_time;
-    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
     if (cur_meta_timestamp_ != 0
-      && cur_meta_timestamp_ < static_cast<int32_t>(unix_time)) {
+      && cur_meta_timestamp_ < cur_time_) {
       Trace("Drop[Timeout]");
       return true;
     }
@@ -130,13 +132,13 @@ class ListsDataFilter : public rocksdb::CompactionFilter {
   const char* Name() const override { return "ListsDataFilter"; }
 
  private:
-  rocksdb::DB* db_;
   std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
-  rocksdb::ReadOptions default_read_options_;
+  mutable CompactionMetaCursor meta_cursor_;
   mutable std::string cur_key_;
   mutable bool meta_not_found_;
   mutable int32_t cur_meta_version_;
   mutable int32_t cur_meta_timestamp_;
+  const int32_t cur_time_;
 };
 
 class ListsDataFilterFactory : public rocksdb::CompactionFilterFactory {
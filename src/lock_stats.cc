@@ -0,0 +1,144 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/lock_stats.h"
+
+#include <algorithm>
+
+#include "rocksdb/env.h"
+
+namespace blackwidow {
+
+LockStatsCollector::LockStatsCollector(size_t num_slots, size_t top_n)
+    : num_slots_(num_slots),
+      top_n_(top_n),
+      contended_(0),
+      total_wait_micros_(0),
+      max_wait_micros_(0),
+      sketch_capacity_(std::max<size_t>(top_n * 4, 16)) {
+  for (size_t i = 0; i < kLockWaitBuckets; ++i) {
+    wait_histogram_[i].store(0, std::memory_order_relaxed);
+  }
+  slot_contended_ = new std::atomic<uint32_t>[num_slots];
+  for (size_t i = 0; i < num_slots; ++i) {
+    slot_contended_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+LockStatsCollector::~LockStatsCollector() {
+  delete[] slot_contended_;
+}
+
+void LockStatsCollector::RecordWait(size_t slot, const Slice& key,
+                                    uint64_t wait_micros) {
+  contended_.fetch_add(1, std::memory_order_relaxed);
+  total_wait_micros_.fetch_add(wait_micros, std::memory_order_relaxed);
+  uint64_t max_wait = max_wait_micros_.load(std::memory_order_relaxed);
+  while (wait_micros > max_wait
+    && !max_wait_micros_.compare_exchange_weak(max_wait, wait_micros,
+                                               std::memory_order_relaxed)) {
+  }
+  size_t bucket = 0;
+  while (bucket + 1 < kLockWaitBuckets && (wait_micros >> bucket) != 0) {
+    ++bucket;
+  }
+  wait_histogram_[bucket].fetch_add(1, std::memory_order_relaxed);
+  slot_contended_[slot].fetch_add(1, std::memory_order_relaxed);
+
+  std::string key_str = key.ToString();
+  slash::MutexLock l(&sketch_mu_);
+  auto iter = sketch_.find(key_str);
+  if (iter != sketch_.end()) {
+    iter->second++;
+  } else if (sketch_.size() < sketch_capacity_) {
+    sketch_.insert(std::make_pair(key_str, 1));
+  } else {
+    auto min_iter = sketch_.begin();
+    for (auto it = sketch_.begin(); it != sketch_.end(); ++it) {
+      if (it->second < min_iter->second) {
+        min_iter = it;
+      }
+    }
+    uint64_t count = min_iter->second + 1;
+    sketch_.erase(min_iter);
+    sketch_.insert(std::make_pair(key_str, count));
+  }
+}
+
+void LockStatsCollector::RecordHold(size_t slot, const Slice& key) {
+  HolderShard* shard = &holder_shards_[slot % kHolderShards];
+  uint64_t now = rocksdb::Env::Default()->NowMicros();
+  slash::MutexLock l(&shard->mu);
+  Holder& holder = shard->holders[slot];
+  holder.since = now;
+  holder.key.assign(key.data(), key.size());
+}
+
+void LockStatsCollector::RecordRelease(size_t slot) {
+  HolderShard* shard = &holder_shards_[slot % kHolderShards];
+  slash::MutexLock l(&shard->mu);
+  shard->holders.erase(slot);
+}
+
+void LockStatsCollector::GetStats(const DataType& type, LockStats* stats) {
+  stats->contended += contended_.load(std::memory_order_relaxed);
+  stats->total_wait_micros +=
+    total_wait_micros_.load(std::memory_order_relaxed);
+  stats->max_wait_micros = std::max(stats->max_wait_micros,
+      max_wait_micros_.load(std::memory_order_relaxed));
+  stats->wait_histogram.resize(kLockWaitBuckets, 0);
+  for (size_t i = 0; i < kLockWaitBuckets; ++i) {
+    stats->wait_histogram[i] +=
+      wait_histogram_[i].load(std::memory_order_relaxed);
+  }
+
+  std::vector<LockSlotStat> slots;
+  for (size_t i = 0; i < num_slots_; ++i) {
+    uint32_t contended = slot_contended_[i].load(std::memory_order_relaxed);
+    if (contended != 0) {
+      slots.push_back({type, i, contended});
+    }
+  }
+  std::sort(slots.begin(), slots.end(),
+            [](const LockSlotStat& a, const LockSlotStat& b) {
+              return a.contended > b.contended;
+            });
+  slots.resize(std::min(slots.size(), top_n_));
+  stats->hot_slots.insert(stats->hot_slots.end(), slots.begin(), slots.end());
+
+  std::vector<LockKeyStat> keys;
+  {
+    slash::MutexLock l(&sketch_mu_);
+    for (const auto& entry : sketch_) {
+      keys.push_back({type, entry.first, entry.second});
+    }
+  }
+  std::sort(keys.begin(), keys.end(),
+            [](const LockKeyStat& a, const LockKeyStat& b) {
+              return a.count > b.count;
+            });
+  keys.resize(std::min(keys.size(), top_n_));
+  stats->hot_keys.insert(stats->hot_keys.end(), keys.begin(), keys.end());
+
+  keys.clear();
+  uint64_t now = rocksdb::Env::Default()->NowMicros();
+  for (size_t i = 0; i < kHolderShards; ++i) {
+    slash::MutexLock l(&holder_shards_[i].mu);
+    for (const auto& entry : holder_shards_[i].holders) {
+      const Holder& holder = entry.second;
+      keys.push_back({type, holder.key,
+                      now > holder.since ? now - holder.since : 0});
+    }
+  }
+  std::sort(keys.begin(), keys.end(),
+            [](const LockKeyStat& a, const LockKeyStat& b) {
+              return a.count > b.count;
+            });
+  keys.resize(std::min(keys.size(), top_n_));
+  stats->longest_holders.insert(stats->longest_holders.end(),
+                                keys.begin(), keys.end());
+}
+
+}  //  namespace blackwidow
@@ -0,0 +1,77 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_LOCK_STATS_H_
+#define SRC_LOCK_STATS_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <string>
+#include <unordered_map>
+
+#include "rocksdb/slice.h"
+#include "slash/include/slash_mutex.h"
+
+#include "blackwidow/blackwidow.h"
+
+namespace blackwidow {
+using Slice = rocksdb::Slice;
+
+/*
+ * The contention stats of one SlotLockMgr. Waits are only recorded by the
+ * acquisitions that found their slot taken, the holders by every exclusive
+ * acquisition, in one of kHolderShards maps so that they rarely share a
+ * mutex. Readers are not tracked as holders.
+ */
+class LockStatsCollector {
+ public:
+  LockStatsCollector(size_t num_slots, size_t top_n);
+  ~LockStatsCollector();
+
+  void RecordWait(size_t slot, const Slice& key, uint64_t wait_micros);
+  void RecordHold(size_t slot, const Slice& key);
+  void RecordRelease(size_t slot);
+
+  // Adds the counts to stats, and appends the top_n of each list
+  void GetStats(const DataType& type, LockStats* stats);
+
+ private:
+  static const size_t kHolderShards = 64;
+
+  struct Holder {
+    uint64_t since;
+    std::string key;
+  };
+  struct HolderShard {
+    slash::Mutex mu;
+    std::unordered_map<size_t, Holder> holders;
+  };
+
+  const size_t num_slots_;
+  const size_t top_n_;
+
+  std::atomic<uint64_t> contended_;
+  std::atomic<uint64_t> total_wait_micros_;
+  std::atomic<uint64_t> max_wait_micros_;
+  std::atomic<uint64_t> wait_histogram_[kLockWaitBuckets];
+  std::atomic<uint32_t>* slot_contended_;
+
+  // Space saving sketch of the contended keys: once it holds
+  // sketch_capacity_ keys, a new key replaces the one with the smallest
+  // count and takes over that count
+  slash::Mutex sketch_mu_;
+  const size_t sketch_capacity_;
+  std::unordered_map<std::string, uint64_t> sketch_;
+
+  HolderShard holder_shards_[kHolderShards];
+
+  // No copying allowed
+  LockStatsCollector(const LockStatsCollector&);
+  void operator=(const LockStatsCollector&);
+};
+
+}  //  namespace blackwidow
+#endif  // SRC_LOCK_STATS_H_
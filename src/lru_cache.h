@@ -7,22 +7,49 @@
 #define SRC_LRU_CACHE_H_
 
 #include <stdio.h>
+#include <stdint.h>
 #include <assert.h>
-#include <unordered_map>
+#include <atomic>
+#include <vector>
+#include <functional>
 
+#include "rocksdb/status.h"
 #include "slash/include/slash_mutex.h"
 
 namespace blackwidow {
+using Status = rocksdb::Status;
+
+// std::hash of an integer is the integer itself, so mix it, the low bits
+// pick the table slot and the high bits the shard
+template <typename T1>
+inline uint64_t LRUHash(const T1& key) {
+  uint64_t h = std::hash<T1>()(key);
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9f2c3be5b5bULL;
+  h ^= h >> 33;
+  return h;
+}
 
 template <typename T1, typename T2>
 struct LRUHandle {
   T1 key;
   T2 value;
+  uint64_t hash;
   size_t charge;
+  // Set by hits in approximate mode, cleared when the entry is given a
+  // second chance by LRU_Trim
+  bool referenced;
+  // Also links the free handles of the slabs
   LRUHandle* next;
   LRUHandle* prev;
 };
 
+// Open addressing with linear probing over the handles themselves, which
+// carry their hash, so every operation walks one probe sequence and never
+// copies the key. Remove shifts the following entries back instead of
+// leaving tombstones.
 template <typename T1, typename T2>
 class HandleTable {
  public:
@@ -30,63 +57,136 @@ class HandleTable {
   ~HandleTable();
 
   size_t TableSize();
-  LRUHandle<T1, T2>* Lookup(const T1& key);
-  LRUHandle<T1, T2>* Remove(const T1& key);
-  LRUHandle<T1, T2>* Insert(const T1& key, LRUHandle<T1, T2>* const handle);
+  LRUHandle<T1, T2>* Lookup(const T1& key, uint64_t hash);
+  LRUHandle<T1, T2>* Remove(const T1& key, uint64_t hash);
+  // Returns the handle of the same key that handle replaced, if any
+  LRUHandle<T1, T2>* Insert(LRUHandle<T1, T2>* const handle);
 
  private:
-  std::unordered_map<T1, LRUHandle<T1, T2>*> table_;
+  // The slot holding key, or the empty slot that ends its probe sequence
+  size_t FindSlot(const T1& key, uint64_t hash);
+  void Resize();
+
+  size_t length_;
+  size_t elems_;
+  LRUHandle<T1, T2>** list_;
+
+  HandleTable(const HandleTable&);
+  void operator=(const HandleTable&);
 };
 
 template <typename T1, typename T2>
-HandleTable<T1, T2>::HandleTable() {
+HandleTable<T1, T2>::HandleTable()
+    : length_(16),
+      elems_(0) {
+  list_ = new LRUHandle<T1, T2>*[length_]();
 }
 
 template <typename T1, typename T2>
 HandleTable<T1, T2>::~HandleTable() {
+  delete[] list_;
 }
 
 template <typename T1, typename T2>
 size_t HandleTable<T1, T2>::TableSize() {
-  return table_.size();
+  return elems_;
 }
 
 template <typename T1, typename T2>
-LRUHandle<T1, T2>* HandleTable<T1, T2>::Lookup(const T1& key) {
-  if (table_.find(key) != table_.end()) {
-    return table_[key];
-  } else {
-    return NULL;
+size_t HandleTable<T1, T2>::FindSlot(const T1& key, uint64_t hash) {
+  size_t mask = length_ - 1;
+  size_t slot = hash & mask;
+  while (list_[slot] != NULL
+    && (list_[slot]->hash != hash || list_[slot]->key != key)) {
+    slot = (slot + 1) & mask;
   }
+  return slot;
 }
 
 template <typename T1, typename T2>
-LRUHandle<T1, T2>* HandleTable<T1, T2>::Remove(const T1& key) {
-  LRUHandle<T1, T2>* old = NULL;
-  if (table_.find(key) != table_.end()) {
-    old = table_[key];
-    table_.erase(key);
+LRUHandle<T1, T2>* HandleTable<T1, T2>::Lookup(const T1& key, uint64_t hash) {
+  return list_[FindSlot(key, hash)];
+}
+
+template <typename T1, typename T2>
+LRUHandle<T1, T2>* HandleTable<T1, T2>::Remove(const T1& key, uint64_t hash) {
+  size_t hole = FindSlot(key, hash);
+  LRUHandle<T1, T2>* old = list_[hole];
+  if (old == NULL) {
+    return NULL;
+  }
+  list_[hole] = NULL;
+  elems_--;
+
+  // Move back every following entry of the run whose home slot is not
+  // between the hole and itself, else Lookup would stop at the hole
+  size_t mask = length_ - 1;
+  size_t slot = hole;
+  while (true) {
+    slot = (slot + 1) & mask;
+    if (list_[slot] == NULL) {
+      break;
+    }
+    size_t home = list_[slot]->hash & mask;
+    bool movable = slot > hole ? (home <= hole || home > slot)
+                               : (home <= hole && home > slot);
+    if (movable) {
+      list_[hole] = list_[slot];
+      list_[slot] = NULL;
+      hole = slot;
+    }
   }
   return old;
 }
 
 template <typename T1, typename T2>
-LRUHandle<T1, T2>* HandleTable<T1, T2>::Insert(const T1& key,
-                                               LRUHandle<T1, T2>* const handle) {
-  LRUHandle<T1, T2>* old = NULL;
-  if (table_.find(key) != table_.end()) {
-    old = table_[key];
-    table_.erase(key);
+LRUHandle<T1, T2>* HandleTable<T1, T2>::Insert(
+        LRUHandle<T1, T2>* const handle) {
+  size_t slot = FindSlot(handle->key, handle->hash);
+  LRUHandle<T1, T2>* old = list_[slot];
+  list_[slot] = handle;
+  if (old == NULL) {
+    elems_++;
+    // Keep the load under 3/4 so that probe sequences stay short
+    if (elems_ * 4 > length_ * 3) {
+      Resize();
+    }
   }
-  table_.insert({key, handle});
   return old;
 }
 
+template <typename T1, typename T2>
+void HandleTable<T1, T2>::Resize() {
+  size_t old_length = length_;
+  LRUHandle<T1, T2>** old_list = list_;
+  length_ = old_length * 2;
+  list_ = new LRUHandle<T1, T2>*[length_]();
+  size_t mask = length_ - 1;
+  for (size_t i = 0; i < old_length; ++i) {
+    if (old_list[i] != NULL) {
+      size_t slot = old_list[i]->hash & mask;
+      while (list_[slot] != NULL) {
+        slot = (slot + 1) & mask;
+      }
+      list_[slot] = old_list[i];
+    }
+  }
+  delete[] old_list;
+}
+
+// Handles are carved from slabs of this many and recycled through a free
+// list, the slabs are only released with the cache
+static const size_t kLRUHandleSlabSize = 64;
 
+// In approximate (CLOCK) mode a hit only marks the entry as referenced
+// instead of moving it to the head of the list, and LRU_Trim moves marked
+// entries to the head rather than evicting them. Hits then write nothing
+// but one flag under the mutex, at the price of an eviction order that is
+// only close to LRU.
 template <typename T1, typename T2>
 class LRUCache {
  public:
-  LRUCache();
+  explicit LRUCache(bool approximate = false);
   ~LRUCache();
 
   size_t Size();
@@ -99,6 +199,12 @@ class LRUCache {
   Status Remove(const T1& key);
   Status Clear();
 
+  // The same with LRUHash(key) already computed
+  Status HashedLookup(const T1& key, uint64_t hash, T2* value);
+  Status HashedInsert(const T1& key, uint64_t hash, const T2& value,
+                      size_t charge = 1);
+  Status HashedRemove(const T1& key, uint64_t hash);
+
   // Just for test
   bool LRUAndHandleTableConsistent();
   bool LRUAsExpected(const std::vector<std::pair<T1, T2>>& expect);
@@ -109,6 +215,10 @@ class LRUCache {
   void LRU_Append(LRUHandle<T1, T2>* const e);
   void LRU_MoveToHead(LRUHandle<T1, T2>* const e);
   bool FinishErase(LRUHandle<T1, T2>* const e);
+  LRUHandle<T1, T2>* NewHandle();
+  void FreeHandle(LRUHandle<T1, T2>* const e);
+
+  const bool approximate_;
 
   // Initialized before use.
   size_t capacity_;
@@ -122,13 +232,21 @@ class LRUCache {
   LRUHandle<T1, T2> lru_;
 
   HandleTable<T1, T2> handle_table_;
+
+  std::vector<LRUHandle<T1, T2>*> slabs_;
+  LRUHandle<T1, T2>* free_list_;
+
+  LRUCache(const LRUCache&);
+  void operator=(const LRUCache&);
 };
 
 template <typename T1, typename T2>
-LRUCache<T1, T2>::LRUCache()
-    : capacity_(0),
+LRUCache<T1, T2>::LRUCache(bool approximate)
+    : approximate_(approximate),
+      capacity_(0),
       usage_(0),
-      size_(0) {
+      size_(0),
+      free_list_(NULL) {
   // Make empty circular linked lists.
   lru_.next = &lru_;
   lru_.prev = &lru_;
@@ -137,6 +255,9 @@ LRUCache<T1, T2>::LRUCache()
 template <typename T1, typename T2>
 LRUCache<T1, T2>::~LRUCache() {
   Clear();
+  for (auto slab : slabs_) {
+    delete[] slab;
+  }
 }
 
 template <typename T1, typename T2>
@@ -166,38 +287,61 @@ void LRUCache<T1, T2>::SetCapacity(size_t capacity) {
 
 template <typename T1, typename T2>
 Status LRUCache<T1, T2>::Lookup(const T1& key, T2* const value) {
+  return HashedLookup(key, LRUHash(key), value);
+}
+
+template <typename T1, typename T2>
+Status LRUCache<T1, T2>::Insert(const T1& key, const T2& value, size_t charge) {
+  return HashedInsert(key, LRUHash(key), value, charge);
+}
+
+template <typename T1, typename T2>
+Status LRUCache<T1, T2>::Remove(const T1& key) {
+  return HashedRemove(key, LRUHash(key));
+}
+
+template <typename T1, typename T2>
+Status LRUCache<T1, T2>::HashedLookup(const T1& key, uint64_t hash,
+                                      T2* const value) {
   slash::MutexLock l(&mutex_);
-  LRUHandle<T1, T2>* handle = handle_table_.Lookup(key);
+  LRUHandle<T1, T2>* handle = handle_table_.Lookup(key, hash);
   if (handle != NULL) {
-    LRU_MoveToHead(handle);
+    if (approximate_) {
+      handle->referenced = true;
+    } else {
+      LRU_MoveToHead(handle);
+    }
     *value = handle->value;
   }
   return (handle == NULL) ? Status::NotFound() : Status::OK();
 }
 
 template <typename T1, typename T2>
-Status LRUCache<T1, T2>::Insert(const T1& key, const T2& value, size_t charge) {
+Status LRUCache<T1, T2>::HashedInsert(const T1& key, uint64_t hash,
+                                      const T2& value, size_t charge) {
   slash::MutexLock l(&mutex_);
   if (capacity_ == 0) {
     return Status::Corruption("capacity is empty");
   } else {
-    LRUHandle<T1, T2>* handle = new LRUHandle<T1, T2>();
+    LRUHandle<T1, T2>* handle = NewHandle();
     handle->key = key;
+    handle->hash = hash;
     handle->value = value;
     handle->charge = charge;
+    handle->referenced = false;
     LRU_Append(handle);
     size_++;
     usage_ += charge;
-    FinishErase(handle_table_.Insert(key, handle));
+    FinishErase(handle_table_.Insert(handle));
     LRU_Trim();
   }
   return Status::OK();
 }
 
 template <typename T1, typename T2>
-Status LRUCache<T1, T2>::Remove(const T1& key) {
+Status LRUCache<T1, T2>::HashedRemove(const T1& key, uint64_t hash) {
   slash::MutexLock l(&mutex_);
-  bool erased = FinishErase(handle_table_.Remove(key));
+  bool erased = FinishErase(handle_table_.Remove(key, hash));
   return erased ? Status::OK() : Status::NotFound();
 }
 
@@ -207,7 +351,7 @@ Status LRUCache<T1, T2>::Clear() {
   LRUHandle<T1, T2>* old = NULL;
   while (lru_.next != &lru_) {
     old = lru_.next;
-    bool erased =  FinishErase(handle_table_.Remove(old->key));
+    bool erased =  FinishErase(handle_table_.Remove(old->key, old->hash));
     if (!erased) {   // to avoid unused variable when compiled NDEBUG
       assert(erased);
     }
@@ -222,7 +366,7 @@ bool LRUCache<T1, T2>::LRUAndHandleTableConsistent() {
   LRUHandle<T1, T2>* handle = NULL;
   LRUHandle<T1, T2>* current = lru_.prev;
   while (current != &lru_) {
-    handle = handle_table_.Lookup(current->key);
+    handle = handle_table_.Lookup(current->key, current->hash);
     if (handle == NULL || handle != current) {
       return false;
     } else {
@@ -259,13 +403,41 @@ void LRUCache<T1, T2>::LRU_Trim() {
   LRUHandle<T1, T2>* old = NULL;
   while (usage_ > capacity_ && lru_.next != &lru_) {
     old = lru_.next;
-    bool erased =  FinishErase(handle_table_.Remove(old->key));
+    if (old->referenced) {
+      old->referenced = false;
+      LRU_MoveToHead(old);
+      continue;
+    }
+    bool erased =  FinishErase(handle_table_.Remove(old->key, old->hash));
     if (!erased) {   // to avoid unused variable when compiled NDEBUG
       assert(erased);
     }
   }
 }
 
+template <typename T1, typename T2>
+LRUHandle<T1, T2>* LRUCache<T1, T2>::NewHandle() {
+  if (free_list_ == NULL) {
+    LRUHandle<T1, T2>* slab = new LRUHandle<T1, T2>[kLRUHandleSlabSize];
+    slabs_.push_back(slab);
+    for (size_t i = 0; i < kLRUHandleSlabSize; ++i) {
+      slab[i].next = free_list_;
+      free_list_ = &slab[i];
+    }
+  }
+  LRUHandle<T1, T2>* e = free_list_;
+  free_list_ = e->next;
+  return e;
+}
+
+template <typename T1, typename T2>
+void LRUCache<T1, T2>::FreeHandle(LRUHandle<T1, T2>* const e) {
+  // Keep the key so its buffer is reused, but do not hold on to the value
+  e->value = T2();
+  e->next = free_list_;
+  free_list_ = e;
+}
+
 template <typename T1, typename T2>
 void LRUCache<T1, T2>::LRU_Remove(LRUHandle<T1, T2>* const e) {
   e->next->prev = e->prev;
@@ -294,12 +466,122 @@ bool LRUCache<T1, T2>::FinishErase(LRUHandle<T1, T2>* const e) {
     LRU_Remove(e);
     size_--;
     usage_ -= e->charge;
-    delete e;
+    FreeHandle(e);
     erased = true;
   }
   return erased;
 }
 
+// Spreads the keys over num_shards LRUCaches by hash, each with its own
+// mutex and an equal part of the capacity, so that threads working on
+// different keys rarely wait for each other. Eviction is decided per
+// shard, so an entry may go while another shard still holds older ones.
+template <typename T1, typename T2>
+class ShardedLRUCache {
+ public:
+  explicit ShardedLRUCache(size_t num_shards = 16, bool approximate = false);
+  ~ShardedLRUCache();
+
+  size_t Size();
+  size_t TotalCharge();
+  size_t Capacity();
+  void SetCapacity(size_t capacity);
+
+  Status Lookup(const T1& key, T2* value);
+  Status Insert(const T1& key, const T2& value, size_t charge = 1);
+  Status Remove(const T1& key);
+  Status Clear();
+
+ private:
+  LRUCache<T1, T2>* Shard(uint64_t hash) {
+    return shards_[(hash >> 32) % shards_.size()];
+  }
+
+  // Read without taking any shard mutex, callers check it on every write
+  std::atomic<size_t> capacity_;
+  std::vector<LRUCache<T1, T2>*> shards_;
+
+  ShardedLRUCache(const ShardedLRUCache&);
+  void operator=(const ShardedLRUCache&);
+};
+
+template <typename T1, typename T2>
+ShardedLRUCache<T1, T2>::ShardedLRUCache(size_t num_shards, bool approximate)
+    : capacity_(0) {
+  if (num_shards == 0) {
+    num_shards = 1;
+  }
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.push_back(new LRUCache<T1, T2>(approximate));
+  }
+}
+
+template <typename T1, typename T2>
+ShardedLRUCache<T1, T2>::~ShardedLRUCache() {
+  for (auto shard : shards_) {
+    delete shard;
+  }
+}
+
+template <typename T1, typename T2>
+size_t ShardedLRUCache<T1, T2>::Size() {
+  size_t size = 0;
+  for (auto shard : shards_) {
+    size += shard->Size();
+  }
+  return size;
+}
+
+template <typename T1, typename T2>
+size_t ShardedLRUCache<T1, T2>::TotalCharge() {
+  size_t usage = 0;
+  for (auto shard : shards_) {
+    usage += shard->TotalCharge();
+  }
+  return usage;
+}
+
+template <typename T1, typename T2>
+size_t ShardedLRUCache<T1, T2>::Capacity() {
+  return capacity_.load(std::memory_order_relaxed);
+}
+
+template <typename T1, typename T2>
+void ShardedLRUCache<T1, T2>::SetCapacity(size_t capacity) {
+  capacity_.store(capacity, std::memory_order_relaxed);
+  size_t per_shard = (capacity + shards_.size() - 1) / shards_.size();
+  for (auto shard : shards_) {
+    shard->SetCapacity(per_shard);
+  }
+}
+
+template <typename T1, typename T2>
+Status ShardedLRUCache<T1, T2>::Lookup(const T1& key, T2* const value) {
+  uint64_t hash = LRUHash(key);
+  return Shard(hash)->HashedLookup(key, hash, value);
+}
+
+template <typename T1, typename T2>
+Status ShardedLRUCache<T1, T2>::Insert(const T1& key, const T2& value,
+                                       size_t charge) {
+  uint64_t hash = LRUHash(key);
+  return Shard(hash)->HashedInsert(key, hash, value, charge);
+}
+
+template <typename T1, typename T2>
+Status ShardedLRUCache<T1, T2>::Remove(const T1& key) {
+  uint64_t hash = LRUHash(key);
+  return Shard(hash)->HashedRemove(key, hash);
+}
+
+template <typename T1, typename T2>
+Status ShardedLRUCache<T1, T2>::Clear() {
+  for (auto shard : shards_) {
+    shard->Clear();
+  }
+  return Status::OK();
+}
+
 }  //  namespace blackwidow
 #endif  // SRC_LRU_CACHE_H_
 
@@ -5,15 +5,26 @@
 
 #include "src/redis.h"
 
+#include "rocksdb/perf_context.h"
+#include "rocksdb/utilities/table_properties_collectors.h"
+
+#include "src/coding.h"
+
 namespace blackwidow {
 
+static const size_t kStatisticsStoreShards = 16;
+
 Redis::Redis(BlackWidow* const bw, const DataType& type)
     : bw_(bw),
       type_(type),
-      lock_mgr_(new LockMgr(1000, 0, std::make_shared<MutexFactoryImpl>())),
+      lock_mgr_(new SlotLockMgr(kDefaultLockSlots)),
       db_(nullptr),
-      small_compaction_threshold_(5000) {
-  statistics_store_ = new LRUCache<std::string, size_t>();
+      small_compaction_threshold_(5000),
+      read_skip_sample_interval_(0),
+      read_skip_compaction_threshold_(0),
+      reclaim_range_delete_threshold_(0) {
+  statistics_store_ = new ShardedLRUCache<std::string, size_t>(
+      kStatisticsStoreShards, true);
   scan_cursors_store_ = new LRUCache<std::string, std::string>();
   scan_cursors_store_->SetCapacity(5000);
   default_compact_range_options_.exclusive_manual_compaction = false;
@@ -77,4 +88,97 @@ Status Redis::AddCompactKeyTaskIfNeeded(const std::string& key,
   return Status::OK();
 }
 
+void Redis::SetTombstoneCompactionOptions(
+    const BlackwidowOptions& bw_options) {
+  read_skip_sample_interval_ = bw_options.read_skip_sample_interval;
+  read_skip_compaction_threshold_ = bw_options.read_skip_compaction_threshold;
+  reclaim_range_delete_threshold_ = bw_options.reclaim_range_delete_threshold;
+}
+
+void Redis::DeleteVersionRange(rocksdb::WriteBatch* batch,
+                               rocksdb::ColumnFamilyHandle* handle,
+                               const Slice& key, int32_t version,
+                               uint64_t count) {
+  if (reclaim_range_delete_threshold_ == 0
+    || count < reclaim_range_delete_threshold_) {
+    return;
+  }
+  std::string begin, end;
+  if (VersionRange(key, version, &begin, &end)) {
+    batch->DeleteRange(handle, begin, end);
+  }
+}
+
+// The member keys all start with the key size, the key and the version
+bool Redis::VersionRange(const Slice& key, int32_t version,
+                         std::string* begin, std::string* end) {
+  char buf[sizeof(int32_t)];
+  EncodeFixed32(buf, key.size());
+  begin->assign(buf, sizeof(int32_t));
+  begin->append(key.data(), key.size());
+  EncodeFixed32(buf, version);
+  begin->append(buf, sizeof(int32_t));
+
+  // The smallest key of the same size after all the keys with the prefix,
+  // which keeps the key size the same
+  *end = *begin;
+  for (size_t i = end->size(); i > sizeof(int32_t); --i) {
+    if (static_cast<uint8_t>((*end)[i - 1]) != 0xff) {
+      (*end)[i - 1]++;
+      return true;
+    }
+    (*end)[i - 1] = '\0';
+  }
+  return false;
+}
+
+void Redis::AddDeletionCollector(const BlackwidowOptions& bw_options,
+                                 rocksdb::ColumnFamilyOptions* cf_ops) {
+  if (bw_options.deletion_compaction_window == 0) {
+    return;
+  }
+  cf_ops->table_properties_collector_factories.push_back(
+      rocksdb::NewCompactOnDeletionCollectorFactory(
+          bw_options.deletion_compaction_window,
+          bw_options.deletion_compaction_trigger));
+}
+
+static uint64_t SkippedEntries() {
+  rocksdb::PerfContext* context = rocksdb::get_perf_context();
+  return context->internal_key_skipped_count
+    + context->internal_delete_skipped_count;
+}
+
+ScopeReadSkipSample::ScopeReadSkipSample(Redis* redis, const Slice& key)
+    : redis_(redis),
+      key_(key),
+      sampled_(false),
+      saved_level_(rocksdb::kDisable),
+      skipped_before_(0) {
+  static thread_local uint64_t reads = 0;
+  size_t interval = redis_->read_skip_sample_interval_;
+  if (interval == 0 || ++reads % interval != 0) {
+    return;
+  }
+  sampled_ = true;
+  saved_level_ = rocksdb::GetPerfLevel();
+  if (saved_level_ < rocksdb::kEnableCount) {
+    rocksdb::SetPerfLevel(rocksdb::kEnableCount);
+  }
+  skipped_before_ = SkippedEntries();
+}
+
+ScopeReadSkipSample::~ScopeReadSkipSample() {
+  if (!sampled_) {
+    return;
+  }
+  uint64_t skipped = SkippedEntries() - skipped_before_;
+  rocksdb::SetPerfLevel(saved_level_);
+  if (skipped >= redis_->read_skip_compaction_threshold_) {
+    std::string key = key_.ToString();
+    redis_->bw_->AddBGTask({redis_->type_, kCompactKey, key});
+    redis_->statistics_store_->Remove(key);
+  }
+}
+
 }  // namespace blackwidow
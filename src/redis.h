@@ -13,10 +13,10 @@
 #include "rocksdb/db.h"
 #include "rocksdb/status.h"
 #include "rocksdb/slice.h"
+#include "rocksdb/perf_level.h"
 
-#include "src/lock_mgr.h"
+#include "src/slot_lock_mgr.h"
 #include "src/lru_cache.h"
-#include "src/mutex_impl.h"
 #include "blackwidow/blackwidow.h"
 
 namespace blackwidow {
@@ -65,10 +65,18 @@ class Redis {
   Status SetMaxCacheStatisticKeys(size_t max_cache_statistic_keys);
   Status SetSmallCompactionThreshold(size_t small_compaction_threshold);
 
+  // Key lock contention, see BlackwidowOptions::lock_stats_top_n
+  void EnableLockStats(size_t top_n) {
+    lock_mgr_->EnableStats(top_n);
+  }
+  void GetLockStats(LockStats* stats) {
+    lock_mgr_->GetStats(type_, stats);
+  }
+
  protected:
   BlackWidow* const bw_;
   DataType type_;
-  LockMgr* lock_mgr_;
+  SlotLockMgr* lock_mgr_;
   rocksdb::DB* db_;
   rocksdb::WriteOptions default_write_options_;
   rocksdb::ReadOptions default_read_options_;
@@ -84,10 +92,53 @@ class Redis {
 
   // For Statistics
   std::atomic<size_t> small_compaction_threshold_;
-  LRUCache<std::string, size_t>* statistics_store_;
+  // Touched by every write, so sharded and in approximate mode
+  ShardedLRUCache<std::string, size_t>* statistics_store_;
 
   Status UpdateSpecificKeyStatistics(const std::string& key, size_t count);
   Status AddCompactKeyTaskIfNeeded(const std::string& key, size_t total);
+
+  // For the compactions driven by tombstones
+  size_t read_skip_sample_interval_;
+  size_t read_skip_compaction_threshold_;
+
+  void SetTombstoneCompactionOptions(const BlackwidowOptions& bw_options);
+  // Installs the deletion collector on the options of a member data CF
+  static void AddDeletionCollector(const BlackwidowOptions& bw_options,
+                                   rocksdb::ColumnFamilyOptions* cf_ops);
+
+  // For reclaiming the members of abandoned versions
+  size_t reclaim_range_delete_threshold_;
+
+  // Drops the count members key held at version in handle with a range
+  // tombstone, if they are at least reclaim_range_delete_threshold_
+  void DeleteVersionRange(rocksdb::WriteBatch* batch,
+                          rocksdb::ColumnFamilyHandle* handle,
+                          const Slice& key, int32_t version, uint64_t count);
+  // The range [begin, end) of the member keys of key at version, in the
+  // order of the default bytewise comparator
+  virtual bool VersionRange(const Slice& key, int32_t version,
+                            std::string* begin, std::string* end);
+
+  friend class ScopeReadSkipSample;
+};
+
+// Counts the entries the iterators of one read of key skip over, if the
+// read is sampled, and compacts the key when they are too many
+class ScopeReadSkipSample {
+ public:
+  ScopeReadSkipSample(Redis* redis, const Slice& key);
+  ~ScopeReadSkipSample();
+
+ private:
+  Redis* const redis_;
+  const Slice key_;
+  bool sampled_;
+  rocksdb::PerfLevel saved_level_;
+  uint64_t skipped_before_;
+
+  ScopeReadSkipSample(const ScopeReadSkipSample&);
+  void operator=(const ScopeReadSkipSample&);
 };
 
 }  //  namespace blackwidow
@@ -5,17 +5,20 @@
 
 #include "src/redis_hashes.h"
 
+#include <map>
 #include <memory>
 
 #include "blackwidow/util.h"
 #include "src/base_filter.h"
+#include "src/key_num_collector.h"
 #include "src/scope_record_lock.h"
 #include "src/scope_snapshot.h"
 
 namespace blackwidow {
 
 RedisHashes::RedisHashes(BlackWidow* const bw, const DataType& type)
-    : Redis(bw, type) {
+    : Redis(bw, type),
+      write_coalescer_(lock_mgr_) {
 }
 
 RedisHashes::~RedisHashes() {
@@ -30,6 +33,8 @@ Status RedisHashes::Open(const BlackwidowOptions& bw_options,
                          const std::string& db_path) {
   statistics_store_->SetCapacity(bw_options.statistics_max_size);
   small_compaction_threshold_ = bw_options.small_compaction_threshold;
+  SetTombstoneCompactionOptions(bw_options);
+  write_coalescer_.set_enabled(bw_options.coalesce_key_writes);
 
   rocksdb::Options ops(bw_options.options);
   Status s = rocksdb::DB::Open(ops, db_path, &db_);
@@ -52,8 +57,11 @@ Status RedisHashes::Open(const BlackwidowOptions& bw_options,
   rocksdb::ColumnFamilyOptions data_cf_ops(bw_options.options);
   meta_cf_ops.compaction_filter_factory =
     std::make_shared<HashesMetaFilterFactory>();
+  meta_cf_ops.table_properties_collector_factories.push_back(
+      std::make_shared<KeyNumCollectorFactory>(kHashes));
   data_cf_ops.compaction_filter_factory =
     std::make_shared<HashesDataFilterFactory>(&db_, &handles_);
+  AddDeletionCollector(bw_options, &data_cf_ops);
 
   // use the bloom filter policy to reduce disk reads
   rocksdb::BlockBasedTableOptions table_ops(bw_options.table_options);
@@ -291,9 +299,7 @@ Status RedisHashes::HGet(const Slice& key, const Slice& field,
   std::string meta_value;
   int32_t version = 0;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  ScopeSharedRecordLock l(lock_mgr_, key);
   Status s = db_->Get(read_options, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
@@ -312,6 +318,7 @@ Status RedisHashes::HGet(const Slice& key, const Slice& field,
 
 Status RedisHashes::HGetall(const Slice& key,
                             std::vector<FieldValue>* fvs) {
+  ScopeReadSkipSample sample(this, key);
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -346,76 +353,11 @@ Status RedisHashes::HGetall(const Slice& key,
 
 Status RedisHashes::HIncrby(const Slice& key, const Slice& field, int64_t value,
                             int64_t* ret) {
-  *ret = 0;
-  rocksdb::WriteBatch batch;
-  ScopeRecordLock l(lock_mgr_, key);
-
-  int32_t version = 0;
-  uint32_t statistic = 0;
-  std::string old_value;
-  std::string meta_value;
-
-  Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
-  if (s.ok()) {
-    ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
-    if (parsed_hashes_meta_value.IsStale()
-      || parsed_hashes_meta_value.count() == 0) {
-      version = parsed_hashes_meta_value.UpdateVersion();
-      parsed_hashes_meta_value.set_count(1);
-      parsed_hashes_meta_value.set_timestamp(0);
-      batch.Put(handles_[0], key, meta_value);
-      HashesDataKey hashes_data_key(key, version, field);
-      char buf[32];
-      Int64ToStr(buf, 32, value);
-      batch.Put(handles_[1], hashes_data_key.Encode(), buf);
-      *ret = value;
-    } else {
-      version = parsed_hashes_meta_value.version();
-      HashesDataKey hashes_data_key(key, version, field);
-      s = db_->Get(default_read_options_, handles_[1],
-              hashes_data_key.Encode(), &old_value);
-      if (s.ok()) {
-        int64_t ival = 0;
-        if (!StrToInt64(old_value.data(), old_value.size(), &ival)) {
-          return Status::Corruption("hash value is not an integer");
-        }
-        if ((value >= 0 && LLONG_MAX - value < ival) ||
-          (value < 0 && LLONG_MIN - value > ival)) {
-          return Status::InvalidArgument("Overflow");
-        }
-        *ret = ival + value;
-        char buf[32];
-        Int64ToStr(buf, 32, *ret);
-        batch.Put(handles_[1], hashes_data_key.Encode(), buf);
-        statistic++;
-      } else if (s.IsNotFound()) {
-        char buf[32];
-        Int64ToStr(buf, 32, value);
-        parsed_hashes_meta_value.ModifyCount(1);
-        batch.Put(handles_[0], key, meta_value);
-        batch.Put(handles_[1], hashes_data_key.Encode(), buf);
-        *ret = value;
-      } else {
-        return s;
-      }
-    }
-  } else if (s.IsNotFound()) {
-    char str[4];
-    EncodeFixed32(str, 1);
-    HashesMetaValue hashes_meta_value(std::string(str, sizeof(int32_t)));
-    version = hashes_meta_value.UpdateVersion();
-    batch.Put(handles_[0], key, hashes_meta_value.Encode());
-    HashesDataKey hashes_data_key(key, version, field);
-
-    char buf[32];
-    Int64ToStr(buf, 32, value);
-    batch.Put(handles_[1], hashes_data_key.Encode(), buf);
-    *ret = value;
-  } else {
-    return s;
-  }
-  s = db_->Write(default_write_options_, &batch);
-  UpdateSpecificKeyStatistics(key.ToString(), statistic);
+  HashesWrite write(key, HashesWrite::kHIncrby, field);
+  write.by = value;
+  Status s = write_coalescer_.Run(&write,
+      [this](std::vector<HashesWrite*>* group) { CommitWrites(group); });
+  *ret = s.ok() ? write.ret : 0;
   return s;
 }
 
@@ -440,6 +382,9 @@ Status RedisHashes::HIncrbyfloat(const Slice& key, const Slice& field,
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
     if (parsed_hashes_meta_value.IsStale()
       || parsed_hashes_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_hashes_meta_value.version(),
+                         parsed_hashes_meta_value.count());
       version = parsed_hashes_meta_value.UpdateVersion();
       parsed_hashes_meta_value.set_count(1);
       parsed_hashes_meta_value.set_timestamp(0);
@@ -496,6 +441,7 @@ Status RedisHashes::HIncrbyfloat(const Slice& key, const Slice& field,
 
 Status RedisHashes::HKeys(const Slice& key,
                           std::vector<std::string>* fields) {
+  ScopeReadSkipSample sample(this, key);
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -557,9 +503,7 @@ Status RedisHashes::HMGet(const Slice& key,
   std::string value;
   std::string meta_value;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  ScopeSharedRecordLock l(lock_mgr_, key);
   Status s = db_->Get(read_options, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
@@ -617,6 +561,9 @@ Status RedisHashes::HMSet(const Slice& key,
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
     if (parsed_hashes_meta_value.IsStale()
       || parsed_hashes_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_hashes_meta_value.version(),
+                         parsed_hashes_meta_value.count());
       version = parsed_hashes_meta_value.InitialMetaValue();
       parsed_hashes_meta_value.set_count(filtered_fvs.size());
       batch.Put(handles_[0], key, meta_value);
@@ -663,61 +610,132 @@ Status RedisHashes::HMSet(const Slice& key,
 
 Status RedisHashes::HSet(const Slice& key, const Slice& field,
                          const Slice& value, int32_t* res) {
-  rocksdb::WriteBatch batch;
-  ScopeRecordLock l(lock_mgr_, key);
+  HashesWrite write(key, HashesWrite::kHSet, field);
+  write.value = value;
+  Status s = write_coalescer_.Run(&write,
+      [this](std::vector<HashesWrite*>* group) { CommitWrites(group); });
+  if (s.ok()) {
+    *res = static_cast<int32_t>(write.ret);
+  }
+  return s;
+}
 
-  int32_t version = 0;
+// Applies the writes of one key in order against one read of its meta
+// value, reading each field from the db at most once, and writes them all
+// with one batch
+void RedisHashes::CommitWrites(std::vector<HashesWrite*>* group) {
+  const Slice& key = group->front()->key;
+  rocksdb::WriteBatch batch;
   uint32_t statistic = 0;
+  bool meta_changed = false;
+  // Whether the fields of the current version may be in the db
+  bool fields_in_db = false;
+
   std::string meta_value;
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
     if (parsed_hashes_meta_value.IsStale()
       || parsed_hashes_meta_value.count() == 0) {
-      version = parsed_hashes_meta_value.InitialMetaValue();
-      parsed_hashes_meta_value.set_count(1);
-      batch.Put(handles_[0], key, meta_value);
-      HashesDataKey data_key(key, version, field);
-      batch.Put(handles_[1], data_key.Encode(), value);
-      *res = 1;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_hashes_meta_value.version(),
+                         parsed_hashes_meta_value.count());
+      parsed_hashes_meta_value.InitialMetaValue();
+      meta_changed = true;
     } else {
-      version = parsed_hashes_meta_value.version();
-      std::string data_value;
-      HashesDataKey hashes_data_key(key, version, field);
-      s = db_->Get(default_read_options_,
-          handles_[1], hashes_data_key.Encode(), &data_value);
-      if (s.ok()) {
-        *res = 0;
-        if (data_value == value.ToString()) {
-          return Status::OK();
-        } else {
-          batch.Put(handles_[1], hashes_data_key.Encode(), value);
-          statistic++;
-        }
-      } else if (s.IsNotFound()) {
-        parsed_hashes_meta_value.ModifyCount(1);
-        batch.Put(handles_[0], key, meta_value);
-        batch.Put(handles_[1], hashes_data_key.Encode(), value);
-        *res = 1;
-      } else {
-        return s;
-      }
+      fields_in_db = true;
     }
   } else if (s.IsNotFound()) {
     char str[4];
-    EncodeFixed32(str, 1);
-    HashesMetaValue meta_value(std::string(str, sizeof(int32_t)));
-    version = meta_value.UpdateVersion();
-    batch.Put(handles_[0], key, meta_value.Encode());
-    HashesDataKey data_key(key, version, field);
-    batch.Put(handles_[1], data_key.Encode(), value);
-    *res = 1;
+    EncodeFixed32(str, 0);
+    HashesMetaValue hashes_meta_value(std::string(str, sizeof(int32_t)));
+    hashes_meta_value.UpdateVersion();
+    meta_value = hashes_meta_value.Encode().ToString();
+    meta_changed = true;
   } else {
-    return s;
+    for (auto write : *group) {
+      write->status = s;
+    }
+    return;
+  }
+  ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
+  int32_t version = parsed_hashes_meta_value.version();
+
+  // The new values of the fields the group wrote so far
+  std::map<std::string, std::string> written;
+  for (auto write : *group) {
+    std::string field = write->field.ToString();
+    std::string old_value;
+    bool exists = false, in_db = false;
+    auto iter = written.find(field);
+    if (iter != written.end()) {
+      old_value = iter->second;
+      exists = true;
+    } else if (fields_in_db) {
+      HashesDataKey hashes_data_key(key, version, write->field);
+      s = db_->Get(default_read_options_, handles_[1],
+                   hashes_data_key.Encode(), &old_value);
+      if (s.ok()) {
+        exists = in_db = true;
+      } else if (!s.IsNotFound()) {
+        write->status = s;
+        continue;
+      }
+    }
+
+    std::string new_value;
+    if (write->type == HashesWrite::kHSet) {
+      write->ret = exists ? 0 : 1;
+      write->status = Status::OK();
+      if (exists && old_value == write->value) {
+        continue;
+      }
+      new_value = write->value.ToString();
+    } else {
+      int64_t ival = 0;
+      if (exists && !StrToInt64(old_value.data(), old_value.size(), &ival)) {
+        write->status = Status::Corruption("hash value is not an integer");
+        continue;
+      }
+      if ((write->by >= 0 && LLONG_MAX - write->by < ival) ||
+        (write->by < 0 && LLONG_MIN - write->by > ival)) {
+        write->status = Status::InvalidArgument("Overflow");
+        continue;
+      }
+      write->ret = ival + write->by;
+      write->status = Status::OK();
+      char buf[32];
+      Int64ToStr(buf, 32, write->ret);
+      new_value = buf;
+    }
+    if (!exists) {
+      parsed_hashes_meta_value.ModifyCount(1);
+      meta_changed = true;
+    } else if (in_db) {
+      statistic++;
+    }
+    written[field] = new_value;
+  }
+  if (written.empty()) {
+    return;
+  }
+
+  if (meta_changed) {
+    batch.Put(handles_[0], key, meta_value);
+  }
+  for (const auto& entry : written) {
+    HashesDataKey hashes_data_key(key, version, entry.first);
+    batch.Put(handles_[1], hashes_data_key.Encode(), entry.second);
   }
   s = db_->Write(default_write_options_, &batch);
+  if (!s.ok()) {
+    for (auto write : *group) {
+      if (write->status.ok()) {
+        write->status = s;
+      }
+    }
+  }
   UpdateSpecificKeyStatistics(key.ToString(), statistic);
-  return s;
 }
 
 Status RedisHashes::HSetnx(const Slice& key, const Slice& field,
@@ -732,6 +750,9 @@ Status RedisHashes::HSetnx(const Slice& key, const Slice& field,
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
     if (parsed_hashes_meta_value.IsStale()
       || parsed_hashes_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_hashes_meta_value.version(),
+                         parsed_hashes_meta_value.count());
       version = parsed_hashes_meta_value.InitialMetaValue();
       parsed_hashes_meta_value.set_count(1);
       batch.Put(handles_[0], key, meta_value);
@@ -772,6 +793,7 @@ Status RedisHashes::HSetnx(const Slice& key, const Slice& field,
 
 Status RedisHashes::HVals(const Slice& key,
                           std::vector<std::string>* values) {
+  ScopeReadSkipSample sample(this, key);
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -823,12 +845,33 @@ Status RedisHashes::HScan(const Slice& key,
   *next_cursor = 0;
   field_values->clear();
   if (cursor < 0) {
-    *next_cursor = 0;
     return Status::OK();
   }
 
+  std::string start_point, next_point;
+  if (!GetScanStartPoint(key, pattern, cursor, &start_point).ok()) {
+    cursor = 0;
+    start_point.clear();
+  }
+  Status s = HScan(key, start_point, pattern, count, field_values, &next_point);
+  if (s.ok() && !next_point.empty()) {
+    *next_cursor = cursor + count;
+    StoreScanNextPoint(key, pattern, *next_cursor, next_point);
+  }
+  return s;
+}
+
+Status RedisHashes::HScan(const Slice& key,
+                          const std::string& start_point,
+                          const std::string& pattern,
+                          int64_t count,
+                          std::vector<FieldValue>* field_values,
+                          std::string* next_point) {
+  ScopeReadSkipSample sample(this, key);
+  next_point->clear();
+  field_values->clear();
+
   int64_t rest = count;
-  int64_t step_length = count;
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -840,25 +883,18 @@ Status RedisHashes::HScan(const Slice& key,
     ParsedHashesMetaValue parsed_hashes_meta_value(&meta_value);
     if (parsed_hashes_meta_value.IsStale()
       || parsed_hashes_meta_value.count() == 0) {
-      *next_cursor = 0;
       return Status::NotFound();
     } else {
       std::string sub_field;
-      std::string start_point;
       int32_t version = parsed_hashes_meta_value.version();
-      s = GetScanStartPoint(key, pattern, cursor, &start_point);
-      if (s.IsNotFound()) {
-        cursor = 0;
-        if (isTailWildcard(pattern)) {
-          start_point = pattern.substr(0, pattern.size() - 1);
-        }
-      }
       if (isTailWildcard(pattern)) {
         sub_field = pattern.substr(0, pattern.size() - 1);
       }
+      const std::string& seek_point = start_point.empty()
+        ? sub_field : start_point;
 
       HashesDataKey hashes_data_prefix(key, version, sub_field);
-      HashesDataKey hashes_start_data_key(key, version, start_point);
+      HashesDataKey hashes_start_data_key(key, version, seek_point);
       std::string prefix = hashes_data_prefix.Encode().ToString();
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[1]);
       for (iter->Seek(hashes_start_data_key.Encode());
@@ -873,20 +909,13 @@ Status RedisHashes::HScan(const Slice& key,
         rest--;
       }
 
-      if (iter->Valid()
-        && (iter->key().compare(prefix) <= 0
-          || iter->key().starts_with(prefix))) {
-        *next_cursor = cursor + step_length;
+      if (iter->Valid() && iter->key().starts_with(prefix)) {
         ParsedHashesDataKey parsed_hashes_data_key(iter->key());
-        std::string next_field = parsed_hashes_data_key.field().ToString();
-        StoreScanNextPoint(key, pattern, *next_cursor, next_field);
-      } else {
-        *next_cursor = 0;
+        *next_point = parsed_hashes_data_key.field().ToString();
       }
       delete iter;
     }
   } else {
-    *next_cursor = 0;
     return s;
   }
   return Status::OK();
@@ -1231,8 +1260,13 @@ Status RedisHashes::Expire(const Slice& key, int32_t ttl) {
       parsed_hashes_meta_value.SetRelativeTimestamp(ttl);
       s = db_->Put(default_write_options_, handles_[0], key, meta_value);
     } else {
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_hashes_meta_value.version(),
+                         parsed_hashes_meta_value.count());
       parsed_hashes_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
     }
   }
   return s;
@@ -1250,8 +1284,13 @@ Status RedisHashes::Del(const Slice& key) {
       return Status::NotFound();
     } else {
       uint32_t statistic = parsed_hashes_meta_value.count();
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_hashes_meta_value.version(),
+                         parsed_hashes_meta_value.count());
       parsed_hashes_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
       UpdateSpecificKeyStatistics(key.ToString(), statistic);
     }
   }
@@ -1355,12 +1394,17 @@ Status RedisHashes::Expireat(const Slice& key, int32_t timestamp) {
     } else if (parsed_hashes_meta_value.count() == 0) {
       return Status::NotFound();
     } else {
+      rocksdb::WriteBatch batch;
       if (timestamp > 0) {
         parsed_hashes_meta_value.set_timestamp(timestamp);
       } else {
+        DeleteVersionRange(&batch, handles_[1], key,
+                           parsed_hashes_meta_value.version(),
+                           parsed_hashes_meta_value.count());
         parsed_hashes_meta_value.InitialMetaValue();
       }
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
     }
   }
   return s;
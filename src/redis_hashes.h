@@ -11,6 +11,7 @@
 #include <unordered_set>
 
 #include "src/redis.h"
+#include "src/write_coalescer.h"
 
 namespace blackwidow {
 
@@ -59,6 +60,11 @@ class RedisHashes : public Redis {
   Status HScan(const Slice& key, int64_t cursor,
                const std::string& pattern, int64_t count,
                std::vector<FieldValue>* field_values, int64_t* next_cursor);
+  // Resumes at start_point, from the start if it is empty, next_point is
+  // empty once the scan is done
+  Status HScan(const Slice& key, const std::string& start_point,
+               const std::string& pattern, int64_t count,
+               std::vector<FieldValue>* field_values, std::string* next_point);
   Status HScanx(const Slice& key, const std::string start_field,
                 const std::string& pattern, int64_t count,
                 std::vector<FieldValue>* field_values,
@@ -102,6 +108,22 @@ class RedisHashes : public Redis {
 
  private:
   std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+
+  // An HSet or HIncrby, see WriteCoalescer
+  struct HashesWrite : public CoalescedWrite {
+    enum Type { kHSet, kHIncrby };
+    HashesWrite(const Slice& _key, Type _type, const Slice& _field)
+        : CoalescedWrite(_key), type(_type), field(_field), by(0), ret(0) {}
+    Type type;
+    Slice field;
+    Slice value;  // kHSet
+    int64_t by;   // kHIncrby
+    // kHSet: 1 if the field was added, kHIncrby: the new value
+    int64_t ret;
+  };
+  WriteCoalescer<HashesWrite> write_coalescer_;
+
+  void CommitWrites(std::vector<HashesWrite*>* group);
 };
 
 }  //  namespace blackwidow
@@ -3,28 +3,193 @@
 //  LICENSE file in the root directory of this source tree. An additional grant
 //  of patent rights can be found in the PATENTS file in the same directory.
 
+#include <string.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__SSSE3__)
+#include <tmmintrin.h>
+#endif
+
 #include <cmath>
 #include <string>
 #include <algorithm>
+#include "src/coding.h"
 #include "src/redis_hyperloglog.h"
 #include "src/blackwidow_murmur3.h"
 
 namespace blackwidow {
 
 const int32_t HLL_HASH_SEED = 313;
+const uint64_t kHllRedisHashSeed = 0xadc83b19ULL;
+const double kHllAlphaInf = 0.721347520444481703680;
+
+// The MurmurHash64A Redis hashes elements with, reading the input as
+// little endian on every platform
+static uint64_t HllMurmurHash64A(const void* key, int len, uint64_t seed) {
+  const uint64_t m = 0xc6a4a7935bd1e995ULL;
+  const int r = 47;
+  uint64_t h = seed ^ (len * m);
+  const uint8_t* data = static_cast<const uint8_t*>(key);
+  const uint8_t* end = data + (len - (len & 7));
+
+  while (data != end) {
+    uint64_t k = 0;
+    for (int i = 7; i >= 0; --i) {
+      k = (k << 8) | data[i];
+    }
+    k *= m;
+    k ^= k >> r;
+    k *= m;
+    h ^= k;
+    h *= m;
+    data += 8;
+  }
+
+  switch (len & 7) {
+    case 7: h ^= static_cast<uint64_t>(data[6]) << 48;  // fallthrough
+    case 6: h ^= static_cast<uint64_t>(data[5]) << 40;  // fallthrough
+    case 5: h ^= static_cast<uint64_t>(data[4]) << 32;  // fallthrough
+    case 4: h ^= static_cast<uint64_t>(data[3]) << 24;  // fallthrough
+    case 3: h ^= static_cast<uint64_t>(data[2]) << 16;  // fallthrough
+    case 2: h ^= static_cast<uint64_t>(data[1]) << 8;   // fallthrough
+    case 1: h ^= static_cast<uint64_t>(data[0]);
+            h *= m;
+  }
 
-HyperLogLog::HyperLogLog(uint8_t precision, std::string origin_register) {
+  h ^= h >> r;
+  h *= m;
+  h ^= h >> r;
+  return h;
+}
+
+// Every 3 bytes of the dense encoding hold 4 registers
+static void UnpackRegisters(const uint8_t* packed,
+                            uint8_t* registers, uint32_t m) {
+  uint32_t i = 0;
+#if defined(__SSSE3__)
+  // Spread 12 bytes over the 4 lanes, then move every 6 bit register of a
+  // lane into a byte of its own
+  const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1,
+                                        6, 7, 8, -1, 9, 10, 11, -1);
+  const __m128i mask = _mm_set1_epi32(0x3f);
+  // each load reads 16 bytes, 4 more than it consumes
+  for (; i / 4 * 3 + 16 <= m / 4 * 3; i += 16) {
+    __m128i v = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(packed + i / 4 * 3));
+    v = _mm_shuffle_epi8(v, shuffle);
+    __m128i r = _mm_and_si128(v, mask);
+    r = _mm_or_si128(r, _mm_and_si128(_mm_slli_epi32(v, 2),
+                                      _mm_slli_epi32(mask, 8)));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_slli_epi32(v, 4),
+                                      _mm_slli_epi32(mask, 16)));
+    r = _mm_or_si128(r, _mm_and_si128(_mm_slli_epi32(v, 6),
+                                      _mm_slli_epi32(mask, 24)));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(registers + i), r);
+  }
+#endif
+  for (; i < m; i += 4) {
+    const uint8_t* p = packed + i / 4 * 3;
+    registers[i] = p[0] & 0x3f;
+    registers[i + 1] = ((p[0] >> 6) | (p[1] << 2)) & 0x3f;
+    registers[i + 2] = ((p[1] >> 4) | (p[2] << 4)) & 0x3f;
+    registers[i + 3] = p[2] >> 2;
+  }
+}
+
+static void PackRegisters(const uint8_t* registers,
+                          uint32_t m, uint8_t* packed) {
+  for (uint32_t i = 0; i < m; i += 4) {
+    uint8_t* p = packed + i / 4 * 3;
+    p[0] = registers[i] | (registers[i + 1] << 6);
+    p[1] = (registers[i + 1] >> 2) | (registers[i + 2] << 4);
+    p[2] = (registers[i + 2] >> 4) | (registers[i + 3] << 2);
+  }
+}
+
+// dst = max(dst, src) register by register, returns whether dst changed
+static bool MaxMergeRegisters(uint8_t* dst, const uint8_t* src, uint32_t m) {
+  uint32_t i = 0;
+  bool changed = false;
+#if defined(__SSE2__)
+  for (; i + 16 <= m; i += 16) {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i max = _mm_max_epu8(a, b);
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(max, a)) != 0xffff) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), max);
+      changed = true;
+    }
+  }
+#endif
+  for (; i < m; ++i) {
+    if (src[i] > dst[i]) {
+      dst[i] = src[i];
+      changed = true;
+    }
+  }
+  return changed;
+}
+
+// Count the registers of every rank, which is all the estimators need.
+// Runs of zero registers are skipped 16 at a time.
+static void DenseHistogram(const uint8_t* registers,
+                           uint32_t m, uint32_t* histogram) {
+  uint32_t i = 0;
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= m; i += 16) {
+    __m128i v = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(registers + i));
+    if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) == 0xffff) {
+      histogram[0] += 16;
+      continue;
+    }
+    for (uint32_t j = i; j < i + 16; ++j) {
+      histogram[registers[j]]++;
+    }
+  }
+#endif
+  for (; i < m; ++i) {
+    histogram[registers[i]]++;
+  }
+}
+
+HyperLogLog::HyperLogLog(uint8_t precision,
+                         const std::string& origin_register)
+    : valid_(true),
+      sparse_(true),
+      legacy_(false),
+      card_valid_(false),
+      card_(0),
+      register_(nullptr) {
   b_ = precision;
   m_ = 1 << precision;
-  alpha_ = Alpha();
-  register_ = new char[m_];
-  for (uint32_t i = 0; i < m_; ++i) {
-    register_[i] = 0;
+  if (origin_register.empty()) {
+    return;
   }
-  if (origin_register != "") {
-    for (uint32_t i = 0; i < m_; ++i) {
-      register_[i] = origin_register[i];
-    }
+  const char* ptr = origin_register.data();
+  size_t len = origin_register.size();
+  if (len == (1U << kHllLegacyPrecision)) {
+    // legacy value, one byte registers without a header
+    b_ = kHllLegacyPrecision;
+    m_ = 1 << kHllLegacyPrecision;
+    legacy_ = true;
+    ToDense();
+    memcpy(register_, ptr, m_);
+  } else if (len < kHllHeaderSize || memcmp(ptr, "HYLL", 4)) {
+    valid_ = false;
+  } else if (ptr[4] == kHllDense && len == kHllHeaderSize + m_ / 4 * 3) {
+    ToDense();
+    UnpackRegisters(reinterpret_cast<const uint8_t*>(ptr) + kHllHeaderSize,
+                    register_, m_);
+  } else if (ptr[4] != kHllSparse
+    || !ParseSparse(ptr + kHllHeaderSize, len - kHllHeaderSize)) {
+    sparse_register_.clear();
+    valid_ = false;
+  }
+  if (valid_ && !legacy_) {
+    card_valid_ = CachedCardinality(origin_register, &card_);
   }
 }
 
@@ -32,82 +197,330 @@ HyperLogLog::~HyperLogLog() {
   delete [] register_;
 }
 
-std::string HyperLogLog::Add(const char* value, uint32_t len) {
-  uint32_t hash_value;
-  MurmurHash3_x86_32(value, len, HLL_HASH_SEED,
-                     static_cast<void *>(&hash_value));
-  int32_t index = hash_value & ((1 << b_) - 1);
-  uint8_t rank = Nclz((hash_value << b_), 32 - b_);
-  if (rank > register_[index])
-    register_[index] = rank;
-  std::string result(m_, 0);
-  for (uint32_t i = 0; i < m_; ++i) {
-    result[i] = register_[i];
+bool HyperLogLog::IsValid() const {
+  return valid_;
+}
+
+bool HyperLogLog::IsSparse() const {
+  return sparse_;
+}
+
+bool HyperLogLog::IsLegacy() const {
+  return legacy_;
+}
+
+bool HyperLogLog::CachedCardinality(const std::string& value,
+                                    uint64_t* cardinality) {
+  if (value.size() < kHllHeaderSize || memcmp(value.data(), "HYLL", 4)
+    || (value[4] != kHllDense && value[4] != kHllSparse)
+    || (value[15] & 0x80)) {
+    return false;
+  }
+  *cardinality = DecodeFixed64(value.data() + 8);
+  return true;
+}
+
+void HyperLogLog::SetCachedCardinality(uint64_t cardinality) {
+  card_valid_ = !legacy_;
+  card_ = cardinality;
+}
+
+bool HyperLogLog::Compatible(const HyperLogLog& hll) const {
+  return legacy_ == hll.legacy_ && m_ == hll.m_;
+}
+
+bool HyperLogLog::ParseSparse(const char* ptr, size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(ptr);
+  const uint8_t* end = p + len;
+  uint32_t index = 0;
+  while (p < end) {
+    uint8_t opcode = *p++;
+    if ((opcode & 0xc0) == 0x00) {
+      index += (opcode & 0x3f) + 1;
+    } else if ((opcode & 0xc0) == 0x40) {
+      if (p == end) {
+        return false;
+      }
+      index += (((opcode & 0x3f) << 8) | *p++) + 1;
+    } else {
+      uint8_t rank = ((opcode >> 2) & 0x1f) + 1;
+      uint32_t run = (opcode & 0x03) + 1;
+      if (index + run > m_) {
+        return false;
+      }
+      while (run--) {
+        sparse_register_.push_back(std::make_pair(index++, rank));
+      }
+    }
+    if (index > m_) {
+      return false;
+    }
+  }
+  return index == m_;
+}
+
+static void EncodeSparseZeros(uint32_t zeros, std::string* result) {
+  while (zeros > 64) {
+    uint32_t run = std::min(zeros, static_cast<uint32_t>(16384));
+    result->push_back(static_cast<char>(0x40 | ((run - 1) >> 8)));
+    result->push_back(static_cast<char>((run - 1) & 0xff));
+    zeros -= run;
+  }
+  if (zeros > 0) {
+    result->push_back(static_cast<char>(zeros - 1));
+  }
+}
+
+bool HyperLogLog::EncodeSparse(std::string* result) const {
+  size_t base = result->size();
+  uint32_t index = 0;
+  size_t pos = 0;
+  while (pos < sparse_register_.size()) {
+    uint32_t first = sparse_register_[pos].first;
+    uint8_t rank = sparse_register_[pos].second;
+    if (rank > kHllSparseValMax) {
+      return false;
+    }
+    EncodeSparseZeros(first - index, result);
+    uint32_t run = 1;
+    while (run < 4 && pos + run < sparse_register_.size()
+      && sparse_register_[pos + run].first == first + run
+      && sparse_register_[pos + run].second == rank) {
+      run++;
+    }
+    result->push_back(static_cast<char>(0x80 | ((rank - 1) << 2) | (run - 1)));
+    index = first + run;
+    pos += run;
+    if (result->size() - base > kHllSparseMaxBytes) {
+      return false;
+    }
+  }
+  EncodeSparseZeros(m_ - index, result);
+  return result->size() - base <= kHllSparseMaxBytes;
+}
+
+std::string HyperLogLog::Serialize() const {
+  if (legacy_) {
+    return std::string(reinterpret_cast<const char*>(register_), m_);
+  }
+  std::string result(kHllHeaderSize, 0);
+  memcpy(&result[0], "HYLL", 4);
+  if (card_valid_) {
+    EncodeFixed64(&result[8], card_);
+  } else {
+    result[15] = static_cast<char>(0x80);
+  }
+  if (sparse_) {
+    result[4] = kHllSparse;
+    if (EncodeSparse(&result)) {
+      return result;
+    }
+    result.resize(kHllHeaderSize);
+  }
+  // promote to dense
+  result[4] = kHllDense;
+  result.append(m_ / 4 * 3, 0);
+  uint8_t* packed = reinterpret_cast<uint8_t*>(&result[kHllHeaderSize]);
+  if (sparse_) {
+    std::vector<uint8_t> registers(m_, 0);
+    for (const auto& reg : sparse_register_) {
+      registers[reg.first] = reg.second;
+    }
+    PackRegisters(registers.data(), m_, packed);
+  } else {
+    PackRegisters(register_, m_, packed);
   }
   return result;
 }
 
-double HyperLogLog::Estimate() const {
-  double estimate = FirstEstimate();
-  if (estimate <= 2.5 * m_) {
-    uint32_t zeros = CountZero();
-    if (zeros != 0) {
-      estimate = m_ * log(static_cast<double>(m_) / zeros);
+static bool RegisterIndexLess(const std::pair<uint32_t, uint8_t>& reg,
+                              uint32_t index) {
+  return reg.first < index;
+}
+
+// Raise the register at index to rank, never lowers it
+bool HyperLogLog::SetRegister(uint32_t index, uint8_t rank) {
+  if (sparse_ && rank > kHllSparseValMax) {
+    ToDense();
+  }
+  if (!sparse_) {
+    if (rank > register_[index]) {
+      register_[index] = rank;
+      card_valid_ = false;
+      return true;
     }
-  } else if (estimate > pow(2, 32) / 30.0) {
-    estimate = log1p(estimate * -1 / pow(2, 32)) * pow(2, 32) * -1;
+    return false;
   }
-  return estimate;
+  auto iter = std::lower_bound(sparse_register_.begin(),
+      sparse_register_.end(), index, RegisterIndexLess);
+  if (iter != sparse_register_.end() && iter->first == index) {
+    if (rank <= iter->second) {
+      return false;
+    }
+    iter->second = rank;
+  } else {
+    sparse_register_.insert(iter, std::make_pair(index, rank));
+    // a VAL opcode covers at most 4 registers, this can not fit any more
+    if (sparse_register_.size() > kHllSparseMaxBytes * 4) {
+      ToDense();
+    }
+  }
+  card_valid_ = false;
+  return true;
 }
 
-double HyperLogLog::FirstEstimate() const {
-  double estimate, sum = 0.0;
-  for (uint32_t i = 0; i < m_; i++) {
-    sum += 1.0 / (1 << register_[i]);
+void HyperLogLog::ToDense() {
+  register_ = new uint8_t[m_];
+  memset(register_, 0, m_);
+  for (const auto& reg : sparse_register_) {
+    register_[reg.first] = reg.second;
   }
+  std::vector<std::pair<uint32_t, uint8_t>>().swap(sparse_register_);
+  sparse_ = false;
+}
 
-  estimate = alpha_ * m_ * m_ / sum;
-  return estimate;
+bool HyperLogLog::Add(const char* value, uint32_t len, std::string* operand) {
+  if (legacy_) {
+    uint32_t hash_value;
+    MurmurHash3_x86_32(value, len, HLL_HASH_SEED,
+                       static_cast<void *>(&hash_value));
+    int32_t index = hash_value & ((1 << b_) - 1);
+    uint8_t rank = Nclz((hash_value << b_), 32 - b_);
+    return SetRegister(index, rank);
+  }
+  // The low b_ bits select the register, the rank is the position of the
+  // lowest set bit among the others
+  uint64_t hash = HllMurmurHash64A(value, len, kHllRedisHashSeed);
+  uint32_t index = hash & (m_ - 1);
+  hash >>= b_;
+  hash |= 1ULL << (64 - b_);
+  uint8_t rank = __builtin_ctzll(hash) + 1;
+  if (!SetRegister(index, rank)) {
+    return false;
+  }
+  if (operand != nullptr) {
+    operand->push_back(static_cast<char>(index & 0xff));
+    operand->push_back(static_cast<char>(index >> 8));
+    operand->push_back(static_cast<char>(rank));
+  }
+  return true;
 }
 
-double HyperLogLog::Alpha() const {
-  switch (m_) {
-    case 16:
-      return 0.673;
-    case 32:
-      return 0.697;
-    case 64:
-      return 0.709;
-    default:
-      return 0.7213 / (1 + 1.079 / m_);
+bool HyperLogLog::MergeOperand(const char* operand, size_t len) {
+  if (legacy_ || len % kHllOperandEntrySize != 0) {
+    return false;
+  }
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(operand);
+  for (size_t i = 0; i < len; i += kHllOperandEntrySize) {
+    uint32_t index = p[i] | (p[i + 1] << 8);
+    uint8_t rank = p[i + 2];
+    if (index >= m_ || rank > 64 - b_ + 1) {
+      return false;
     }
+    SetRegister(index, rank);
+  }
+  return true;
 }
 
-uint32_t HyperLogLog::CountZero() const {
-  uint32_t count = 0;
-  for (uint32_t i = 0; i < m_; i++) {
-    if (register_[i] == 0) {
-      count++;
+void HyperLogLog::Histogram(uint32_t* histogram) const {
+  if (sparse_) {
+    histogram[0] = m_ - sparse_register_.size();
+    for (const auto& reg : sparse_register_) {
+      histogram[reg.second]++;
     }
+  } else {
+    DenseHistogram(register_, m_, histogram);
+  }
+}
+
+static double HllSigma(double x) {
+  if (x == 1.) {
+    return INFINITY;
+  }
+  double z_prime;
+  double y = 1;
+  double z = x;
+  do {
+    x *= x;
+    z_prime = z;
+    z += x * y;
+    y += y;
+  } while (z_prime != z);
+  return z;
+}
+
+static double HllTau(double x) {
+  if (x == 0. || x == 1.) {
+    return 0.;
+  }
+  double z_prime;
+  double y = 1.0;
+  double z = 1 - x;
+  do {
+    x = sqrt(x);
+    z_prime = z;
+    y *= 0.5;
+    z -= pow(1 - x, 2) * y;
+  } while (z_prime != z);
+  return z / 3;
+}
+
+// The estimator of Redis, "New cardinality estimation algorithms for
+// HyperLogLog sketches" by Otmar Ertl
+double HyperLogLog::Estimate() const {
+  uint32_t histogram[64] = {0};
+  Histogram(histogram);
+  if (legacy_) {
+    return LegacyEstimate(histogram);
   }
-  return count;
+  uint32_t q = 64 - b_;
+  double m = m_;
+  double z = m * HllTau((m - histogram[q + 1]) / m);
+  for (uint32_t j = q; j >= 1; --j) {
+    z += histogram[j];
+    z *= 0.5;
+  }
+  z += m * HllSigma(histogram[0] / m);
+  return llroundl(kHllAlphaInf * m * m / z);
 }
 
-std::string HyperLogLog::Merge(const HyperLogLog & hll) {
-  if (m_ != hll.m_) {
-    // TODO(shq) the number of registers doesn't match
+double HyperLogLog::LegacyEstimate(const uint32_t* histogram) const {
+  double sum = 0.0;
+  for (uint32_t r = 0; r < 64; ++r) {
+    sum += histogram[r] / static_cast<double>(1ULL << r);
   }
-  for (uint32_t r = 0; r < m_; r++) {
-    if (register_[r] < hll.register_[r]) {
-      register_[r] |= hll.register_[r];
+  double alpha = 0.7213 / (1 + 1.079 / m_);
+  double estimate = alpha * m_ * m_ / sum;
+  if (estimate <= 2.5 * m_) {
+    uint32_t zeros = histogram[0];
+    if (zeros != 0) {
+      estimate = m_ * log(static_cast<double>(m_) / zeros);
     }
+  } else if (estimate > pow(2, 32) / 30.0) {
+    estimate = log1p(estimate * -1 / pow(2, 32)) * pow(2, 32) * -1;
   }
+  return estimate;
+}
 
-  std::string result(m_, 0);
-  for (uint32_t i = 0; i < m_; ++i) {
-    result[i] = register_[i];
+bool HyperLogLog::Merge(const HyperLogLog & hll) {
+  if (!Compatible(hll)) {
+    return false;
   }
-  return result;
+  bool changed = false;
+  if (hll.sparse_) {
+    for (const auto& reg : hll.sparse_register_) {
+      changed |= SetRegister(reg.first, reg.second);
+    }
+  } else {
+    if (sparse_) {
+      ToDense();
+    }
+    changed = MaxMergeRegisters(register_, hll.register_, m_);
+    if (changed) {
+      card_valid_ = false;
+    }
+  }
+  return changed;
 }
 
 // ::__builtin_clz(x): 返回左起第一个‘1’之前0的个数
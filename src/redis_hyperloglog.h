@@ -8,31 +8,103 @@
 
 #include <iostream>
 #include <string>
+#include <vector>
+#include <utility>
 
 namespace blackwidow {
 
+/*
+ * A HyperLogLog value uses the layout of Redis:
+ *
+ * | "HYLL" | encoding | 3 unused bytes | 8 bytes cardinality | registers |
+ *
+ * The cardinality is a little endian cache of the estimate, the top bit of
+ * its last byte set means it is stale. Any register change marks it stale.
+ *
+ * kHllDense registers are 6 bits each, packed starting from the least
+ * significant bit, 12288 bytes for the 2^14 registers. kHllSparse registers
+ * use the opcodes of the Redis sparse representation:
+ *
+ * ZERO:  00xxxxxx           xxxxxx + 1 zero registers (1 ~ 64)
+ * XZERO: 01xxxxxx yyyyyyyy  xxxxxxyyyyyyyy + 1 zero registers (1 ~ 16384)
+ * VAL:   1vvvvvxx           xx + 1 registers set to vvvvv + 1 (1 ~ 4)
+ *
+ * A sparse value is promoted to dense once its encoding outgrows
+ * kHllSparseMaxBytes or it holds a rank that VAL can not express. Elements
+ * are hashed like Redis does, so values can be exchanged with Redis.
+ *
+ * Values written before the header existed are 2^17 one byte registers
+ * filled with another hash. They keep that legacy form, and can only be
+ * merged with other legacy values.
+ *
+ * PfAdd writes the registers it raised as a merge operand, 3 bytes per
+ * register: its index as 16 bit little endian, then its new rank.
+ */
+enum HllEncoding {
+  kHllDense = 0,
+  kHllSparse = 1,
+};
+
+static const size_t kHllHeaderSize = 16;
+static const size_t kHllSparseMaxBytes = 3000;
+static const uint8_t kHllSparseValMax = 32;
+static const uint8_t kHllLegacyPrecision = 17;
+static const size_t kHllOperandEntrySize = 3;
+static const char kInvalidHllValue[] =
+  "Key is not a valid HyperLogLog string value";
+
 class HyperLogLog {
  public:
-  HyperLogLog(uint8_t precision, std::string origin_resiter);
+  HyperLogLog(uint8_t precision, const std::string& origin_register);
   ~HyperLogLog();
 
+  // false if origin_register is neither empty nor a HyperLogLog value
+  bool IsValid() const;
+  bool IsSparse() const;
+  bool IsLegacy() const;
+  // Whether hll can be merged into this one
+  bool Compatible(const HyperLogLog& hll) const;
+
   double Estimate() const;
-  double FirstEstimate() const;
-  uint32_t CountZero() const;
-  double Alpha() const;
-  uint8_t Nclz(uint32_t x, int b);
 
-  std::string Add(const char* str, uint32_t len);
-  std::string Merge(const HyperLogLog& hll);
+  // Read the cardinality cached in the header of a value without parsing
+  // its registers, false if there is none or it is stale
+  static bool CachedCardinality(const std::string& value,
+                                uint64_t* cardinality);
+  // Cache cardinality in the header Serialize writes, until the next
+  // register change. Legacy values have no header to keep it in.
+  void SetCachedCardinality(uint64_t cardinality);
+
+  // Both update the registers in place and return whether any of them
+  // changed, call Serialize once done to get the value to store. Add also
+  // appends the register it raised to operand, if one is given.
+  bool Add(const char* str, uint32_t len, std::string* operand = nullptr);
+  bool Merge(const HyperLogLog& hll);
+  // Raise the registers listed in a merge operand, false if it is malformed
+  bool MergeOperand(const char* operand, size_t len);
+  std::string Serialize() const;
 
  protected:
-  uint32_t m_;  // register bit width
-  uint32_t b_;  // regieter size
-  double alpha_;
-  char* register_;  // register;
+  bool ParseSparse(const char* ptr, size_t len);
+  bool EncodeSparse(std::string* result) const;
+  bool SetRegister(uint32_t index, uint8_t rank);
+  void ToDense();
+  void Histogram(uint32_t* histogram) const;
+  double LegacyEstimate(const uint32_t* histogram) const;
+  uint8_t Nclz(uint32_t x, int b);
+
+  uint32_t m_;  // register size
+  uint32_t b_;  // hash bits that select a register
+  bool valid_;
+  bool sparse_;
+  bool legacy_;
+  bool card_valid_;
+  uint64_t card_;
+  // non-zero registers sorted by index, while sparse_
+  std::vector<std::pair<uint32_t, uint8_t>> sparse_register_;
+  uint8_t* register_;  // one byte per register, once dense
 };
 
 }  // namespace blackwidow
 
 #endif  // SRC_REDIS_HYPERLOGLOG_H_
-
@@ -5,10 +5,12 @@
 
 
 #include <memory>
+#include <limits>
 
 #include "blackwidow/util.h"
 #include "src/redis_lists.h"
 #include "src/lists_filter.h"
+#include "src/key_num_collector.h"
 #include "src/scope_record_lock.h"
 #include "src/scope_snapshot.h"
 
@@ -20,7 +22,8 @@ const rocksdb::Comparator* ListsDataKeyComparator() {
 }
 
 RedisLists::RedisLists(BlackWidow* const bw, const DataType& type)
-    : Redis(bw, type) {
+    : Redis(bw, type),
+      write_coalescer_(lock_mgr_) {
 }
 
 RedisLists::~RedisLists() {
@@ -35,6 +38,8 @@ Status RedisLists::Open(const BlackwidowOptions& bw_options,
                         const std::string& db_path) {
   statistics_store_->SetCapacity(bw_options.statistics_max_size);
   small_compaction_threshold_ = bw_options.small_compaction_threshold;
+  SetTombstoneCompactionOptions(bw_options);
+  write_coalescer_.set_enabled(bw_options.coalesce_key_writes);
 
   rocksdb::Options ops(bw_options.options);
   Status s = rocksdb::DB::Open(ops, db_path, &db_);
@@ -58,8 +63,11 @@ Status RedisLists::Open(const BlackwidowOptions& bw_options,
   rocksdb::ColumnFamilyOptions data_cf_ops(bw_options.options);
   meta_cf_ops.compaction_filter_factory =
     std::make_shared<ListsMetaFilterFactory>();
+  meta_cf_ops.table_properties_collector_factories.push_back(
+      std::make_shared<KeyNumCollectorFactory>(kLists));
   data_cf_ops.compaction_filter_factory =
     std::make_shared<ListsDataFilterFactory>(&db_, &handles_);
+  AddDeletionCollector(bw_options, &data_cf_ops);
   data_cf_ops.comparator = ListsDataKeyComparator();
 
   // use the bloom filter policy to reduce disk reads
@@ -229,10 +237,8 @@ Status RedisLists::LIndex(const Slice& key,
                           int64_t index,
                           std::string* element) {
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
 
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  ScopeSharedRecordLock l(lock_mgr_, key);
   std::string meta_value;
   Status s = db_->Get(read_options, handles_[0], key, &meta_value);
   if (s.ok()) {
@@ -429,48 +435,66 @@ Status RedisLists::LPop(const Slice& key, std::string* element) {
 Status RedisLists::LPush(const Slice& key,
                          const std::vector<std::string>& values,
                          uint64_t* ret) {
-  *ret = 0;
+  ListsWrite write(key, true, values);
+  Status s = write_coalescer_.Run(&write,
+      [this](std::vector<ListsWrite*>* group) { CommitWrites(group); });
+  *ret = s.ok() ? write.ret : 0;
+  return s;
+}
+
+// Applies the pushes of one key in order against one read of its meta
+// value, and writes them all with one batch
+void RedisLists::CommitWrites(std::vector<ListsWrite*>* group) {
+  const Slice& key = group->front()->key;
   rocksdb::WriteBatch batch;
-  ScopeRecordLock l(lock_mgr_, key);
 
-  uint64_t index = 0;
-  int32_t version = 0;
   std::string meta_value;
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedListsMetaValue parsed_lists_meta_value(&meta_value);
     if (parsed_lists_meta_value.IsStale()
       || parsed_lists_meta_value.count() == 0) {
-      version = parsed_lists_meta_value.InitialMetaValue();
-    } else {
-      version = parsed_lists_meta_value.version();
-    }
-    for (const auto& value : values) {
-      index = parsed_lists_meta_value.left_index();
-      parsed_lists_meta_value.ModifyLeftIndex(1);
-      parsed_lists_meta_value.ModifyCount(1);
-      ListsDataKey lists_data_key(key, version, index);
-      batch.Put(handles_[1], lists_data_key.Encode(), value);
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_lists_meta_value.version(),
+                         parsed_lists_meta_value.count());
+      parsed_lists_meta_value.InitialMetaValue();
     }
-    batch.Put(handles_[0], key, meta_value);
-    *ret = parsed_lists_meta_value.count();
   } else if (s.IsNotFound()) {
     char str[8];
-    EncodeFixed64(str, values.size());
+    EncodeFixed64(str, 0);
     ListsMetaValue lists_meta_value(Slice(str, sizeof(uint64_t)));
-    version = lists_meta_value.UpdateVersion();
-    for (const auto& value : values) {
-      index = lists_meta_value.left_index();
-      lists_meta_value.ModifyLeftIndex(1);
+    lists_meta_value.UpdateVersion();
+    meta_value = lists_meta_value.Encode().ToString();
+  } else {
+    for (auto write : *group) {
+      write->status = s;
+    }
+    return;
+  }
+
+  ParsedListsMetaValue parsed_lists_meta_value(&meta_value);
+  int32_t version = parsed_lists_meta_value.version();
+  uint64_t index = 0;
+  for (auto write : *group) {
+    for (const auto& value : write->values) {
+      if (write->left) {
+        index = parsed_lists_meta_value.left_index();
+        parsed_lists_meta_value.ModifyLeftIndex(1);
+      } else {
+        index = parsed_lists_meta_value.right_index();
+        parsed_lists_meta_value.ModifyRightIndex(1);
+      }
+      parsed_lists_meta_value.ModifyCount(1);
       ListsDataKey lists_data_key(key, version, index);
       batch.Put(handles_[1], lists_data_key.Encode(), value);
     }
-    batch.Put(handles_[0], key, lists_meta_value.Encode());
-    *ret = lists_meta_value.right_index() - lists_meta_value.left_index() - 1;
-  } else {
-    return s;
+    write->ret = parsed_lists_meta_value.count();
+  }
+  batch.Put(handles_[0], key, meta_value);
+  s = db_->Write(default_write_options_, &batch);
+  for (auto write : *group) {
+    write->status = s;
   }
-  return db_->Write(default_write_options_, &batch);
 }
 
 Status RedisLists::LPushx(const Slice& key, const Slice& value, uint64_t* len) {
@@ -503,6 +527,7 @@ Status RedisLists::LPushx(const Slice& key, const Slice& value, uint64_t* len) {
 
 Status RedisLists::LRange(const Slice& key, int64_t start, int64_t stop,
                           std::vector<std::string>* ret) {
+  ScopeReadSkipSample sample(this, key);
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -919,6 +944,9 @@ Status RedisLists::RPoplpush(const Slice& source,
     ParsedListsMetaValue parsed_lists_meta_value(&destination_meta_value);
     if (parsed_lists_meta_value.IsStale()
       || parsed_lists_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], destination,
+                         parsed_lists_meta_value.version(),
+                         parsed_lists_meta_value.count());
       version = parsed_lists_meta_value.InitialMetaValue();
     } else {
       version = parsed_lists_meta_value.version();
@@ -954,47 +982,11 @@ Status RedisLists::RPoplpush(const Slice& source,
 Status RedisLists::RPush(const Slice& key,
                          const std::vector<std::string>& values,
                          uint64_t* ret) {
-  *ret = 0;
-  rocksdb::WriteBatch batch;
-
-  uint64_t index = 0;
-  int32_t version = 0;
-  std::string meta_value;
-  Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
-  if (s.ok()) {
-    ParsedListsMetaValue parsed_lists_meta_value(&meta_value);
-    if (parsed_lists_meta_value.IsStale()
-      || parsed_lists_meta_value.count() == 0) {
-      version = parsed_lists_meta_value.InitialMetaValue();
-    } else {
-      version = parsed_lists_meta_value.version();
-    }
-    for (const auto& value : values) {
-      index = parsed_lists_meta_value.right_index();
-      parsed_lists_meta_value.ModifyRightIndex(1);
-      parsed_lists_meta_value.ModifyCount(1);
-      ListsDataKey lists_data_key(key, version, index);
-      batch.Put(handles_[1], lists_data_key.Encode(), value);
-    }
-    batch.Put(handles_[0], key, meta_value);
-    *ret = parsed_lists_meta_value.count();
-  } else if (s.IsNotFound()) {
-    char str[8];
-    EncodeFixed64(str, values.size());
-    ListsMetaValue lists_meta_value(Slice(str, sizeof(uint64_t)));
-    version = lists_meta_value.UpdateVersion();
-    for (auto value : values) {
-      index = lists_meta_value.right_index();
-      lists_meta_value.ModifyRightIndex(1);
-      ListsDataKey lists_data_key(key, version, index);
-      batch.Put(handles_[1], lists_data_key.Encode(), value);
-    }
-    batch.Put(handles_[0], key, lists_meta_value.Encode());
-    *ret = lists_meta_value.right_index() - lists_meta_value.left_index() - 1;
-  } else {
-    return s;
-  }
-  return db_->Write(default_write_options_, &batch);
+  ListsWrite write(key, false, values);
+  Status s = write_coalescer_.Run(&write,
+      [this](std::vector<ListsWrite*>* group) { CommitWrites(group); });
+  *ret = s.ok() ? write.ret : 0;
+  return s;
 }
 
 Status RedisLists::RPushx(const Slice& key, const Slice& value, uint64_t* len) {
@@ -1169,8 +1161,13 @@ Status RedisLists::Expire(const Slice& key, int32_t ttl) {
       parsed_lists_meta_value.SetRelativeTimestamp(ttl);
       s = db_->Put(default_write_options_, handles_[0], key, meta_value);
     } else {
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_lists_meta_value.version(),
+                         parsed_lists_meta_value.count());
       parsed_lists_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
     }
   }
   return s;
@@ -1188,14 +1185,32 @@ Status RedisLists::Del(const Slice& key) {
       return Status::NotFound();
     } else {
       uint32_t statistic = parsed_lists_meta_value.count();
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_lists_meta_value.version(),
+                         parsed_lists_meta_value.count());
       parsed_lists_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
       UpdateSpecificKeyStatistics(key.ToString(), statistic);
     }
   }
   return s;
 }
 
+// ListsDataKeyComparator orders the versions of a key by their value, so
+// the range ends right before the next version instead
+bool RedisLists::VersionRange(const Slice& key, int32_t version,
+                              std::string* begin, std::string* end) {
+  if (version == std::numeric_limits<int32_t>::max()) {
+    return false;
+  }
+  std::string successor;
+  Redis::VersionRange(key, version, begin, &successor);
+  Redis::VersionRange(key, version + 1, end, &successor);
+  return true;
+}
+
 bool RedisLists::Scan(const std::string& start_key,
                       const std::string& pattern,
                       std::vector<std::string>* keys,
@@ -1293,12 +1308,17 @@ Status RedisLists::Expireat(const Slice& key, int32_t timestamp) {
     } else if (parsed_lists_meta_value.count() == 0) {
       return Status::NotFound();
     } else {
+      rocksdb::WriteBatch batch;
       if (timestamp > 0) {
         parsed_lists_meta_value.set_timestamp(timestamp);
       } else {
+        DeleteVersionRange(&batch, handles_[1], key,
+                           parsed_lists_meta_value.version(),
+                           parsed_lists_meta_value.count());
         parsed_lists_meta_value.InitialMetaValue();
       }
-      return db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      return db_->Write(default_write_options_, &batch);
     }
   }
   return s;
@@ -12,6 +12,7 @@
 
 #include "src/redis.h"
 #include "src/custom_comparator.h"
+#include "src/write_coalescer.h"
 
 namespace blackwidow {
 
@@ -80,8 +81,26 @@ class RedisLists : public Redis {
   // Iterate all data
   void ScanDatabase();
 
+ protected:
+  bool VersionRange(const Slice& key, int32_t version,
+                    std::string* begin, std::string* end) override;
+
  private:
   std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+
+  // An LPush or RPush, see WriteCoalescer
+  struct ListsWrite : public CoalescedWrite {
+    ListsWrite(const Slice& _key, bool _left,
+               const std::vector<std::string>& _values)
+        : CoalescedWrite(_key), left(_left), values(_values), ret(0) {}
+    bool left;
+    const std::vector<std::string>& values;
+    // the length of the list after the push
+    uint64_t ret;
+  };
+  WriteCoalescer<ListsWrite> write_coalescer_;
+
+  void CommitWrites(std::vector<ListsWrite*>* group);
 };
 
 }  //  namespace blackwidow
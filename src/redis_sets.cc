@@ -12,6 +12,7 @@
 
 #include "blackwidow/util.h"
 #include "src/base_filter.h"
+#include "src/key_num_collector.h"
 #include "src/scope_snapshot.h"
 #include "src/scope_record_lock.h"
 
@@ -36,6 +37,7 @@ Status RedisSets::Open(const BlackwidowOptions& bw_options,
                        const std::string& db_path) {
   statistics_store_->SetCapacity(bw_options.statistics_max_size);
   small_compaction_threshold_ = bw_options.small_compaction_threshold;
+  SetTombstoneCompactionOptions(bw_options);
 
   rocksdb::Options ops(bw_options.options);
   Status s = rocksdb::DB::Open(ops, db_path, &db_);
@@ -58,8 +60,11 @@ Status RedisSets::Open(const BlackwidowOptions& bw_options,
   rocksdb::ColumnFamilyOptions member_cf_ops(bw_options.options);
   meta_cf_ops.compaction_filter_factory =
       std::make_shared<SetsMetaFilterFactory>();
+  meta_cf_ops.table_properties_collector_factories.push_back(
+      std::make_shared<KeyNumCollectorFactory>(kSets));
   member_cf_ops.compaction_filter_factory =
       std::make_shared<SetsMemberFilterFactory>(&db_, &handles_);
+  AddDeletionCollector(bw_options, &member_cf_ops);
 
   // use the bloom filter policy to reduce disk reads
   rocksdb::BlockBasedTableOptions table_ops(bw_options.table_options);
@@ -244,6 +249,9 @@ Status RedisSets::SAdd(const Slice& key,
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
     if (parsed_sets_meta_value.IsStale()
       || parsed_sets_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_sets_meta_value.version(),
+                         parsed_sets_meta_value.count());
       version = parsed_sets_meta_value.InitialMetaValue();
       parsed_sets_meta_value.set_count(filtered_members.size());
       batch.Put(handles_[0], key, meta_value);
@@ -393,13 +401,10 @@ Status RedisSets::SDiffstore(const Slice& destination,
 
   rocksdb::WriteBatch batch;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
 
   std::string meta_value;
   int32_t version = 0;
-  ScopeRecordLock l(lock_mgr_, destination);
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  MultiScopeRecordLock l(lock_mgr_, {destination.ToString()}, keys);
   std::vector<KeyVersion> vaild_sets;
   Status s;
 
@@ -463,6 +468,9 @@ Status RedisSets::SDiffstore(const Slice& destination,
   if (s.ok()) {
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
     statistic = parsed_sets_meta_value.count();
+    DeleteVersionRange(&batch, handles_[1], destination,
+                       parsed_sets_meta_value.version(),
+                       parsed_sets_meta_value.count());
     version = parsed_sets_meta_value.InitialMetaValue();
     parsed_sets_meta_value.set_count(members.size());
     batch.Put(handles_[0], destination, meta_value);
@@ -576,14 +584,11 @@ Status RedisSets::SInterstore(const Slice& destination,
 
   rocksdb::WriteBatch batch;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
 
   std::string meta_value;
   int32_t version = 0;
   bool have_invalid_sets = false;
-  ScopeRecordLock l(lock_mgr_, destination);
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  MultiScopeRecordLock l(lock_mgr_, {destination.ToString()}, keys);
   std::vector<KeyVersion> vaild_sets;
   Status s;
 
@@ -660,6 +665,9 @@ Status RedisSets::SInterstore(const Slice& destination,
   if (s.ok()) {
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
     statistic = parsed_sets_meta_value.count();
+    DeleteVersionRange(&batch, handles_[1], destination,
+                       parsed_sets_meta_value.version(),
+                       parsed_sets_meta_value.count());
     version = parsed_sets_meta_value.InitialMetaValue();
     parsed_sets_meta_value.set_count(members.size());
     batch.Put(handles_[0], destination, meta_value);
@@ -686,12 +694,10 @@ Status RedisSets::SIsmember(const Slice& key, const Slice& member,
                             int32_t* ret) {
   *ret = 0;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
 
   std::string meta_value;
   int32_t version = 0;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  ScopeSharedRecordLock l(lock_mgr_, key);
   Status s = db_->Get(read_options, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
@@ -715,6 +721,7 @@ Status RedisSets::SIsmember(const Slice& key, const Slice& member,
 
 Status RedisSets::SMembers(const Slice& key,
                            std::vector<std::string>* members) {
+  ScopeReadSkipSample sample(this, key);
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -801,6 +808,9 @@ Status RedisSets::SMove(const Slice& source, const Slice& destination,
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
     if (parsed_sets_meta_value.IsStale()
       || parsed_sets_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], destination,
+                         parsed_sets_meta_value.version(),
+                         parsed_sets_meta_value.count());
       version = parsed_sets_meta_value.InitialMetaValue();
       parsed_sets_meta_value.set_count(1);
       batch.Put(handles_[0], destination, meta_value);
@@ -839,6 +849,7 @@ Status RedisSets::SMove(const Slice& source, const Slice& destination,
 Status RedisSets::SPop(const Slice& key,
                        std::string* member,
                        bool* need_compact) {
+  ScopeReadSkipSample sample(this, key);
   std::default_random_engine engine;
 
   std::string meta_value;
@@ -905,6 +916,7 @@ Status RedisSets::AddAndGetSpopCount(const std::string& key, uint64_t* count) {
 
 Status RedisSets::SRandmember(const Slice& key, int32_t count,
                               std::vector<std::string>* members) {
+  ScopeReadSkipSample sample(this, key);
   if (count == 0) {
     return Status::OK();
   }
@@ -1081,13 +1093,10 @@ Status RedisSets::SUnionstore(const Slice& destination,
 
   rocksdb::WriteBatch batch;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
 
   std::string meta_value;
   int32_t version = 0;
-  ScopeRecordLock l(lock_mgr_, destination);
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  MultiScopeRecordLock l(lock_mgr_, {destination.ToString()}, keys);
   std::vector<KeyVersion> vaild_sets;
   Status s;
 
@@ -1130,6 +1139,9 @@ Status RedisSets::SUnionstore(const Slice& destination,
   if (s.ok()) {
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
     statistic = parsed_sets_meta_value.count();
+    DeleteVersionRange(&batch, handles_[1], destination,
+                       parsed_sets_meta_value.version(),
+                       parsed_sets_meta_value.count());
     version = parsed_sets_meta_value.InitialMetaValue();
     parsed_sets_meta_value.set_count(members.size());
     batch.Put(handles_[0], destination, meta_value);
@@ -1161,12 +1173,33 @@ Status RedisSets::SScan(const Slice& key,
   *next_cursor = 0;
   members->clear();
   if (cursor < 0) {
-    *next_cursor = 0;
     return Status::OK();
   }
 
+  std::string start_point, next_point;
+  if (!GetScanStartPoint(key, pattern, cursor, &start_point).ok()) {
+    cursor = 0;
+    start_point.clear();
+  }
+  Status s = SScan(key, start_point, pattern, count, members, &next_point);
+  if (s.ok() && !next_point.empty()) {
+    *next_cursor = cursor + count;
+    StoreScanNextPoint(key, pattern, *next_cursor, next_point);
+  }
+  return s;
+}
+
+Status RedisSets::SScan(const Slice& key,
+                        const std::string& start_point,
+                        const std::string& pattern,
+                        int64_t count,
+                        std::vector<std::string>* members,
+                        std::string* next_point) {
+  ScopeReadSkipSample sample(this, key);
+  next_point->clear();
+  members->clear();
+
   int64_t rest = count;
-  int64_t step_length = count;
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -1178,25 +1211,18 @@ Status RedisSets::SScan(const Slice& key,
     ParsedSetsMetaValue parsed_sets_meta_value(&meta_value);
     if (parsed_sets_meta_value.IsStale()
       || parsed_sets_meta_value.count() == 0) {
-      *next_cursor = 0;
       return Status::NotFound();
     } else {
       std::string sub_member;
-      std::string start_point;
       int32_t version = parsed_sets_meta_value.version();
-      s = GetScanStartPoint(key, pattern, cursor, &start_point);
-      if (s.IsNotFound()) {
-        cursor = 0;
-        if (isTailWildcard(pattern)) {
-          start_point = pattern.substr(0, pattern.size() - 1);
-        }
-      }
       if (isTailWildcard(pattern)) {
         sub_member = pattern.substr(0, pattern.size() - 1);
       }
+      const std::string& seek_point = start_point.empty()
+        ? sub_member : start_point;
 
       SetsMemberKey sets_member_prefix(key, version, sub_member);
-      SetsMemberKey sets_member_key(key, version, start_point);
+      SetsMemberKey sets_member_key(key, version, seek_point);
       std::string prefix = sets_member_prefix.Encode().ToString();
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[1]);
       for (iter->Seek(sets_member_key.Encode());
@@ -1211,20 +1237,13 @@ Status RedisSets::SScan(const Slice& key,
         rest--;
       }
 
-      if (iter->Valid()
-        && (iter->key().compare(prefix) <= 0
-          || iter->key().starts_with(prefix))) {
-        *next_cursor = cursor + step_length;
+      if (iter->Valid() && iter->key().starts_with(prefix)) {
         ParsedSetsMemberKey parsed_sets_member_key(iter->key());
-        std::string next_member = parsed_sets_member_key.member().ToString();
-        StoreScanNextPoint(key, pattern, *next_cursor, next_member);
-      } else {
-        *next_cursor = 0;
+        *next_point = parsed_sets_member_key.member().ToString();
       }
       delete iter;
     }
   } else {
-    *next_cursor = 0;
     return s;
   }
   return Status::OK();
@@ -1374,8 +1393,13 @@ Status RedisSets::Expire(const Slice& key, int32_t ttl) {
       parsed_sets_meta_value.SetRelativeTimestamp(ttl);
       s = db_->Put(default_write_options_, handles_[0], key, meta_value);
     } else {
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_sets_meta_value.version(),
+                         parsed_sets_meta_value.count());
       parsed_sets_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
     }
   }
   return s;
@@ -1393,8 +1417,13 @@ Status RedisSets::Del(const Slice& key) {
       return Status::NotFound();
     } else {
       uint32_t statistic = parsed_sets_meta_value.count();
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_sets_meta_value.version(),
+                         parsed_sets_meta_value.count());
       parsed_sets_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
       UpdateSpecificKeyStatistics(key.ToString(), statistic);
     }
   }
@@ -1498,12 +1527,17 @@ Status RedisSets::Expireat(const Slice& key, int32_t timestamp) {
     } else if (parsed_sets_meta_value.count() == 0) {
       return Status::NotFound();
     } else {
+      rocksdb::WriteBatch batch;
       if (timestamp > 0) {
         parsed_sets_meta_value.set_timestamp(timestamp);
       } else {
+        DeleteVersionRange(&batch, handles_[1], key,
+                           parsed_sets_meta_value.version(),
+                           parsed_sets_meta_value.count());
         parsed_sets_meta_value.InitialMetaValue();
       }
-      return db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      return db_->Write(default_write_options_, &batch);
     }
   }
   return s;
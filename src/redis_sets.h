@@ -71,6 +71,11 @@ class RedisSets : public Redis {
   Status SScan(const Slice& key, int64_t cursor,
                const std::string& pattern, int64_t count,
                std::vector<std::string>* members, int64_t* next_cursor);
+  // Resumes at start_point, from the start if it is empty, next_point is
+  // empty once the scan is done
+  Status SScan(const Slice& key, const std::string& start_point,
+               const std::string& pattern, int64_t count,
+               std::vector<std::string>* members, std::string* next_point);
   Status PKScanRange(const Slice& key_start, const Slice& key_end,
                      const Slice& pattern, int32_t limit,
                      std::vector<std::string>* keys, std::string* next_key);
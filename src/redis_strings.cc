@@ -12,6 +12,8 @@
 
 #include "blackwidow/util.h"
 #include "src/strings_filter.h"
+#include "src/hyperloglog_merge_operator.h"
+#include "src/key_num_collector.h"
 #include "src/scope_record_lock.h"
 #include "src/scope_snapshot.h"
 
@@ -25,6 +27,9 @@ Status RedisStrings::Open(const BlackwidowOptions& bw_options,
     const std::string& db_path) {
   rocksdb::Options ops(bw_options.options);
   ops.compaction_filter_factory = std::make_shared<StringsFilterFactory>();
+  ops.merge_operator = std::make_shared<HyperLogLogMergeOperator>();
+  ops.table_properties_collector_factories.push_back(
+      std::make_shared<KeyNumCollectorFactory>(kStrings));
 
   // use the bloom filter policy to reduce disk reads
   rocksdb::BlockBasedTableOptions table_ops(bw_options.table_options);
@@ -587,9 +592,7 @@ Status RedisStrings::MGet(const std::vector<std::string>& keys,
   Status s;
   std::string value;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  MultiScopeRecordLock l(lock_mgr_, {}, keys);
   for (const auto& key : keys) {
     s = db_->Get(read_options, key, &value);
     if (s.ok()) {
@@ -610,6 +613,108 @@ Status RedisStrings::MGet(const std::vector<std::string>& keys,
   return Status::OK();
 }
 
+Status RedisStrings::MergeHyperLogLog(const Slice& key,
+                                      const Slice& operand) {
+  ScopeRecordLock l(lock_mgr_, key);
+  return db_->Merge(default_write_options_, key, operand);
+}
+
+Status RedisStrings::PfAddLegacy(const Slice& key,
+                                 const std::vector<std::string>& values,
+                                 bool* update) {
+  *update = false;
+  std::string value;
+  int32_t timestamp = 0;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, key, &value);
+  if (s.ok()) {
+    ParsedStringsValue parsed_strings_value(&value);
+    if (parsed_strings_value.IsStale()) {
+      value.clear();
+      s = Status::NotFound("Stale");
+    } else {
+      timestamp = parsed_strings_value.timestamp();
+      parsed_strings_value.StripSuffix();
+    }
+  } else if (!s.IsNotFound()) {
+    return s;
+  }
+
+  HyperLogLog log(BlackWidow::kPrecision, value);
+  if (!log.IsValid()) {
+    return Status::InvalidArgument(kInvalidHllValue);
+  }
+  if (!log.IsLegacy()) {
+    std::string operand;
+    for (const auto& element : values) {
+      log.Add(element.data(), element.size(), &operand);
+    }
+    if (operand.empty() && !s.IsNotFound()) {
+      return Status::OK();
+    }
+    *update = true;
+    return db_->Merge(default_write_options_, key, operand);
+  }
+
+  bool changed = false;
+  for (const auto& element : values) {
+    changed |= log.Add(element.data(), element.size());
+  }
+  if (!changed) {
+    return Status::OK();
+  }
+  *update = true;
+  std::string registers = log.Serialize();
+  StringsValue strings_value(registers);
+  strings_value.set_timestamp(timestamp);
+  return db_->Put(default_write_options_, key, strings_value.Encode());
+}
+
+Status RedisStrings::HyperLogLogCount(const Slice& key, int64_t* result) {
+  *result = 0;
+  std::string value;
+  uint64_t cardinality;
+  Status s = Get(key, &value);
+  if (s.IsNotFound()) {
+    return Status::OK();
+  } else if (!s.ok()) {
+    return s;
+  } else if (HyperLogLog::CachedCardinality(value, &cardinality)) {
+    *result = cardinality;
+    return Status::OK();
+  }
+
+  // Estimate under the record lock, so no PfAdd lands between the read
+  // and the write back of the cache
+  ScopeRecordLock l(lock_mgr_, key);
+  s = db_->Get(default_read_options_, key, &value);
+  if (s.IsNotFound()) {
+    return Status::OK();
+  } else if (!s.ok()) {
+    return s;
+  }
+  ParsedStringsValue parsed_strings_value(&value);
+  if (parsed_strings_value.IsStale()) {
+    return Status::OK();
+  }
+  int32_t timestamp = parsed_strings_value.timestamp();
+  parsed_strings_value.StripSuffix();
+  HyperLogLog log(BlackWidow::kPrecision, value);
+  if (!log.IsValid()) {
+    return Status::InvalidArgument(kInvalidHllValue);
+  }
+  *result = static_cast<int64_t>(log.Estimate());
+  if (log.IsLegacy() || HyperLogLog::CachedCardinality(value, &cardinality)) {
+    return Status::OK();
+  }
+
+  log.SetCachedCardinality(*result);
+  std::string registers = log.Serialize();
+  StringsValue strings_value(registers);
+  strings_value.set_timestamp(timestamp);
+  return db_->Put(default_write_options_, key, strings_value.Encode());
+}
+
 Status RedisStrings::MSet(const std::vector<KeyValue>& kvs) {
   std::vector<std::string> keys;
   for (const auto& kv :  kvs) {
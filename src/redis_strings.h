@@ -47,6 +47,16 @@ class RedisStrings : public Redis {
   Status Incrbyfloat(const Slice& key, const Slice& value, std::string* ret);
   Status MGet(const std::vector<std::string>& keys,
               std::vector<ValueStatus>* vss);
+  // Write a register update of PfAdd, see HyperLogLogMergeOperator
+  Status MergeHyperLogLog(const Slice& key, const Slice& operand);
+  // PfAdd on a legacy HyperLogLog, whose registers can only be rewritten
+  // whole. Reads the value again under the record lock, and merges an
+  // operand instead if it is no longer legacy by then.
+  Status PfAddLegacy(const Slice& key, const std::vector<std::string>& values,
+                     bool* update);
+  // Cardinality of the HyperLogLog at key, served from the cache in its
+  // header when valid, estimated and cached otherwise
+  Status HyperLogLogCount(const Slice& key, int64_t* result);
   Status MSet(const std::vector<KeyValue>& kvs);
   Status MSetnx(const std::vector<KeyValue>& kvs, int32_t* ret);
   Status Set(const Slice& key, const Slice& value);
@@ -6,6 +6,7 @@
 #include "src/redis_zsets.h"
 
 #include <map>
+#include <cmath>
 #include <memory>
 #include <limits>
 #include <algorithm>
@@ -13,6 +14,7 @@
 #include "iostream"
 #include "blackwidow/util.h"
 #include "src/zsets_filter.h"
+#include "src/key_num_collector.h"
 #include "src/scope_record_lock.h"
 #include "src/scope_snapshot.h"
 
@@ -24,7 +26,8 @@ rocksdb::Comparator* ZSetsScoreKeyComparator() {
 }
 
 RedisZSets::RedisZSets(BlackWidow* const bw, const DataType& type)
-    : Redis(bw, type) {
+    : Redis(bw, type),
+      range_delete_threshold_(0) {
 }
 
 RedisZSets::~RedisZSets() {
@@ -35,10 +38,64 @@ RedisZSets::~RedisZSets() {
   }
 }
 
+// Format 1 score column family, ordered by ZSetsScoreKeyComparator. Format 2
+// lives in "score_cf_v2" and uses the default bytewise comparator.
+static const std::string kZSetsScoreCFV1 = "score_cf";
+static const std::string kZSetsScoreCFV2 = "score_cf_v2";
+static const int kZSetsScoreMigrateBatch = 1000;
+
+// Collects the deletes of a run of adjacent keys in one column family, and
+// replaces them with a single range tombstone once the run reaches
+// threshold keys. A threshold of 0 keeps point deletes.
+class RangeDeleter {
+ public:
+  RangeDeleter(rocksdb::WriteBatch* batch,
+               rocksdb::ColumnFamilyHandle* handle, size_t threshold)
+      : batch_(batch), handle_(handle), threshold_(threshold), count_(0) {}
+
+  void Delete(const Slice& key) {
+    if (count_ == 0) {
+      first_key_ = key.ToString();
+    }
+    last_key_ = key.ToString();
+    if (threshold_ == 0 || count_ < threshold_) {
+      keys_.push_back(last_key_);
+    } else {
+      keys_.clear();
+    }
+    count_++;
+  }
+
+  void Finish() {
+    if (threshold_ != 0 && count_ >= threshold_) {
+      // the smallest key after last_key_, so last_key_ is covered
+      last_key_.push_back('\0');
+      batch_->DeleteRange(handle_, first_key_, last_key_);
+    } else {
+      for (const auto& key : keys_) {
+        batch_->Delete(handle_, key);
+      }
+    }
+  }
+
+ private:
+  rocksdb::WriteBatch* batch_;
+  rocksdb::ColumnFamilyHandle* handle_;
+  size_t threshold_;
+  size_t count_;
+  std::string first_key_;
+  std::string last_key_;
+  std::vector<std::string> keys_;
+};
+
 Status RedisZSets::Open(const BlackwidowOptions& bw_options,
                         const std::string& db_path) {
   statistics_store_->SetCapacity(bw_options.statistics_max_size);
   small_compaction_threshold_ = bw_options.small_compaction_threshold;
+  SetTombstoneCompactionOptions(bw_options);
+  range_delete_threshold_ = bw_options.zsets_range_delete_threshold;
+  window_cache_.SetOptions(bw_options.zsets_window_cache_size,
+                           bw_options.zsets_window_size);
 
   rocksdb::Options ops(bw_options.options);
   Status s = rocksdb::DB::Open(ops, db_path, &db_);
@@ -49,9 +106,8 @@ Status RedisZSets::Open(const BlackwidowOptions& bw_options,
     if (!s.ok()) {
       return s;
     }
-    rocksdb::ColumnFamilyOptions score_cf_ops;
-    score_cf_ops.comparator = ZSetsScoreKeyComparator();
-    s = db_->CreateColumnFamily(score_cf_ops, "score_cf", &scf);
+    s = db_->CreateColumnFamily(rocksdb::ColumnFamilyOptions(),
+        kZSetsScoreCFV2, &scf);
     if (!s.ok()) {
       return s;
     }
@@ -61,16 +117,27 @@ Status RedisZSets::Open(const BlackwidowOptions& bw_options,
   }
 
   rocksdb::DBOptions db_ops(bw_options.options);
+  std::vector<std::string> cf_names;
+  rocksdb::DB::ListColumnFamilies(db_ops, db_path, &cf_names);
+  bool has_v1_score_cf = std::find(cf_names.begin(), cf_names.end(),
+                                   kZSetsScoreCFV1) != cf_names.end();
+  if (has_v1_score_cf) {
+    db_ops.create_missing_column_families = true;
+  }
+
   rocksdb::ColumnFamilyOptions meta_cf_ops(bw_options.options);
   rocksdb::ColumnFamilyOptions data_cf_ops(bw_options.options);
   rocksdb::ColumnFamilyOptions score_cf_ops(bw_options.options);
   meta_cf_ops.compaction_filter_factory =
     std::make_shared<ZSetsMetaFilterFactory>();
+  meta_cf_ops.table_properties_collector_factories.push_back(
+      std::make_shared<KeyNumCollectorFactory>(kZSets));
   data_cf_ops.compaction_filter_factory =
     std::make_shared<ZSetsDataFilterFactory>(&db_, &handles_);
   score_cf_ops.compaction_filter_factory =
     std::make_shared<ZSetsScoreFilterFactory>(&db_, &handles_);
-  score_cf_ops.comparator = ZSetsScoreKeyComparator();
+  AddDeletionCollector(bw_options, &data_cf_ops);
+  AddDeletionCollector(bw_options, &score_cf_ops);
 
   // use the bloom filter policy to reduce disk reads
   rocksdb::BlockBasedTableOptions table_ops(bw_options.table_options);
@@ -99,8 +166,58 @@ Status RedisZSets::Open(const BlackwidowOptions& bw_options,
   column_families.push_back(rocksdb::ColumnFamilyDescriptor(
         "data_cf", data_cf_ops));
   column_families.push_back(rocksdb::ColumnFamilyDescriptor(
-        "score_cf", score_cf_ops));
-  return rocksdb::DB::Open(db_ops, db_path, column_families, &handles_, &db_);
+        kZSetsScoreCFV2, score_cf_ops));
+  if (has_v1_score_cf) {
+    // No compaction filter here, it only understands the current format
+    rocksdb::ColumnFamilyOptions v1_score_cf_ops(bw_options.options);
+    v1_score_cf_ops.comparator = ZSetsScoreKeyComparator();
+    column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+          kZSetsScoreCFV1, v1_score_cf_ops));
+  }
+  s = rocksdb::DB::Open(db_ops, db_path, column_families, &handles_, &db_);
+  if (s.ok() && has_v1_score_cf) {
+    s = MigrateScoreCF();
+  }
+  return s;
+}
+
+// Upgrade a format 1 db in place: copy every score key into the format 2
+// column family, then drop the old one. Copying is idempotent, so an
+// upgrade interrupted by a crash simply starts over on the next Open.
+Status RedisZSets::MigrateScoreCF() {
+  rocksdb::ColumnFamilyHandle* v1_handle = handles_[3];
+  rocksdb::WriteBatch batch;
+  rocksdb::Iterator* iter = db_->NewIterator(default_read_options_, v1_handle);
+  Status s;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    batch.Put(handles_[2], ConvertZSetsScoreKeyV1(iter->key()), iter->value());
+    if (batch.Count() >= kZSetsScoreMigrateBatch) {
+      s = db_->Write(default_write_options_, &batch);
+      if (!s.ok()) {
+        break;
+      }
+      batch.Clear();
+    }
+  }
+  if (s.ok()) {
+    s = iter->status();
+  }
+  delete iter;
+  if (s.ok() && batch.Count() > 0) {
+    s = db_->Write(default_write_options_, &batch);
+  }
+  if (s.ok()) {
+    s = db_->DropColumnFamily(v1_handle);
+  }
+  if (s.ok()) {
+    handles_.pop_back();
+    delete v1_handle;
+  }
+  return s;
+}
+
+void RedisZSets::GetWindowCacheInfo(ZSetsCacheInfo* info) {
+  window_cache_.GetInfo(info);
 }
 
 Status RedisZSets::CompactRange(const rocksdb::Slice* begin,
@@ -218,6 +335,7 @@ Status RedisZSets::PKPatternMatchDel(const std::string& pattern,
       && StringMatch(pattern.data(), pattern.size(), key.data(), key.size(), 0)) {
       parsed_zsets_meta_value.InitialMetaValue();
       batch.Put(handles_[0], key, meta_value);
+      window_cache_.Remove(key);
     }
     if (static_cast<size_t>(batch.Count()) >= BATCH_DELETE_LIMIT) {
       s = db_->Write(default_write_options_, &batch);
@@ -246,6 +364,7 @@ Status RedisZSets::PKPatternMatchDel(const std::string& pattern,
 Status RedisZSets::ZPopMax(const Slice& key, 
                            const int64_t count,
                            std::vector<ScoreMember>* score_members) {
+  ScopeReadSkipSample sample(this, key);
   uint32_t statistic = 0;
   score_members->clear();
   rocksdb::WriteBatch batch;
@@ -282,7 +401,12 @@ Status RedisZSets::ZPopMax(const Slice& key,
       delete iter;
       parsed_zsets_meta_value.ModifyCount(-del_cnt);
       batch.Put(handles_[0], key, meta_value); 
+      std::shared_ptr<ZSetsWindow> window = window_cache_.Take(key.ToString());
       s = db_->Write(default_write_options_, &batch);
+      if (s.ok()) {
+        window_cache_.Apply(key.ToString(), window, version,
+                            parsed_zsets_meta_value.count(), *score_members, {});
+      }
       UpdateSpecificKeyStatistics(key.ToString(), statistic);
       return s;
     }    
@@ -294,6 +418,7 @@ Status RedisZSets::ZPopMax(const Slice& key,
 Status RedisZSets::ZPopMin(const Slice& key, 
                            const int64_t count,
                            std::vector<ScoreMember>* score_members) {
+  ScopeReadSkipSample sample(this, key);
   uint32_t statistic = 0;
   score_members->clear();
   rocksdb::WriteBatch batch;
@@ -330,7 +455,12 @@ Status RedisZSets::ZPopMin(const Slice& key,
       delete iter;
       parsed_zsets_meta_value.ModifyCount(-del_cnt);
       batch.Put(handles_[0], key, meta_value); 
+      std::shared_ptr<ZSetsWindow> window = window_cache_.Take(key.ToString());
       s = db_->Write(default_write_options_, &batch);
+      if (s.ok()) {
+        window_cache_.Apply(key.ToString(), window, version,
+                            parsed_zsets_meta_value.count(), *score_members, {});
+      }
       UpdateSpecificKeyStatistics(key.ToString(), statistic);
       return s;
     }    
@@ -342,7 +472,30 @@ Status RedisZSets::ZPopMin(const Slice& key,
 Status RedisZSets::ZAdd(const Slice& key,
                         const std::vector<ScoreMember>& score_members,
                         int32_t* ret) {
+  return ZAdd(key, score_members, kZAddNone, ret, nullptr);
+}
+
+Status RedisZSets::ZAdd(const Slice& key,
+                        const std::vector<ScoreMember>& score_members,
+                        int32_t flags,
+                        int32_t* ret,
+                        double* incr_score) {
   *ret = 0;
+  bool nx = flags & kZAddNX;
+  bool xx = flags & kZAddXX;
+  bool gt = flags & kZAddGT;
+  bool lt = flags & kZAddLT;
+  bool incr = flags & kZAddINCR;
+  if (nx && xx) {
+    return Status::InvalidArgument("XX and NX options at the same time are not compatible");
+  }
+  if ((gt && nx) || (lt && nx) || (gt && lt)) {
+    return Status::InvalidArgument("GT, LT, and/or NX options at the same time are not compatible");
+  }
+  if (incr && score_members.size() != 1) {
+    return Status::InvalidArgument("INCR option supports a single increment-element pair");
+  }
+
   uint32_t statistic = 0;
   std::unordered_set<std::string> unique;
   std::vector<ScoreMember> filtered_score_members;
@@ -354,85 +507,143 @@ Status RedisZSets::ZAdd(const Slice& key,
   }
 
   char score_buf[8];
+  bool vaild = false;
   int32_t version = 0;
   std::string meta_value;
   rocksdb::WriteBatch batch;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
   if (s.ok()) {
-    bool vaild = true;
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
     if (parsed_zsets_meta_value.IsStale()
       || parsed_zsets_meta_value.count() == 0) {
-      vaild = false;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
+      DeleteVersionRange(&batch, handles_[2], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
       version = parsed_zsets_meta_value.InitialMetaValue();
     } else {
       vaild = true;
       version = parsed_zsets_meta_value.version();
     }
-
-    int32_t cnt = 0;
-    std::string data_value;
-    for (const auto& sm : filtered_score_members) {
-      bool not_found = true;
-      ZSetsMemberKey zsets_member_key(key, version, sm.member);
-      if (vaild) {
-        s = db_->Get(default_read_options_,
-            handles_[1], zsets_member_key.Encode(), &data_value);
-        if (s.ok()) {
-          not_found = false;
-          uint64_t tmp = DecodeFixed64(data_value.data());
-          const void* ptr_tmp = reinterpret_cast<const void*>(&tmp);
-          double old_score = *reinterpret_cast<const double*>(ptr_tmp);
-          if (old_score == sm.score) {
-            continue;
-          } else {
-            ZSetsScoreKey zsets_score_key(key, version, old_score, sm.member);
-            batch.Delete(handles_[2], zsets_score_key.Encode());
-            // delete old zsets_score_key and overwirte zsets_member_key
-            // but in different column_families so we accumulative 1
-            statistic++;
-          }
-        } else if (!s.IsNotFound()) {
-          return s;
-        }
-      }
-
-      const void* ptr_score = reinterpret_cast<const void*>(&sm.score);
-      EncodeFixed64(score_buf, *reinterpret_cast<const uint64_t*>(ptr_score));
-      batch.Put(handles_[1],
-          zsets_member_key.Encode(), Slice(score_buf, sizeof(uint64_t)));
-
-      ZSetsScoreKey zsets_score_key(key, version, sm.score, sm.member);
-      batch.Put(handles_[2], zsets_score_key.Encode(), Slice());
-      if (not_found) {
-        cnt++;
-      }
-    }
-    parsed_zsets_meta_value.ModifyCount(cnt);
-    batch.Put(handles_[0], key, meta_value);
-    *ret = cnt;
   } else if (s.IsNotFound()) {
     char buf[4];
-    EncodeFixed32(buf, filtered_score_members.size());
+    EncodeFixed32(buf, 0);
     ZSetsMetaValue zsets_meta_value(Slice(buf, sizeof(int32_t)));
     version = zsets_meta_value.UpdateVersion();
-    batch.Put(handles_[0], key, zsets_meta_value.Encode());
-    for (const auto& sm : filtered_score_members) {
-      ZSetsMemberKey zsets_member_key(key, version, sm.member);
-      const void* ptr_score = reinterpret_cast<const void*>(&sm.score);
-      EncodeFixed64(score_buf, *reinterpret_cast<const uint64_t*>(ptr_score));
-      batch.Put(handles_[1],
-          zsets_member_key.Encode(), Slice(score_buf, sizeof(uint64_t)));
-
-      ZSetsScoreKey zsets_score_key(key, version, sm.score, sm.member);
-      batch.Put(handles_[2], zsets_score_key.Encode(), Slice());
-    }
-    *ret = filtered_score_members.size();
+    meta_value = zsets_meta_value.Encode().ToString();
   } else {
     return s;
   }
+
+  // Fetch the current score of every member at once
+  std::vector<std::string> member_keys;
+  std::vector<std::string> data_values;
+  std::vector<Status> statuses;
+  for (const auto& sm : filtered_score_members) {
+    ZSetsMemberKey zsets_member_key(key, version, sm.member);
+    member_keys.push_back(zsets_member_key.Encode().ToString());
+  }
+  if (vaild) {
+    std::vector<rocksdb::Slice> member_key_slices(member_keys.begin(),
+                                                  member_keys.end());
+    std::vector<rocksdb::ColumnFamilyHandle*> cfs(member_keys.size(),
+                                                  handles_[1]);
+    statuses = db_->MultiGet(default_read_options_,
+                             cfs, member_key_slices, &data_values);
+  }
+
+  int32_t added = 0;
+  int32_t changed = 0;
+  bool incr_applied = false;
+  std::vector<ScoreMember> window_removed;
+  std::vector<ScoreMember> window_added;
+  double incr_result = 0;
+  for (size_t idx = 0; idx < filtered_score_members.size(); ++idx) {
+    const ScoreMember& sm = filtered_score_members[idx];
+    bool exist = false;
+    double old_score = 0;
+    if (vaild) {
+      if (statuses[idx].ok()) {
+        exist = true;
+        uint64_t tmp = DecodeFixed64(data_values[idx].data());
+        const void* ptr_tmp = reinterpret_cast<const void*>(&tmp);
+        old_score = *reinterpret_cast<const double*>(ptr_tmp);
+      } else if (!statuses[idx].IsNotFound()) {
+        return statuses[idx];
+      }
+    }
+
+    double score = sm.score;
+    if (incr && exist) {
+      score = old_score + sm.score;
+      if (std::isnan(score)) {
+        return Status::InvalidArgument("resulting score is not a number (NaN)");
+      }
+    }
+    if ((nx && exist) || (xx && !exist)) {
+      continue;
+    }
+    if (exist) {
+      if ((gt && score <= old_score) || (lt && score >= old_score)) {
+        continue;
+      }
+      incr_applied = true;
+      incr_result = score;
+      if (score == old_score) {
+        continue;
+      }
+      ZSetsScoreKey zsets_score_key(key, version, old_score, sm.member);
+      batch.Delete(handles_[2], zsets_score_key.Encode());
+      // delete old zsets_score_key and overwirte zsets_member_key
+      // but in different column_families so we accumulative 1
+      statistic++;
+      changed++;
+      if (window_cache_.Enabled()) {
+        window_removed.push_back({old_score, sm.member});
+      }
+    } else {
+      incr_applied = true;
+      incr_result = score;
+      added++;
+    }
+
+    const void* ptr_score = reinterpret_cast<const void*>(&score);
+    EncodeFixed64(score_buf, *reinterpret_cast<const uint64_t*>(ptr_score));
+    batch.Put(handles_[1], member_keys[idx], Slice(score_buf, sizeof(uint64_t)));
+
+    ZSetsScoreKey zsets_score_key(key, version, score, sm.member);
+    batch.Put(handles_[2], zsets_score_key.Encode(), Slice());
+    if (window_cache_.Enabled()) {
+      window_added.push_back({score, sm.member});
+    }
+  }
+
+  if (incr) {
+    if (!incr_applied) {
+      return Status::NotFound();
+    }
+    if (incr_score != nullptr) {
+      *incr_score = incr_result;
+    }
+  }
+  *ret = (flags & kZAddCH) ? added + changed : added;
+  if (added == 0 && changed == 0) {
+    return Status::OK();
+  }
+
+  ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
+  parsed_zsets_meta_value.ModifyCount(added);
+  batch.Put(handles_[0], key, meta_value);
+  std::shared_ptr<ZSetsWindow> window = window_cache_.Take(key.ToString());
   s = db_->Write(default_write_options_, &batch);
+  if (s.ok() && vaild) {
+    window_cache_.Apply(key.ToString(), window, version,
+                        parsed_zsets_meta_value.count(),
+                        window_removed, window_added);
+  }
   UpdateSpecificKeyStatistics(key.ToString(), statistic);
   return s;
 }
@@ -464,6 +675,7 @@ Status RedisZSets::ZCount(const Slice& key,
                           bool left_close,
                           bool right_close,
                           int32_t* ret) {
+  ScopeReadSkipSample sample(this, key);
   *ret = 0;
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -523,8 +735,11 @@ Status RedisZSets::ZIncrby(const Slice& key,
   uint32_t statistic = 0;
   double score = 0;
   char score_buf[8];
+  bool vaild = false;
+  int32_t count = 0;
   int32_t version = 0;
   std::string meta_value;
+  std::vector<ScoreMember> window_removed;
   rocksdb::WriteBatch batch;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
@@ -532,8 +747,15 @@ Status RedisZSets::ZIncrby(const Slice& key,
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
     if (parsed_zsets_meta_value.IsStale()
       || parsed_zsets_meta_value.count() == 0) {
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
+      DeleteVersionRange(&batch, handles_[2], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
       version = parsed_zsets_meta_value.InitialMetaValue();
     } else {
+      vaild = true;
       version = parsed_zsets_meta_value.version();
     }
     std::string data_value;
@@ -550,6 +772,7 @@ Status RedisZSets::ZIncrby(const Slice& key,
       // delete old zsets_score_key and overwirte zsets_member_key
       // but in different column_families so we accumulative 1
       statistic++;
+      window_removed.push_back({old_score, member.ToString()});
     } else if (s.IsNotFound()) {
       score = increment;
       parsed_zsets_meta_value.ModifyCount(1);
@@ -557,6 +780,7 @@ Status RedisZSets::ZIncrby(const Slice& key,
     } else {
       return s;
     }
+    count = parsed_zsets_meta_value.count();
   } else if (s.IsNotFound()) {
     char buf[8];
     EncodeFixed32(buf, 1);
@@ -576,15 +800,98 @@ Status RedisZSets::ZIncrby(const Slice& key,
   ZSetsScoreKey zsets_score_key(key, version, score, member);
   batch.Put(handles_[2], zsets_score_key.Encode(), Slice());
   *ret = score;
+  std::shared_ptr<ZSetsWindow> window = window_cache_.Take(key.ToString());
   s = db_->Write(default_write_options_, &batch);
+  if (s.ok() && vaild) {
+    window_cache_.Apply(key.ToString(), window, version, count,
+                        window_removed, {{score, member.ToString()}});
+  }
   UpdateSpecificKeyStatistics(key.ToString(), statistic);
   return s;
 }
 
+bool RedisZSets::LookupWindowCache(const Slice& key, int32_t version,
+                                   int32_t count, int32_t start_index,
+                                   int32_t stop_index, bool reverse,
+                                   std::vector<ScoreMember>* score_members) {
+  if (!window_cache_.Enabled()) {
+    return false;
+  }
+  if (window_cache_.Lookup(key.ToString(), version, count,
+                           start_index, stop_index, reverse, score_members)) {
+    return true;
+  }
+  // Only head and tail queries are worth a fill, the rest go to rocksdb
+  if (!window_cache_.Covers(count, start_index, stop_index)) {
+    return false;
+  }
+  // Serve from the window just built, the miss is already counted
+  std::shared_ptr<ZSetsWindow> window = FillWindowCache(key);
+  return window != nullptr && window->version == version
+    && window->count == count
+    && ZSetsWindowCache::Serve(*window, count, start_index, stop_index,
+                               reverse, score_members);
+}
+
+// Load the head and tail windows of key. Runs under the record lock so that
+// no write can slip in between the scan and the insert and leave a window
+// behind that is older than the data. Returns the window it cached, if any.
+std::shared_ptr<ZSetsWindow> RedisZSets::FillWindowCache(const Slice& key) {
+  std::string meta_value;
+  ScopeRecordLock l(lock_mgr_, key);
+  Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
+  if (!s.ok()) {
+    return nullptr;
+  }
+  ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
+  if (parsed_zsets_meta_value.IsStale()
+    || parsed_zsets_meta_value.count() == 0) {
+    return nullptr;
+  }
+  int32_t count = parsed_zsets_meta_value.count();
+  int32_t version = parsed_zsets_meta_value.version();
+  size_t window_size = std::min(count, window_cache_.WindowSize());
+  std::shared_ptr<ZSetsWindow> window = std::make_shared<ZSetsWindow>();
+  window->version = version;
+  window->count = count;
+
+  ZSetsScoreKey zsets_score_key(key, version, 0, Slice());
+  std::string prefix = zsets_score_key.Encode().ToString();
+  prefix.resize(prefix.size() - sizeof(uint64_t));
+  // sorts after every score key of this key and version
+  std::string upper_bound = prefix + std::string(sizeof(uint64_t) + 1, '\xff');
+  rocksdb::Iterator* iter = db_->NewIterator(default_read_options_, handles_[2]);
+  for (iter->Seek(prefix);
+       iter->Valid() && iter->key().starts_with(prefix)
+       && window->head.size() < window_size;
+       iter->Next()) {
+    ParsedZSetsScoreKey parsed_zsets_score_key(iter->key());
+    window->head.push_back({parsed_zsets_score_key.score(),
+                            parsed_zsets_score_key.member().ToString()});
+  }
+  for (iter->SeekForPrev(upper_bound);
+       iter->Valid() && iter->key().starts_with(prefix)
+       && window->tail.size() < window_size;
+       iter->Prev()) {
+    ParsedZSetsScoreKey parsed_zsets_score_key(iter->key());
+    window->tail.push_back({parsed_zsets_score_key.score(),
+                            parsed_zsets_score_key.member().ToString()});
+  }
+  s = iter->status();
+  delete iter;
+  if (s.ok() && window->head.size() == window_size
+    && window->tail.size() == window_size) {
+    window_cache_.Insert(key.ToString(), window);
+    return window;
+  }
+  return nullptr;
+}
+
 Status RedisZSets::ZRange(const Slice& key,
                           int32_t start,
                           int32_t stop,
                           std::vector<ScoreMember>* score_members) {
+  ScopeReadSkipSample sample(this, key);
   score_members->clear();
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -612,13 +919,19 @@ Status RedisZSets::ZRange(const Slice& key,
         || stop_index < 0) {
         return s;
       }
+      if (LookupWindowCache(key, version, count, start_index,
+                            stop_index, false, score_members)) {
+        return s;
+      }
       int32_t cur_index = 0;
       ScoreMember score_member;
-      ZSetsScoreKey zsets_score_key(key, version,
-          std::numeric_limits<double>::lowest(), Slice());
+      ZSetsScoreKey zsets_score_key(key, version, 0, Slice());
+      Slice prefix = zsets_score_key.Encode();
+      prefix.remove_suffix(sizeof(uint64_t));
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[2]);
-      for (iter->Seek(zsets_score_key.Encode());
-           iter->Valid() && cur_index <= stop_index;
+      for (iter->Seek(prefix);
+           iter->Valid() && cur_index <= stop_index
+           && iter->key().starts_with(prefix);
            iter->Next(), ++cur_index) {
         if (cur_index >= start_index) {
           ParsedZSetsScoreKey parsed_zsets_score_key(iter->key());
@@ -638,7 +951,10 @@ Status RedisZSets::ZRangebyscore(const Slice& key,
                                  double max,
                                  bool left_close,
                                  bool right_close,
+                                 int64_t offset,
+                                 int64_t count,
                                  std::vector<ScoreMember>* score_members) {
+  ScopeReadSkipSample sample(this, key);
   score_members->clear();
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -653,16 +969,25 @@ Status RedisZSets::ZRangebyscore(const Slice& key,
       return Status::NotFound("Stale");
     } else if (parsed_zsets_meta_value.count() == 0) {
       return Status::NotFound();
+    } else if (offset < 0 || count == 0) {
+      return s;
     } else {
       int32_t version = parsed_zsets_meta_value.version();
       int32_t index = 0;
       int32_t stop_index = parsed_zsets_meta_value.count() - 1;
+      int64_t skipped = 0;
       ScoreMember score_member;
-      ZSetsScoreKey zsets_score_key(key, version,
+      ZSetsScoreKey zsets_score_prefix(key, version,
           std::numeric_limits<double>::lowest(), Slice());
+      Slice prefix = zsets_score_prefix.Encode();
+      prefix.remove_suffix(sizeof(uint64_t));
+      // Seek straight to the lower bound of the window instead of walking
+      // every member whose score is below min
+      ZSetsScoreKey zsets_score_key(key, version, min, Slice());
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[2]);
       for (iter->Seek(zsets_score_key.Encode());
-           iter->Valid() && index <= stop_index;
+           iter->Valid() && index <= stop_index
+             && iter->key().starts_with(prefix);
            iter->Next(), ++index) {
         bool left_pass = false;
         bool right_pass = false;
@@ -675,13 +1000,21 @@ Status RedisZSets::ZRangebyscore(const Slice& key,
           || (!right_close && parsed_zsets_score_key.score() < max)) {
           right_pass = true;
         }
-        if (left_pass && right_pass) {
+        if (!right_pass) {
+          break;
+        }
+        if (left_pass) {
+          if (skipped < offset) {
+            skipped++;
+            continue;
+          }
           score_member.score = parsed_zsets_score_key.score();
           score_member.member = parsed_zsets_score_key.member().ToString();
           score_members->push_back(score_member);
-        }
-        if (!right_pass) {
-          break;
+          if (count > 0
+            && static_cast<int64_t>(score_members->size()) >= count) {
+            break;
+          }
         }
       }
       delete iter;
@@ -693,6 +1026,7 @@ Status RedisZSets::ZRangebyscore(const Slice& key,
 Status RedisZSets::ZRank(const Slice& key,
                          const Slice& member,
                          int32_t* rank) {
+  ScopeReadSkipSample sample(this, key);
   *rank = -1;
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -751,7 +1085,10 @@ Status RedisZSets::ZRem(const Slice& key,
     }
   }
 
+  int32_t count = 0;
+  int32_t version = 0;
   std::string meta_value;
+  std::vector<ScoreMember> window_removed;
   rocksdb::WriteBatch batch;
   ScopeRecordLock l(lock_mgr_, key);
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
@@ -764,7 +1101,7 @@ Status RedisZSets::ZRem(const Slice& key,
     } else {
       int32_t del_cnt = 0;
       std::string data_value;
-      int32_t version = parsed_zsets_meta_value.version();
+      version = parsed_zsets_meta_value.version();
       for (const auto& member : filtered_members) {
         ZSetsMemberKey zsets_member_key(key, version, member);
         s = db_->Get(default_read_options_,
@@ -779,6 +1116,7 @@ Status RedisZSets::ZRem(const Slice& key,
 
           ZSetsScoreKey zsets_score_key(key, version, score, member);
           batch.Delete(handles_[2], zsets_score_key.Encode());
+          window_removed.push_back({score, member});
         } else if (!s.IsNotFound()) {
           return s;
         }
@@ -786,11 +1124,18 @@ Status RedisZSets::ZRem(const Slice& key,
       *ret = del_cnt;
       parsed_zsets_meta_value.ModifyCount(-del_cnt);
       batch.Put(handles_[0], key, meta_value);
+      version = parsed_zsets_meta_value.version();
+      count = parsed_zsets_meta_value.count();
     }
   } else {
     return s;
   }
+  std::shared_ptr<ZSetsWindow> window = window_cache_.Take(key.ToString());
   s = db_->Write(default_write_options_, &batch);
+  if (s.ok()) {
+    window_cache_.Apply(key.ToString(), window, version, count,
+                        window_removed, {});
+  }
   UpdateSpecificKeyStatistics(key.ToString(), statistic);
   return s;
 }
@@ -804,6 +1149,7 @@ Status RedisZSets::ZRemrangebyrank(const Slice& key,
   std::string meta_value;
   rocksdb::WriteBatch batch;
   ScopeRecordLock l(lock_mgr_, key);
+  window_cache_.Remove(key.ToString());
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
@@ -821,24 +1167,28 @@ Status RedisZSets::ZRemrangebyrank(const Slice& key,
       int32_t stop_index  = stop  >= 0 ? stop  : count + stop;
       start_index = start_index <= 0 ? 0 : start_index;
       stop_index = stop_index >= count ? count - 1 : stop_index;
-      ZSetsScoreKey zsets_score_key(key, version,
-          std::numeric_limits<double>::lowest(), Slice());
+      ZSetsScoreKey zsets_score_key(key, version, 0, Slice());
+      Slice prefix = zsets_score_key.Encode();
+      prefix.remove_suffix(sizeof(uint64_t));
+      RangeDeleter score_deleter(&batch, handles_[2], range_delete_threshold_);
       rocksdb::Iterator* iter =
         db_->NewIterator(default_read_options_, handles_[2]);
-      for (iter->Seek(zsets_score_key.Encode());
-           iter->Valid() && cur_index <= stop_index;
+      for (iter->Seek(prefix);
+           iter->Valid() && cur_index <= stop_index
+           && iter->key().starts_with(prefix);
            iter->Next(), ++cur_index) {
         if (cur_index >= start_index) {
           ParsedZSetsScoreKey parsed_zsets_score_key(iter->key());
           ZSetsMemberKey zsets_member_key(key, version,
               parsed_zsets_score_key.member());
           batch.Delete(handles_[1], zsets_member_key.Encode());
-          batch.Delete(handles_[2], iter->key());
+          score_deleter.Delete(iter->key());
           del_cnt++;
           statistic++;
         }
       }
       delete iter;
+      score_deleter.Finish();
       *ret = del_cnt;
       parsed_zsets_meta_value.ModifyCount(-del_cnt);
       batch.Put(handles_[0], key, meta_value);
@@ -862,6 +1212,7 @@ Status RedisZSets::ZRemrangebyscore(const Slice& key,
   std::string meta_value;
   rocksdb::WriteBatch batch;
   ScopeRecordLock l(lock_mgr_, key);
+  window_cache_.Remove(key.ToString());
   Status s = db_->Get(default_read_options_, handles_[0], key, &meta_value);
   if (s.ok()) {
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
@@ -875,12 +1226,15 @@ Status RedisZSets::ZRemrangebyscore(const Slice& key,
       int32_t cur_index = 0;
       int32_t stop_index = parsed_zsets_meta_value.count() - 1;
       int32_t version = parsed_zsets_meta_value.version();
-      ZSetsScoreKey zsets_score_key(key, version,
-          std::numeric_limits<double>::lowest(), Slice());
+      ZSetsScoreKey zsets_score_key(key, version, min, Slice());
+      Slice seek_key = zsets_score_key.Encode();
+      Slice prefix(seek_key.data(), seek_key.size() - sizeof(uint64_t));
+      RangeDeleter score_deleter(&batch, handles_[2], range_delete_threshold_);
       rocksdb::Iterator* iter =
         db_->NewIterator(default_read_options_, handles_[2]);
-      for (iter->Seek(zsets_score_key.Encode());
-           iter->Valid() && cur_index <= stop_index;
+      for (iter->Seek(seek_key);
+           iter->Valid() && cur_index <= stop_index
+           && iter->key().starts_with(prefix);
            iter->Next(), ++cur_index) {
         bool left_pass = false;
         bool right_pass = false;
@@ -897,7 +1251,7 @@ Status RedisZSets::ZRemrangebyscore(const Slice& key,
           ZSetsMemberKey zsets_member_key(key, version,
               parsed_zsets_score_key.member());
           batch.Delete(handles_[1], zsets_member_key.Encode());
-          batch.Delete(handles_[2], iter->key());
+          score_deleter.Delete(iter->key());
           del_cnt++;
           statistic++;
         }
@@ -906,6 +1260,7 @@ Status RedisZSets::ZRemrangebyscore(const Slice& key,
         }
       }
       delete iter;
+      score_deleter.Finish();
       *ret = del_cnt;
       parsed_zsets_meta_value.ModifyCount(-del_cnt);
       batch.Put(handles_[0], key, meta_value);
@@ -922,6 +1277,7 @@ Status RedisZSets::ZRevrange(const Slice& key,
                              int32_t start,
                              int32_t stop,
                              std::vector<ScoreMember>* score_members) {
+  ScopeReadSkipSample sample(this, key);
   score_members->clear();
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -949,13 +1305,21 @@ Status RedisZSets::ZRevrange(const Slice& key,
         || stop_index < 0) {
         return s;
       }
+      if (LookupWindowCache(key, version, count, start_index,
+                            stop_index, true, score_members)) {
+        return s;
+      }
       int32_t cur_index = count - 1;
       ScoreMember score_member;
-      ZSetsScoreKey zsets_score_key(key, version,
-          std::numeric_limits<double>::max(), Slice());
+      ZSetsScoreKey zsets_score_key(key, version, 0, Slice());
+      std::string prefix = zsets_score_key.Encode().ToString();
+      prefix.resize(prefix.size() - sizeof(uint64_t));
+      // sorts after every score key of this key and version
+      std::string upper_bound = prefix + std::string(sizeof(uint64_t) + 1, '\xff');
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[2]);
-      for (iter->SeekForPrev(zsets_score_key.Encode());
-           iter->Valid() && cur_index >= start_index;
+      for (iter->SeekForPrev(upper_bound);
+           iter->Valid() && cur_index >= start_index
+           && iter->key().starts_with(prefix);
            iter->Prev(), --cur_index) {
         if (cur_index <= stop_index) {
           ParsedZSetsScoreKey parsed_zsets_score_key(iter->key());
@@ -975,7 +1339,10 @@ Status RedisZSets::ZRevrangebyscore(const Slice& key,
                                     double max,
                                     bool left_close,
                                     bool right_close,
+                                    int64_t offset,
+                                    int64_t count,
                                     std::vector<ScoreMember>* score_members) {
+  ScopeReadSkipSample sample(this, key);
   score_members->clear();
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -990,15 +1357,33 @@ Status RedisZSets::ZRevrangebyscore(const Slice& key,
       return Status::NotFound("Stale");
     } else if (parsed_zsets_meta_value.count() == 0) {
       return Status::NotFound();
+    } else if (offset < 0 || count == 0) {
+      return s;
     } else {
       int32_t version = parsed_zsets_meta_value.version();
       int32_t left = parsed_zsets_meta_value.count();
+      int64_t skipped = 0;
       ScoreMember score_member;
-      ZSetsScoreKey zsets_score_key(key, version,
+      ZSetsScoreKey zsets_score_prefix(key, version,
           std::numeric_limits<double>::max(), Slice());
+      Slice prefix = zsets_score_prefix.Encode();
+      prefix.remove_suffix(sizeof(uint64_t));
+      // Members sharing the max score sort after (max, ""), so position
+      // just past them by seeking to the next representable score. There
+      // is none above +inf, seek past every score key of the version.
+      std::string seek_key;
+      if (max < std::numeric_limits<double>::infinity()) {
+        ZSetsScoreKey zsets_score_key(key, version,
+            std::nextafter(max, std::numeric_limits<double>::infinity()),
+            Slice());
+        seek_key = zsets_score_key.Encode().ToString();
+      } else {
+        seek_key = prefix.ToString()
+          + std::string(sizeof(uint64_t) + 1, '\xff');
+      }
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[2]);
-      for (iter->SeekForPrev(zsets_score_key.Encode());
-           iter->Valid() && left > 0;
+      for (iter->SeekForPrev(seek_key);
+           iter->Valid() && left > 0 && iter->key().starts_with(prefix);
            iter->Prev(), --left) {
         bool left_pass = false;
         bool right_pass = false;
@@ -1011,13 +1396,21 @@ Status RedisZSets::ZRevrangebyscore(const Slice& key,
           || (!right_close && parsed_zsets_score_key.score() < max)) {
           right_pass = true;
         }
-        if (left_pass && right_pass) {
+        if (!left_pass) {
+          break;
+        }
+        if (right_pass) {
+          if (skipped < offset) {
+            skipped++;
+            continue;
+          }
           score_member.score = parsed_zsets_score_key.score();
           score_member.member = parsed_zsets_score_key.member().ToString();
           score_members->push_back(score_member);
-        }
-        if (!left_pass) {
-          break;
+          if (count > 0
+            && static_cast<int64_t>(score_members->size()) >= count) {
+            break;
+          }
         }
       }
       delete iter;
@@ -1029,6 +1422,7 @@ Status RedisZSets::ZRevrangebyscore(const Slice& key,
 Status RedisZSets::ZRevrank(const Slice& key,
                             const Slice& member,
                             int32_t* rank) {
+  ScopeReadSkipSample sample(this, key);
   *rank = -1;
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -1077,11 +1471,9 @@ Status RedisZSets::ZScore(const Slice& key,
                           double* score) {
   *score = 0;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot = nullptr;
 
   std::string meta_value;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
+  ScopeSharedRecordLock l(lock_mgr_, key);
 
   Status s = db_->Get(read_options, key, &meta_value);
   if (s.ok()) {
@@ -1119,14 +1511,12 @@ Status RedisZSets::ZUnionstore(const Slice& destination,
   uint32_t statistic = 0;
   rocksdb::WriteBatch batch;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot = nullptr;
 
   int32_t version;
   std::string meta_value;
   ScoreMember sm;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
-  ScopeRecordLock l(lock_mgr_, destination);
+  MultiScopeRecordLock l(lock_mgr_, {destination.ToString()}, keys);
+  window_cache_.Remove(destination.ToString());
   std::map<std::string, double> member_score_map;
 
   Status s;
@@ -1174,6 +1564,12 @@ Status RedisZSets::ZUnionstore(const Slice& destination,
   if (s.ok()) {
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
     statistic = parsed_zsets_meta_value.count();
+    DeleteVersionRange(&batch, handles_[1], destination,
+                       parsed_zsets_meta_value.version(),
+                       parsed_zsets_meta_value.count());
+    DeleteVersionRange(&batch, handles_[2], destination,
+                       parsed_zsets_meta_value.version(),
+                       parsed_zsets_meta_value.count());
     version = parsed_zsets_meta_value.InitialMetaValue();
     parsed_zsets_meta_value.set_count(member_score_map.size());
     batch.Put(handles_[0], destination, meta_value);
@@ -1216,10 +1612,8 @@ Status RedisZSets::ZInterstore(const Slice& destination,
   uint32_t statistic = 0;
   rocksdb::WriteBatch batch;
   rocksdb::ReadOptions read_options;
-  const rocksdb::Snapshot* snapshot = nullptr;
-  ScopeSnapshot ss(db_, &snapshot);
-  read_options.snapshot = snapshot;
-  ScopeRecordLock l(lock_mgr_, destination);
+  MultiScopeRecordLock l(lock_mgr_, {destination.ToString()}, keys);
+  window_cache_.Remove(destination.ToString());
 
   std::string meta_value;
   int32_t version = 0;
@@ -1303,6 +1697,12 @@ Status RedisZSets::ZInterstore(const Slice& destination,
   if (s.ok()) {
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
     statistic = parsed_zsets_meta_value.count();
+    DeleteVersionRange(&batch, handles_[1], destination,
+                       parsed_zsets_meta_value.version(),
+                       parsed_zsets_meta_value.count());
+    DeleteVersionRange(&batch, handles_[2], destination,
+                       parsed_zsets_meta_value.version(),
+                       parsed_zsets_meta_value.count());
     version = parsed_zsets_meta_value.InitialMetaValue();
     parsed_zsets_meta_value.set_count(final_score_members.size());
     batch.Put(handles_[0], destination, meta_value);
@@ -1336,7 +1736,10 @@ Status RedisZSets::ZRangebylex(const Slice& key,
                                const Slice& max,
                                bool left_close,
                                bool right_close,
+                               int64_t offset,
+                               int64_t count,
                                std::vector<std::string>* members) {
+  ScopeReadSkipSample sample(this, key);
   members->clear();
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot = nullptr;
@@ -1354,14 +1757,21 @@ Status RedisZSets::ZRangebylex(const Slice& key,
     if (parsed_zsets_meta_value.IsStale()
       || parsed_zsets_meta_value.count() == 0) {
       return Status::NotFound();
+    } else if (offset < 0 || count == 0) {
+      return s;
     } else {
       int32_t version = parsed_zsets_meta_value.version();
       int32_t cur_index = 0;
       int32_t stop_index = parsed_zsets_meta_value.count() - 1;
-      ZSetsMemberKey zsets_member_key(key, version, Slice());
+      int64_t skipped = 0;
+      ZSetsMemberKey zsets_member_prefix(key, version, Slice());
+      std::string prefix = zsets_member_prefix.Encode().ToString();
+      ZSetsMemberKey zsets_member_key(key, version,
+          left_no_limit ? Slice() : min);
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[1]);
       for (iter->Seek(zsets_member_key.Encode());
-           iter->Valid() && cur_index <= stop_index;
+           iter->Valid() && cur_index <= stop_index
+             && iter->key().starts_with(prefix);
            iter->Next(), ++cur_index) {
         bool left_pass = false;
         bool right_pass = false;
@@ -1377,12 +1787,20 @@ Status RedisZSets::ZRangebylex(const Slice& key,
           || (!right_close && max.compare(member) > 0)) {
           right_pass = true;
         }
-        if (left_pass && right_pass) {
-          members->push_back(member.ToString());
-        }
         if (!right_pass) {
           break;
         }
+        if (left_pass) {
+          if (skipped < offset) {
+            skipped++;
+            continue;
+          }
+          members->push_back(member.ToString());
+          if (count > 0
+            && static_cast<int64_t>(members->size()) >= count) {
+            break;
+          }
+        }
       }
       delete iter;
     }
@@ -1397,7 +1815,8 @@ Status RedisZSets::ZLexcount(const Slice& key,
                              bool right_close,
                              int32_t* ret) {
   std::vector<std::string> members;
-  Status s = ZRangebylex(key, min, max, left_close, right_close, &members);
+  Status s = ZRangebylex(key, min, max,
+      left_close, right_close, 0, -1, &members);
   *ret = members.size();
   return s;
 }
@@ -1417,6 +1836,7 @@ Status RedisZSets::ZRemrangebylex(const Slice& key,
   ScopeSnapshot ss(db_, &snapshot);
   read_options.snapshot = snapshot;
   ScopeRecordLock l(lock_mgr_, key);
+  window_cache_.Remove(key.ToString());
 
   bool left_no_limit = !min.compare("-");
   bool right_not_limit = !max.compare("+");
@@ -1433,10 +1853,15 @@ Status RedisZSets::ZRemrangebylex(const Slice& key,
       int32_t version = parsed_zsets_meta_value.version();
       int32_t cur_index = 0;
       int32_t stop_index = parsed_zsets_meta_value.count() - 1;
-      ZSetsMemberKey zsets_member_key(key, version, Slice());
+      ZSetsMemberKey zsets_member_prefix(key, version, Slice());
+      Slice prefix = zsets_member_prefix.Encode();
+      ZSetsMemberKey zsets_member_key(key, version,
+                                      left_no_limit ? Slice() : min);
+      RangeDeleter member_deleter(&batch, handles_[1], range_delete_threshold_);
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[1]);
       for (iter->Seek(zsets_member_key.Encode());
-           iter->Valid() && cur_index <= stop_index;
+           iter->Valid() && cur_index <= stop_index
+           && iter->key().starts_with(prefix);
            iter->Next(), ++cur_index) {
         bool left_pass = false;
         bool right_pass = false;
@@ -1453,7 +1878,7 @@ Status RedisZSets::ZRemrangebylex(const Slice& key,
           right_pass = true;
         }
         if (left_pass && right_pass) {
-          batch.Delete(handles_[1], iter->key());
+          member_deleter.Delete(iter->key());
 
           uint64_t tmp = DecodeFixed64(iter->value().data());
           const void* ptr_tmp = reinterpret_cast<const void*>(&tmp);
@@ -1468,6 +1893,7 @@ Status RedisZSets::ZRemrangebylex(const Slice& key,
         }
       }
       delete iter;
+      member_deleter.Finish();
     }
     if (del_cnt > 0) {
       parsed_zsets_meta_value.ModifyCount(-del_cnt);
@@ -1494,12 +1920,21 @@ Status RedisZSets::Expire(const Slice& key, int32_t ttl) {
       return Status::NotFound();
     }
 
+    rocksdb::WriteBatch batch;
     if (ttl > 0) {
       parsed_zsets_meta_value.SetRelativeTimestamp(ttl);
     } else {
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
+      DeleteVersionRange(&batch, handles_[2], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
       parsed_zsets_meta_value.InitialMetaValue();
+      window_cache_.Remove(key.ToString());
     }
-    s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+    batch.Put(handles_[0], key, meta_value);
+    s = db_->Write(default_write_options_, &batch);
   }
   return s;
 }
@@ -1516,8 +1951,17 @@ Status RedisZSets::Del(const Slice& key) {
       return Status::NotFound();
     } else {
       uint32_t statistic = parsed_zsets_meta_value.count();
+      rocksdb::WriteBatch batch;
+      DeleteVersionRange(&batch, handles_[1], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
+      DeleteVersionRange(&batch, handles_[2], key,
+                         parsed_zsets_meta_value.version(),
+                         parsed_zsets_meta_value.count());
       parsed_zsets_meta_value.InitialMetaValue();
-      s = db_->Put(default_write_options_, handles_[0], key, meta_value);
+      window_cache_.Remove(key.ToString());
+      batch.Put(handles_[0], key, meta_value);
+      s = db_->Write(default_write_options_, &batch);
       UpdateSpecificKeyStatistics(key.ToString(), statistic);
     }
   }
@@ -1622,12 +2066,21 @@ Status RedisZSets::Expireat(const Slice& key, int32_t timestamp) {
     } else if (parsed_zsets_meta_value.count() == 0) {
       return Status::NotFound();
     } else {
+      rocksdb::WriteBatch batch;
       if (timestamp > 0) {
         parsed_zsets_meta_value.set_timestamp(timestamp);
       } else {
+        DeleteVersionRange(&batch, handles_[1], key,
+                           parsed_zsets_meta_value.version(),
+                           parsed_zsets_meta_value.count());
+        DeleteVersionRange(&batch, handles_[2], key,
+                           parsed_zsets_meta_value.version(),
+                           parsed_zsets_meta_value.count());
         parsed_zsets_meta_value.InitialMetaValue();
+        window_cache_.Remove(key.ToString());
       }
-      return db_->Put(default_write_options_, handles_[0], key, meta_value);
+      batch.Put(handles_[0], key, meta_value);
+      return db_->Write(default_write_options_, &batch);
     }
   }
   return s;
@@ -1642,12 +2095,33 @@ Status RedisZSets::ZScan(const Slice& key,
   *next_cursor = 0;
   score_members->clear();
   if (cursor < 0) {
-    *next_cursor = 0;
     return Status::OK();
   }
 
+  std::string start_point, next_point;
+  if (!GetScanStartPoint(key, pattern, cursor, &start_point).ok()) {
+    cursor = 0;
+    start_point.clear();
+  }
+  Status s = ZScan(key, start_point, pattern, count, score_members, &next_point);
+  if (s.ok() && !next_point.empty()) {
+    *next_cursor = cursor + count;
+    StoreScanNextPoint(key, pattern, *next_cursor, next_point);
+  }
+  return s;
+}
+
+Status RedisZSets::ZScan(const Slice& key,
+                         const std::string& start_point,
+                         const std::string& pattern,
+                         int64_t count,
+                         std::vector<ScoreMember>* score_members,
+                         std::string* next_point) {
+  ScopeReadSkipSample sample(this, key);
+  next_point->clear();
+  score_members->clear();
+
   int64_t rest = count;
-  int64_t step_length = count;
   rocksdb::ReadOptions read_options;
   const rocksdb::Snapshot* snapshot;
 
@@ -1659,25 +2133,18 @@ Status RedisZSets::ZScan(const Slice& key,
     ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
     if (parsed_zsets_meta_value.IsStale()
       || parsed_zsets_meta_value.count() == 0) {
-      *next_cursor = 0;
       return Status::NotFound();
     } else {
       std::string sub_member;
-      std::string start_point;
       int32_t version = parsed_zsets_meta_value.version();
-      s = GetScanStartPoint(key, pattern, cursor, &start_point);
-      if (s.IsNotFound()) {
-        cursor = 0;
-        if (isTailWildcard(pattern)) {
-          start_point = pattern.substr(0, pattern.size() - 1);
-        }
-      }
       if (isTailWildcard(pattern)) {
         sub_member = pattern.substr(0, pattern.size() - 1);
       }
+      const std::string& seek_point = start_point.empty()
+        ? sub_member : start_point;
 
       ZSetsMemberKey zsets_member_prefix(key, version, sub_member);
-      ZSetsMemberKey zsets_member_key(key, version, start_point);
+      ZSetsMemberKey zsets_member_key(key, version, seek_point);
       std::string prefix = zsets_member_prefix.Encode().ToString();
       rocksdb::Iterator* iter = db_->NewIterator(read_options, handles_[1]);
       for (iter->Seek(zsets_member_key.Encode());
@@ -1695,20 +2162,13 @@ Status RedisZSets::ZScan(const Slice& key,
         rest--;
       }
 
-      if (iter->Valid()
-        && (iter->key().compare(prefix) <= 0
-          || iter->key().starts_with(prefix))) {
-        *next_cursor = cursor + step_length;
+      if (iter->Valid() && iter->key().starts_with(prefix)) {
         ParsedZSetsMemberKey parsed_zsets_member_key(iter->key());
-        std::string next_member = parsed_zsets_member_key.member().ToString();
-        StoreScanNextPoint(key, pattern, *next_cursor, next_member);
-      } else {
-        *next_cursor = 0;
+        *next_point = parsed_zsets_member_key.member().ToString();
       }
       delete iter;
     }
   } else {
-    *next_cursor = 0;
     return s;
   }
   return Status::OK();
@@ -12,6 +12,7 @@
 
 #include "src/redis.h"
 #include "src/custom_comparator.h"
+#include "src/zsets_window_cache.h"
 
 namespace blackwidow {
 
@@ -31,11 +32,17 @@ class RedisZSets : public Redis {
   Status ScanKeys(const std::string& pattern,
                   std::vector<std::string>* keys) override;
   Status PKPatternMatchDel(const std::string& pattern, int32_t* ret) override;
+  void GetWindowCacheInfo(ZSetsCacheInfo* info);
 
   // ZSets Commands
   Status ZAdd(const Slice& key,
               const std::vector<ScoreMember>& score_members,
               int32_t* ret);
+  Status ZAdd(const Slice& key,
+              const std::vector<ScoreMember>& score_members,
+              int32_t flags,
+              int32_t* ret,
+              double* incr_score);
   Status ZCard(const Slice& key, int32_t* card);
   Status ZCount(const Slice& key,
                 double min,
@@ -56,6 +63,8 @@ class RedisZSets : public Redis {
                        double max,
                        bool left_close,
                        bool right_close,
+                       int64_t offset,
+                       int64_t count,
                        std::vector<ScoreMember>* score_members);
   Status ZRank(const Slice& key,
                const Slice& member,
@@ -82,6 +91,8 @@ class RedisZSets : public Redis {
                           double max,
                           bool left_close,
                           bool right_close,
+                          int64_t offset,
+                          int64_t count,
                           std::vector<ScoreMember>* score_members);
   Status ZRevrank(const Slice& key,
                   const Slice& member,
@@ -102,6 +113,8 @@ class RedisZSets : public Redis {
                      const Slice& max,
                      bool left_close,
                      bool right_close,
+                     int64_t offset,
+                     int64_t count,
                      std::vector<std::string>* members);
   Status ZLexcount(const Slice& key,
                    const Slice& min,
@@ -121,6 +134,14 @@ class RedisZSets : public Redis {
                int64_t count,
                std::vector<ScoreMember>* score_members,
                int64_t* next_cursor);
+  // Resumes at start_point, from the start if it is empty, next_point is
+  // empty once the scan is done
+  Status ZScan(const Slice& key,
+               const std::string& start_point,
+               const std::string& pattern,
+               int64_t count,
+               std::vector<ScoreMember>* score_members,
+               std::string* next_point);
   Status PKScanRange(const Slice& key_start,
                      const Slice& key_end,
                      const Slice& pattern,
@@ -160,6 +181,14 @@ class RedisZSets : public Redis {
 
  private:
   std::vector<rocksdb::ColumnFamilyHandle*> handles_;
+  ZSetsWindowCache window_cache_;
+  size_t range_delete_threshold_;
+
+  Status MigrateScoreCF();
+  bool LookupWindowCache(const Slice& key, int32_t version, int32_t count,
+                         int32_t start_index, int32_t stop_index, bool reverse,
+                         std::vector<ScoreMember>* score_members);
+  std::shared_ptr<ZSetsWindow> FillWindowCache(const Slice& key);
 };
 
 }  // namespace blackwidow
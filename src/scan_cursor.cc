@@ -0,0 +1,203 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/scan_cursor.h"
+
+#include "blackwidow/util.h"
+#include "src/coding.h"
+
+namespace blackwidow {
+
+static const char kScanCursorVersion = 2;
+static const size_t kScanCursorCheckSize = 8;
+static const char kBase64Chars[] =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+static void PutVarint32(std::string* dst, uint32_t value) {
+  while (value >= 0x80) {
+    dst->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  dst->push_back(static_cast<char>(value));
+}
+
+static bool GetVarint32(Slice* input, uint32_t* value) {
+  *value = 0;
+  for (uint32_t shift = 0; shift <= 28 && !input->empty(); shift += 7) {
+    uint32_t byte = static_cast<unsigned char>((*input)[0]);
+    input->remove_prefix(1);
+    *value |= (byte & 0x7f) << shift;
+    if (!(byte & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static std::string PatternPrefix(const std::string& pattern) {
+  return isTailWildcard(pattern)
+    ? pattern.substr(0, pattern.size() - 1) : std::string();
+}
+
+static inline uint64_t Rotl64(uint64_t x, int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+static inline void SipRound(uint64_t* v0, uint64_t* v1,
+                            uint64_t* v2, uint64_t* v3) {
+  *v0 += *v1;
+  *v1 = Rotl64(*v1, 13);
+  *v1 ^= *v0;
+  *v0 = Rotl64(*v0, 32);
+  *v2 += *v3;
+  *v3 = Rotl64(*v3, 16);
+  *v3 ^= *v2;
+  *v0 += *v3;
+  *v3 = Rotl64(*v3, 21);
+  *v3 ^= *v0;
+  *v2 += *v1;
+  *v1 = Rotl64(*v1, 17);
+  *v1 ^= *v2;
+  *v2 = Rotl64(*v2, 32);
+}
+
+// SipHash-2-4, a keyed hash that can not be forged without the key
+static uint64_t SipHash(uint64_t k0, uint64_t k1, const Slice& input) {
+  uint64_t v0 = 0x736f6d6570736575ULL ^ k0;
+  uint64_t v1 = 0x646f72616e646f6dULL ^ k1;
+  uint64_t v2 = 0x6c7967656e657261ULL ^ k0;
+  uint64_t v3 = 0x7465646279746573ULL ^ k1;
+  size_t len = input.size();
+  size_t end = len - len % 8;
+  for (size_t i = 0; i < end; i += 8) {
+    uint64_t m = DecodeFixed64(input.data() + i);
+    v3 ^= m;
+    SipRound(&v0, &v1, &v2, &v3);
+    SipRound(&v0, &v1, &v2, &v3);
+    v0 ^= m;
+  }
+  uint64_t last = static_cast<uint64_t>(len) << 56;
+  for (size_t i = 0; i < len % 8; ++i) {
+    last |= static_cast<uint64_t>(
+        static_cast<unsigned char>(input[end + i])) << (8 * i);
+  }
+  v3 ^= last;
+  SipRound(&v0, &v1, &v2, &v3);
+  SipRound(&v0, &v1, &v2, &v3);
+  v0 ^= last;
+  v2 ^= 0xff;
+  for (int i = 0; i < 4; ++i) {
+    SipRound(&v0, &v1, &v2, &v3);
+  }
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+// Keyed by the secret, folded into 128 bits with two fixed keys
+static uint64_t CursorCheck(const Slice& payload, const Slice& key,
+                            const std::string& pattern,
+                            const std::string& secret) {
+  uint64_t k0 = SipHash(0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL, secret);
+  uint64_t k1 = SipHash(0x0f0e0d0c0b0a0908ULL, 0x0706050403020100ULL, secret);
+  std::string input;
+  input.reserve(key.size() + pattern.size() + payload.size() + 10);
+  PutVarint32(&input, static_cast<uint32_t>(key.size()));
+  input.append(key.data(), key.size());
+  PutVarint32(&input, static_cast<uint32_t>(pattern.size()));
+  input.append(pattern);
+  input.append(payload.data(), payload.size());
+  return SipHash(k0, k1, input);
+}
+
+static std::string Base64Encode(const std::string& input) {
+  std::string output;
+  output.reserve((input.size() + 2) / 3 * 4);
+  uint32_t bits = 0;
+  int bit_count = 0;
+  for (unsigned char c : input) {
+    bits = (bits << 8) | c;
+    bit_count += 8;
+    while (bit_count >= 6) {
+      bit_count -= 6;
+      output.push_back(kBase64Chars[(bits >> bit_count) & 0x3f]);
+    }
+  }
+  if (bit_count > 0) {
+    output.push_back(kBase64Chars[(bits << (6 - bit_count)) & 0x3f]);
+  }
+  return output;
+}
+
+static bool Base64Decode(const std::string& input, std::string* output) {
+  uint32_t bits = 0;
+  int bit_count = 0;
+  for (char c : input) {
+    const char* pos = strchr(kBase64Chars, c);
+    if (c == '\0' || pos == NULL) {
+      return false;
+    }
+    bits = (bits << 6) | static_cast<uint32_t>(pos - kBase64Chars);
+    bit_count += 6;
+    if (bit_count >= 8) {
+      bit_count -= 8;
+      output->push_back(static_cast<char>((bits >> bit_count) & 0xff));
+    }
+  }
+  return true;
+}
+
+std::string EncodeScanCursor(const ScanCursor& cursor, const Slice& key,
+                             const std::string& pattern,
+                             const std::string& secret) {
+  std::string prefix = PatternPrefix(pattern);
+  size_t shared = 0;
+  while (shared < prefix.size() && shared < cursor.start_point.size()
+    && prefix[shared] == cursor.start_point[shared]) {
+    ++shared;
+  }
+
+  std::string payload;
+  payload.push_back(kScanCursorVersion);
+  payload.push_back(cursor.tag);
+  PutVarint32(&payload, cursor.shard);
+  PutVarint32(&payload, static_cast<uint32_t>(shared));
+  payload.append(cursor.start_point, shared, std::string::npos);
+
+  char check[kScanCursorCheckSize];
+  EncodeFixed64(check, CursorCheck(payload, key, pattern, secret));
+  payload.append(check, kScanCursorCheckSize);
+  return Base64Encode(payload);
+}
+
+bool DecodeScanCursor(const std::string& cursor, const Slice& key,
+                      const std::string& pattern, const std::string& secret,
+                      ScanCursor* result) {
+  std::string payload;
+  if (!Base64Decode(cursor, &payload)
+    || payload.size() < 2 + kScanCursorCheckSize
+    || payload[0] != kScanCursorVersion) {
+    return false;
+  }
+
+  Slice body(payload.data(), payload.size() - kScanCursorCheckSize);
+  uint64_t check = DecodeFixed64(payload.data() + body.size());
+  if (check != CursorCheck(body, key, pattern, secret)) {
+    return false;
+  }
+
+  result->tag = body[1];
+  body.remove_prefix(2);
+  uint32_t shared;
+  std::string prefix = PatternPrefix(pattern);
+  if (!GetVarint32(&body, &result->shard)
+    || !GetVarint32(&body, &shared)
+    || shared > prefix.size()) {
+    return false;
+  }
+  result->start_point.assign(prefix, 0, shared);
+  result->start_point.append(body.data(), body.size());
+  return true;
+}
+
+}  //  namespace blackwidow
@@ -0,0 +1,53 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_SCAN_CURSOR_H_
+#define SRC_SCAN_CURSOR_H_
+
+#include <string>
+
+#include "rocksdb/slice.h"
+
+namespace blackwidow {
+using Slice = rocksdb::Slice;
+
+// Starts a scan, and is returned once it is done
+static const char kScanCursorStart[] = "0";
+
+/*
+ * Where a scan resumes, carried by the cursor itself instead of a cursor
+ * cache, so it holds across evictions and restarts.
+ *
+ * A cursor is the URL safe base64 of:
+ *
+ * | version | tag | shard (varint) | shared (varint) | suffix | 8 bytes check |
+ *
+ * tag is the DataTypeTag of the type being scanned. The start point is
+ * stored as the length it shares with the literal prefix of the pattern
+ * plus the rest of it, as most scans resume inside that prefix. The check
+ * is a SipHash of the payload and the scanned key and pattern, keyed by
+ * the secret of the options, so that a cursor is only accepted for the
+ * scan that returned it, and clients can not craft one that resumes
+ * elsewhere without knowing the secret. With an empty secret it only
+ * catches corrupted or mismatched cursors.
+ */
+struct ScanCursor {
+  uint32_t shard;
+  char tag;
+  std::string start_point;
+
+  ScanCursor() : shard(0), tag(0) {}
+};
+
+std::string EncodeScanCursor(const ScanCursor& cursor, const Slice& key,
+                             const std::string& pattern,
+                             const std::string& secret);
+// false if cursor is malformed, or was returned by another scan
+bool DecodeScanCursor(const std::string& cursor, const Slice& key,
+                      const std::string& pattern, const std::string& secret,
+                      ScanCursor* result);
+
+}  //  namespace blackwidow
+#endif  //  SRC_SCAN_CURSOR_H_
@@ -10,64 +10,98 @@
 #include <string>
 #include <algorithm>
 
-#include "src/lock_mgr.h"
+#include "src/slot_lock_mgr.h"
 
 namespace blackwidow {
 class ScopeRecordLock {
  public:
-  ScopeRecordLock(LockMgr* lock_mgr, const Slice& key) :
-    lock_mgr_(lock_mgr), key_(key) {
-    lock_mgr_->TryLock(key_.ToString());
+  ScopeRecordLock(SlotLockMgr* lock_mgr, const Slice& key) :
+    lock_mgr_(lock_mgr), slot_(lock_mgr->Slot(key)) {
+    lock_mgr_->LockSlot(slot_, key);
   }
   ~ScopeRecordLock() {
-    lock_mgr_->UnLock(key_.ToString());
+    lock_mgr_->UnLockSlot(slot_);
   }
 
  private:
-  LockMgr* const lock_mgr_;
-  Slice key_;
+  SlotLockMgr* const lock_mgr_;
+  const size_t slot_;
   ScopeRecordLock(const ScopeRecordLock&);
   void operator=(const ScopeRecordLock&);
 };
 
+class ScopeSharedRecordLock {
+ public:
+  ScopeSharedRecordLock(SlotLockMgr* lock_mgr, const Slice& key) :
+    lock_mgr_(lock_mgr), slot_(lock_mgr->Slot(key)) {
+    lock_mgr_->LockSlotShared(slot_, key);
+  }
+  ~ScopeSharedRecordLock() {
+    lock_mgr_->UnLockSlotShared(slot_);
+  }
+
+ private:
+  SlotLockMgr* const lock_mgr_;
+  const size_t slot_;
+  ScopeSharedRecordLock(const ScopeSharedRecordLock&);
+  void operator=(const ScopeSharedRecordLock&);
+};
+
+// Locks keys exclusively and shared_keys shared. Keys may share a slot, so
+// the slots are locked once each and in order, exclusively if any of their
+// keys is.
 class MultiScopeRecordLock {
  public:
-  MultiScopeRecordLock(LockMgr* lock_mgr,
-                       const std::vector<std::string>& keys) :
-      lock_mgr_(lock_mgr),
-      keys_(keys) {
-    std::string pre_key;
-    std::sort(keys_.begin(), keys_.end());
-    if (!keys_.empty() &&
-      keys_[0].empty()) {
-      lock_mgr_->TryLock(pre_key);
+  MultiScopeRecordLock(SlotLockMgr* lock_mgr,
+                       const std::vector<std::string>& keys,
+                       const std::vector<std::string>& shared_keys =
+                         std::vector<std::string>()) :
+      lock_mgr_(lock_mgr) {
+    for (const auto& key : keys) {
+      slots_.push_back({lock_mgr_->Slot(key), false, &key});
     }
-
-    for (const auto& key : keys_) {
-      if (pre_key != key) {
-        lock_mgr_->TryLock(key);
-        pre_key = key;
+    for (const auto& key : shared_keys) {
+      slots_.push_back({lock_mgr_->Slot(key), true, &key});
+    }
+    // Exclusive sorts before shared within a slot
+    std::sort(slots_.begin(), slots_.end(),
+              [](const SlotMode& a, const SlotMode& b) {
+                return a.slot < b.slot
+                  || (a.slot == b.slot && a.shared < b.shared);
+              });
+    slots_.erase(std::unique(slots_.begin(), slots_.end(),
+                             [](const SlotMode& a, const SlotMode& b) {
+                               return a.slot == b.slot;
+                             }),
+                 slots_.end());
+    for (const auto& slot : slots_) {
+      if (slot.shared) {
+        lock_mgr_->LockSlotShared(slot.slot, *slot.key);
+      } else {
+        lock_mgr_->LockSlot(slot.slot, *slot.key);
       }
     }
   }
   ~MultiScopeRecordLock() {
-    std::string pre_key;
-    if (!keys_.empty() &&
-      keys_[0].empty()) {
-      lock_mgr_->UnLock(pre_key);
-    }
-
-    for (const auto& key : keys_) {
-      if (pre_key != key) {
-        lock_mgr_->UnLock(key);
-        pre_key = key;
+    for (const auto& slot : slots_) {
+      if (slot.shared) {
+        lock_mgr_->UnLockSlotShared(slot.slot);
+      } else {
+        lock_mgr_->UnLockSlot(slot.slot);
       }
     }
   }
 
  private:
-  LockMgr* const lock_mgr_;
-  std::vector<std::string> keys_;
+  struct SlotMode {
+    size_t slot;
+    bool shared;
+    // only valid in the constructor
+    const std::string* key;
+  };
+
+  SlotLockMgr* const lock_mgr_;
+  std::vector<SlotMode> slots_;
   MultiScopeRecordLock(const MultiScopeRecordLock&);
   void operator=(const MultiScopeRecordLock&);
 };
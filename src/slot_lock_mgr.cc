@@ -0,0 +1,253 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/slot_lock_mgr.h"
+
+#include <limits.h>
+#include <sched.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "rocksdb/env.h"
+
+#include "src/murmurhash.h"
+
+namespace blackwidow {
+
+// Layout of a slot word
+static const uint32_t kSlotWriter = 1u << 31;
+static const uint32_t kSlotWriterParked = 1u << 30;
+static const uint32_t kSlotReaderParked = 1u << 29;
+static const uint32_t kSlotParked = kSlotWriterParked | kSlotReaderParked;
+static const uint32_t kSlotReaders = kSlotReaderParked - 1;
+
+// Futex bitsets, so that a wakeup can pick writers or readers
+static const uint32_t kWakeWriter = 1;
+static const uint32_t kWakeReader = 2;
+
+// Roughly the time a write holds its key, past that parking is cheaper
+static const int kSpinRounds = 100;
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  asm volatile("pause");
+#endif
+}
+
+// Sleeps until woken through bitset, unless slot no longer holds value
+static void ParkOn(std::atomic<uint32_t>* slot, uint32_t value,
+                   uint32_t bitset) {
+#ifdef __linux__
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(slot),
+          FUTEX_WAIT_BITSET_PRIVATE, value, NULL, NULL, bitset);
+#else
+  (void)slot;
+  (void)value;
+  (void)bitset;
+  sched_yield();
+#endif
+}
+
+static void Wake(std::atomic<uint32_t>* slot, uint32_t parked) {
+#ifdef __linux__
+  if (parked & kSlotWriterParked) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(slot),
+            FUTEX_WAKE_BITSET_PRIVATE, 1, NULL, NULL, kWakeWriter);
+  }
+  if (parked & kSlotReaderParked) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(slot),
+            FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL, NULL, kWakeReader);
+  }
+#else
+  (void)slot;
+  (void)parked;
+#endif
+}
+
+// Records the wait of a contended acquisition once it got the slot
+class ScopeLockWait {
+ public:
+  ScopeLockWait(LockStatsCollector* stats, size_t slot, const Slice& key)
+      : stats_(stats), slot_(slot), key_(key),
+        start_(stats ? rocksdb::Env::Default()->NowMicros() : 0) {}
+  ~ScopeLockWait() {
+    if (stats_ != nullptr) {
+      stats_->RecordWait(slot_, key_,
+                         rocksdb::Env::Default()->NowMicros() - start_);
+    }
+  }
+
+ private:
+  LockStatsCollector* const stats_;
+  const size_t slot_;
+  const Slice key_;
+  const uint64_t start_;
+};
+
+SlotLockMgr::SlotLockMgr(size_t num_slots)
+    : stats_(nullptr) {
+  size_t slots = 1;
+  while (slots < num_slots) {
+    slots <<= 1;
+  }
+  mask_ = slots - 1;
+  slots_ = new std::atomic<uint32_t>[slots];
+  for (size_t i = 0; i < slots; ++i) {
+    slots_[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+SlotLockMgr::~SlotLockMgr() {
+  delete stats_;
+  delete[] slots_;
+}
+
+void SlotLockMgr::EnableStats(size_t top_n) {
+  if (stats_ == nullptr && top_n != 0) {
+    stats_ = new LockStatsCollector(mask_ + 1, top_n);
+  }
+}
+
+void SlotLockMgr::GetStats(const DataType& type, LockStats* stats) {
+  if (stats_ != nullptr) {
+    stats_->GetStats(type, stats);
+  }
+}
+
+size_t SlotLockMgr::Slot(const Slice& key) const {
+  return MurmurHash(key.data(), static_cast<int>(key.size()), 0) & mask_;
+}
+
+void SlotLockMgr::LockSlot(size_t slot, const Slice& key) {
+#ifndef LOCKLESS
+  uint32_t expected = 0;
+  if (!slots_[slot].compare_exchange_strong(expected, kSlotWriter,
+                                            std::memory_order_acquire)) {
+    LockSlotSlow(slot, key);
+  }
+  if (stats_ != nullptr) {
+    stats_->RecordHold(slot, key);
+  }
+#endif
+}
+
+void SlotLockMgr::LockSlotSlow(size_t slot_index, const Slice& key) {
+  std::atomic<uint32_t>* slot = &slots_[slot_index];
+  ScopeLockWait timer(stats_, slot_index, key);
+  uint32_t state = slot->load(std::memory_order_relaxed);
+  for (int i = 0; i < kSpinRounds; ++i) {
+    if (!(state & (kSlotWriter | kSlotReaders))
+      && slot->compare_exchange_weak(state, state | kSlotWriter,
+                                     std::memory_order_acquire)) {
+      return;
+    }
+    CpuRelax();
+    state = slot->load(std::memory_order_relaxed);
+  }
+
+  // The free that woke us cleared the parked bits, so once parked we keep
+  // ours set on taking the slot, others may still be waiting
+  uint32_t parked = 0;
+  while (true) {
+    if (!(state & (kSlotWriter | kSlotReaders))) {
+      if (slot->compare_exchange_weak(state, state | kSlotWriter | parked,
+                                      std::memory_order_acquire)) {
+        return;
+      }
+      continue;
+    }
+    if (!(state & kSlotWriterParked)
+      && !slot->compare_exchange_weak(state, state | kSlotWriterParked,
+                                      std::memory_order_relaxed)) {
+      continue;
+    }
+    ParkOn(slot, state | kSlotWriterParked, kWakeWriter);
+    parked = kSlotWriterParked;
+    state = slot->load(std::memory_order_relaxed);
+  }
+}
+
+void SlotLockMgr::UnLockSlot(size_t slot) {
+#ifndef LOCKLESS
+  if (stats_ != nullptr) {
+    stats_->RecordRelease(slot);
+  }
+  uint32_t state = slots_[slot].exchange(0, std::memory_order_release);
+  if (state & kSlotParked) {
+    Wake(&slots_[slot], state);
+  }
+#endif
+}
+
+void SlotLockMgr::LockSlotShared(size_t slot, const Slice& key) {
+#ifndef LOCKLESS
+  uint32_t state = slots_[slot].load(std::memory_order_relaxed);
+  if ((state & (kSlotWriter | kSlotWriterParked))
+    || (state & kSlotReaders) == kSlotReaders
+    || !slots_[slot].compare_exchange_weak(state, state + 1,
+                                           std::memory_order_acquire)) {
+    LockSlotSharedSlow(slot, key);
+  }
+#endif
+}
+
+void SlotLockMgr::LockSlotSharedSlow(size_t slot_index, const Slice& key) {
+  std::atomic<uint32_t>* slot = &slots_[slot_index];
+  ScopeLockWait timer(stats_, slot_index, key);
+  uint32_t state = slot->load(std::memory_order_relaxed);
+  for (int i = 0; i < kSpinRounds; ++i) {
+    if (!(state & (kSlotWriter | kSlotWriterParked))
+      && (state & kSlotReaders) != kSlotReaders
+      && slot->compare_exchange_weak(state, state + 1,
+                                     std::memory_order_acquire)) {
+      return;
+    }
+    CpuRelax();
+    state = slot->load(std::memory_order_relaxed);
+  }
+
+  while (true) {
+    if (!(state & (kSlotWriter | kSlotWriterParked))
+      && (state & kSlotReaders) != kSlotReaders) {
+      if (slot->compare_exchange_weak(state, state + 1,
+                                      std::memory_order_acquire)) {
+        return;
+      }
+      continue;
+    }
+    if (!(state & kSlotReaderParked)
+      && !slot->compare_exchange_weak(state, state | kSlotReaderParked,
+                                      std::memory_order_relaxed)) {
+      continue;
+    }
+    ParkOn(slot, state | kSlotReaderParked, kWakeReader);
+    state = slot->load(std::memory_order_relaxed);
+  }
+}
+
+void SlotLockMgr::UnLockSlotShared(size_t slot) {
+#ifndef LOCKLESS
+  uint32_t state = slots_[slot].load(std::memory_order_relaxed);
+  while (true) {
+    uint32_t next = state - 1;
+    // The last reader frees the slot and wakes whoever parked on it
+    if (!(next & kSlotReaders)) {
+      next = 0;
+    }
+    if (slots_[slot].compare_exchange_weak(state, next,
+                                           std::memory_order_release)) {
+      break;
+    }
+  }
+  if ((state & kSlotReaders) == 1 && (state & kSlotParked)) {
+    Wake(&slots_[slot], state);
+  }
+#endif
+}
+
+}  //  namespace blackwidow
@@ -0,0 +1,90 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_SLOT_LOCK_MGR_H_
+#define SRC_SLOT_LOCK_MGR_H_
+
+#include <stdint.h>
+
+#include <atomic>
+
+#include "rocksdb/slice.h"
+
+#include "blackwidow/blackwidow.h"
+#include "src/lock_stats.h"
+
+namespace blackwidow {
+using Slice = rocksdb::Slice;
+
+static const size_t kDefaultLockSlots = 1 << 16;
+
+/*
+ * Locks keys through a fixed array of slots the keys are hashed to, so
+ * taking and releasing a lock never allocates and only touches the one
+ * word of its slot.
+ *
+ * Keys sharing a slot share their lock, which only costs some extra
+ * waiting given enough slots, but means a thread must never lock the slots
+ * of two keys one by one: take the slots of all the keys, drop the
+ * duplicates and lock them in increasing order (see MultiScopeRecordLock).
+ *
+ * A slot is held either exclusively by one writer or shared by up to
+ * kSlotReaders readers, with one bit each for writers and readers that
+ * parked on it. A contended lock spins for a while, then parks on the slot
+ * word with a futex, and the unlock that frees a slot only makes the
+ * syscall when someone parked: it wakes one writer and all the readers.
+ * New readers wait while a writer is parked, so that a stream of short
+ * reads can not starve the writes of a key.
+ *
+ * With stats enabled, contended acquisitions record their waits and
+ * exclusive ones their holding, see LockStatsCollector.
+ */
+class SlotLockMgr {
+ public:
+  // num_slots is rounded up to a power of two
+  explicit SlotLockMgr(size_t num_slots = kDefaultLockSlots);
+  ~SlotLockMgr();
+
+  // Starts collecting contention stats, before the first lock is taken
+  void EnableStats(size_t top_n);
+  // Adds the stats of the locks of type, if collected
+  void GetStats(const DataType& type, LockStats* stats);
+
+  size_t Slot(const Slice& key) const;
+  // key only names the lock in the stats
+  void LockSlot(size_t slot, const Slice& key);
+  void UnLockSlot(size_t slot);
+  void LockSlotShared(size_t slot, const Slice& key);
+  void UnLockSlotShared(size_t slot);
+
+  void Lock(const Slice& key) {
+    LockSlot(Slot(key), key);
+  }
+  void UnLock(const Slice& key) {
+    UnLockSlot(Slot(key));
+  }
+  void LockShared(const Slice& key) {
+    LockSlotShared(Slot(key), key);
+  }
+  void UnLockShared(const Slice& key) {
+    UnLockSlotShared(Slot(key));
+  }
+
+ private:
+  void LockSlotSlow(size_t slot, const Slice& key);
+  void LockSlotSharedSlow(size_t slot, const Slice& key);
+
+  size_t mask_;
+  std::atomic<uint32_t>* slots_;
+  // nullptr unless enabled, so the uncontended paths only test it
+  LockStatsCollector* stats_;
+
+  // No copying allowed
+  SlotLockMgr(const SlotLockMgr&);
+  void operator=(const SlotLockMgr&);
+};
+
+}  //  namespace blackwidow
+#endif  // SRC_SLOT_LOCK_MGR_H_
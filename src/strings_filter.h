@@ -9,6 +9,7 @@
 #include <string>
 #include <memory>
 
+#include "src/base_filter.h"
 #include "src/strings_value_format.h"
 #include "rocksdb/compaction_filter.h"
 #include "src/debug.h"
@@ -17,13 +18,11 @@ namespace blackwidow {
 
 class StringsFilter : public rocksdb::CompactionFilter {
  public:
-  StringsFilter() = default;
+  StringsFilter() : cur_time_(CompactionTime()) {}
   bool Filter(int level, const rocksdb::Slice& key,
               const rocksdb::Slice& value,
               std::string* new_value, bool* value_changed) const override {
-    int64_t unix_time;
-    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
-    int32_t cur_time = static_cast<int32_t>(unix_time);
+    int32_t cur_time = cur_time_;
     ParsedStringsValue parsed_strings_value(value);
     Trace("==========================START==========================");
     Trace("[StringsFilter], key: %s, value = %s, timestamp: %d, cur_time: %d",
@@ -43,6 +42,9 @@ class StringsFilter : public rocksdb::CompactionFilter {
   }
 
   const char* Name() const override { return "StringsFilter"; }
+
+ private:
+  const int32_t cur_time_;
 };
 
 class StringsFilterFactory : public rocksdb::CompactionFilterFactory {
@@ -0,0 +1,117 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_WRITE_COALESCER_H_
+#define SRC_WRITE_COALESCER_H_
+
+#include <vector>
+
+#include "rocksdb/status.h"
+#include "rocksdb/slice.h"
+#include "slash/include/slash_mutex.h"
+
+#include "src/slot_lock_mgr.h"
+
+namespace blackwidow {
+using Status = rocksdb::Status;
+using Slice = rocksdb::Slice;
+
+static const size_t kCoalesceStripes = 256;
+// Bounds the time the thread committing a group keeps the others waiting
+static const size_t kMaxCoalescedWrites = 128;
+
+// The part of a coalesced write the coalescer uses, the commit fills in
+// status and whatever results the write has
+struct CoalescedWrite {
+  explicit CoalescedWrite(const Slice& _key) : key(_key), done(false) {}
+  Slice key;
+  Status status;
+  bool done;
+};
+
+/*
+ * Group commit of the writes to one key. A write queues itself under its
+ * key, then waits for the record lock of the key. Whoever gets the lock
+ * first takes all the writes queued for the key by then, in queue order,
+ * and passes them to commit, which applies them with one read of the
+ * meta value and writes them with one WriteBatch. The writes taken along
+ * find themselves done once they get the lock, and return at once.
+ *
+ * Disabled, every write takes the lock and commits alone.
+ */
+template <typename Write>
+class WriteCoalescer {
+ public:
+  explicit WriteCoalescer(SlotLockMgr* lock_mgr)
+      : lock_mgr_(lock_mgr), enabled_(false) {}
+
+  void set_enabled(bool enabled) {
+    enabled_ = enabled;
+  }
+
+  // commit(std::vector<Write*>* group) runs with the key locked, and must
+  // set the status of every write of the group
+  template <typename Commit>
+  Status Run(Write* write, Commit commit) {
+    size_t slot = lock_mgr_->Slot(write->key);
+    std::vector<Write*> group;
+    if (!enabled_) {
+      lock_mgr_->LockSlot(slot, write->key);
+      group.push_back(write);
+      commit(&group);
+      lock_mgr_->UnLockSlot(slot);
+      return write->status;
+    }
+
+    Stripe* stripe = &stripes_[slot % kCoalesceStripes];
+    stripe->mu.Lock();
+    stripe->queue.push_back(write);
+    stripe->mu.Unlock();
+
+    lock_mgr_->LockSlot(slot, write->key);
+    // Set by the holder that took it along, under the lock we now hold.
+    // Until then, commit groups in queue order to get to it.
+    while (!write->done) {
+      group.clear();
+      stripe->mu.Lock();
+      size_t kept = 0;
+      for (size_t i = 0; i < stripe->queue.size(); ++i) {
+        Write* queued = stripe->queue[i];
+        if (group.size() < kMaxCoalescedWrites
+          && queued->key == write->key) {
+          group.push_back(queued);
+        } else {
+          stripe->queue[kept++] = queued;
+        }
+      }
+      stripe->queue.resize(kept);
+      stripe->mu.Unlock();
+
+      commit(&group);
+      for (auto done : group) {
+        done->done = true;
+      }
+    }
+    lock_mgr_->UnLockSlot(slot);
+    return write->status;
+  }
+
+ private:
+  struct Stripe {
+    slash::Mutex mu;
+    std::vector<Write*> queue;
+  };
+
+  SlotLockMgr* const lock_mgr_;
+  bool enabled_;
+  Stripe stripes_[kCoalesceStripes];
+
+  // No copying allowed
+  WriteCoalescer(const WriteCoalescer&);
+  void operator=(const WriteCoalescer&);
+};
+
+}  //  namespace blackwidow
+#endif  // SRC_WRITE_COALESCER_H_
@@ -11,6 +11,11 @@ namespace blackwidow {
 /*
  * |  <Key Size>  |      <Key>      | <Version> |  <Score>  |      <Member>      |
  *      4 Bytes      key size Bytes    4 Bytes     8 Bytes    member size Bytes
+ *
+ * The score is stored with EncodeOrderedDouble, so score keys sort correctly
+ * under the default bytewise comparator (format 2). Format 1 stored the raw
+ * little-endian double and needed ZSetsScoreKeyComparatorImpl, see
+ * ConvertZSetsScoreKeyV1.
  */
 class ZSetsScoreKey {
  public:
@@ -47,8 +52,7 @@ class ZSetsScoreKey {
     dst += key_.size();
     EncodeFixed32(dst, version_);
     dst += sizeof(int32_t);
-    const void* addr_score = reinterpret_cast<const void*>(&score_);
-    EncodeFixed64(dst, *reinterpret_cast<const uint64_t*>(addr_score));
+    EncodeOrderedDouble(dst, score_);
     dst += sizeof(uint64_t);
     memcpy(dst, member_.data(), member_.size());
     return Slice(start_, needed);
@@ -75,9 +79,7 @@ class ParsedZSetsScoreKey {
     version_ = DecodeFixed32(ptr);
     ptr += sizeof(int32_t);
 
-    uint64_t tmp = DecodeFixed64(ptr);
-    const void* ptr_tmp = reinterpret_cast<const void*>(&tmp);
-    score_ = *reinterpret_cast<const double*>(ptr_tmp);
+    score_ = DecodeOrderedDouble(ptr);
     ptr += sizeof(uint64_t);
     member_ = Slice(ptr, key->size() - key_len
                        - 2 * sizeof(int32_t) - sizeof(uint64_t));
@@ -92,9 +94,7 @@ class ParsedZSetsScoreKey {
     version_ = DecodeFixed32(ptr);
     ptr += sizeof(int32_t);
 
-    uint64_t tmp = DecodeFixed64(ptr);
-    const void* ptr_tmp = reinterpret_cast<const void*>(&tmp);
-    score_ = *reinterpret_cast<const double*>(ptr_tmp);
+    score_ = DecodeOrderedDouble(ptr);
     ptr += sizeof(uint64_t);
     member_ = Slice(ptr, key.size() - key_len
                        - 2 * sizeof(int32_t) - sizeof(uint64_t));
@@ -120,5 +120,16 @@ class ParsedZSetsScoreKey {
   Slice member_;
 };
 
+// Rewrite a format 1 score key (raw little-endian double) into the
+// current order-preserving layout, used when upgrading an old db.
+inline std::string ConvertZSetsScoreKeyV1(const Slice& v1_key) {
+  std::string key(v1_key.data(), v1_key.size());
+  size_t score_pos = DecodeFixed32(v1_key.data()) + 2 * sizeof(int32_t);
+  uint64_t tmp = DecodeFixed64(v1_key.data() + score_pos);
+  const void* ptr_tmp = reinterpret_cast<const void*>(&tmp);
+  EncodeOrderedDouble(&key[score_pos], *reinterpret_cast<const double*>(ptr_tmp));
+  return key;
+}
+
 }  // namespace blackwidow
 #endif  // SRC_ZSETS_DATA_KEY_FORMAT_H_
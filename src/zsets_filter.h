@@ -23,7 +23,10 @@ class ZSetsScoreFilter : public rocksdb::CompactionFilter {
  public:
   ZSetsScoreFilter(rocksdb::DB* db,
                    std::vector<rocksdb::ColumnFamilyHandle*>* handles_ptr) :
-    db_(db), cf_handles_ptr_(handles_ptr), meta_not_found_(false) {}
+    cf_handles_ptr_(handles_ptr),
+    meta_cursor_(db, handles_ptr),
+    meta_not_found_(false),
+    cur_time_(CompactionTime()) {}
 
   bool Filter(int level, const rocksdb::Slice& key,
               const rocksdb::Slice& value,
@@ -44,8 +47,7 @@ class ZSetsScoreFilter : public rocksdb::CompactionFilter {
       if (cf_handles_ptr_->size() == 0) {
         return false;
       }
-      Status s = db_->Get(default_read_options_,
-              (*cf_handles_ptr_)[0], cur_key_, &meta_value);
+      Status s = meta_cursor_.Get(cur_key_, &meta_value);
       if (s.ok()) {
         meta_not_found_ = false;
         ParsedZSetsMetaValue parsed_zsets_meta_value(&meta_value);
@@ -65,10 +67,8 @@ class ZSetsScoreFilter : public rocksdb::CompactionFilter {
       return true;
     }
 
-    int64_t unix_time;
-    rocksdb::Env::Default()->GetCurrentTime(&unix_time);
-    if (cur_meta_timestamp_ != 0 &&
-        cur_meta_timestamp_ < static_cast<int32_t>(unix_time)) {
+    if (cur_meta_timestamp_ != 0
+      && cur_meta_timestamp_ < cur_time_) {
       Trace("Drop[Timeout]");
       return true;
     }
@@ -84,13 +84,13 @@ class ZSetsScoreFilter : public rocksdb::CompactionFilter {
   const char* Name() const override { return "ZSetsScoreFilter";}
 
  private:
-  rocksdb::DB* db_;
   std::vector<rocksdb::ColumnFamilyHandle*>* cf_handles_ptr_;
-  rocksdb::ReadOptions default_read_options_;
+  mutable CompactionMetaCursor meta_cursor_;
   mutable std::string cur_key_;
   mutable bool meta_not_found_;
   mutable int32_t cur_meta_version_;
   mutable int32_t cur_meta_timestamp_;
+  const int32_t cur_time_;
 };
 
 class ZSetsScoreFilterFactory : public rocksdb::CompactionFilterFactory {
@@ -0,0 +1,192 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#include "src/zsets_window_cache.h"
+
+#include <iterator>
+#include <algorithm>
+
+namespace blackwidow {
+
+// Same order as the score cf: by score, then by member
+static bool ScoreMemberLess(const ScoreMember& a, const ScoreMember& b) {
+  if (a.score != b.score) {
+    return a.score < b.score;
+  }
+  return a.member < b.member;
+}
+
+static bool ScoreMemberGreater(const ScoreMember& a, const ScoreMember& b) {
+  return ScoreMemberLess(b, a);
+}
+
+static size_t WindowCharge(const std::string& key, const ZSetsWindow& window) {
+  size_t charge = sizeof(ZSetsWindow) + key.size();
+  for (const auto& sm : window.head) {
+    charge += sizeof(ScoreMember) + sm.member.size();
+  }
+  for (const auto& sm : window.tail) {
+    charge += sizeof(ScoreMember) + sm.member.size();
+  }
+  return charge;
+}
+
+// Keep one side of a window exact after a write, see ZSetsWindow. A side
+// that held the whole zset still does; otherwise only members ordered
+// strictly before its current boundary can be placed.
+template <typename Compare>
+static void ApplyToSide(std::vector<ScoreMember>* side, bool complete,
+                        const std::vector<ScoreMember>& removed,
+                        const std::vector<ScoreMember>& added,
+                        size_t window_size, Compare cmp) {
+  for (const auto& sm : removed) {
+    for (auto iter = side->begin(); iter != side->end(); ++iter) {
+      if (iter->member == sm.member) {
+        side->erase(iter);
+        break;
+      }
+    }
+  }
+  for (const auto& sm : added) {
+    if (complete || (!side->empty() && cmp(sm, side->back()))) {
+      side->insert(std::upper_bound(side->begin(), side->end(), sm, cmp), sm);
+    }
+  }
+  if (side->size() > window_size) {
+    side->resize(window_size);
+  }
+}
+
+ZSetsWindowCache::ZSetsWindowCache()
+    : enabled_(false),
+      window_size_(0),
+      hits_(0),
+      misses_(0) {
+}
+
+void ZSetsWindowCache::SetOptions(size_t capacity, int32_t window_size) {
+  window_size_ = window_size;
+  enabled_ = capacity > 0 && window_size > 0;
+  windows_.SetCapacity(enabled_ ? capacity : 0);
+}
+
+bool ZSetsWindowCache::Enabled() {
+  return enabled_;
+}
+
+int32_t ZSetsWindowCache::WindowSize() {
+  return window_size_;
+}
+
+bool ZSetsWindowCache::Covers(int32_t count,
+                              int32_t start_index, int32_t stop_index) {
+  int32_t window_size = window_size_;
+  return stop_index < window_size || start_index >= count - window_size;
+}
+
+bool ZSetsWindowCache::Lookup(const std::string& key,
+                              int32_t version, int32_t count,
+                              int32_t start_index, int32_t stop_index,
+                              bool reverse,
+                              std::vector<ScoreMember>* score_members) {
+  if (!enabled_) {
+    return false;
+  }
+  std::shared_ptr<ZSetsWindow> window;
+  Status s = windows_.Lookup(key, &window);
+  if (!s.ok() || window->version != version || window->count != count
+    || !Serve(*window, count, start_index, stop_index,
+              reverse, score_members)) {
+    misses_++;
+    return false;
+  }
+  hits_++;
+  return true;
+}
+
+bool ZSetsWindowCache::Serve(const ZSetsWindow& window, int32_t count,
+                             int32_t start_index, int32_t stop_index,
+                             bool reverse,
+                             std::vector<ScoreMember>* score_members) {
+  int32_t head_size = window.head.size();
+  int32_t tail_size = window.tail.size();
+  if (stop_index < head_size) {
+    auto first = window.head.begin() + start_index;
+    auto last = window.head.begin() + stop_index + 1;
+    if (reverse) {
+      score_members->assign(std::reverse_iterator<decltype(last)>(last),
+                            std::reverse_iterator<decltype(first)>(first));
+    } else {
+      score_members->assign(first, last);
+    }
+  } else if (count - 1 - start_index < tail_size) {
+    auto first = window.tail.begin() + (count - 1 - stop_index);
+    auto last = window.tail.begin() + (count - start_index);
+    if (reverse) {
+      score_members->assign(first, last);
+    } else {
+      score_members->assign(std::reverse_iterator<decltype(last)>(last),
+                            std::reverse_iterator<decltype(first)>(first));
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+void ZSetsWindowCache::Insert(const std::string& key,
+                              const std::shared_ptr<ZSetsWindow>& window) {
+  if (enabled_) {
+    windows_.Insert(key, window, WindowCharge(key, *window));
+  }
+}
+
+void ZSetsWindowCache::Remove(const std::string& key) {
+  if (enabled_) {
+    windows_.Remove(key);
+  }
+}
+
+std::shared_ptr<ZSetsWindow> ZSetsWindowCache::Take(const std::string& key) {
+  std::shared_ptr<ZSetsWindow> window;
+  if (enabled_ && windows_.Lookup(key, &window).ok()) {
+    windows_.Remove(key);
+  }
+  return window;
+}
+
+void ZSetsWindowCache::Apply(const std::string& key,
+                             const std::shared_ptr<ZSetsWindow>& window,
+                             int32_t version, int32_t count,
+                             const std::vector<ScoreMember>& removed,
+                             const std::vector<ScoreMember>& added) {
+  if (window == nullptr || window->version != version || count <= 0) {
+    return;
+  }
+  std::shared_ptr<ZSetsWindow> updated =
+    std::make_shared<ZSetsWindow>(*window);
+  size_t window_size = window_size_;
+  ApplyToSide(&updated->head,
+              updated->head.size() == static_cast<size_t>(window->count),
+              removed, added, window_size, ScoreMemberLess);
+  ApplyToSide(&updated->tail,
+              updated->tail.size() == static_cast<size_t>(window->count),
+              removed, added, window_size, ScoreMemberGreater);
+  updated->count = count;
+  if (updated->head.empty() || updated->tail.empty()) {
+    return;
+  }
+  Insert(key, updated);
+}
+
+void ZSetsWindowCache::GetInfo(ZSetsCacheInfo* info) {
+  info->hits = hits_;
+  info->misses = misses_;
+  info->windows = windows_.Size();
+  info->usage = windows_.TotalCharge();
+  info->capacity = windows_.Capacity();
+}
+
+}  //  namespace blackwidow
@@ -0,0 +1,86 @@
+//  Copyright (c) 2017-present The blackwidow Authors.  All rights reserved.
+//  This source code is licensed under the BSD-style license found in the
+//  LICENSE file in the root directory of this source tree. An additional grant
+//  of patent rights can be found in the PATENTS file in the same directory.
+
+#ifndef SRC_ZSETS_WINDOW_CACHE_H_
+#define SRC_ZSETS_WINDOW_CACHE_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "blackwidow/blackwidow.h"
+#include "src/lru_cache.h"
+
+namespace blackwidow {
+
+/*
+ * The lowest and highest ranked members of one version of a zset.
+ * head holds the exact ranks [0, head.size()) in ascending order, tail the
+ * exact ranks [count - tail.size(), count) in descending order.
+ */
+struct ZSetsWindow {
+  int32_t version;
+  int32_t count;
+  std::vector<ScoreMember> head;
+  std::vector<ScoreMember> tail;
+};
+
+// Caches the head and tail windows of hot zsets so that leaderboard style
+// ZRange/ZRevrange queries are answered without touching the score cf.
+// All mutating calls must be made while holding the record lock of the key.
+class ZSetsWindowCache {
+ public:
+  ZSetsWindowCache();
+
+  // capacity is the memory budget in bytes, 0 disables the cache
+  void SetOptions(size_t capacity, int32_t window_size);
+  bool Enabled();
+  int32_t WindowSize();
+
+  // Whether the ascending ranks [start_index, stop_index] of a zset with
+  // count members fall in the window a fill would cache
+  bool Covers(int32_t count, int32_t start_index, int32_t stop_index);
+
+  // Serve the ascending ranks [start_index, stop_index], in descending
+  // order if reverse is set. Only succeeds when the cached window belongs
+  // to the same version and count the caller read from the meta value.
+  bool Lookup(const std::string& key, int32_t version, int32_t count,
+              int32_t start_index, int32_t stop_index, bool reverse,
+              std::vector<ScoreMember>* score_members);
+  // The same from a window at hand, the hit and miss counts are untouched
+  static bool Serve(const ZSetsWindow& window, int32_t count,
+                    int32_t start_index, int32_t stop_index, bool reverse,
+                    std::vector<ScoreMember>* score_members);
+
+  void Insert(const std::string& key,
+              const std::shared_ptr<ZSetsWindow>& window);
+  void Remove(const std::string& key);
+
+  // Detach the window of key before a write, hand it back with Apply
+  // once the write succeeded
+  std::shared_ptr<ZSetsWindow> Take(const std::string& key);
+
+  // Fold a committed write into a detached window and cache it again.
+  // removed holds the old score of every member whose score changed or
+  // that was deleted, added the new score of every member written.
+  void Apply(const std::string& key,
+             const std::shared_ptr<ZSetsWindow>& window,
+             int32_t version, int32_t count,
+             const std::vector<ScoreMember>& removed,
+             const std::vector<ScoreMember>& added);
+
+  void GetInfo(ZSetsCacheInfo* info);
+
+ private:
+  LRUCache<std::string, std::shared_ptr<ZSetsWindow>> windows_;
+  std::atomic<bool> enabled_;
+  std::atomic<int32_t> window_size_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
+
+}  //  namespace blackwidow
+#endif  // SRC_ZSETS_WINDOW_CACHE_H_
@@ -5,23 +5,51 @@
 
 #include <gtest/gtest.h>
 #include <thread>
+#include <limits>
 #include <iostream>
 
 #include "src/redis.h"
 #include "src/custom_comparator.h"
 #include "src/zsets_data_key_format.h"
+#include "src/base_meta_value_format.h"
+#include "src/base_data_key_format.h"
 #include "blackwidow/blackwidow.h"
 
 using namespace blackwidow;
 
+// Format 1 score key layout, the one ZSetsScoreKeyComparatorImpl orders
+class ZSetsScoreKeyV1 {
+ public:
+  ZSetsScoreKeyV1(const Slice& key, int32_t version,
+                  double score, const Slice& member) {
+    char buf[sizeof(uint64_t)];
+    EncodeFixed32(buf, key.size());
+    encoded_.append(buf, sizeof(int32_t));
+    encoded_.append(key.data(), key.size());
+    EncodeFixed32(buf, version);
+    encoded_.append(buf, sizeof(int32_t));
+    const void* addr_score = reinterpret_cast<const void*>(&score);
+    EncodeFixed64(buf, *reinterpret_cast<const uint64_t*>(addr_score));
+    encoded_.append(buf, sizeof(uint64_t));
+    encoded_.append(member.data(), member.size());
+  }
+
+  const Slice Encode() {
+    return Slice(encoded_);
+  }
+
+ private:
+  std::string encoded_;
+};
+
 // FindShortestSeparator
 TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
   ZSetsScoreKeyComparatorImpl impl;
 
   // ***************** Group 1 Test *****************
-  ZSetsScoreKey zsets_score_key_start_1("Axlgrep",  1557212501, 3.1415, "abc");
-  ZSetsScoreKey zsets_score_key_limit_1("Axlgreq", 1557212501, 3.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_start_1("Axlgrep",  1557212501, 3.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_1("Axlgreq", 1557212501, 3.1415, "abc");
   std::string start_1 = zsets_score_key_start_1.Encode().ToString();
   std::string limit_1 = zsets_score_key_limit_1.Encode().ToString();
   std::string change_start_1 = start_1;
@@ -35,8 +63,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 2 Test *****************
-  ZSetsScoreKey zsets_score_key_start_2("Axlgrep", 1557212501, 3.1314, "abc");
-  ZSetsScoreKey zsets_score_key_limit_2("Axlgrep", 1557212502, 3.1314, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_start_2("Axlgrep", 1557212501, 3.1314, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_2("Axlgrep", 1557212502, 3.1314, "abc");
   std::string start_2 = zsets_score_key_start_2.Encode().ToString();
   std::string limit_2 = zsets_score_key_limit_2.Encode().ToString();
   std::string change_start_2 = start_2;
@@ -50,8 +78,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 3 Test *****************
-  ZSetsScoreKey zsets_score_key_start_3("Axlgrep", 1557212501, 3.1415, "abc");
-  ZSetsScoreKey zsets_score_key_limit_3("Axlgrep", 1557212501, 4.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_start_3("Axlgrep", 1557212501, 3.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_3("Axlgrep", 1557212501, 4.1415, "abc");
   std::string start_3 = zsets_score_key_start_3.Encode().ToString();
   std::string limit_3 = zsets_score_key_limit_3.Encode().ToString();
   std::string change_start_3 = start_3;
@@ -65,8 +93,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 4 Test *****************
-  ZSetsScoreKey zsets_score_key_start_4("Axlgrep", 1557212501, 3.1415, "abc");
-  ZSetsScoreKey zsets_score_key_limit_4("Axlgrep", 1557212501, 5.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_start_4("Axlgrep", 1557212501, 3.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_4("Axlgrep", 1557212501, 5.1415, "abc");
   std::string start_4 = zsets_score_key_start_4.Encode().ToString();
   std::string limit_4 = zsets_score_key_limit_4.Encode().ToString();
   std::string change_start_4 = start_4;
@@ -80,8 +108,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 5 Test *****************
-  ZSetsScoreKey zsets_score_key_start_5("Axlgrep", 1557212501, 3.1415, "abc");
-  ZSetsScoreKey zsets_score_key_limit_5("Axlgrep", 1557212501, 3.1415, "abd");
+  ZSetsScoreKeyV1 zsets_score_key_start_5("Axlgrep", 1557212501, 3.1415, "abc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_5("Axlgrep", 1557212501, 3.1415, "abd");
   std::string start_5 = zsets_score_key_start_5.Encode().ToString();
   std::string limit_5 = zsets_score_key_limit_5.Encode().ToString();
   std::string change_start_5 = start_5;
@@ -95,8 +123,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 6 Test *****************
-  ZSetsScoreKey zsets_score_key_start_6("Axlgrep", 1557212501, 3.1415, "abccccccc");
-  ZSetsScoreKey zsets_score_key_limit_6("Axlgrep", 1557212501, 3.1415, "abd");
+  ZSetsScoreKeyV1 zsets_score_key_start_6("Axlgrep", 1557212501, 3.1415, "abccccccc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_6("Axlgrep", 1557212501, 3.1415, "abd");
   std::string start_6 = zsets_score_key_start_6.Encode().ToString();
   std::string limit_6 = zsets_score_key_limit_6.Encode().ToString();
   std::string change_start_6 = start_6;
@@ -110,8 +138,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 7 Test *****************
-  ZSetsScoreKey zsets_score_key_start_7("Axlgrep", 1557212501, 3.1415, "abcccaccc");
-  ZSetsScoreKey zsets_score_key_limit_7("Axlgrep", 1557212501, 3.1415, "abccccccc");
+  ZSetsScoreKeyV1 zsets_score_key_start_7("Axlgrep", 1557212501, 3.1415, "abcccaccc");
+  ZSetsScoreKeyV1 zsets_score_key_limit_7("Axlgrep", 1557212501, 3.1415, "abccccccc");
   std::string start_7 = zsets_score_key_start_7.Encode().ToString();
   std::string limit_7 = zsets_score_key_limit_7.Encode().ToString();
   std::string change_start_7 = start_7;
@@ -125,8 +153,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 8 Test *****************
-  ZSetsScoreKey zsets_score_key_start_8("Axlgrep", 1557212501, 3.1415, "");
-  ZSetsScoreKey zsets_score_key_limit_8("Axlgrep", 1557212501, 3.1415, "abccccccc");
+  ZSetsScoreKeyV1 zsets_score_key_start_8("Axlgrep", 1557212501, 3.1415, "");
+  ZSetsScoreKeyV1 zsets_score_key_limit_8("Axlgrep", 1557212501, 3.1415, "abccccccc");
   std::string start_8 = zsets_score_key_start_8.Encode().ToString();
   std::string limit_8 = zsets_score_key_limit_8.Encode().ToString();
   std::string change_start_8 = start_8;
@@ -140,8 +168,8 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
 
 
   // ***************** Group 9 Test *****************
-  ZSetsScoreKey zsets_score_key_start_9("Axlgrep", 1557212501, 3.1415, "aaaa");
-  ZSetsScoreKey zsets_score_key_limit_9("Axlgrep", 1557212501, 4.1415, "");
+  ZSetsScoreKeyV1 zsets_score_key_start_9("Axlgrep", 1557212501, 3.1415, "aaaa");
+  ZSetsScoreKeyV1 zsets_score_key_limit_9("Axlgrep", 1557212501, 4.1415, "");
   std::string start_9 = zsets_score_key_start_9.Encode().ToString();
   std::string limit_9 = zsets_score_key_limit_9.Encode().ToString();
   std::string change_start_9 = start_9;
@@ -154,6 +182,133 @@ TEST(ZSetScoreKeyComparator, FindShortestSeparatorTest) {
   ASSERT_TRUE(impl.Compare(change_start_9, limit_9) <  0);
 }
 
+// Format 2 score keys sort by score under the bytewise comparator
+TEST(ZSetScoreKeyFormat, BytewiseOrderTest) {
+  const rocksdb::Comparator* bytewise = rocksdb::BytewiseComparator();
+  ZSetsScoreKeyComparatorImpl impl;
+  std::vector<double> scores({-std::numeric_limits<double>::infinity(),
+                              std::numeric_limits<double>::lowest(),
+                              -1024.5, -1, -std::numeric_limits<double>::min(),
+                              0, std::numeric_limits<double>::denorm_min(),
+                              std::numeric_limits<double>::min(), 1, 3.1415,
+                              1024.5, std::numeric_limits<double>::max(),
+                              std::numeric_limits<double>::infinity()});
+
+  for (size_t i = 0; i + 1 < scores.size(); ++i) {
+    ZSetsScoreKey lo("Axlgrep", 1557212501, scores[i], "zzz");
+    ZSetsScoreKey hi("Axlgrep", 1557212501, scores[i + 1], "aaa");
+    ASSERT_LT(bytewise->Compare(lo.Encode(), hi.Encode()), 0);
+
+    ZSetsScoreKeyV1 lo_v1("Axlgrep", 1557212501, scores[i], "zzz");
+    ZSetsScoreKeyV1 hi_v1("Axlgrep", 1557212501, scores[i + 1], "aaa");
+    ASSERT_LT(impl.Compare(lo_v1.Encode(), hi_v1.Encode()), 0);
+  }
+
+  // Round trip through the order-preserving encoding and the upgrade path
+  for (double score : scores) {
+    ZSetsScoreKey key("Axlgrep", 1557212501, score, "abc");
+    ParsedZSetsScoreKey parsed(key.Encode());
+    ASSERT_EQ(parsed.score(), score);
+    ASSERT_EQ(parsed.member().ToString(), "abc");
+    ASSERT_EQ(parsed.version(), 1557212501);
+
+    ZSetsScoreKeyV1 key_v1("Axlgrep", 1557212501, score, "abc");
+    ASSERT_EQ(ConvertZSetsScoreKeyV1(key_v1.Encode()),
+              key.Encode().ToString());
+  }
+
+  // -0.0 and 0.0 compare equal, so they share an encoding
+  ZSetsScoreKey neg_zero("Axlgrep", 1557212501, -0.0, "abc");
+  ZSetsScoreKey pos_zero("Axlgrep", 1557212501, 0.0, "abc");
+  ASSERT_EQ(neg_zero.Encode().ToString(), pos_zero.Encode().ToString());
+
+  // Members with the same score keep bytewise member order
+  ZSetsScoreKey member_a("Axlgrep", 1557212501, -2.5, "ab");
+  ZSetsScoreKey member_b("Axlgrep", 1557212501, -2.5, "abc");
+  ASSERT_LT(bytewise->Compare(member_a.Encode(), member_b.Encode()), 0);
+}
+
+// A zsets db written with the format 1 score column family is upgraded
+// in place when BlackWidow opens it
+TEST(ZSetScoreKeyFormat, UpgradeV1Test) {
+  std::string path = "./db/zsets_v1";
+  std::string zsets_path = path + "/zsets";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+
+  static ZSetsScoreKeyComparatorImpl v1_comparator;
+  rocksdb::DBOptions db_ops;
+  db_ops.create_if_missing = true;
+  db_ops.create_missing_column_families = true;
+  rocksdb::ColumnFamilyOptions score_cf_ops;
+  score_cf_ops.comparator = &v1_comparator;
+  std::vector<rocksdb::ColumnFamilyDescriptor> column_families;
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+        rocksdb::kDefaultColumnFamilyName, rocksdb::ColumnFamilyOptions()));
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+        "data_cf", rocksdb::ColumnFamilyOptions()));
+  column_families.push_back(rocksdb::ColumnFamilyDescriptor(
+        "score_cf", score_cf_ops));
+  std::vector<rocksdb::ColumnFamilyHandle*> handles;
+  rocksdb::DB* v1_db = nullptr;
+  Status s = rocksdb::DB::Open(db_ops, zsets_path,
+                               column_families, &handles, &v1_db);
+  ASSERT_TRUE(s.ok());
+
+  std::vector<ScoreMember> score_members({{-3.5, "MM1"}, {0, "MM2"},
+                                          {2, "MM3"}, {1024, "MM4"}});
+  rocksdb::WriteBatch batch;
+  char buf[8];
+  EncodeFixed32(buf, score_members.size());
+  ZSetsMetaValue zsets_meta_value(Slice(buf, sizeof(int32_t)));
+  int32_t version = zsets_meta_value.UpdateVersion();
+  batch.Put(handles[0], "GP1_UPGRADE_KEY", zsets_meta_value.Encode());
+  for (const auto& sm : score_members) {
+    ZSetsMemberKey zsets_member_key("GP1_UPGRADE_KEY", version, sm.member);
+    const void* ptr_score = reinterpret_cast<const void*>(&sm.score);
+    EncodeFixed64(buf, *reinterpret_cast<const uint64_t*>(ptr_score));
+    batch.Put(handles[1], zsets_member_key.Encode(),
+              Slice(buf, sizeof(uint64_t)));
+    ZSetsScoreKeyV1 zsets_score_key("GP1_UPGRADE_KEY", version,
+                                    sm.score, sm.member);
+    batch.Put(handles[2], zsets_score_key.Encode(), Slice());
+  }
+  s = v1_db->Write(rocksdb::WriteOptions(), &batch);
+  ASSERT_TRUE(s.ok());
+  for (auto handle : handles) {
+    delete handle;
+  }
+  delete v1_db;
+
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  BlackWidow db;
+  s = db.Open(bw_options, path);
+  ASSERT_TRUE(s.ok());
+
+  std::vector<ScoreMember> score_members_out;
+  s = db.ZRangebyscore("GP1_UPGRADE_KEY", -1, 1024, true, false,
+                       &score_members_out);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(score_members_out.size(), 2);
+  ASSERT_EQ(score_members_out[0].member, "MM2");
+  ASSERT_EQ(score_members_out[1].member, "MM3");
+
+  int32_t ret = 0;
+  std::vector<std::string> members({"MM1"});
+  s = db.ZRem("GP1_UPGRADE_KEY", members, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+
+  score_members_out.clear();
+  s = db.ZRange("GP1_UPGRADE_KEY", 0, -1, &score_members_out);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(score_members_out.size(), 3);
+  ASSERT_EQ(score_members_out[0].member, "MM2");
+  ASSERT_EQ(score_members_out[2].member, "MM4");
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -55,26 +55,31 @@ TEST(HashesFilterTest, FilterTest) {
   std::string new_value;
 
   /*************** TEST META FILTER ***************/
-  HashesMetaFilter* hashes_meta_filter = new HashesMetaFilter();
-  ASSERT_TRUE(hashes_meta_filter != nullptr);
+  // A filter is created for each compaction, and uses the time the
+  // compaction started at
+  HashesMetaFilter* hashes_meta_filter;
 
   // Timeout timestamp is not set, but it's an empty hash table.
   EncodeFixed32(str, 0);
   HashesMetaValue tmf_meta_value1(std::string(str, sizeof(int32_t)));
   tmf_meta_value1.UpdateVersion();
   std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  hashes_meta_filter = new HashesMetaFilter();
   filter_result = hashes_meta_filter->Filter(0, "FILTER_TEST_KEY",
       tmf_meta_value1.Encode(), &new_value, &value_changed);
   ASSERT_EQ(filter_result, true);
+  delete hashes_meta_filter;
 
   // Timeout timestamp is not set, it's not an empty hash table.
   EncodeFixed32(str, 1);
   HashesMetaValue tmf_meta_value2(std::string(str, sizeof(int32_t)));
   tmf_meta_value2.UpdateVersion();
   std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  hashes_meta_filter = new HashesMetaFilter();
   filter_result = hashes_meta_filter->Filter(0, "FILTER_TEST_KEY",
       tmf_meta_value2.Encode(), &new_value, &value_changed);
   ASSERT_EQ(filter_result, false);
+  delete hashes_meta_filter;
 
   // Timeout timestamp is set, but not expired.
   EncodeFixed32(str, 1);
@@ -82,9 +87,11 @@ TEST(HashesFilterTest, FilterTest) {
   tmf_meta_value3.UpdateVersion();
   tmf_meta_value3.SetRelativeTimestamp(3);
   std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+  hashes_meta_filter = new HashesMetaFilter();
   filter_result = hashes_meta_filter->Filter(0, "FILTER_TEST_KEY",
       tmf_meta_value3.Encode(), &new_value, &value_changed);
   ASSERT_EQ(filter_result, false);
+  delete hashes_meta_filter;
 
   // Timeout timestamp is set, already expired.
   EncodeFixed32(str, 1);
@@ -92,6 +99,7 @@ TEST(HashesFilterTest, FilterTest) {
   tmf_meta_value4.UpdateVersion();
   tmf_meta_value4.SetRelativeTimestamp(1);
   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+  hashes_meta_filter = new HashesMetaFilter();
   filter_result = hashes_meta_filter->Filter(0, "FILTER_TEST_KEY",
       tmf_meta_value4.Encode(), &new_value, &value_changed);
   ASSERT_EQ(filter_result, true);
@@ -140,9 +148,6 @@ TEST(HashesFilterTest, FilterTest) {
   delete hashes_data_filter2;
 
   // timeout timestamp is set, already timeout.
-  HashesDataFilter* hashes_data_filter3
-    = new HashesDataFilter(meta_db, &handles);
-  ASSERT_TRUE(hashes_data_filter3 != nullptr);
   EncodeFixed32(str, 1);
   HashesMetaValue tdf_meta_value3(std::string(str, sizeof(int32_t)));
   version = tdf_meta_value3.UpdateVersion();
@@ -151,6 +156,9 @@ TEST(HashesFilterTest, FilterTest) {
       "FILTER_TEST_KEY", tdf_meta_value3.Encode());
   ASSERT_TRUE(s.ok());
   std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+  HashesDataFilter* hashes_data_filter3
+    = new HashesDataFilter(meta_db, &handles);
+  ASSERT_TRUE(hashes_data_filter3 != nullptr);
   HashesDataKey tdf_data_key3("FILTER_TEST_KEY", version, "FILTER_TEST_FIELD");
   filter_result = hashes_data_filter3->Filter(0, tdf_data_key3.Encode(),
       "FILTER_TEST_VALUE", &new_value, &value_changed);
@@ -202,6 +210,45 @@ TEST(HashesFilterTest, FilterTest) {
   ASSERT_EQ(filter_result, true);
   delete hashes_data_filter5;
 
+  // Keys come grouped by their length, and sorted within a group. The
+  // filter steps or seeks forward through the meta values in a group,
+  // and seeks back at the next group.
+  EncodeFixed32(str, 1);
+  HashesMetaValue tdf_meta_value6(std::string(str, sizeof(int32_t)));
+  version = tdf_meta_value6.UpdateVersion();
+  std::vector<std::string> meta_keys = {"A", "BB", "C", "DD"};
+  for (int32_t i = 0; i < 100; ++i) {
+    char buf[8];
+    snprintf(buf, sizeof(buf), "K%03d", i);
+    meta_keys.push_back(buf);
+  }
+  for (const auto& meta_key : meta_keys) {
+    s = meta_db->Put(rocksdb::WriteOptions(), handles[0],
+        meta_key, tdf_meta_value6.Encode());
+    ASSERT_TRUE(s.ok());
+  }
+  std::vector<std::pair<std::string, int32_t>> data_keys = {
+    {"A", version}, {"C", version}, {"E", version},
+    {"BB", version}, {"DD", version - 1},
+    {"K000", version}, {"K050", version}, {"K051", version - 1},
+    {"K099", version}, {"K100", version}};
+  std::vector<bool> results = {false, false, true, false, true,
+                               false, false, true, false, true};
+  HashesDataFilter* hashes_data_filter6
+    = new HashesDataFilter(meta_db, &handles);
+  for (size_t i = 0; i < data_keys.size(); ++i) {
+    HashesDataKey data_key(data_keys[i].first, data_keys[i].second,
+                           "FILTER_TEST_FIELD");
+    filter_result = hashes_data_filter6->Filter(0, data_key.Encode(),
+        "FILTER_TEST_VALUE", &new_value, &value_changed);
+    ASSERT_EQ(filter_result, results[i]);
+  }
+  delete hashes_data_filter6;
+  for (const auto& meta_key : meta_keys) {
+    s = meta_db->Delete(rocksdb::WriteOptions(), handles[0], meta_key);
+    ASSERT_TRUE(s.ok());
+  }
+
   // Delete Meta db
   delete meta_db;
 }
@@ -70,6 +70,15 @@ TEST_F(HyperLogLogTest, PfaddTest) {
   s = db.PfAdd("HLL", values, &update);
   ASSERT_TRUE(s.ok());
   ASSERT_FALSE(update);
+
+  // PFADD that modifies no reg leaves the value alone
+  int32_t ret = db.Expire("HLL", 100, &type_status);
+  ASSERT_EQ(ret, 1);
+  s = db.PfAdd("HLL", values, &update);
+  ASSERT_TRUE(s.ok());
+  ASSERT_FALSE(update);
+  std::map<blackwidow::DataType, int64_t> ttl_ret = db.TTL("HLL", &type_status);
+  ASSERT_GT(ttl_ret[kStrings], 0);
   nums = db.Del(keys, &type_status);
   ASSERT_EQ(nums, 1);
 
@@ -173,6 +182,177 @@ TEST_F(HyperLogLogTest, MultipleKeysTest) {
   ASSERT_LT(ratio_nums, static_cast<double>(result/100)*5);
 }
 
+TEST_F(HyperLogLogTest, SparseTest) {
+  // small HLLs are stored sparse, big ones are promoted to the 6 bit
+  // dense registers of Redis
+  bool update;
+  std::string value;
+  std::vector<std::string> values {"A", "B", "C"};
+  s = db.PfAdd("HLL_SPARSE", values, &update);
+  ASSERT_TRUE(s.ok());
+  s = db.Get("HLL_SPARSE", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_LT(value.size(), 64);
+
+  values.clear();
+  for (int32_t i = 1; i <= 5000; i++) {
+    values.push_back("DENSE" + std::to_string(i));
+    if (values.size() == 100) {
+      s = db.PfAdd("HLL_DENSE", values, &update);
+      ASSERT_TRUE(s.ok());
+      values.clear();
+    }
+  }
+  s = db.Get("HLL_DENSE", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value.size(), 16 + (1 << BlackWidow::kPrecision) * 6 / 8);
+
+  // PFCOUNT and PFMERGE over mixed representations
+  std::vector<std::string> keys {"HLL_SPARSE", "HLL_DENSE"};
+  int64_t result;
+  s = db.PfCount(keys, &result);
+  ASSERT_TRUE(s.ok());
+  ASSERT_LT(abs(5003 - result), 5003 / 100 * 5);
+
+  s = db.PfMerge(keys);
+  ASSERT_TRUE(s.ok());
+  s = db.Get("HLL_SPARSE", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value.size(), 16 + (1 << BlackWidow::kPrecision) * 6 / 8);
+  int64_t merged;
+  keys = {"HLL_SPARSE"};
+  s = db.PfCount(keys, &merged);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(merged, result);
+
+  // legacy dense registers without a header are still readable
+  std::string legacy(1 << 17, 0);
+  legacy[1] = 1;
+  legacy[2] = 1;
+  s = db.Set("HLL_LEGACY", legacy);
+  ASSERT_TRUE(s.ok());
+  keys = {"HLL_LEGACY"};
+  s = db.PfCount(keys, &result);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(result, 2);
+
+  // and can not be mixed with the current format
+  keys = {"HLL_LEGACY", "HLL_DENSE"};
+  s = db.PfCount(keys, &result);
+  ASSERT_TRUE(s.IsInvalidArgument());
+
+  // other strings are rejected
+  s = db.Set("HLL_INVALID", "not a hll");
+  ASSERT_TRUE(s.ok());
+  s = db.PfAdd("HLL_INVALID", {"A"}, &update);
+  ASSERT_TRUE(s.IsInvalidArgument());
+
+  std::map<blackwidow::DataType, Status> type_status;
+  keys = {"HLL_SPARSE", "HLL_DENSE", "HLL_LEGACY", "HLL_INVALID"};
+  int64_t nums = db.Del(keys, &type_status);
+  ASSERT_EQ(nums, 4);
+}
+
+TEST_F(HyperLogLogTest, ConcurrentPfaddTest) {
+  // concurrent PFADD on one key loses no elements
+  std::vector<std::thread> threads;
+  for (int32_t t = 0; t < 4; t++) {
+    threads.emplace_back([this, t]() {
+      bool update;
+      std::vector<std::string> values;
+      for (int32_t i = 1; i <= 5000; i++) {
+        values.push_back("T" + std::to_string(t) + "_" + std::to_string(i));
+        if (values.size() == 50) {
+          db.PfAdd("HLL_CONCURRENT", values, &update);
+          values.clear();
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  std::vector<std::string> keys {"HLL_CONCURRENT"};
+  int64_t result;
+  s = db.PfCount(keys, &result);
+  ASSERT_TRUE(s.ok());
+  ASSERT_LT(abs(20000 - result), 20000 / 100 * 5);
+
+  // PFADD keeps the TTL of the key
+  std::map<blackwidow::DataType, Status> type_status;
+  int32_t ret = db.Expire("HLL_CONCURRENT", 100, &type_status);
+  ASSERT_EQ(ret, 1);
+  bool update;
+  s = db.PfAdd("HLL_CONCURRENT", {"NEW1", "NEW2", "NEW3"}, &update);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(update);
+  std::map<blackwidow::DataType, int64_t> ttl_ret =
+    db.TTL("HLL_CONCURRENT", &type_status);
+  ASSERT_GT(ttl_ret[kStrings], 0);
+
+  int64_t nums = db.Del(keys, &type_status);
+  ASSERT_EQ(nums, 1);
+}
+
+TEST_F(HyperLogLogTest, CachedCardinalityTest) {
+  // PFCOUNT caches the cardinality in the header, PFADD invalidates it
+  bool update;
+  int64_t result;
+  std::string value;
+  std::vector<std::string> keys {"HLL_CACHED"};
+  std::vector<std::string> values;
+  for (int32_t i = 1; i <= 2000; i++) {
+    values.push_back("CACHED" + std::to_string(i));
+  }
+  s = db.PfAdd("HLL_CACHED", values, &update);
+  ASSERT_TRUE(s.ok());
+  s = db.Get("HLL_CACHED", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(value[15] & 0x80);
+
+  s = db.PfCount(keys, &result);
+  ASSERT_TRUE(s.ok());
+  s = db.Get("HLL_CACHED", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_FALSE(value[15] & 0x80);
+  int64_t cached;
+  s = db.PfCount(keys, &cached);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(cached, result);
+
+  // re-adding the same elements keeps the cache
+  s = db.PfAdd("HLL_CACHED", values, &update);
+  ASSERT_TRUE(s.ok());
+  ASSERT_FALSE(update);
+  s = db.Get("HLL_CACHED", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_FALSE(value[15] & 0x80);
+
+  s = db.PfAdd("HLL_CACHED", {"CACHED_NEW"}, &update);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(update);
+  s = db.Get("HLL_CACHED", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(value[15] & 0x80);
+  s = db.PfCount(keys, &result);
+  ASSERT_TRUE(s.ok());
+  ASSERT_LT(abs(2001 - result), 2001 / 100 * 5);
+
+  // PFMERGE invalidates it too
+  s = db.PfAdd("HLL_CACHED_OTHER", {"OTHER1", "OTHER2"}, &update);
+  ASSERT_TRUE(s.ok());
+  keys = {"HLL_CACHED", "HLL_CACHED_OTHER"};
+  s = db.PfMerge(keys);
+  ASSERT_TRUE(s.ok());
+  s = db.Get("HLL_CACHED", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(value[15] & 0x80);
+
+  std::map<blackwidow::DataType, Status> type_status;
+  int64_t nums = db.Del(keys, &type_status);
+  ASSERT_EQ(nums, 2);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
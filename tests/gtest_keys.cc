@@ -5,9 +5,11 @@
 
 #include <gtest/gtest.h>
 #include <thread>
+#include <algorithm>
 #include <iostream>
 
 #include "blackwidow/blackwidow.h"
+#include "src/key_type_directory.h"
 
 using namespace blackwidow;
 
@@ -7978,6 +7980,712 @@ TEST_F(KeysTest, TTLTest) {
   }
 }
 
+// Key type directory
+TEST(KeyTypeDirectoryTest, RouteTest) {
+  std::string path = "./db/key_type_directory";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  uint64_t llen;
+  std::string type;
+  std::map<blackwidow::DataType, Status> type_status;
+  std::map<blackwidow::DataType, int64_t> ttl_ret;
+  std::vector<std::string> keys {"DIRECTORY_KEY_1", "DIRECTORY_KEY_2",
+                                 "DIRECTORY_KEY_3", "DIRECTORY_KEY_4"};
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+
+  // Keys written without the directory are recorded when it is built
+  {
+    blackwidow::BlackWidow db;
+    ASSERT_TRUE(db.Open(bw_options, path).ok());
+    ASSERT_GE(db.Del(keys, &type_status), 0);
+    ASSERT_TRUE(db.Set("DIRECTORY_KEY_1", "VALUE").ok());
+    ASSERT_TRUE(db.SAdd("DIRECTORY_KEY_2", {"MEMBER"}, &ret).ok());
+  }
+
+  bw_options.enable_key_type_directory = true;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  ASSERT_EQ(db.Exists(keys, &type_status), 2);
+  ASSERT_TRUE(db.Type("DIRECTORY_KEY_1", &type).ok());
+  ASSERT_EQ(type, "string");
+  ASSERT_TRUE(db.Type("DIRECTORY_KEY_2", &type).ok());
+  ASSERT_EQ(type, "set");
+  ASSERT_TRUE(db.Type("DIRECTORY_KEY_3", &type).ok());
+  ASSERT_EQ(type, "none");
+
+  // A key held by several types
+  ASSERT_TRUE(db.RPush("DIRECTORY_KEY_3", {"NODE"}, &llen).ok());
+  ASSERT_TRUE(db.ZAdd("DIRECTORY_KEY_3", {{1, "MEMBER"}}, &ret).ok());
+  ASSERT_EQ(db.Exists({"DIRECTORY_KEY_3"}, &type_status), 2);
+  ASSERT_EQ(db.Expire("DIRECTORY_KEY_3", 100, &type_status), 2);
+  ttl_ret = db.TTL("DIRECTORY_KEY_3", &type_status);
+  ASSERT_EQ(ttl_ret.size(), 5);
+  ASSERT_EQ(ttl_ret[DataType::kStrings], -2);
+  ASSERT_EQ(ttl_ret[DataType::kHashes], -2);
+  ASSERT_GT(ttl_ret[DataType::kLists], 0);
+  ASSERT_LE(ttl_ret[DataType::kLists], 100);
+  ASSERT_GT(ttl_ret[DataType::kZSets], 0);
+  ASSERT_LE(ttl_ret[DataType::kZSets], 100);
+  ASSERT_EQ(db.Persist("DIRECTORY_KEY_3", &type_status), 2);
+
+  ASSERT_EQ(db.Del({"DIRECTORY_KEY_1", "DIRECTORY_KEY_3"}, &type_status), 3);
+  ASSERT_EQ(db.Exists(keys, &type_status), 1);
+  ASSERT_TRUE(db.Type("DIRECTORY_KEY_3", &type).ok());
+  ASSERT_EQ(type, "none");
+
+  // Created again after the Del
+  ASSERT_TRUE(db.HSet("DIRECTORY_KEY_3", "FIELD", "VALUE", &ret).ok());
+  ASSERT_TRUE(db.Type("DIRECTORY_KEY_3", &type).ok());
+  ASSERT_EQ(type, "hash");
+
+  // Destination of a store command
+  ASSERT_TRUE(db.SUnionstore("DIRECTORY_KEY_4",
+                             {"DIRECTORY_KEY_2"}, &ret).ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_TRUE(db.Type("DIRECTORY_KEY_4", &type).ok());
+  ASSERT_EQ(type, "set");
+  ASSERT_EQ(db.Exists(keys, &type_status), 3);
+}
+
+TEST(KeyTypeDirectoryTest, ReclaimTest) {
+  std::string path = "./db/key_type_directory_reclaim";
+  std::string directory_path = "./db/key_type_directory_reclaim_directory";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  uint8_t types;
+  std::map<blackwidow::DataType, Status> type_status;
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  ASSERT_GE(db.Del({"RECLAIM_KEY_1", "RECLAIM_KEY_2", "RECLAIM_KEY_3"},
+                   &type_status), 0);
+
+  // The directory asks db whether its strings and hashes hold a key
+  KeyTypeDirectory directory;
+  ASSERT_TRUE(KeyTypeDirectory::Destroy(bw_options, directory_path).ok());
+  ASSERT_TRUE(directory.Open(bw_options, directory_path,
+        [&](const Slice& key, const DataType& type) {
+          std::string value;
+          int32_t len;
+          if (type == kStrings) {
+            return !db.Get(key, &value).IsNotFound();
+          } else if (type == kHashes) {
+            return !db.HLen(key, &len).IsNotFound();
+          }
+          return true;
+        }).ok());
+
+  // An expired string, an emptied hash, and a key that is only left in
+  // one of its types
+  ASSERT_TRUE(db.Setex("RECLAIM_KEY_1", "VALUE", 1).ok());
+  ASSERT_TRUE(directory.Mark("RECLAIM_KEY_1", kStrings).ok());
+  ASSERT_TRUE(db.HSet("RECLAIM_KEY_2", "FIELD", "VALUE", &ret).ok());
+  ASSERT_TRUE(directory.Mark("RECLAIM_KEY_2", kHashes).ok());
+  ASSERT_TRUE(db.HDel("RECLAIM_KEY_2", {"FIELD"}, &ret).ok());
+  ASSERT_TRUE(db.Set("RECLAIM_KEY_3", "VALUE").ok());
+  ASSERT_TRUE(directory.Mark("RECLAIM_KEY_3", kStrings).ok());
+  ASSERT_TRUE(db.HSet("RECLAIM_KEY_3", "FIELD", "VALUE", &ret).ok());
+  ASSERT_TRUE(directory.Mark("RECLAIM_KEY_3", kHashes).ok());
+  ASSERT_TRUE(db.HDel("RECLAIM_KEY_3", {"FIELD"}, &ret).ok());
+  std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+
+  ASSERT_TRUE(directory.CompactRange().ok());
+  ASSERT_TRUE(directory.Lookup("RECLAIM_KEY_1", &types).ok());
+  ASSERT_EQ(types, 0);
+  ASSERT_TRUE(directory.Lookup("RECLAIM_KEY_2", &types).ok());
+  ASSERT_EQ(types, 0);
+  ASSERT_TRUE(directory.Lookup("RECLAIM_KEY_3", &types).ok());
+  ASSERT_EQ(types, 1 << kStrings);
+
+  // A reclaimed key written again is recorded again
+  ASSERT_TRUE(db.Set("RECLAIM_KEY_1", "VALUE").ok());
+  ASSERT_TRUE(directory.Mark("RECLAIM_KEY_1", kStrings).ok());
+  ASSERT_TRUE(directory.Lookup("RECLAIM_KEY_1", &types).ok());
+  ASSERT_EQ(types, 1 << kStrings);
+  ASSERT_GE(db.Del({"RECLAIM_KEY_1", "RECLAIM_KEY_3"}, &type_status), 2);
+}
+
+// Keys commands fanned out to the types
+TEST(KeysFanoutTest, FanoutTest) {
+  std::string path = "./db/keys_fanout";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  uint64_t llen;
+  std::map<blackwidow::DataType, Status> type_status;
+  std::map<blackwidow::DataType, int64_t> ttl_ret;
+  std::vector<std::string> keys {"FANOUT_KEY_1", "FANOUT_KEY_2"};
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.keys_fanout_threads = 4;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  ASSERT_GE(db.Del(keys, &type_status), 0);
+
+  for (const auto& key : keys) {
+    ASSERT_TRUE(db.Set(key, "VALUE").ok());
+    ASSERT_TRUE(db.HSet(key, "FIELD", "VALUE", &ret).ok());
+    ASSERT_TRUE(db.SAdd(key, {"MEMBER"}, &ret).ok());
+    ASSERT_TRUE(db.RPush(key, {"NODE"}, &llen).ok());
+    ASSERT_TRUE(db.ZAdd(key, {{1, "MEMBER"}}, &ret).ok());
+  }
+  ASSERT_EQ(db.Exists(keys, &type_status), 10);
+  ASSERT_TRUE(type_status.empty());
+
+  ASSERT_EQ(db.Expire("FANOUT_KEY_1", 100, &type_status), 5);
+  ttl_ret = db.TTL("FANOUT_KEY_1", &type_status);
+  ASSERT_EQ(ttl_ret.size(), 5);
+  for (auto it = ttl_ret.begin(); it != ttl_ret.end(); it++) {
+    ASSERT_GT(it->second, 0);
+    ASSERT_LE(it->second, 100);
+  }
+  ttl_ret = db.TTL("FANOUT_KEY_2", &type_status);
+  for (auto it = ttl_ret.begin(); it != ttl_ret.end(); it++) {
+    ASSERT_EQ(it->second, -1);
+  }
+
+  ASSERT_EQ(db.Del({"FANOUT_KEY_1", "FANOUT_KEY_1"}, &type_status), 5);
+  ASSERT_EQ(db.Exists(keys, &type_status), 5);
+  ASSERT_EQ(db.Del(keys, &type_status), 5);
+  ASSERT_EQ(db.Exists(keys, &type_status), 0);
+  ttl_ret = db.TTL("FANOUT_KEY_2", &type_status);
+  for (auto it = ttl_ret.begin(); it != ttl_ret.end(); it++) {
+    ASSERT_EQ(it->second, -2);
+  }
+}
+
+TEST(ShardsTest, RouteTest) {
+  std::string path = "./db/shards";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  std::string value;
+  std::map<blackwidow::DataType, Status> type_status;
+  std::vector<std::string> keys;
+  std::vector<blackwidow::KeyValue> kvs;
+  for (int32_t i = 0; i < 20; ++i) {
+    keys.push_back("SHARD_KEY_" + std::to_string(i));
+    kvs.push_back({keys.back(), "VALUE_" + std::to_string(i)});
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.shards = 4;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  ASSERT_GE(db.Del(keys, &type_status), 0);
+
+  // The number of shards is fixed once the db exists
+  BlackwidowOptions unsharded_options;
+  unsharded_options.options.create_if_missing = true;
+  blackwidow::BlackWidow unsharded_db;
+  ASSERT_TRUE(unsharded_db.Open(unsharded_options, path).IsInvalidArgument());
+
+  // MSet, MGet
+  ASSERT_TRUE(db.MSet(kvs).ok());
+  std::vector<blackwidow::ValueStatus> vss;
+  std::vector<std::string> mget_keys(keys);
+  mget_keys.push_back("SHARD_NOT_EXIST_KEY");
+  ASSERT_TRUE(db.MGet(mget_keys, &vss).ok());
+  ASSERT_EQ(vss.size(), 21);
+  for (int32_t i = 0; i < 20; ++i) {
+    ASSERT_TRUE(vss[i].status.ok());
+    ASSERT_EQ(vss[i].value, kvs[i].value);
+  }
+  ASSERT_TRUE(vss[20].status.IsNotFound());
+
+  // Scan, Keys
+  int64_t cursor = 0;
+  std::vector<std::string> scan_keys, total_keys;
+  do {
+    cursor = db.Scan(blackwidow::DataType::kStrings, cursor,
+                     "SHARD_KEY_*", 3, &scan_keys);
+    total_keys.insert(total_keys.end(), scan_keys.begin(), scan_keys.end());
+  } while (cursor != 0);
+  std::sort(total_keys.begin(), total_keys.end());
+  std::vector<std::string> sorted_keys(keys);
+  std::sort(sorted_keys.begin(), sorted_keys.end());
+  ASSERT_EQ(total_keys, sorted_keys);
+
+  total_keys.clear();
+  ASSERT_TRUE(db.Keys(blackwidow::DataType::kStrings,
+                      "SHARD_KEY_*", &total_keys).ok());
+  std::sort(total_keys.begin(), total_keys.end());
+  ASSERT_EQ(total_keys, sorted_keys);
+
+  // Del, Exists
+  ASSERT_EQ(db.Exists(keys, &type_status), 20);
+  ASSERT_EQ(db.Del(keys, &type_status), 20);
+  ASSERT_EQ(db.Exists(keys, &type_status), 0);
+
+  // SUnion gathers the members of all the shards
+  for (const auto& key : keys) {
+    ASSERT_TRUE(db.SAdd(key, {key, "MEMBER"}, &ret).ok());
+  }
+  std::vector<std::string> members;
+  ASSERT_TRUE(db.SUnion(keys, &members).ok());
+  ASSERT_EQ(members.size(), 21);
+  members.clear();
+  ASSERT_TRUE(db.SInter(keys, &members).ok());
+  ASSERT_EQ(members, std::vector<std::string>{"MEMBER"});
+
+  // A write on keys of several shards needs a hash tag
+  ASSERT_TRUE(db.SUnionstore("SHARD_DEST_KEY", keys, &ret).IsNotSupported());
+  ASSERT_TRUE(db.SAdd("{SHARD_TAG}_1", {"MEMBER_1"}, &ret).ok());
+  ASSERT_TRUE(db.SAdd("{SHARD_TAG}_2", {"MEMBER_2"}, &ret).ok());
+  ASSERT_TRUE(db.SUnionstore("{SHARD_TAG}_DEST",
+        {"{SHARD_TAG}_1", "{SHARD_TAG}_2"}, &ret).ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_TRUE(db.Type("{SHARD_TAG}_DEST", &value).ok());
+  ASSERT_EQ(value, "set");
+
+  keys.push_back("{SHARD_TAG}_1");
+  keys.push_back("{SHARD_TAG}_2");
+  keys.push_back("{SHARD_TAG}_DEST");
+  ASSERT_EQ(db.Del(keys, &type_status), 23);
+}
+
+TEST(ShardsTest, AdminTest) {
+  std::string path = "./db/shards_admin";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  std::map<blackwidow::DataType, Status> type_status;
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.shards = 4;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+
+  // The settings are applied to every shard, the parent has no type dbs
+  ASSERT_TRUE(db.SetMaxCacheStatisticKeys(100).ok());
+  ASSERT_TRUE(db.SetSmallCompactionThreshold(10).ok());
+
+  ASSERT_TRUE(db.SAdd("SHARD_ADMIN_KEY", {"MEMBER_1", "MEMBER_2"}, &ret).ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_TRUE(db.SCard("SHARD_ADMIN_KEY", &ret).ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_EQ(db.Del({"SHARD_ADMIN_KEY"}, &type_status), 1);
+}
+
+TEST(ScanCursorTest, StatelessCursorTest) {
+  std::string path = "./db/scan_cursor";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  std::map<blackwidow::DataType, Status> type_status;
+  std::vector<std::string> keys, sorted_keys;
+  for (int32_t i = 0; i < 10; ++i) {
+    keys.push_back("SCAN_CURSOR_KEY_" + std::to_string(i));
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.scan_cursor_secret = "SECRET";
+  std::string cursor = "0", next_cursor;
+  std::vector<std::string> scan_keys, total_keys;
+  {
+    blackwidow::BlackWidow db;
+    ASSERT_TRUE(db.Open(bw_options, path).ok());
+    ASSERT_GE(db.Del(keys, &type_status), 0);
+    for (int32_t i = 0; i < 10; ++i) {
+      if (i % 2) {
+        ASSERT_TRUE(db.Set(keys[i], "VALUE").ok());
+      } else {
+        ASSERT_TRUE(db.SAdd(keys[i], {"MEMBER"}, &ret).ok());
+      }
+      sorted_keys.push_back(keys[i]);
+    }
+    ASSERT_TRUE(db.Scan(blackwidow::DataType::kAll, cursor,
+          "SCAN_CURSOR_KEY_*", 3, &scan_keys, &next_cursor).ok());
+    ASSERT_EQ(scan_keys.size(), 3);
+    ASSERT_NE(next_cursor, "0");
+    total_keys = scan_keys;
+    cursor = next_cursor;
+
+    // A cursor only resumes the scan that returned it
+    ASSERT_TRUE(db.Scan(blackwidow::DataType::kAll, cursor,
+          "SCAN_CURSOR_*", 3, &scan_keys, &next_cursor).IsInvalidArgument());
+    ASSERT_TRUE(db.Scan(blackwidow::DataType::kAll, "FORGED",
+          "SCAN_CURSOR_KEY_*", 3, &scan_keys,
+          &next_cursor).IsInvalidArgument());
+  }
+
+  // The cursor still resumes the scan after a restart
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  while (cursor != "0") {
+    ASSERT_TRUE(db.Scan(blackwidow::DataType::kAll, cursor,
+          "SCAN_CURSOR_KEY_*", 3, &scan_keys, &next_cursor).ok());
+    total_keys.insert(total_keys.end(), scan_keys.begin(), scan_keys.end());
+    cursor = next_cursor;
+  }
+  std::sort(total_keys.begin(), total_keys.end());
+  std::sort(sorted_keys.begin(), sorted_keys.end());
+  ASSERT_EQ(total_keys, sorted_keys);
+
+  // SScan
+  std::vector<std::string> members, total_members;
+  ASSERT_TRUE(db.SAdd(keys[0], {"MEMBER_1", "MEMBER_2", "MEMBER_3"},
+                      &ret).ok());
+  cursor = "0";
+  do {
+    ASSERT_TRUE(db.SScan(keys[0], cursor, "*", 1, &members,
+                         &next_cursor).ok());
+    total_members.insert(total_members.end(), members.begin(), members.end());
+    cursor = next_cursor;
+  } while (cursor != "0");
+  ASSERT_EQ(total_members, std::vector<std::string>(
+        {"MEMBER", "MEMBER_1", "MEMBER_2", "MEMBER_3"}));
+  ASSERT_EQ(db.Del(keys, &type_status), 10);
+}
+
+TEST(KeyNumTest, EstimateTest) {
+  std::string path = "./db/key_num";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  std::map<blackwidow::DataType, Status> type_status;
+  std::vector<std::string> keys;
+  for (int32_t i = 0; i < 10; ++i) {
+    keys.push_back("KEY_NUM_KEY_" + std::to_string(i));
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.estimate_key_num = true;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  ASSERT_GE(db.Del(keys, &type_status), 0);
+
+  for (int32_t i = 0; i < 10; ++i) {
+    if (i % 2) {
+      ASSERT_TRUE(db.Setex(keys[i], "VALUE", 100).ok());
+    } else {
+      ASSERT_TRUE(db.Set(keys[i], "VALUE").ok());
+    }
+  }
+  for (int32_t i = 0; i < 3; ++i) {
+    ASSERT_TRUE(db.HSet(keys[i], "FIELD", "VALUE", &ret).ok());
+  }
+  // Written to SST files, once per key
+  ASSERT_TRUE(db.Compact(blackwidow::DataType::kAll, true).ok());
+
+  std::vector<blackwidow::KeyInfo> key_infos;
+  ASSERT_TRUE(db.GetKeyNum(&key_infos).ok());
+  ASSERT_EQ(key_infos.size(), 5);
+  // strings
+  ASSERT_EQ(key_infos[0].keys, 10);
+  ASSERT_EQ(key_infos[0].expires, 5);
+  ASSERT_GT(key_infos[0].avg_ttl, 0);
+  ASSERT_LE(key_infos[0].avg_ttl, 100);
+  // hashes
+  ASSERT_EQ(key_infos[1].keys, 3);
+  ASSERT_EQ(key_infos[1].expires, 0);
+
+  ASSERT_EQ(db.Del(keys, &type_status), 13);
+}
+
+TEST(BGTaskTest, SchedulerTest) {
+  std::string path = "./db/bg_task";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  std::map<blackwidow::DataType, Status> type_status;
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.bg_task_workers = 2;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  ASSERT_TRUE(db.Set("BG_TASK_KEY", "VALUE").ok());
+
+  blackwidow::BGTask task(blackwidow::DataType::kStrings,
+                          blackwidow::Operation::kCompactKey, "BG_TASK_KEY");
+  for (int32_t i = 0; i < 100; ++i) {
+    ASSERT_TRUE(db.AddBGTask(task).ok());
+  }
+  ASSERT_TRUE(db.Compact(blackwidow::DataType::kAll, false).ok());
+  ASSERT_TRUE(db.Compact(blackwidow::DataType::kAll, false).ok());
+
+  // Every task is either run, dropped or cancelled
+  blackwidow::BGTaskStats stats;
+  for (int32_t i = 0; i < 100; ++i) {
+    ASSERT_TRUE(db.GetBGTaskStats(&stats).ok());
+    if (!stats.queued_key_tasks && !stats.queued_full_tasks
+      && !stats.running_tasks) {
+      break;
+    }
+    usleep(100 * 1000);
+  }
+  ASSERT_EQ(stats.queued_key_tasks, 0);
+  ASSERT_EQ(stats.queued_full_tasks, 0);
+  ASSERT_EQ(stats.running_tasks, 0);
+  ASSERT_GT(stats.finished_tasks, 0);
+  ASSERT_GT(stats.deduped_tasks + stats.cancelled_tasks, 0);
+  ASSERT_EQ(stats.finished_tasks + stats.deduped_tasks
+            + stats.cancelled_tasks, 102);
+  ASSERT_GE(stats.max_run_micros, stats.avg_run_micros);
+  ASSERT_GE(stats.max_wait_micros, stats.avg_wait_micros);
+
+  ASSERT_EQ(db.Del({"BG_TASK_KEY"}, &type_status), 1);
+}
+
+static uint64_t WaitBGTasks(blackwidow::BlackWidow* db) {
+  blackwidow::BGTaskStats stats;
+  for (int32_t i = 0; i < 100; ++i) {
+    db->GetBGTaskStats(&stats);
+    if (!stats.queued_key_tasks && !stats.queued_full_tasks
+      && !stats.running_tasks) {
+      break;
+    }
+    usleep(100 * 1000);
+  }
+  return stats.finished_tasks + stats.deduped_tasks + stats.cancelled_tasks;
+}
+
+TEST(ReadSkipTest, CompactTest) {
+  std::string path = "./db/read_skip";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  int32_t ret;
+  std::map<blackwidow::DataType, Status> type_status;
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.read_skip_sample_interval = 1;
+  bw_options.read_skip_compaction_threshold = 100;
+  bw_options.deletion_compaction_window = 10000;
+  bw_options.deletion_compaction_trigger = 5000;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  db.Del({"READ_SKIP_KEY"}, &type_status);
+
+  std::vector<std::string> fields;
+  for (int32_t i = 0; i < 1000; ++i) {
+    fields.push_back("FIELD_" + std::to_string(i));
+    ASSERT_TRUE(db.HSet("READ_SKIP_KEY", fields.back(), "VALUE", &ret).ok());
+  }
+  fields.pop_back();
+  ASSERT_TRUE(db.HDel("READ_SKIP_KEY", fields, &ret).ok());
+  ASSERT_EQ(ret, 999);
+  uint64_t tasks = WaitBGTasks(&db);
+
+  // Skips the 999 deleted fields, and compacts them away
+  std::vector<blackwidow::FieldValue> fvs;
+  ASSERT_TRUE(db.HGetall("READ_SKIP_KEY", &fvs).ok());
+  ASSERT_EQ(fvs.size(), 1);
+  ASSERT_GT(WaitBGTasks(&db), tasks);
+  tasks = WaitBGTasks(&db);
+
+  ASSERT_TRUE(db.HGetall("READ_SKIP_KEY", &fvs).ok());
+  ASSERT_EQ(fvs.size(), 1);
+  ASSERT_EQ(WaitBGTasks(&db), tasks);
+
+  ASSERT_EQ(db.Del({"READ_SKIP_KEY"}, &type_status), 1);
+}
+
+static void FillReclaimKey(blackwidow::BlackWidow* db,
+                           const std::string& key, int32_t num) {
+  int32_t ret;
+  uint64_t len;
+  std::vector<std::string> members;
+  std::vector<blackwidow::ScoreMember> score_members;
+  for (int32_t i = 0; i < num; ++i) {
+    members.push_back("MEMBER_" + std::to_string(i));
+    score_members.push_back({static_cast<double>(i), members.back()});
+    ASSERT_TRUE(db->HSet(key, members.back(), "VALUE", &ret).ok());
+  }
+  ASSERT_TRUE(db->SAdd(key, members, &ret).ok());
+  ASSERT_TRUE(db->RPush(key, members, &len).ok());
+  ASSERT_TRUE(db->ZAdd(key, score_members, &ret).ok());
+}
+
+static void CheckReclaimKey(blackwidow::BlackWidow* db,
+                            const std::string& key, size_t num) {
+  std::vector<blackwidow::FieldValue> fvs;
+  std::vector<std::string> members;
+  std::vector<std::string> elements;
+  std::vector<blackwidow::ScoreMember> score_members;
+  db->HGetall(key, &fvs);
+  db->SMembers(key, &members);
+  db->LRange(key, 0, -1, &elements);
+  db->ZRange(key, 0, -1, &score_members);
+  ASSERT_EQ(fvs.size(), num);
+  ASSERT_EQ(members.size(), num);
+  ASSERT_EQ(elements.size(), num);
+  ASSERT_EQ(score_members.size(), num);
+}
+
+TEST(ReclaimTest, RangeDeleteTest) {
+  std::string path = "./db/reclaim";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  std::map<blackwidow::DataType, Status> type_status;
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.reclaim_range_delete_threshold = 1;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  db.Del({"RECLAIM_A", "RECLAIM_B"}, &type_status);
+
+  // The range of a key does not reach the members of its neighbour
+  FillReclaimKey(&db, "RECLAIM_A", 10);
+  FillReclaimKey(&db, "RECLAIM_B", 10);
+  ASSERT_EQ(db.Del({"RECLAIM_A"}, &type_status), 4);
+  CheckReclaimKey(&db, "RECLAIM_A", 0);
+  CheckReclaimKey(&db, "RECLAIM_B", 10);
+
+  FillReclaimKey(&db, "RECLAIM_A", 3);
+  CheckReclaimKey(&db, "RECLAIM_A", 3);
+  ASSERT_EQ(db.Expire("RECLAIM_A", 0, &type_status), 4);
+  CheckReclaimKey(&db, "RECLAIM_A", 0);
+  CheckReclaimKey(&db, "RECLAIM_B", 10);
+
+  // Overwriting an expired key
+  FillReclaimKey(&db, "RECLAIM_A", 10);
+  ASSERT_EQ(db.Expire("RECLAIM_A", 1, &type_status), 4);
+  std::this_thread::sleep_for(std::chrono::milliseconds(2000));
+  FillReclaimKey(&db, "RECLAIM_A", 3);
+  CheckReclaimKey(&db, "RECLAIM_A", 3);
+  CheckReclaimKey(&db, "RECLAIM_B", 10);
+
+  // The live members outlast the range tombstones in compactions
+  ASSERT_TRUE(db.Compact(blackwidow::DataType::kAll, true).ok());
+  CheckReclaimKey(&db, "RECLAIM_A", 3);
+  CheckReclaimKey(&db, "RECLAIM_B", 10);
+
+  ASSERT_EQ(db.Del({"RECLAIM_A", "RECLAIM_B"}, &type_status), 8);
+}
+
+TEST(LockStatsTest, ContentionTest) {
+  std::string path = "./db/lock_stats";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.lock_stats_top_n = 4;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+
+  std::vector<std::thread> writers;
+  for (int32_t t = 0; t < 8; ++t) {
+    writers.push_back(std::thread([&db]() {
+      int64_t ret;
+      for (int32_t i = 0; i < 1000; ++i) {
+        db.HIncrby("LOCK_STATS_KEY", "FIELD", 1, &ret);
+      }
+    }));
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+  std::string value;
+  ASSERT_TRUE(db.HGet("LOCK_STATS_KEY", "FIELD", &value).ok());
+  ASSERT_EQ(value, "8000");
+
+  blackwidow::LockStats stats;
+  ASSERT_TRUE(db.GetLockStats(&stats).ok());
+  ASSERT_EQ(stats.wait_histogram.size(), blackwidow::kLockWaitBuckets);
+  uint64_t waits = 0;
+  for (auto count : stats.wait_histogram) {
+    waits += count;
+  }
+  ASSERT_EQ(waits, stats.contended);
+  ASSERT_GE(stats.total_wait_micros, stats.max_wait_micros);
+  // Nothing is held once the writers are done
+  ASSERT_TRUE(stats.longest_holders.empty());
+  // Whether the writers had to wait depends on the scheduling
+  if (stats.contended != 0) {
+    ASSERT_EQ(stats.hot_keys.size(), 1);
+    ASSERT_EQ(stats.hot_keys[0].type, blackwidow::DataType::kHashes);
+    ASSERT_EQ(stats.hot_keys[0].key, "LOCK_STATS_KEY");
+    ASSERT_EQ(stats.hot_keys[0].count, stats.contended);
+    ASSERT_EQ(stats.hot_slots.size(), 1);
+    ASSERT_EQ(stats.hot_slots[0].contended, stats.contended);
+  }
+
+  // Disabled, nothing is recorded
+  blackwidow::BlackWidow plain_db;
+  bw_options.lock_stats_top_n = 0;
+  ASSERT_TRUE(plain_db.Open(bw_options, path + "_plain").ok());
+  int64_t ret;
+  ASSERT_TRUE(plain_db.HIncrby("LOCK_STATS_KEY", "FIELD", 1, &ret).ok());
+  ASSERT_TRUE(plain_db.GetLockStats(&stats).ok());
+  ASSERT_EQ(stats.contended, 0);
+  ASSERT_TRUE(stats.hot_keys.empty());
+  ASSERT_TRUE(stats.longest_holders.empty());
+}
+
+TEST(CoalesceTest, HotKeyTest) {
+  std::string path = "./db/coalesce";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.coalesce_key_writes = true;
+  blackwidow::BlackWidow db;
+  ASSERT_TRUE(db.Open(bw_options, path).ok());
+  std::map<blackwidow::DataType, Status> type_status;
+  db.Del({"COALESCE_HASH", "COALESCE_LIST"}, &type_status);
+
+  std::vector<std::thread> writers;
+  std::atomic<int32_t> added(0);
+  for (int32_t t = 0; t < 8; ++t) {
+    writers.push_back(std::thread([&db, &added, t]() {
+      int32_t res;
+      int64_t ret;
+      uint64_t len;
+      for (int32_t i = 0; i < 500; ++i) {
+        db.HIncrby("COALESCE_HASH", "COUNTER", 1, &ret);
+        db.HSet("COALESCE_HASH", "FIELD_" + std::to_string(i % 50),
+                std::to_string(t), &res);
+        added += res;
+        if (t % 2) {
+          db.LPush("COALESCE_LIST", {"L"}, &len);
+        } else {
+          db.RPush("COALESCE_LIST", {"R", "R"}, &len);
+        }
+      }
+    }));
+  }
+  for (auto& writer : writers) {
+    writer.join();
+  }
+
+  // Every field was added once, and every increment and push applied
+  ASSERT_EQ(added, 50);
+  std::string value;
+  ASSERT_TRUE(db.HGet("COALESCE_HASH", "COUNTER", &value).ok());
+  ASSERT_EQ(value, "4000");
+  int32_t hlen;
+  ASSERT_TRUE(db.HLen("COALESCE_HASH", &hlen).ok());
+  ASSERT_EQ(hlen, 51);
+  uint64_t llen;
+  ASSERT_TRUE(db.LLen("COALESCE_LIST", &llen).ok());
+  ASSERT_EQ(llen, 4 * 500 + 4 * 500 * 2);
+
+  // A failed write of a group does not fail the others
+  int64_t ret;
+  int32_t res;
+  ASSERT_TRUE(db.HSet("COALESCE_HASH", "NOT_INT", "abc", &res).ok());
+  ASSERT_TRUE(db.HIncrby("COALESCE_HASH", "NOT_INT", 1, &ret).IsCorruption());
+  ASSERT_TRUE(db.HIncrby("COALESCE_HASH", "COUNTER", 1, &ret).ok());
+  ASSERT_EQ(ret, 4001);
+
+  ASSERT_EQ(db.Del({"COALESCE_HASH", "COALESCE_LIST"}, &type_status), 2);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -493,3 +493,123 @@ int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
 }
+
+TEST(LRUCacheTest, TestApproximateCase1) {
+  Status s;
+  std::string value;
+  blackwidow::LRUCache<std::string, std::string> lru_cache(true);
+  lru_cache.SetCapacity(3);
+
+  // ***************** Step 1 *****************
+  // (k3, v3) -> (k2, v2) -> (k1, v1);
+  lru_cache.Insert("k1", "v1");
+  lru_cache.Insert("k2", "v2");
+  lru_cache.Insert("k3", "v3");
+  ASSERT_EQ(lru_cache.Size(), 3);
+  ASSERT_TRUE(lru_cache.LRUAndHandleTableConsistent());
+  ASSERT_TRUE(lru_cache.LRUAsExpected({{"k3", "v3"}, {"k2", "v2"}, {"k1", "v1"}}));
+
+  // ***************** Step 2 *****************
+  // (k3, v3) -> (k2, v2) -> (k1, v1);  a hit does not move k1
+  s = lru_cache.Lookup("k1", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, "v1");
+  ASSERT_TRUE(lru_cache.LRUAsExpected({{"k3", "v3"}, {"k2", "v2"}, {"k1", "v1"}}));
+
+  // ***************** Step 3 *****************
+  // (k1, v1) -> (k4, v4) -> (k3, v3);  k1 gets a second chance
+  lru_cache.Insert("k4", "v4");
+  ASSERT_EQ(lru_cache.Size(), 3);
+  ASSERT_TRUE(lru_cache.LRUAndHandleTableConsistent());
+  ASSERT_TRUE(lru_cache.LRUAsExpected({{"k1", "v1"}, {"k4", "v4"}, {"k3", "v3"}}));
+  s = lru_cache.Lookup("k2", &value);
+  ASSERT_TRUE(s.IsNotFound());
+
+  // ***************** Step 4 *****************
+  // (k5, v5) -> (k1, v1) -> (k4, v4);  k3 was never hit
+  lru_cache.Insert("k5", "v5");
+  ASSERT_EQ(lru_cache.Size(), 3);
+  ASSERT_TRUE(lru_cache.LRUAndHandleTableConsistent());
+  ASSERT_TRUE(lru_cache.LRUAsExpected({{"k5", "v5"}, {"k1", "v1"}, {"k4", "v4"}}));
+}
+
+TEST(LRUCacheTest, TestShardedCase1) {
+  Status s;
+  size_t value;
+  blackwidow::ShardedLRUCache<std::string, size_t> lru_cache(16, true);
+  ASSERT_EQ(lru_cache.Capacity(), 0);
+  s = lru_cache.Insert("k0", 0);
+  ASSERT_TRUE(s.IsCorruption());
+
+  // ***************** Step 1 *****************
+  // every shard holds at most ceil(100 / 16) entries
+  lru_cache.SetCapacity(100);
+  ASSERT_EQ(lru_cache.Capacity(), 100);
+  for (size_t i = 0; i < 1000; ++i) {
+    lru_cache.Insert("k" + std::to_string(i), i);
+  }
+  size_t size = lru_cache.Size();
+  ASSERT_LE(size, 16 * 7);
+  ASSERT_GE(size, 16 * 6);
+  ASSERT_EQ(lru_cache.TotalCharge(), size);
+  s = lru_cache.Lookup("k999", &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, 999);
+
+  // ***************** Step 2 *****************
+  s = lru_cache.Remove("k999");
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(lru_cache.Size(), size - 1);
+  s = lru_cache.Lookup("k999", &value);
+  ASSERT_TRUE(s.IsNotFound());
+
+  // ***************** Step 3 *****************
+  lru_cache.Clear();
+  ASSERT_EQ(lru_cache.Size(), 0);
+  ASSERT_EQ(lru_cache.TotalCharge(), 0);
+  ASSERT_EQ(lru_cache.Capacity(), 100);
+}
+
+TEST(LRUCacheTest, TestManyKeysCase1) {
+  Status s;
+  int32_t value;
+  blackwidow::LRUCache<int32_t, int32_t> lru_cache;
+  lru_cache.SetCapacity(100000);
+
+  // ***************** Step 1 *****************
+  // enough keys to grow the handle table several times
+  for (int32_t i = 0; i < 10000; ++i) {
+    lru_cache.Insert(i, i * 2);
+  }
+  ASSERT_EQ(lru_cache.Size(), 10000);
+  ASSERT_TRUE(lru_cache.LRUAndHandleTableConsistent());
+
+  // ***************** Step 2 *****************
+  // removing keys must not hide the ones probed after them
+  for (int32_t i = 0; i < 10000; i += 2) {
+    s = lru_cache.Remove(i);
+    ASSERT_TRUE(s.ok());
+  }
+  ASSERT_EQ(lru_cache.Size(), 5000);
+  ASSERT_TRUE(lru_cache.LRUAndHandleTableConsistent());
+  for (int32_t i = 0; i < 10000; ++i) {
+    s = lru_cache.Lookup(i, &value);
+    if (i % 2) {
+      ASSERT_TRUE(s.ok());
+      ASSERT_EQ(value, i * 2);
+    } else {
+      ASSERT_TRUE(s.IsNotFound());
+    }
+  }
+
+  // ***************** Step 3 *****************
+  // freed handles are reused
+  for (int32_t i = 0; i < 10000; i += 2) {
+    lru_cache.Insert(i, i * 3);
+  }
+  ASSERT_EQ(lru_cache.Size(), 10000);
+  ASSERT_TRUE(lru_cache.LRUAndHandleTableConsistent());
+  s = lru_cache.Lookup(9998, &value);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(value, 9998 * 3);
+}
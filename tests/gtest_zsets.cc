@@ -707,6 +707,136 @@ TEST_F(ZSetsTest, ZAddTest) {
 }
 
 
+// ZAdd with flags
+TEST_F(ZSetsTest, ZAddFlagsTest) {
+  int32_t ret;
+  double score;
+
+  // ***************** Group 1 Test *****************
+  // incompatible flags
+  std::vector<blackwidow::ScoreMember> gp1_sm {{1, "MM1"}, {2, "MM2"}};
+  s = db.ZAdd("GP1_ZADD_FLAGS_KEY", gp1_sm, kZAddNX | kZAddXX, &ret);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  s = db.ZAdd("GP1_ZADD_FLAGS_KEY", gp1_sm, kZAddNX | kZAddGT, &ret);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  s = db.ZAdd("GP1_ZADD_FLAGS_KEY", gp1_sm, kZAddGT | kZAddLT, &ret);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  s = db.ZAdd("GP1_ZADD_FLAGS_KEY", gp1_sm, kZAddINCR, &ret, &score);
+  ASSERT_TRUE(s.IsInvalidArgument());
+  ASSERT_TRUE(size_match(&db, "GP1_ZADD_FLAGS_KEY", 0));
+
+  // XX on a missing key creates nothing
+  s = db.ZAdd("GP1_ZADD_FLAGS_KEY", gp1_sm, kZAddXX, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 0);
+  ASSERT_TRUE(size_match(&db, "GP1_ZADD_FLAGS_KEY", 0));
+
+  s = db.ZAdd("GP1_ZADD_FLAGS_KEY", gp1_sm, kZAddNone, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_TRUE(score_members_match(&db, "GP1_ZADD_FLAGS_KEY", {{1, "MM1"}, {2, "MM2"}}));
+
+
+  // ***************** Group 2 Test *****************
+  // NX only adds, XX only updates, CH counts the updates too
+  std::vector<blackwidow::ScoreMember> gp2_sm1 {{1, "MM1"}, {2, "MM2"}};
+  s = db.ZAdd("GP2_ZADD_FLAGS_KEY", gp2_sm1, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 2);
+
+  std::vector<blackwidow::ScoreMember> gp2_sm2 {{10, "MM1"}, {3, "MM3"}};
+  s = db.ZAdd("GP2_ZADD_FLAGS_KEY", gp2_sm2, kZAddNX, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_TRUE(size_match(&db, "GP2_ZADD_FLAGS_KEY", 3));
+  ASSERT_TRUE(score_members_match(&db, "GP2_ZADD_FLAGS_KEY", {{1, "MM1"}, {2, "MM2"}, {3, "MM3"}}));
+
+  std::vector<blackwidow::ScoreMember> gp2_sm3 {{20, "MM2"}, {4, "MM4"}};
+  s = db.ZAdd("GP2_ZADD_FLAGS_KEY", gp2_sm3, kZAddXX, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 0);
+  ASSERT_TRUE(size_match(&db, "GP2_ZADD_FLAGS_KEY", 3));
+  ASSERT_TRUE(score_members_match(&db, "GP2_ZADD_FLAGS_KEY", {{1, "MM1"}, {3, "MM3"}, {20, "MM2"}}));
+
+  std::vector<blackwidow::ScoreMember> gp2_sm4 {{5, "MM1"}, {3, "MM3"}, {4, "MM4"}};
+  s = db.ZAdd("GP2_ZADD_FLAGS_KEY", gp2_sm4, kZAddCH, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_TRUE(size_match(&db, "GP2_ZADD_FLAGS_KEY", 4));
+  ASSERT_TRUE(score_members_match(&db, "GP2_ZADD_FLAGS_KEY", {{3, "MM3"}, {4, "MM4"}, {5, "MM1"}, {20, "MM2"}}));
+
+
+  // ***************** Group 3 Test *****************
+  // GT/LT only move existing scores in one direction but still add
+  std::vector<blackwidow::ScoreMember> gp3_sm1 {{10, "MM1"}, {10, "MM2"}};
+  s = db.ZAdd("GP3_ZADD_FLAGS_KEY", gp3_sm1, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 2);
+
+  std::vector<blackwidow::ScoreMember> gp3_sm2 {{5, "MM1"}, {15, "MM2"}, {1, "MM3"}};
+  s = db.ZAdd("GP3_ZADD_FLAGS_KEY", gp3_sm2, kZAddGT | kZAddCH, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_TRUE(size_match(&db, "GP3_ZADD_FLAGS_KEY", 3));
+  ASSERT_TRUE(score_members_match(&db, "GP3_ZADD_FLAGS_KEY", {{1, "MM3"}, {10, "MM1"}, {15, "MM2"}}));
+
+  std::vector<blackwidow::ScoreMember> gp3_sm3 {{5, "MM1"}, {20, "MM2"}};
+  s = db.ZAdd("GP3_ZADD_FLAGS_KEY", gp3_sm3, kZAddLT | kZAddXX | kZAddCH, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_TRUE(size_match(&db, "GP3_ZADD_FLAGS_KEY", 3));
+  ASSERT_TRUE(score_members_match(&db, "GP3_ZADD_FLAGS_KEY", {{1, "MM3"}, {5, "MM1"}, {15, "MM2"}}));
+
+
+  // ***************** Group 4 Test *****************
+  // INCR returns the new score, or NotFound when a condition aborts it
+  std::vector<blackwidow::ScoreMember> gp4_sm1 {{2.5, "MM1"}};
+  s = db.ZAdd("GP4_ZADD_FLAGS_KEY", gp4_sm1, kZAddINCR, &ret, &score);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_EQ(score, 2.5);
+
+  s = db.ZAdd("GP4_ZADD_FLAGS_KEY", gp4_sm1, kZAddINCR, &ret, &score);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 0);
+  ASSERT_EQ(score, 5);
+
+  s = db.ZAdd("GP4_ZADD_FLAGS_KEY", gp4_sm1, kZAddINCR | kZAddNX, &ret, &score);
+  ASSERT_TRUE(s.IsNotFound());
+  ASSERT_EQ(ret, 0);
+
+  std::vector<blackwidow::ScoreMember> gp4_sm2 {{-1, "MM1"}};
+  s = db.ZAdd("GP4_ZADD_FLAGS_KEY", gp4_sm2, kZAddINCR | kZAddGT, &ret, &score);
+  ASSERT_TRUE(s.IsNotFound());
+  ASSERT_TRUE(score_members_match(&db, "GP4_ZADD_FLAGS_KEY", {{5, "MM1"}}));
+
+  s = db.ZAdd("GP4_ZADD_FLAGS_KEY", gp4_sm2, kZAddINCR | kZAddLT | kZAddCH, &ret, &score);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_EQ(score, 4);
+  ASSERT_TRUE(size_match(&db, "GP4_ZADD_FLAGS_KEY", 1));
+  ASSERT_TRUE(score_members_match(&db, "GP4_ZADD_FLAGS_KEY", {{4, "MM1"}}));
+
+
+  // ***************** Group 5 Test *****************
+  // stale key is treated as empty
+  std::vector<blackwidow::ScoreMember> gp5_sm1 {{1, "MM1"}, {2, "MM2"}};
+  s = db.ZAdd("GP5_ZADD_FLAGS_KEY", gp5_sm1, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(make_expired(&db, "GP5_ZADD_FLAGS_KEY"));
+
+  s = db.ZAdd("GP5_ZADD_FLAGS_KEY", gp5_sm1, kZAddXX, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 0);
+  ASSERT_TRUE(size_match(&db, "GP5_ZADD_FLAGS_KEY", 0));
+
+  s = db.ZAdd("GP5_ZADD_FLAGS_KEY", gp5_sm1, kZAddNX | kZAddCH, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 2);
+  ASSERT_TRUE(size_match(&db, "GP5_ZADD_FLAGS_KEY", 2));
+  ASSERT_TRUE(score_members_match(&db, "GP5_ZADD_FLAGS_KEY", {{1, "MM1"}, {2, "MM2"}}));
+}
+
 // ZCard
 TEST_F(ZSetsTest, ZCardTest) {
   int32_t ret;
@@ -1458,6 +1588,40 @@ TEST_F(ZSetsTest, ZRangebyscoreTest) {
   s = db.ZRangebyscore("GP4_ZRANGEBYSCORE_KEY", std::numeric_limits<double>::lowest(), std::numeric_limits<double>::max(), false, true, &score_members);
   ASSERT_TRUE(s.ok());
   ASSERT_TRUE(score_members_match(score_members, {{0, "MM1"}, {std::numeric_limits<double>::max(), "MM2"}}));
+
+
+  // ***************** Group 5 Test *****************
+  // {-5, MM0} {-3, MM1} {-1, MM2} {0, MM3} {1, MM4} {3, MM5} {5, MM6}
+  std::vector<blackwidow::ScoreMember> gp5_sm {{-5, "MM0"}, {-3, "MM1"}, {-1, "MM2"},
+                                               {0,  "MM3"}, {1,  "MM4"}, {3,  "MM5"},
+                                               {5, "MM6"}};
+  s = db.ZAdd("GP5_ZRANGEBYSCORE_KEY", gp5_sm, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(7, ret);
+
+  s = db.ZRangebyscore("GP5_ZRANGEBYSCORE_KEY", -3, 3, true, true, 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{-3, "MM1"}, {-1, "MM2"}}));
+
+  s = db.ZRangebyscore("GP5_ZRANGEBYSCORE_KEY", -3, 3, false, true, 1, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{0, "MM3"}, {1, "MM4"}}));
+
+  s = db.ZRangebyscore("GP5_ZRANGEBYSCORE_KEY", -3, 3, true, true, 3, -1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{1, "MM4"}, {3, "MM5"}}));
+
+  s = db.ZRangebyscore("GP5_ZRANGEBYSCORE_KEY", -3, 3, true, true, 10, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {}));
+
+  s = db.ZRangebyscore("GP5_ZRANGEBYSCORE_KEY", -3, 3, true, true, -1, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {}));
+
+  s = db.ZRangebyscore("GP5_ZRANGEBYSCORE_KEY", -3, 3, true, true, 0, 0, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {}));
 }
 
 // ZRank
@@ -3004,6 +3168,58 @@ TEST_F(ZSetsTest, ZRevrangebyscoreTest) {
   s = db.ZRevrangebyscore("GP4_ZREVRANGEBYSCORE_KEY", -1000000000.0000000001, 1000000000.0000000001, false, true, &score_members);
   ASSERT_TRUE(s.ok());
   ASSERT_TRUE(score_members_match(score_members, {{1000000000.0000000001, "MM2"}, {0, "MM1"}}));
+
+
+  // ***************** Group 5 Test *****************
+  // {-5, MM0} {-3, MM1} {-1, MM2} {0, MM3} {1, MM4} {3, MM5} {5, MM6}
+  std::vector<blackwidow::ScoreMember> gp5_sm {{-5, "MM0"}, {-3, "MM1"}, {-1, "MM2"},
+                                               {0,  "MM3"}, {1,  "MM4"}, {3,  "MM5"},
+                                               {5, "MM6"}};
+  s = db.ZAdd("GP5_ZREVRANGEBYSCORE_KEY", gp5_sm, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(7, ret);
+
+  s = db.ZRevrangebyscore("GP5_ZREVRANGEBYSCORE_KEY", -3, 3, true, true, 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{3, "MM5"}, {1, "MM4"}}));
+
+  s = db.ZRevrangebyscore("GP5_ZREVRANGEBYSCORE_KEY", -3, 3, true, false, 1, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{0, "MM3"}, {-1, "MM2"}}));
+
+  s = db.ZRevrangebyscore("GP5_ZREVRANGEBYSCORE_KEY", -3, 3, true, true, 3, -1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{-1, "MM2"}, {-3, "MM1"}}));
+
+  s = db.ZRevrangebyscore("GP5_ZREVRANGEBYSCORE_KEY", -3, 3, true, true, 10, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {}));
+
+
+  // ***************** Group 6 Test *****************
+  // {-inf, MM0} {-1, MM1} {1, MM2} {+inf, MM3} {+inf, MM4}
+  double inf = std::numeric_limits<double>::infinity();
+  std::vector<blackwidow::ScoreMember> gp6_sm {{-inf, "MM0"}, {-1, "MM1"}, {1, "MM2"},
+                                               {inf, "MM3"}, {inf, "MM4"}};
+  s = db.ZAdd("GP6_ZREVRANGEBYSCORE_KEY", gp6_sm, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(5, ret);
+
+  s = db.ZRevrangebyscore("GP6_ZREVRANGEBYSCORE_KEY", -inf, inf, true, true, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{inf, "MM4"}, {inf, "MM3"}, {1, "MM2"}, {-1, "MM1"}, {-inf, "MM0"}}));
+
+  s = db.ZRevrangebyscore("GP6_ZREVRANGEBYSCORE_KEY", -inf, inf, true, true, 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{inf, "MM4"}, {inf, "MM3"}}));
+
+  s = db.ZRevrangebyscore("GP6_ZREVRANGEBYSCORE_KEY", -inf, inf, true, true, 1, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{inf, "MM3"}, {1, "MM2"}}));
+
+  s = db.ZRevrangebyscore("GP6_ZREVRANGEBYSCORE_KEY", -inf, inf, true, false, 0, -1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{1, "MM2"}, {-1, "MM1"}, {-inf, "MM0"}}));
 }
 
 // ZRevrank
@@ -3695,6 +3911,29 @@ TEST_F(ZSetsTest, ZRangebylexTest) {
   s = db.ZRangebylex("GP3_ZRANGEBYLEX", "-", "+", true, true, &members);
   ASSERT_TRUE(s.IsNotFound());
   ASSERT_TRUE(members_match(members, {}));
+
+
+  // ***************** Group 4 Test *****************
+  // {1, e} {1, f} {1, g} {1, h} {1, i} {1, j} {1, k} {1, l} {1, m}
+  s = db.ZAdd("GP4_ZRANGEBYLEX", gp1_sm1, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 9);
+
+  s = db.ZRangebylex("GP4_ZRANGEBYLEX", "-", "+", true, true, 0, 3, &members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(members_match(members, {"e", "f", "g"}));
+
+  s = db.ZRangebylex("GP4_ZRANGEBYLEX", "g", "+", false, true, 2, 2, &members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(members_match(members, {"j", "k"}));
+
+  s = db.ZRangebylex("GP4_ZRANGEBYLEX", "g", "k", true, true, 3, -1, &members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(members_match(members, {"j", "k"}));
+
+  s = db.ZRangebylex("GP4_ZRANGEBYLEX", "g", "k", true, true, 5, 1, &members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(members_match(members, {}));
 }
 
 // ZLEXCOUNT
@@ -4722,6 +4961,175 @@ TEST_F(ZSetsTest, ZScanTest) {
 }
 
 
+// ZSets window cache
+TEST(ZSetsWindowCacheTest, ZRangeTest) {
+  std::string path = "./db/zsets_window_cache";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.zsets_window_cache_size = 1024 * 1024;
+  bw_options.zsets_window_size = 3;
+  blackwidow::BlackWidow db;
+  blackwidow::Status s = db.Open(bw_options, path);
+  ASSERT_TRUE(s.ok());
+
+  int32_t ret;
+  double score;
+  ZSetsCacheInfo info;
+  std::vector<blackwidow::ScoreMember> score_members;
+
+  // ***************** Group 1 Test *****************
+  std::vector<blackwidow::ScoreMember> gp1_sm {{1, "MM1"}, {2, "MM2"}, {3, "MM3"},
+                                               {4, "MM4"}, {5, "MM5"}, {6, "MM6"},
+                                               {7, "MM7"}, {8, "MM8"}};
+  s = db.ZAdd("GP1_WINDOW_CACHE_KEY", gp1_sm, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 8);
+
+  // first head query misses and fills the window, the others are hits
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{8, "MM8"}, {7, "MM7"}, {6, "MM6"}}));
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{8, "MM8"}, {7, "MM7"}}));
+  s = db.ZRange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{1, "MM1"}, {2, "MM2"}, {3, "MM3"}}));
+  s = db.ZRange("GP1_WINDOW_CACHE_KEY", -2, -1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{7, "MM7"}, {8, "MM8"}}));
+  db.GetZSetsCacheInfo(&info);
+  ASSERT_EQ(info.windows, 1);
+  ASSERT_EQ(info.hits, 3);
+  ASSERT_EQ(info.misses, 1);
+  ASSERT_GT(info.usage, 0);
+
+  // a range past the window is served by rocksdb
+  s = db.ZRange("GP1_WINDOW_CACHE_KEY", 2, 5, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{3, "MM3"}, {4, "MM4"}, {5, "MM5"}, {6, "MM6"}}));
+  db.GetZSetsCacheInfo(&info);
+  ASSERT_EQ(info.hits, 3);
+  ASSERT_EQ(info.misses, 2);
+
+
+  // ***************** Group 2 Test *****************
+  // writes keep the window in step with rocksdb
+  s = db.ZAdd("GP1_WINDOW_CACHE_KEY", {{10, "MM9"}, {0, "MM1"}}, &ret);
+  ASSERT_TRUE(s.ok());
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{10, "MM9"}, {8, "MM8"}, {7, "MM7"}}));
+  s = db.ZRange("GP1_WINDOW_CACHE_KEY", 0, 1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{0, "MM1"}, {2, "MM2"}}));
+
+  s = db.ZIncrby("GP1_WINDOW_CACHE_KEY", "MM2", 20, &score);
+  ASSERT_TRUE(s.ok());
+  s = db.ZRem("GP1_WINDOW_CACHE_KEY", {"MM8"}, &ret);
+  ASSERT_TRUE(s.ok());
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{22, "MM2"}, {10, "MM9"}, {7, "MM7"}}));
+  s = db.ZRange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{0, "MM1"}, {3, "MM3"}, {4, "MM4"}}));
+
+  s = db.ZPopMax("GP1_WINDOW_CACHE_KEY", 1, &score_members);
+  ASSERT_TRUE(s.ok());
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{10, "MM9"}, {7, "MM7"}}));
+
+
+  // ***************** Group 3 Test *****************
+  // a deleted and recreated key never sees the old window
+  std::map<blackwidow::DataType, blackwidow::Status> type_status;
+  db.Del({"GP1_WINDOW_CACHE_KEY"}, &type_status);
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.IsNotFound());
+  s = db.ZAdd("GP1_WINDOW_CACHE_KEY", {{1, "MM1"}}, &ret);
+  ASSERT_TRUE(s.ok());
+  s = db.ZRevrange("GP1_WINDOW_CACHE_KEY", 0, 2, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{1, "MM1"}}));
+}
+
+// ZRemrangeby* with range tombstones
+TEST(ZSetsRangeDeleteTest, ZRemrangeTest) {
+  std::string path = "./db/zsets_range_delete";
+  if (access(path.c_str(), F_OK)) {
+    mkdir(path.c_str(), 0755);
+  }
+  BlackwidowOptions bw_options;
+  bw_options.options.create_if_missing = true;
+  bw_options.zsets_range_delete_threshold = 2;
+  blackwidow::BlackWidow db;
+  blackwidow::Status s = db.Open(bw_options, path);
+  ASSERT_TRUE(s.ok());
+
+  int32_t ret;
+  std::vector<blackwidow::ScoreMember> score_members;
+  std::vector<blackwidow::ScoreMember> gp_sm {{-3, "a"}, {-2, "b"}, {-1, "c"},
+                                              {0, "d"}, {1, "e"}, {2, "f"},
+                                              {3, "g"}, {4, "h"}};
+
+  // ***************** Group 1 Test *****************
+  // neighbouring keys share the same scores and members
+  s = db.ZAdd("GP1_RANGE_DELETE_KEY", gp_sm, &ret);
+  ASSERT_TRUE(s.ok());
+  s = db.ZAdd("GP1_RANGE_DELETE_KEY1", gp_sm, &ret);
+  ASSERT_TRUE(s.ok());
+  s = db.ZAdd("GP1_RANGE_DELETE_KEZ", gp_sm, &ret);
+  ASSERT_TRUE(s.ok());
+
+  s = db.ZRemrangebyscore("GP1_RANGE_DELETE_KEY", -2, 2, true, false, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 4);
+  s = db.ZRange("GP1_RANGE_DELETE_KEY", 0, -1, &score_members);
+  ASSERT_TRUE(s.ok());
+  ASSERT_TRUE(score_members_match(score_members, {{-3, "a"}, {2, "f"}, {3, "g"}, {4, "h"}}));
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEY", {{-3, "a"}, {2, "f"}, {3, "g"}, {4, "h"}}));
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEY1", gp_sm));
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEZ", gp_sm));
+
+  // a removed member can be added again
+  s = db.ZAdd("GP1_RANGE_DELETE_KEY", {{0, "d"}}, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEY", {{-3, "a"}, {0, "d"}, {2, "f"}, {3, "g"}, {4, "h"}}));
+
+
+  // ***************** Group 2 Test *****************
+  s = db.ZRemrangebyrank("GP1_RANGE_DELETE_KEY1", 1, -2, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 6);
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEY1", {{-3, "a"}, {4, "h"}}));
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEZ", gp_sm));
+
+  // under the threshold point deletes are used
+  s = db.ZRemrangebyrank("GP1_RANGE_DELETE_KEY1", 0, 0, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 1);
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEY1", {{4, "h"}}));
+
+
+  // ***************** Group 3 Test *****************
+  s = db.ZRemrangebylex("GP1_RANGE_DELETE_KEZ", "b", "g", true, false, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 5);
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEZ", {{-3, "a"}, {3, "g"}, {4, "h"}}));
+  ASSERT_TRUE(score_members_match(&db, "GP1_RANGE_DELETE_KEY", {{-3, "a"}, {0, "d"}, {2, "f"}, {3, "g"}, {4, "h"}}));
+
+  s = db.ZRemrangebylex("GP1_RANGE_DELETE_KEZ", "-", "+", true, true, &ret);
+  ASSERT_TRUE(s.ok());
+  ASSERT_EQ(ret, 3);
+  ASSERT_TRUE(size_match(&db, "GP1_RANGE_DELETE_KEZ", 0));
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
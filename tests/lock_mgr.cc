@@ -3,9 +3,15 @@
 //  LICENSE file in the root directory of this source tree. An additional grant
 //  of patent rights can be found in the PATENTS file in the same directory.
 
+#include <sys/time.h>
+
+#include <atomic>
 #include <thread>
+#include <vector>
+#include <string>
 
 #include "src/lock_mgr.h"
+#include "src/slot_lock_mgr.h"
 #include "src/mutex_impl.h"
 
 using namespace blackwidow;
@@ -18,6 +24,130 @@ void Func(LockMgr* mgr, int id, const std::string& key) {
   printf("thread %d UnLock %s\n", id, key.c_str());
 }
 
+static uint64_t NowMicros() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<uint64_t>(tv.tv_sec) * 1000000 + tv.tv_usec;
+}
+
+// Every thread locks, bumps the counter of and unlocks keys picked from
+// num_keys, so the counters also check that no two threads ever held the
+// same key together
+template <typename LockFn, typename UnLockFn>
+static void BenchLock(const char* name, int threads, int num_keys,
+                      LockFn lock, UnLockFn unlock) {
+  const int kOpsPerThread = 200000;
+  std::vector<std::string> keys;
+  for (int i = 0; i < num_keys; ++i) {
+    keys.push_back("bench_key_" + std::to_string(i));
+  }
+  std::vector<int64_t> counters(num_keys, 0);
+
+  uint64_t start = NowMicros();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      uint32_t seed = t * 2654435761u + 1;
+      for (int i = 0; i < kOpsPerThread; ++i) {
+        seed = seed * 1103515245 + 12345;
+        int k = (seed >> 8) % num_keys;
+        lock(keys[k]);
+        counters[k]++;
+        unlock(keys[k]);
+      }
+    }));
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  uint64_t cost = NowMicros() - start;
+
+  int64_t total = 0;
+  for (auto counter : counters) {
+    total += counter;
+  }
+  printf("%-12s threads %2d keys %7d: %10.0f ops/s%s\n",
+         name, threads, num_keys,
+         static_cast<double>(threads) * kOpsPerThread * 1000000 /
+           (cost ? cost : 1),
+         total == static_cast<int64_t>(threads) * kOpsPerThread
+           ? "" : " (lost updates!)");
+}
+
+// One op in ten writes the pair of counters of a key, the others read it
+// and check that the counters match
+static void BenchSharedLock(const char* name, int threads, bool shared) {
+  const int kOpsPerThread = 200000;
+  const int kKeys = 16;
+  SlotLockMgr mgr;
+  std::vector<std::string> keys;
+  for (int i = 0; i < kKeys; ++i) {
+    keys.push_back("bench_key_" + std::to_string(i));
+  }
+  std::vector<int64_t> firsts(kKeys, 0);
+  std::vector<int64_t> seconds(kKeys, 0);
+  std::atomic<int64_t> torn(0);
+
+  uint64_t start = NowMicros();
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; ++t) {
+    workers.push_back(std::thread([&, t]() {
+      uint32_t seed = t * 2654435761u + 1;
+      for (int i = 0; i < kOpsPerThread; ++i) {
+        seed = seed * 1103515245 + 12345;
+        int k = (seed >> 8) % kKeys;
+        if ((seed >> 4) % 10 == 0) {
+          mgr.Lock(keys[k]);
+          firsts[k]++;
+          seconds[k]++;
+          mgr.UnLock(keys[k]);
+        } else if (shared) {
+          mgr.LockShared(keys[k]);
+          if (firsts[k] != seconds[k]) torn++;
+          mgr.UnLockShared(keys[k]);
+        } else {
+          mgr.Lock(keys[k]);
+          if (firsts[k] != seconds[k]) torn++;
+          mgr.UnLock(keys[k]);
+        }
+      }
+    }));
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  uint64_t cost = NowMicros() - start;
+  printf("%-12s threads %2d keys %7d: %10.0f ops/s%s\n",
+         name, threads, kKeys,
+         static_cast<double>(threads) * kOpsPerThread * 1000000 /
+           (cost ? cost : 1),
+         torn.load() == 0 ? "" : " (torn reads!)");
+}
+
+static void BenchLockMgrs() {
+  const int kThreads[] = {1, 4, 16};
+  const int kKeys[] = {16, 1000000};
+  for (int num_keys : kKeys) {
+    for (int threads : kThreads) {
+      LockMgr mgr(1000, 0, std::make_shared<MutexFactoryImpl>());
+      BenchLock("LockMgr", threads, num_keys,
+                [&](const std::string& key) { mgr.TryLock(key); },
+                [&](const std::string& key) { mgr.UnLock(key); });
+
+      SlotLockMgr slot_mgr;
+      BenchLock("SlotLockMgr", threads, num_keys,
+                [&](const std::string& key) { slot_mgr.Lock(key); },
+                [&](const std::string& key) { slot_mgr.UnLock(key); });
+    }
+  }
+
+  printf("90%% reads:\n");
+  for (int threads : kThreads) {
+    BenchSharedLock("Exclusive", threads, false);
+    BenchSharedLock("Shared", threads, true);
+  }
+}
+
 int main() {
   MutexFactory* factory = new MutexFactoryImpl;
   LockMgr mgr(1, 3, std::shared_ptr<MutexFactory>(factory));
@@ -40,5 +170,7 @@ int main() {
   t2.join();
   t3.join();
   t4.join();
+
+  BenchLockMgrs();
   return 0;
 }